@@ -0,0 +1,419 @@
+/*
+ * bench.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+/* Microbenchmarks of the emulator's hot paths; built instead of the
+   emulator with CONFIG+=bench ("make bench").
+
+   The CPU benchmarks run a synthetic ROM whose reset code jumps to a loop
+   exercising one kind of instruction for a fixed number of state times,
+   the others call the code in question directly. The results go to
+   stdout (or the file given with -o) as JSON, so that builds can be
+   compared:
+
+   usage: cascade-bench [-n runs] [-c state times] [-o file] [benchmark...] */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include "os.h"
+#include "debug.h"
+#include "cpu.h"
+#include "lcd.h"
+#include "serial.h"
+#include "ring.h"
+#include "iface_fake.h"
+#include "version.h"
+
+uint32_t debug_level;
+uint32_t debug_level_unabridged;
+FILE *win_stderr;
+
+#define BENCH_ROM_SIZE 0x40000
+#define BENCH_LOOP 0x2100
+/* code mappings (CODEMAP_HI 0) the window code is copied to */
+#define BENCH_BANK_A 4
+#define BENCH_BANK_B 5
+
+/* at the reset vector: a pointer to RAM in 40h, serial port status
+   enabled in IOC1, then off to the benchmark loop */
+static const uint8_t setup_code[] = {
+  0xa1, 0x00, 0x30, 0x40,	/* 2080: LD 40h, #3000h */
+  0xb1, 0x20, 0x30,		/* 2084: LDB 30h, #20h */
+  0xc4, 0x16, 0x30,		/* 2087: STB 30h, 16h (IOC1) */
+  0xe7, 0x73, 0x00,		/* 208a: LJMP 2100h */
+};
+
+static const uint8_t alu_code[] = {
+  0x64, 0x30, 0x32,		/* 2100: ADD 32h, 30h */
+  0x68, 0x34, 0x32,		/* 2103: SUB 32h, 34h */
+  0x60, 0x36, 0x38,		/* 2106: AND 38h, 36h */
+  0x84, 0x32, 0x3a,		/* 2109: XOR 3Ah, 32h */
+  0x80, 0x3a, 0x3c,		/* 210c: OR 3Ch, 3Ah */
+  0x09, 0x03, 0x3c,		/* 210f: SHL 3Ch, #3 */
+  0x65, 0x34, 0x12, 0x3e,	/* 2112: ADD 3Eh, #1234h */
+  0x27, 0xe8,			/* 2116: SJMP 2100h */
+};
+
+/* a mix of taken and not taken conditional branches */
+static const uint8_t branch_code[] = {
+  0x88, 0x32, 0x34,		/* 2100: CMP 34h, 32h */
+  0xd7, 0x02,			/* 2103: JNE 2107h */
+  0x07, 0x34,			/* 2105: INC 34h */
+  0xdf, 0x02,			/* 2107: JE 210Bh */
+  0x07, 0x32,			/* 2109: INC 32h */
+  0xdb, 0x00,			/* 210b: JC 210Dh */
+  0xe0, 0x30, 0xf0,		/* 210d: DJNZ 30h, 2100h */
+  0x27, 0xee,			/* 2110: SJMP 2100h */
+};
+
+static const uint8_t indexed_code[] = {
+  0xa2, 0x40, 0x42,		/* 2100: LD 42h, [40h] */
+  0xa3, 0x40, 0x10, 0x44,	/* 2103: LD 44h, 10h[40h] */
+  0xa3, 0x41, 0x00, 0x01, 0x46,	/* 2107: LD 46h, 0100h[40h] */
+  0xa2, 0x41, 0x48,		/* 210c: LD 48h, [40h]+ */
+  0xc2, 0x40, 0x42,		/* 210f: ST 42h, [40h] */
+  0xc3, 0x40, 0x20, 0x44,	/* 2112: ST 44h, 20h[40h] */
+  0x89, 0x00, 0x38, 0x40,	/* 2116: CMP 40h, #3800h */
+  0xd7, 0x04,			/* 211a: JNE 2120h */
+  0xa1, 0x00, 0x30, 0x40,	/* 211c: LD 40h, #3000h */
+  0x27, 0xde,			/* 2120: SJMP 2100h */
+};
+
+/* BMOV itself is not implemented, the ROMs use BMOVI */
+static const uint8_t bmov_code[] = {
+  0xa1, 0x00, 0x30, 0x50,	/* 2100: LD 50h, #3000h */
+  0xa1, 0x00, 0x40, 0x52,	/* 2104: LD 52h, #4000h */
+  0xa1, 0x20, 0x00, 0x54,	/* 2108: LD 54h, #20h */
+  0xcd, 0x54, 0x50,		/* 210c: BMOVI 50h, 54h */
+  0x27, 0xef,			/* 2110: SJMP 2100h */
+};
+
+/* memRead16()/memWrite16() on RAM and the data window */
+static const uint8_t mem16_code[] = {
+  0xa3, 0x01, 0x00, 0x30, 0x42,	/* 2100: LD 42h, 3000h[0] */
+  0xc3, 0x01, 0x00, 0x31, 0x42,	/* 2105: ST 42h, 3100h[0] */
+  0xa3, 0x01, 0x00, 0xc0, 0x44,	/* 210a: LD 44h, C000h[0] */
+  0xc3, 0x01, 0x02, 0x31, 0x44,	/* 210f: ST 44h, 3102h[0] */
+  0x27, 0xea,			/* 2114: SJMP 2100h */
+};
+
+/* ioRead8() of SP_STAT, which ends up in Serial::readStat() */
+static const uint8_t spstat_code[] = {
+  0xb0, 0x11, 0x32,		/* 2100: LDB 32h, 11h */
+  0xb0, 0x11, 0x33,		/* 2103: LDB 33h, 11h */
+  0x27, 0xf8,			/* 2106: SJMP 2100h */
+};
+
+/* fetches from the window, switching banks twice per iteration */
+static const uint8_t bank_code[] = {
+  0xb1, BENCH_BANK_A, 0x30,	/* 2100: LDB 30h, #BANK_A */
+  0xc7, 0x01, 0x70, 0x02, 0x30,	/* 2103: STB 30h, 0270h[0] (CODEMAP_LO) */
+  0xe7, 0xf5, 0x9e,		/* 2108: LJMP C000h */
+};
+/* copied to both banks; the first half executes in A, the second in B */
+static const uint8_t bank_window[] = {
+  0xb1, BENCH_BANK_B, 0x30,	/* c000: LDB 30h, #BANK_B */
+  0xc7, 0x01, 0x70, 0x02, 0x30,	/* c003: STB 30h, 0270h[0] */
+  0xb1, BENCH_BANK_A, 0x30,	/* c008: LDB 30h, #BANK_A */
+  0xc7, 0x01, 0x70, 0x02, 0x30,	/* c00b: STB 30h, 0270h[0] */
+  0x27, 0xee,			/* c010: SJMP C000h */
+};
+
+struct CpuBench {
+  const char *name;
+  const uint8_t *code;		/* at BENCH_LOOP */
+  int len;
+  const uint8_t *window;	/* at 0xc000 in both banks, or NULL */
+  int window_len;
+};
+
+#define CPU_BENCH(name, code) { name, code, sizeof(code), NULL, 0 }
+static const struct CpuBench cpu_benches[] = {
+  CPU_BENCH("alu", alu_code),
+  CPU_BENCH("branch", branch_code),
+  CPU_BENCH("indexed", indexed_code),
+  CPU_BENCH("bmov", bmov_code),
+  CPU_BENCH("mem16", mem16_code),
+  CPU_BENCH("sp_stat", spstat_code),
+  { "bank_fetch", bank_code, sizeof(bank_code), bank_window, sizeof(bank_window) },
+};
+
+struct Result {
+  const char *name;
+  uint64_t ops;			/* instructions or calls per run */
+  uint64_t best_ns;
+  uint64_t total_ns;
+  int runs;
+  bool cpu;
+};
+
+/* the synthetic ROM, and the EEPROM the emulator saves next to it, live
+   in a temporary directory and are removed however the program ends */
+static char rom_name[1024];
+static char eep_name[1024 + 4];
+
+static void removeRom(void)
+{
+  unlink(rom_name);
+  unlink(eep_name);
+}
+
+static void onSignal(int sig)
+{
+  removeRom();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static bool createRomName(void)
+{
+  const char *dir = getenv("TMPDIR");
+  snprintf(rom_name, sizeof(rom_name), "%s/cascade-bench-XXXXXX", dir && *dir ? dir : "/tmp");
+  int fd = mkstemp(rom_name);
+  if (fd < 0) {
+    ERROR("failed to create %s\n", rom_name);
+    return false;
+  }
+  close(fd);
+  sprintf(eep_name, "%s.eep", rom_name);
+  atexit(removeRom);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  return true;
+}
+
+static bool writeRom(const struct CpuBench *b)
+{
+  uint8_t *rom = (uint8_t *)calloc(BENCH_ROM_SIZE, 1);
+  memcpy(rom + 0x2080, setup_code, sizeof(setup_code));
+  memcpy(rom + BENCH_LOOP, b->code, b->len);
+  if (b->window) {
+    memcpy(rom + BENCH_BANK_A * 0x4000, b->window, b->window_len);
+    memcpy(rom + BENCH_BANK_B * 0x4000, b->window, b->window_len);
+  }
+  FILE *fp = fopen(rom_name, "wb");
+  if (!fp) {
+    ERROR("failed to create %s\n", rom_name);
+    free(rom);
+    return false;
+  }
+  bool ok = fwrite(rom, BENCH_ROM_SIZE, 1, fp) == 1;
+  fclose(fp);
+  free(rom);
+  return ok;
+}
+
+static bool runCpu(Cpu *cpu, const struct CpuBench *b, uint64_t cycles, struct Result *r)
+{
+  if (!writeRom(b))
+    return false;
+  if (!cpu->loadRom(rom_name))
+    return false;
+
+  for (int i = 0; i < r->runs; i++) {
+    cpu->reset();
+    cpu->setMaximumCycles(cycles);
+    uint64_t insns = cpu->getInstructions();
+    uint64_t start = os_ntime();
+    cpu->emulate();
+    uint64_t ns = os_ntime() - start;
+    r->ops = cpu->getInstructions() - insns;
+    r->total_ns += ns;
+    if (!i || ns < r->best_ns)
+      r->best_ns = ns;
+  }
+  r->cpu = true;
+  return true;
+}
+
+/* the others return the number of operations performed */
+
+static uint64_t benchLcd(Cpu *cpu)
+{
+  Lcd *lcd = cpu->getLcd();
+  for (int i = 0; i < 500; i++)
+    lcd->redraw();
+  return 500;
+}
+
+static volatile int sink;
+
+static uint64_t benchRing(Cpu *cpu)
+{
+  Ring<int> ring(256);
+  int sum = 0;
+  for (int i = 0; i < 128; i++)
+    ring.add(i);
+  for (int i = 0; i < 20000000; i++) {
+    ring.add(i);
+    sum += ring.consume();
+  }
+  sink = sum;
+  return 20000000;
+}
+
+static uint64_t benchReadStat(Cpu *cpu)
+{
+  Serial *serial = cpu->getSerial();
+  int sum = 0;
+  for (int i = 0; i < 5000000; i++)
+    sum += serial->readStat();
+  sink = sum;
+  return 5000000;
+}
+
+struct DirectBench {
+  const char *name;
+  uint64_t (*fn)(Cpu *cpu);
+};
+
+static const struct DirectBench direct_benches[] = {
+  { "lcd_update", benchLcd },
+  { "ring", benchRing },
+  { "serial_readstat", benchReadStat },
+};
+
+static void runDirect(Cpu *cpu, const struct DirectBench *b, struct Result *r)
+{
+  for (int i = 0; i < r->runs; i++) {
+    uint64_t start = os_ntime();
+    r->ops = b->fn(cpu);
+    uint64_t ns = os_ntime() - start;
+    r->total_ns += ns;
+    if (!i || ns < r->best_ns)
+      r->best_ns = ns;
+  }
+}
+
+static bool selected(const char *name, int argc, char **argv)
+{
+  if (!argc)
+    return true;
+  for (int i = 0; i < argc; i++) {
+    if (!strcmp(argv[i], name))
+      return true;
+  }
+  return false;
+}
+
+#define NUM_CPU_BENCHES (sizeof(cpu_benches) / sizeof(cpu_benches[0]))
+#define NUM_DIRECT_BENCHES (sizeof(direct_benches) / sizeof(direct_benches[0]))
+#define NUM_BENCHES (NUM_CPU_BENCHES + NUM_DIRECT_BENCHES)
+
+/* runs the selected benchmarks, returns the number of results */
+static int runAll(UI *ui, int argc, char **argv, int runs, uint64_t cycles, struct Result *results)
+{
+  Cpu cpu(ui);
+  ui->setCpu(&cpu);
+  Interface *iface = new IfaceFake(&cpu, ui);
+  cpu.setSerial(iface, false);
+
+  int num = 0;
+  for (unsigned int i = 0; i < NUM_CPU_BENCHES; i++) {
+    if (!selected(cpu_benches[i].name, argc, argv))
+      continue;
+    struct Result *r = &results[num];
+    r->name = cpu_benches[i].name;
+    r->runs = runs;
+    if (!runCpu(&cpu, &cpu_benches[i], cycles, r)) {
+      ERROR("benchmark %s failed\n", r->name);
+      continue;
+    }
+    num++;
+  }
+  for (unsigned int i = 0; i < NUM_DIRECT_BENCHES; i++) {
+    if (!selected(direct_benches[i].name, argc, argv))
+      continue;
+    struct Result *r = &results[num++];
+    r->name = direct_benches[i].name;
+    r->runs = runs;
+    runDirect(&cpu, &direct_benches[i], r);
+  }
+
+  delete iface;
+  return num;
+}
+
+static void writeResults(FILE *fp, struct Result *results, int num, uint64_t cycles, int runs)
+{
+  fprintf(fp, "{\n  \"version\": \"%s\",\n  \"state_times\": %llu,\n  \"runs\": %d,\n",
+          VERSION, (unsigned long long)cycles, runs);
+  fprintf(fp, "  \"benchmarks\": [");
+  for (int i = 0; i < num; i++) {
+    struct Result *r = &results[i];
+    /* best run, and the mean over all runs */
+    double ns = r->ops ? (double)r->best_ns / r->ops : 0;
+    double mean_ns = r->ops ? (double)r->total_ns / r->runs / r->ops : 0;
+    fprintf(fp, "%s\n    {\"name\": \"%s\", \"ops\": %llu, \"ms\": %.3f, \"ns_per_op\": %.3f, \"mean_ns_per_op\": %.3f",
+            i ? "," : "", r->name, (unsigned long long)r->ops, r->best_ns / 1e6, ns, mean_ns);
+    if (r->cpu)
+      fprintf(fp, ", \"mips\": %.3f", r->best_ns ? r->ops * 1e3 / r->best_ns : 0);
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "\n  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+#ifdef __MINGW32__
+  win_stderr = stderr;
+#endif
+  int runs = 3;
+  uint64_t cycles = 100000000;
+  const char *out_name = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "n:c:o:")) != -1) {
+    switch (c) {
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'c':
+        cycles = strtoull(optarg, NULL, 0);
+        break;
+      case 'o':
+        out_name = optarg;
+        break;
+      default:
+        ERROR("usage: %s [-n runs] [-c state times] [-o file] [benchmark...]\n", argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (runs < 1)
+    runs = 1;
+
+  /* quiet, except for errors */
+  debug_level = 0;
+
+  if (!createRomName())
+    return 1;
+
+  UI::initToolkit();
+  UI ui;
+  ui.hide();
+  struct Result *results = (struct Result *)calloc(NUM_BENCHES, sizeof(struct Result));
+  int num = runAll(&ui, argc, argv, runs, cycles, results);
+  removeRom();
+
+  FILE *fp = out_name ? fopen(out_name, "w") : stdout;
+  if (!fp) {
+    ERROR("failed to create %s\n", out_name);
+    return 1;
+  }
+  writeResults(fp, results, num, cycles, runs);
+  if (out_name)
+    fclose(fp);
+  free(results);
+  return 0;
+}
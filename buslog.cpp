@@ -0,0 +1,114 @@
+/*
+ * buslog.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "buslog.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+BusLog::BusLog(const char *name)
+{
+  fp = fopen(name, "w");
+  if (!fp)
+    ERROR("could not create bus capture %s\n", name);
+  else
+    fprintf(fp, "# CASCADE bus capture\n");
+  slow_init_count = -1;
+  slow_init_target = 0;
+}
+
+BusLog::~BusLog()
+{
+  if (fp)
+    fclose(fp);
+}
+
+void BusLog::log(uint64_t cycles, char type, uint8_t value)
+{
+  if (!fp)
+    return;
+  /* a single stdio call, so lines from different threads don't mix */
+  fprintf(fp, "%llu %c %02X\n", (unsigned long long)cycles, type, value);
+}
+
+void BusLog::tx(uint64_t cycles, uint8_t byte)
+{
+  log(cycles, BUSLOG_TX, byte);
+}
+
+void BusLog::rx(uint64_t cycles, uint8_t byte)
+{
+  log(cycles, BUSLOG_RX, byte);
+}
+
+void BusLog::slowInitBit(uint64_t cycles, uint8_t bit)
+{
+  if (slow_init_count < 0) {
+    /* start bit must be 0 */
+    if (!bit) {
+      slow_init_count = 0;
+      slow_init_target = 0;
+    }
+  }
+  else if (slow_init_count < 8) {
+    slow_init_target = (slow_init_target >> 1) | (bit ? 0x80 : 0);
+    slow_init_count++;
+  }
+  else {
+    /* stop bit must be 1 */
+    if (bit)
+      log(cycles, BUSLOG_SLOW_INIT, slow_init_target);
+    slow_init_count = -1;
+  }
+}
+
+BusLogEntry *buslog_load(const char *name, int *count)
+{
+  FILE *fp = fopen(name, "r");
+  if (!fp) {
+    ERROR("could not open bus capture %s\n", name);
+    return NULL;
+  }
+
+  BusLogEntry *entries = NULL;
+  int size = 0;
+  int n = 0;
+  int line_no = 0;
+  char line[80];
+  while (fgets(line, sizeof(line), fp)) {
+    line_no++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    unsigned long long cycles;
+    char type;
+    unsigned int value;
+    if (sscanf(line, "%llu %c %x", &cycles, &type, &value) != 3 ||
+        (type != BUSLOG_TX && type != BUSLOG_RX && type != BUSLOG_SLOW_INIT) ||
+        value > 0xff) {
+      ERROR("%s:%d: malformed bus capture line\n", name, line_no);
+      free(entries);
+      fclose(fp);
+      return NULL;
+    }
+    if (n == size) {
+      size = size ? size * 2 : 1024;
+      entries = (BusLogEntry *)realloc(entries, size * sizeof(BusLogEntry));
+    }
+    entries[n].cycles = cycles;
+    entries[n].type = type;
+    entries[n].value = value;
+    n++;
+  }
+  fclose(fp);
+  if (!entries)	/* empty capture, not an error */
+    entries = (BusLogEntry *)malloc(sizeof(BusLogEntry));
+  *count = n;
+  return entries;
+}
@@ -0,0 +1,58 @@
+/*
+ * buslog.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _BUSLOG_H
+#define _BUSLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Bus captures record the traffic between the firmware and the vehicle at
+   the level of the serial port, independent of the interface used and of
+   the ROM. They are text files with one line per event: the cycle count,
+   the event type and a byte in hex. Lines starting with '#' are ignored. */
+#define BUSLOG_TX 'T'		/* byte sent by the firmware */
+#define BUSLOG_RX 'R'		/* byte received from the vehicle */
+#define BUSLOG_SLOW_INIT 'I'	/* 5-baud init to the given address */
+
+struct BusLogEntry {
+  uint64_t cycles;
+  char type;
+  uint8_t value;
+};
+
+/* Writes a bus capture. tx() and slowInitBit() are called from the
+   emulation thread, rx() may be called from an interface's reader thread. */
+class BusLog {
+public:
+  BusLog(const char *name);
+  ~BusLog();
+
+  bool isOpen() { return fp != NULL; }
+
+  void tx(uint64_t cycles, uint8_t byte);
+  void rx(uint64_t cycles, uint8_t byte);
+  /* decodes the 5-baud init bit by bit, because some interfaces do it
+     bitwise and never see the address */
+  void slowInitBit(uint64_t cycles, uint8_t bit);
+
+private:
+  void log(uint64_t cycles, char type, uint8_t value);
+
+  FILE *fp;
+  int slow_init_count;	/* -1 while waiting for a start bit */
+  uint8_t slow_init_target;
+};
+
+/* reads a bus capture; returns a malloc()ed array of entries, NULL on
+   error */
+BusLogEntry *buslog_load(const char *name, int *count);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * callstack.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "callstack.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+CallStack::CallStack()
+{
+  depth = 0;
+  start_cycles = 0;
+  started = false;
+  stats_size = 1024;
+  stats = (struct CallStats *)calloc(stats_size, sizeof(struct CallStats));
+  num_stats = 0;
+}
+
+CallStack::~CallStack()
+{
+  free(stats);
+}
+
+struct CallStats *CallStack::findStats(uint32_t func)
+{
+  if (num_stats * 2 >= stats_size) {
+    struct CallStats *old = stats;
+    int old_size = stats_size;
+    stats_size *= 2;
+    stats = (struct CallStats *)calloc(stats_size, sizeof(struct CallStats));
+    num_stats = 0;
+    for (int i = 0; i < old_size; i++) {
+      if (old[i].used) {
+        *findStats(old[i].func) = old[i];
+      }
+    }
+    free(old);
+  }
+
+  int mask = stats_size - 1;
+  int i;
+  for (i = (func * 2654435761U) >> 8 & mask; stats[i].used; i = (i + 1) & mask) {
+    if (stats[i].func == func)
+      return &stats[i];
+  }
+  stats[i].used = true;
+  stats[i].func = func;
+  num_stats++;
+  return &stats[i];
+}
+
+void CallStack::leave(uint64_t cycles)
+{
+  struct CallFrame *f = &frames[--depth];
+  uint64_t duration = cycles - f->start;
+  struct CallStats *s = findStats(f->func);
+  s->exclusive += duration - f->children;
+  /* count recursive activations only once */
+  if (!--s->active)
+    s->inclusive += duration;
+  if (depth)
+    frames[depth - 1].children += duration;
+}
+
+void CallStack::call(uint32_t func, uint32_t site, uint16_t sp, uint64_t cycles, bool interrupt)
+{
+  if (!started) {
+    start_cycles = cycles;
+    started = true;
+  }
+
+  /* the stack grows downwards; frames at or below the new return address
+     have been abandoned */
+  while (depth && frames[depth - 1].sp <= sp)
+    leave(cycles);
+
+  if (depth == CALLSTACK_MAX_DEPTH) {
+    /* not tracked; its return will not find a matching frame */
+    return;
+  }
+
+  struct CallFrame *f = &frames[depth++];
+  f->func = func;
+  f->site = site;
+  f->sp = sp;
+  f->interrupt = interrupt;
+  f->start = cycles;
+  f->children = 0;
+
+  struct CallStats *s = findStats(func);
+  s->calls++;
+  s->active++;
+  if (interrupt)
+    s->interrupt = true;
+}
+
+void CallStack::ret(uint16_t sp, uint64_t cycles)
+{
+  /* return addresses already popped by other means */
+  while (depth && frames[depth - 1].sp < sp)
+    leave(cycles);
+  if (depth && frames[depth - 1].sp == sp)
+    leave(cycles);
+  /* otherwise, it is a computed jump */
+}
+
+void CallStack::clear()
+{
+  while (depth) {
+    depth--;
+    findStats(frames[depth].func)->active--;
+  }
+}
+
+static int compare_inclusive(const void *a, const void *b)
+{
+  const struct CallStats *sa = (const struct CallStats *)a;
+  const struct CallStats *sb = (const struct CallStats *)b;
+  if (sa->inclusive != sb->inclusive)
+    return sa->inclusive < sb->inclusive ? 1 : -1;
+  return sa->func < sb->func ? -1 : sa->func > sb->func;
+}
+
+bool CallStack::save(const char *name, uint64_t cycles)
+{
+  while (depth)
+    leave(cycles);
+
+  FILE *fp = fopen(name, "w");
+  if (!fp) {
+    ERROR("could not create call profile %s\n", name);
+    return false;
+  }
+
+  struct CallStats *sorted = (struct CallStats *)malloc((num_stats + 1) * sizeof(struct CallStats));
+  int n = 0;
+  for (int i = 0; i < stats_size; i++) {
+    if (stats[i].used)
+      sorted[n++] = stats[i];
+  }
+  qsort(sorted, n, sizeof(struct CallStats), compare_inclusive);
+
+  double total = started && cycles > start_cycles ? cycles - start_cycles : 1;
+  fprintf(fp, "# %llu cycles, %d functions; * = interrupt handler\n",
+          (unsigned long long)(cycles - start_cycles), n);
+  fprintf(fp, "# function        calls        inclusive       %%        exclusive       %%\n");
+  for (int i = 0; i < n; i++) {
+    struct CallStats *s = &sorted[i];
+    fprintf(fp, "  %06X%c %12llu %16llu %7.2f %16llu %7.2f\n",
+            s->func, s->interrupt ? '*' : ' ', (unsigned long long)s->calls,
+            (unsigned long long)s->inclusive, s->inclusive * 100.0 / total,
+            (unsigned long long)s->exclusive, s->exclusive * 100.0 / total);
+  }
+  free(sorted);
+
+  if (fclose(fp)) {
+    ERROR("failed to write call profile %s\n", name);
+    return false;
+  }
+  return true;
+}
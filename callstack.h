@@ -0,0 +1,86 @@
+/*
+ * callstack.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _CALLSTACK_H
+#define _CALLSTACK_H
+
+#include <stdint.h>
+
+#define CALLSTACK_MAX_DEPTH 256
+
+/* A function activation. Addresses are physical. */
+struct CallFrame {
+  uint32_t func;	/* entry point */
+  uint32_t site;	/* call instruction, or interrupted instruction */
+  uint16_t sp;		/* stack pointer after pushing the return address */
+  bool interrupt;
+  uint64_t start;	/* cycle count at entry */
+  uint64_t children;	/* cycles spent in callees */
+};
+
+struct CallStats {
+  uint32_t func;
+  bool used;
+  bool interrupt;	/* has been entered as an interrupt handler */
+  int active;		/* number of activations on the stack */
+  uint64_t calls;
+  uint64_t inclusive;
+  uint64_t exclusive;
+};
+
+/* Shadow of the firmware call stack, maintained on calls, returns and
+   interrupts, that accumulates the cycles spent per function.
+
+   The firmware does not always return the way it came; it may drop
+   return addresses, or push an address and "return" to it as a computed
+   jump. Frames are therefore matched by stack pointer: a return pops
+   the frame whose return address it takes from the stack, and frames
+   whose return addresses have been popped or overwritten are dropped. */
+class CallStack {
+public:
+  CallStack();
+  ~CallStack();
+
+  void call(uint32_t func, uint32_t site, uint16_t sp, uint64_t cycles, bool interrupt);
+  /* sp is the stack pointer before popping the return address */
+  void ret(uint16_t sp, uint64_t cycles);
+
+  /* drops all frames without accounting them, for when the machine state
+     has been replaced */
+  void clear();
+
+  inline int getDepth() {
+    return depth;
+  }
+  /* frame 0 is the outermost one */
+  inline const struct CallFrame *getFrame(int i) {
+    return &frames[i];
+  }
+
+  /* accounts the open frames and writes a table of inclusive and
+     exclusive cycles per function, sorted by inclusive cycles */
+  bool save(const char *name, uint64_t cycles);
+
+private:
+  struct CallStats *findStats(uint32_t func);
+  void leave(uint64_t cycles);
+
+  struct CallFrame frames[CALLSTACK_MAX_DEPTH];
+  int depth;
+  uint64_t start_cycles;
+  bool started;
+
+  /* hash table */
+  struct CallStats *stats;
+  int stats_size;
+  int num_stats;
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * codec.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "codec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef EVENT_COMPRESSED
+#include <zlib.h>
+#endif
+
+static const char *codec_names[CODEC_MAX] = {
+  "raw", "zlib", "lz"
+};
+
+int codec_find(const char *name)
+{
+  for (int i = 0; i < CODEC_MAX; i++) {
+    if (!strcmp(name, codec_names[i]))
+      return i;
+  }
+  return -1;
+}
+
+const char *codec_name(int codec)
+{
+  if (codec < 0 || codec >= CODEC_MAX)
+    return "unknown";
+  return codec_names[codec];
+}
+
+/* LZ format: a sequence of token bytes, each followed by literals and a
+   match. The high nibble of the token is the number of literals, the low
+   nibble the match length minus LZ_MIN_MATCH; 15 means that more length
+   bytes follow, which are added up until one of them is not 255. The
+   literals are followed by the match offset (16 bits, little-endian). The
+   last token only has literals. */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 14
+
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+static uint8_t *lz_put_literals(uint8_t *op, const uint8_t *lit, size_t len, int match_len)
+{
+  *op++ = ((len >= 15 ? 15 : len) << 4) | (match_len >= 15 ? 15 : match_len);
+  if (len >= 15)
+    op = lz_put_length(op, len - 15);
+  memcpy(op, lit, len);
+  return op + len;
+}
+
+static size_t lz_compress(const uint8_t *in, size_t len, uint8_t *out)
+{
+  uint32_t *table = (uint32_t *)calloc(1 << LZ_HASH_BITS, sizeof(uint32_t));
+  const uint8_t *ip = in;
+  const uint8_t *anchor = in;
+  const uint8_t *end = in + len;
+  uint8_t *op = out;
+
+  while (ip + LZ_MIN_MATCH <= end) {
+    uint32_t h = lz_hash(ip);
+    const uint8_t *ref = in + table[h];
+    table[h] = ip - in;
+    if (ref >= ip || ip - ref > LZ_MAX_OFFSET || memcmp(ref, ip, LZ_MIN_MATCH)) {
+      /* skip faster through data that does not compress */
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    size_t match_len = LZ_MIN_MATCH;
+    while (ip + match_len < end && ref[match_len] == ip[match_len])
+      match_len++;
+
+    op = lz_put_literals(op, anchor, ip - anchor, match_len - LZ_MIN_MATCH);
+    *op++ = (ip - ref) & 0xff;
+    *op++ = (ip - ref) >> 8;
+    if (match_len - LZ_MIN_MATCH >= 15)
+      op = lz_put_length(op, match_len - LZ_MIN_MATCH - 15);
+    ip += match_len;
+    anchor = ip;
+  }
+  op = lz_put_literals(op, anchor, end - anchor, 0);
+
+  free(table);
+  return op - out;
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+  uint8_t b;
+  do {
+    if (*ip >= end)
+      return false;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+static bool lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+  const uint8_t *ip = in;
+  const uint8_t *end = in + in_len;
+  uint8_t *op = out;
+  uint8_t *oend = out + out_len;
+
+  for (;;) {
+    if (ip >= end)
+      return false;
+    uint8_t token = *ip++;
+
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !lz_get_length(&ip, end, &lit_len))
+      return false;
+    if (lit_len > (size_t)(end - ip) || lit_len > (size_t)(oend - op))
+      return false;
+    memcpy(op, ip, lit_len);
+    op += lit_len;
+    ip += lit_len;
+    if (ip == end)
+      return op == oend;
+
+    if (end - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !lz_get_length(&ip, end, &match_len))
+      return false;
+    match_len += LZ_MIN_MATCH;
+    if (!offset || offset > (size_t)(op - out) || match_len > (size_t)(oend - op))
+      return false;
+
+    const uint8_t *ref = op - offset;
+    if (offset >= match_len)
+      memcpy(op, ref, match_len);
+    else {
+      /* overlapping, repeats the last "offset" bytes */
+      for (size_t i = 0; i < match_len; i++)
+        op[i] = ref[i];
+    }
+    op += match_len;
+  }
+}
+
+uint8_t *codec_compress(int codec, const uint8_t *in, size_t in_len, size_t *out_len)
+{
+  uint8_t *out;
+  switch (codec) {
+    case CODEC_RAW:
+      out = (uint8_t *)malloc(in_len);
+      memcpy(out, in, in_len);
+      *out_len = in_len;
+      return out;
+#ifdef EVENT_COMPRESSED
+    case CODEC_ZLIB: {
+        uLongf len = compressBound(in_len);
+        out = (uint8_t *)malloc(len);
+        if (compress2(out, &len, in, in_len, Z_DEFAULT_COMPRESSION) != Z_OK) {
+          free(out);
+          return NULL;
+        }
+        *out_len = len;
+        return out;
+      }
+#endif
+    case CODEC_LZ:
+      out = (uint8_t *)malloc(in_len + in_len / 255 + 16);
+      *out_len = lz_compress(in, in_len, out);
+      return out;
+    default:
+      return NULL;
+  }
+}
+
+bool codec_decompress(int codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+  switch (codec) {
+    case CODEC_RAW:
+      if (in_len != out_len)
+        return false;
+      memcpy(out, in, in_len);
+      return true;
+#ifdef EVENT_COMPRESSED
+    case CODEC_ZLIB: {
+        uLongf len = out_len;
+        return uncompress(out, &len, in, in_len) == Z_OK && len == out_len;
+      }
+#endif
+    case CODEC_LZ:
+      return lz_decompress(in, in_len, out, out_len);
+    default:
+      return false;
+  }
+}
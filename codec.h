@@ -0,0 +1,34 @@
+/*
+ * codec.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _CODEC_H
+#define _CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* compression methods for state files; the numbers end up in the files */
+#define CODEC_RAW 0
+#define CODEC_ZLIB 1	/* only available if built with EVENT_COMPRESSED */
+#define CODEC_LZ 2	/* LZ77, byte-oriented; fast rather than small */
+#define CODEC_MAX 3
+
+/* returns the codec with the given name, -1 if there is none */
+int codec_find(const char *name);
+const char *codec_name(int codec);
+
+/* returns a newly allocated buffer with the compressed data, NULL if the
+   codec is not available */
+uint8_t *codec_compress(int codec, const uint8_t *in, size_t in_len, size_t *out_len);
+/* decompresses into out, which must have room for exactly out_len bytes;
+   returns false if the data is corrupt or the codec is not available */
+bool codec_decompress(int codec, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+#endif
@@ -0,0 +1,664 @@
+/*
+ * codeflow.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "codeflow.h"
+#include "disasm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESET_PC 0x2080
+#define ZERO_REG 0x00
+
+CodeFlow::CodeFlow(const uint8_t *rom, uint32_t size)
+{
+  this->rom = rom;
+  this->size = size;
+  flags = (uint8_t *)calloc(size, 1);
+  work = NULL;
+  num_work = work_size = 0;
+  edges = NULL;
+  num_edges = edges_size = 0;
+  switches = NULL;
+  num_switches = switches_size = 0;
+  blocks = NULL;
+  num_blocks = 0;
+  succ = NULL;
+  funcs = NULL;
+  num_funcs = 0;
+  func_blocks = NULL;
+  entries = NULL;
+  num_entries = 0;
+  seen_size = 1 << 16;
+  seen_used = 0;
+  seen = (uint64_t *)malloc(seen_size * sizeof(uint64_t));
+  memset(seen, 0xff, seen_size * sizeof(uint64_t));
+  num_insns = code_bytes = 0;
+  overlaps = out_of_rom = 0;
+}
+
+CodeFlow::~CodeFlow()
+{
+  for (int i = 0; i < num_entries; i++)
+    free(entries[i].name);
+  free(entries);
+  free(flags);
+  free(work);
+  free(edges);
+  free(switches);
+  free(blocks);
+  free(succ);
+  free(funcs);
+  free(func_blocks);
+  free(seen);
+}
+
+uint16_t CodeFlow::virt(uint32_t phys)
+{
+  return phys < 0xc000 ? phys : 0xc000 | (phys & 0x3fff);
+}
+
+int CodeFlow::bankOf(uint32_t phys)
+{
+  if (phys < 0x400000)
+    return phys >> 14;
+  if (phys < 0x1c00000)
+    return ((phys / 0x400000) << 8) | ((phys >> 14) & 0xff);
+  return CF_BANK_UNKNOWN;
+}
+
+/* the ROM part of Cpu::bankToPhys(), without an extended ROM */
+uint32_t CodeFlow::phys(uint16_t pc, int bank)
+{
+  uint32_t p;
+  if (pc < 0xc000)
+    p = pc;
+  else if (bank == CF_BANK_UNKNOWN)
+    return CF_NONE;
+  else {
+    uint8_t map_hi = bank >> 8;
+    uint8_t map_lo = bank & 0xff;
+    if (map_hi == 9)
+      p = 0xc000 + (map_lo - 6) * 0x4000 + (pc - 0xc000);
+    else if (map_hi == 0 || map_hi == 0x10)
+      p = map_lo * 0x4000 + (pc - 0xc000);
+    else if (map_hi >= 1 && map_hi <= 6)
+      p = 0x400000 * map_hi + map_lo * 0x4000 + (pc - 0xc000);
+    else
+      return CF_NONE;	/* mapped RAM, or not implemented */
+  }
+  return p < size ? p : CF_NONE;
+}
+
+void CodeFlow::fetch(uint32_t phys, uint8_t *code)
+{
+  uint32_t n = size - phys < DISASM_MAX_LEN ? size - phys : DISASM_MAX_LEN;
+  memcpy(code, rom + phys, n);
+  memset(code + n, 0, DISASM_MAX_LEN - n);
+}
+
+void CodeFlow::addEntry(uint16_t pc, int bank, const char *name)
+{
+  uint32_t p = phys(pc, bank);
+  if (p == CF_NONE)
+    return;
+  if (name) {
+    entries = (struct Entry *)realloc(entries, (num_entries + 1) * sizeof(struct Entry));
+    entries[num_entries].phys = p;
+    entries[num_entries].name = strdup(name);
+    num_entries++;
+  }
+  push(pc, bank, CF_NONE, EDGE_CALL);
+}
+
+void CodeFlow::addDefaultEntries()
+{
+  /* interrupt vectors, TRAP and unimplemented opcode included */
+  static const uint16_t vectors[][2] = {{0x2000, 0x2014}, {0x2030, 0x2040}};
+  for (int i = 0; i < 2; i++) {
+    for (uint16_t v = vectors[i][0]; v < vectors[i][1] && v + 1u < size; v += 2) {
+      uint16_t pc = rom[v] | (rom[v + 1] << 8);
+      if (pc == 0 || pc == 0xffff)
+        continue;	/* not programmed */
+      char name[16];
+      sprintf(name, "vector_%04X", v);
+      addEntry(pc, 0, name);
+    }
+  }
+  /* last, so it is followed first */
+  addEntry(RESET_PC, 0, "reset");
+}
+
+void CodeFlow::push(uint16_t pc, int bank, uint32_t from, int kind)
+{
+  uint32_t to = phys(pc, bank);
+  if (from != CF_NONE)
+    addEdge(from, to, pc, kind);
+  if (to == CF_NONE)
+    return;
+  flags[to] |= kind == EDGE_CALL ? CF_FUNC | CF_BLOCK : CF_BLOCK;
+  if (num_work == work_size) {
+    work_size = work_size ? work_size * 2 : 1024;
+    work = (struct Work *)realloc(work, work_size * sizeof(struct Work));
+  }
+  work[num_work].pc = pc;
+  work[num_work].bank = bank;
+  num_work++;
+}
+
+void CodeFlow::addEdge(uint32_t from, uint32_t to, uint16_t virt, int kind)
+{
+  if (num_edges == edges_size) {
+    edges_size = edges_size ? edges_size * 2 : 1024;
+    edges = (struct CodeEdge *)realloc(edges, edges_size * sizeof(struct CodeEdge));
+  }
+  struct CodeEdge *e = &edges[num_edges++];
+  e->from = from;
+  e->to = to;
+  e->virt = virt;
+  e->kind = kind;
+}
+
+void CodeFlow::addSwitch(uint32_t at, uint16_t reg, int value)
+{
+  if (num_switches == switches_size) {
+    switches_size = switches_size ? switches_size * 2 : 256;
+    switches = (struct BankSwitch *)realloc(switches, switches_size * sizeof(struct BankSwitch));
+  }
+  struct BankSwitch *s = &switches[num_switches++];
+  s->at = at;
+  s->reg = reg;
+  s->value = value;
+  if (reg <= 0x271)
+    flags[at] |= CF_SWITCH;
+}
+
+/* Returns true the first time an instruction is reached. Above 0xc000,
+   the physical address implies the bank; below, the same instruction is
+   followed again for every bank it is reached with, because it may jump
+   into the window. */
+bool CodeFlow::visit(uint16_t pc, uint32_t phys, int bank)
+{
+  if (pc >= 0xc000)
+    return !(flags[phys] & CF_INSN);
+
+  if (seen_used * 2 >= seen_size) {
+    uint64_t *old = seen;
+    uint32_t old_size = seen_size;
+    seen_size *= 2;
+    seen = (uint64_t *)malloc(seen_size * sizeof(uint64_t));
+    memset(seen, 0xff, seen_size * sizeof(uint64_t));
+    seen_used = 0;
+    for (uint32_t i = 0; i < old_size; i++) {
+      if (old[i] != (uint64_t)-1) {
+        uint32_t h = (uint32_t)(old[i] * 0x9e3779b97f4a7c15ULL >> 32) & (seen_size - 1);
+        while (seen[h] != (uint64_t)-1)
+          h = (h + 1) & (seen_size - 1);
+        seen[h] = old[i];
+        seen_used++;
+      }
+    }
+    free(old);
+  }
+  uint64_t key = ((uint64_t)phys << 32) | (uint32_t)bank;
+  uint32_t h = (uint32_t)(key * 0x9e3779b97f4a7c15ULL >> 32) & (seen_size - 1);
+  while (seen[h] != (uint64_t)-1) {
+    if (seen[h] == key)
+      return false;
+    h = (h + 1) & (seen_size - 1);
+  }
+  seen[h] = key;
+  seen_used++;
+  return true;
+}
+
+/* register contents; the zero register always reads 0 */
+static void regsReset(uint8_t *val, uint8_t *known)
+{
+  memset(known, 0, 256);
+  val[ZERO_REG] = val[ZERO_REG + 1] = 0;
+  known[ZERO_REG] = known[ZERO_REG + 1] = 1;
+}
+
+static void regsClobber(uint8_t *known, uint8_t reg, int n)
+{
+  for (int i = 0; i < n; i++) {
+    if ((uint8_t)(reg + i) > ZERO_REG + 1)
+      known[(uint8_t)(reg + i)] = 0;
+  }
+}
+
+static void regsSet(uint8_t *val, uint8_t *known, uint8_t reg, uint16_t value, bool word)
+{
+  for (int i = 0; i < (word ? 2 : 1); i++) {
+    if ((uint8_t)(reg + i) > ZERO_REG + 1) {
+      val[(uint8_t)(reg + i)] = value >> (8 * i);
+      known[(uint8_t)(reg + i)] = 1;
+    }
+  }
+}
+
+static bool regsWord(uint8_t *val, uint8_t *known, uint8_t reg, uint16_t *value)
+{
+  reg &= 0xfe;
+  if (!known[reg] || !known[reg + 1])
+    return false;
+  *value = val[reg] | (val[reg + 1] << 8);
+  return true;
+}
+
+/* a store of register src to addr */
+void CodeFlow::storeTo(struct Regs *r, uint16_t addr, uint8_t src, bool word, uint32_t at, int *bank)
+{
+  for (int i = 0; i < (word ? 2 : 1); i++) {
+    uint16_t a = addr + i;
+    uint8_t s = src + i;
+    if (a < 0x100) {
+      if (r->known[s])
+        regsSet(r->val, r->known, a, r->val[s], false);
+      else
+        regsClobber(r->known, a, 1);
+    }
+    else if (a >= 0x270 && a <= 0x273) {
+      int value = r->known[s] ? r->val[s] : -1;
+      addSwitch(at, a, value);
+      if (a == 0x270 || a == 0x271) {
+        if (value < 0 || *bank == CF_BANK_UNKNOWN)
+          *bank = CF_BANK_UNKNOWN;
+        else if (a == 0x270)
+          *bank = (*bank & 0xff00) | value;
+        else
+          *bank = (*bank & 0xff) | (value << 8);
+      }
+    }
+  }
+}
+
+/* Follows what happens to the registers as far as it matters for bank
+   switches and BR [], that is, constants and where they are stored to.
+   Anything that may write a register it does not understand makes it
+   forget about that register. */
+void CodeFlow::track(struct Regs *r, const uint8_t *c, int len, uint32_t at, int *bank)
+{
+  uint8_t opcode = c[0];
+  uint16_t base, addr;
+  switch (opcode) {
+    case 0x01:	/* CLR */
+      regsSet(r->val, r->known, c[1], 0, true);
+      break;
+    case 0x11:	/* CLRB */
+      regsSet(r->val, r->known, c[1], 0, false);
+      break;
+    case 0xa0:	/* LD direct */
+    case 0xb0:	/* LDB direct */
+      storeTo(r, c[2], c[1], opcode == 0xa0, at, bank);
+      break;
+    case 0xa1:	/* LD immediate */
+      regsSet(r->val, r->known, c[3], c[1] | (c[2] << 8), true);
+      break;
+    case 0xb1:	/* LDB immediate */
+      regsSet(r->val, r->known, c[2], c[1], false);
+      break;
+    case 0xc0:	/* ST direct */
+    case 0xc4:	/* STB direct */
+      storeTo(r, c[1], c[2], opcode == 0xc0, at, bank);
+      break;
+    case 0xc2:	/* ST indirect */
+    case 0xc6:	/* STB indirect */
+      if (regsWord(r->val, r->known, c[1], &addr))
+        storeTo(r, addr, c[2], opcode == 0xc2, at, bank);
+      if (c[1] & 1)
+        regsClobber(r->known, c[1] & 0xfe, 2);
+      break;
+    case 0xc3:	/* ST indexed */
+    case 0xc7:	/* STB indexed */
+      if (c[1] & 1) {
+        if (regsWord(r->val, r->known, c[1], &base))
+          storeTo(r, base + (c[2] | (c[3] << 8)), c[4], opcode == 0xc3, at, bank);
+      }
+      else if (regsWord(r->val, r->known, c[1], &base))
+        storeTo(r, base + (int8_t)c[2], c[3], opcode == 0xc3, at, bank);
+      break;
+    case 0x00:	/* SKIP */
+    case 0x20 ... 0x3f:	/* SJMP, SCALL, JBC, JBS */
+    case 0xc5:	/* CMPL */
+    case 0xc8 ... 0xc9:	/* PUSH */
+    case 0xd0 ... 0xdf:	/* conditional jumps */
+    case 0xe2 ... 0xfd:
+      break;
+    case 0x02 ... 0x03:
+    case 0x05 ... 0x07:
+    case 0x12 ... 0x13:
+    case 0x15 ... 0x17:
+      regsClobber(r->known, c[1], 4);
+      break;
+    case 0x04:	/* XCH */
+    case 0x14:	/* XCHB */
+      regsClobber(r->known, c[1], 2);
+      regsClobber(r->known, c[2], 2);
+      break;
+    case 0x08 ... 0x0a:
+    case 0x0c ... 0x0f:
+    case 0x18 ... 0x1a:	/* shifts */
+      regsClobber(r->known, c[2], 4);
+      break;
+    case 0x40 ... 0x9f:
+    case 0xa2 ... 0xaf:
+    case 0xb2 ... 0xbf:
+      regsClobber(r->known, c[len - 1], 4);
+      if ((opcode & 3) == 2 && (c[1] & 1))
+        regsClobber(r->known, c[1] & 0xfe, 2);	/* auto-increment */
+      break;
+    case 0xca:	/* PUSH indirect */
+      if (c[1] & 1)
+        regsClobber(r->known, c[1] & 0xfe, 2);
+      break;
+    case 0xcc:	/* POP direct */
+    case 0xe0 ... 0xe1:	/* DJNZ */
+      regsClobber(r->known, c[1], 2);
+      break;
+    default:
+      /* memory writes to unknown places, block moves, pops */
+      regsReset(r->val, r->known);
+      break;
+  }
+}
+
+void CodeFlow::run(uint16_t pc, int bank)
+{
+  struct Regs r;
+  regsReset(r.val, r.known);
+  /* whether we got to pc by falling through, and whether it only starts
+     a block because it follows our own conditional branch */
+  bool fell_through = false, own_block = false;
+  for (;;) {
+    uint32_t p = phys(pc, bank);
+    if (p == CF_NONE) {
+      out_of_rom++;
+      return;
+    }
+    if (!visit(pc, p, bank))
+      return;
+    /* a jump target is a join point; what the other paths into it have
+       loaded is unknown */
+    if (fell_through && (flags[p] & CF_BLOCK) && !own_block)
+      regsReset(r.val, r.known);
+
+    uint8_t code[DISASM_MAX_LEN];
+    fetch(p, code);
+    int len;
+    disasm(code, pc, &len);
+    if (p + len > size) {
+      out_of_rom++;
+      return;
+    }
+    /* into the middle of an instruction, or across the start of one */
+    bool overlap = flags[p] & CF_CODE;
+    for (int i = 1; i < len; i++)
+      overlap |= flags[p + i] & CF_INSN;
+    if (overlap) {
+      overlaps++;
+      return;
+    }
+
+    uint16_t target;
+    int flow = disasmFlow(code, pc, &target);
+    flags[p] |= CF_INSN | (flow << CF_FLOW_SHIFT);
+    for (int i = 1; i < len; i++)
+      flags[p + i] |= CF_CODE;
+
+    track(&r, code, len, p, &bank);
+
+    uint16_t next = pc + len;
+    own_block = false;
+    switch (flow) {
+      case FLOW_NEXT:
+        break;
+      case FLOW_CALL:
+        push(target, bank, p, EDGE_CALL);
+        /* whatever it does, it comes back with our bank */
+        regsReset(r.val, r.known);
+        break;
+      case FLOW_BRANCH:
+        push(target, bank, p, EDGE_JUMP);
+        {
+          uint32_t n = phys(next, bank);
+          if (n != CF_NONE) {
+            own_block = !(flags[n] & CF_BLOCK);
+            flags[n] |= CF_BLOCK;
+          }
+        }
+        break;
+      case FLOW_JUMP:
+        push(target, bank, p, EDGE_JUMP);
+        return;
+      case FLOW_INDIRECT:
+        if (code[0] == 0xe3 && regsWord(r.val, r.known, code[1], &target))
+          push(target, bank, p, EDGE_JUMP);	/* BR [] to a constant */
+        else
+          addEdge(p, CF_NONE, 0, EDGE_JUMP);
+        return;
+      default:
+        return;
+    }
+    if (next < pc)
+      return;	/* ran off the end of the address space */
+    if (pc >= 0xc000 && (flags[p] & CF_SWITCH)) {
+      /* the code we are running may have been mapped out from under us */
+      push(next, bank, p, EDGE_BANK);
+      return;
+    }
+    pc = next;
+    fell_through = true;
+  }
+}
+
+static int compareEdges(const void *a, const void *b)
+{
+  const struct CodeEdge *x = (const struct CodeEdge *)a;
+  const struct CodeEdge *y = (const struct CodeEdge *)b;
+  if (x->from != y->from)
+    return x->from < y->from ? -1 : 1;
+  if (x->to != y->to)
+    return x->to < y->to ? -1 : 1;
+  if (x->virt != y->virt)
+    return x->virt < y->virt ? -1 : 1;
+  return x->kind - y->kind;
+}
+
+static int compareSwitches(const void *a, const void *b)
+{
+  const struct BankSwitch *x = (const struct BankSwitch *)a;
+  const struct BankSwitch *y = (const struct BankSwitch *)b;
+  if (x->at != y->at)
+    return x->at < y->at ? -1 : 1;
+  if (x->reg != y->reg)
+    return x->reg - y->reg;
+  return x->value - y->value;
+}
+
+void CodeFlow::analyze()
+{
+  while (num_work) {
+    num_work--;
+    run(work[num_work].pc, work[num_work].bank);
+  }
+
+  /* code below 0xc000 followed more than once adds the same edges again */
+  if (num_edges)
+    qsort(edges, num_edges, sizeof(struct CodeEdge), compareEdges);
+  int n = 0;
+  for (int i = 0; i < num_edges; i++) {
+    if (!n || compareEdges(&edges[n - 1], &edges[i]))
+      edges[n++] = edges[i];
+  }
+  num_edges = n;
+  if (num_switches)
+    qsort(switches, num_switches, sizeof(struct BankSwitch), compareSwitches);
+  n = 0;
+  for (int i = 0; i < num_switches; i++) {
+    if (!n || compareSwitches(&switches[n - 1], &switches[i]))
+      switches[n++] = switches[i];
+  }
+  num_switches = n;
+
+  buildBlocks();
+  buildFuncs();
+}
+
+int CodeFlow::findBlock(uint32_t phys)
+{
+  int lo = 0, hi = num_blocks;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (blocks[mid].start < phys)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < num_blocks && blocks[lo].start == phys ? lo : -1;
+}
+
+int CodeFlow::findEdge(uint32_t phys)
+{
+  int lo = 0, hi = num_edges;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (edges[mid].from < phys)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void CodeFlow::buildBlocks()
+{
+  int blocks_size = 0;
+  struct CodeBlock *b = NULL;
+  num_insns = code_bytes = 0;
+  for (uint32_t p = 0; p < size; p++) {
+    if (!(flags[p] & CF_INSN))
+      continue;
+    uint32_t end = p + 1;
+    while (end < size && (flags[end] & CF_CODE))
+      end++;
+    if (!b || b->end != p || (flags[p] & (CF_BLOCK | CF_FUNC))) {
+      if (num_blocks == blocks_size) {
+        blocks_size = blocks_size ? blocks_size * 2 : 1024;
+        blocks = (struct CodeBlock *)realloc(blocks, blocks_size * sizeof(struct CodeBlock));
+      }
+      b = &blocks[num_blocks++];
+      b->start = p;
+      b->insns = 0;
+    }
+    b->end = end;
+    b->last = p;
+    b->insns++;
+    num_insns++;
+    code_bytes += end - p;
+    int flow = flags[p] >> CF_FLOW_SHIFT;
+    if ((flow != FLOW_NEXT && flow != FLOW_CALL) || (flags[p] & CF_SWITCH))
+      b = NULL;	/* the block ends here */
+  }
+
+  /* successors: jumps from the last instruction, and falling through */
+  int succ_size = 0, num_succ = 0;
+  for (int i = 0; i < num_blocks; i++) {
+    b = &blocks[i];
+    b->first_succ = num_succ;
+    b->num_succ = 0;
+    int flow = flags[b->last] >> CF_FLOW_SHIFT;
+    int targets[8];
+    int num_targets = 0;
+    for (int e = findEdge(b->last); e < num_edges && edges[e].from == b->last; e++) {
+      if (edges[e].kind == EDGE_CALL || edges[e].to == CF_NONE)
+        continue;
+      int t = findBlock(edges[e].to);
+      if (t >= 0 && num_targets < 8)
+        targets[num_targets++] = t;
+    }
+    bool fall = flow == FLOW_NEXT || flow == FLOW_CALL || flow == FLOW_BRANCH;
+    if (fall && !((flags[b->last] & CF_SWITCH) && virt(b->last) >= 0xc000)) {
+      int t = findBlock(b->end);
+      if (t >= 0 && num_targets < 8)
+        targets[num_targets++] = t;
+    }
+    for (int j = 0; j < num_targets; j++) {
+      if (num_succ == succ_size) {
+        succ_size = succ_size ? succ_size * 2 : 1024;
+        succ = (int *)realloc(succ, succ_size * sizeof(int));
+      }
+      succ[num_succ++] = targets[j];
+      b->num_succ++;
+    }
+  }
+}
+
+void CodeFlow::buildFuncs()
+{
+  for (int i = 0; i < num_blocks; i++) {
+    if (flags[blocks[i].start] & CF_FUNC)
+      num_funcs++;
+  }
+  funcs = (struct CodeFunc *)calloc(num_funcs, sizeof(struct CodeFunc));
+
+  /* the blocks of a function, found breadth-first; a block belongs to
+     every function it can be reached from */
+  int *stamp = (int *)malloc(num_blocks * sizeof(int));
+  for (int i = 0; i < num_blocks; i++)
+    stamp[i] = -1;
+  int *queue = (int *)malloc(num_blocks * sizeof(int));
+  int pool_size = 0, pool_used = 0;
+
+  int f = 0;
+  for (int i = 0; i < num_blocks; i++) {
+    if (!(flags[blocks[i].start] & CF_FUNC))
+      continue;
+    struct CodeFunc *fn = &funcs[f];
+    fn->addr = blocks[i].start;
+    sprintf(fn->name, "sub_%06X", fn->addr);
+    for (int e = 0; e < num_entries; e++) {
+      if (entries[e].phys == fn->addr) {
+        snprintf(fn->name, sizeof(fn->name), "%s", entries[e].name);
+        break;
+      }
+    }
+
+    int head = 0, tail = 0;
+    queue[tail++] = i;
+    stamp[i] = f;
+    while (head < tail) {
+      struct CodeBlock *b = &blocks[queue[head++]];
+      for (int s = 0; s < b->num_succ; s++) {
+        int t = succ[b->first_succ + s];
+        if (stamp[t] != f) {
+          stamp[t] = f;
+          queue[tail++] = t;
+        }
+      }
+    }
+    if (pool_used + tail > pool_size) {
+      pool_size = (pool_used + tail) * 2;
+      func_blocks = (int *)realloc(func_blocks, pool_size * sizeof(int));
+    }
+    fn->first_block = pool_used;
+    fn->num_blocks = tail;
+    for (int j = 0; j < tail; j++) {
+      struct CodeBlock *b = &blocks[queue[j]];
+      func_blocks[pool_used++] = queue[j];
+      fn->insns += b->insns;
+      fn->bytes += b->end - b->start;
+    }
+    f++;
+  }
+  free(queue);
+  free(stamp);
+}
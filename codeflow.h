@@ -0,0 +1,175 @@
+/*
+ * codeflow.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _CODEFLOW_H
+#define _CODEFLOW_H
+
+#include <stdint.h>
+
+/* per-byte flags */
+#define CF_INSN 0x01	/* first byte of an instruction */
+#define CF_CODE 0x02	/* any other byte of one */
+#define CF_BLOCK 0x04	/* a basic block starts here */
+#define CF_FUNC 0x08	/* a function starts here */
+#define CF_SWITCH 0x10	/* the instruction writes to CODEMAP */
+#define CF_FLOW_SHIFT 5	/* FLOW_* of the instruction */
+
+/* edges */
+#define EDGE_JUMP 0	/* jump, taken branch, resolved BR */
+#define EDGE_CALL 1
+#define EDGE_BANK 2	/* fall-through into another bank after a switch */
+
+/* no physical address, unknown bank */
+#define CF_NONE 0xffffffffUL
+#define CF_BANK_UNKNOWN -1
+
+struct CodeEdge {
+  uint32_t from;	/* physical address of the instruction */
+  uint32_t to;		/* physical address of the target, CF_NONE if unresolved */
+  uint16_t virt;	/* virtual address of the target, if known */
+  uint8_t kind;
+};
+
+struct CodeBlock {
+  uint32_t start, end;	/* physical, end exclusive */
+  uint32_t last;	/* the last instruction */
+  int insns;
+  /* successors not counting calls: succ[first_succ] and on, indices
+     into blocks */
+  int first_succ;
+  int num_succ;
+};
+
+struct CodeFunc {
+  uint32_t addr;
+  char name[32];
+  /* blocks reachable without following calls, the entry block first:
+     func_blocks[first_block] and on */
+  int first_block;
+  int num_blocks;
+  int insns;
+  uint32_t bytes;
+};
+
+/* a write to a mapping register */
+struct BankSwitch {
+  uint32_t at;		/* physical address of the instruction */
+  uint16_t reg;		/* 0x270 (CODEMAP_LO) to 0x273 (DATAMAP_HI) */
+  int value;		/* -1 if not a known constant */
+};
+
+/* Recursive-descent disassembly of a ROM image. Starting at the reset
+   address and the interrupt vectors, it follows jumps, branches and calls,
+   keeping track of the code bank mapped at 0xc000: bank switches are
+   writes of constants to CODEMAP, the constants loaded into registers by
+   LD/LDB/CLR on the path since the last call or jump target, and so are
+   the targets of BR []. The registers are forgotten when falling through
+   into an instruction already known to be a jump target, but each
+   instruction is only followed from the first path to reach it, so a
+   target found later does not undo what was derived on the way there.
+   Calls are assumed to return with the bank they were called with.
+   Instructions are identified by their physical address, as everywhere
+   else in the emulator (see Cpu::virtToPhys()). */
+class CodeFlow {
+public:
+  CodeFlow(const uint8_t *rom, uint32_t size);
+  ~CodeFlow();
+
+  const uint8_t *rom;
+  uint32_t size;
+
+  /* adds an entry point; name may be NULL */
+  void addEntry(uint16_t pc, int bank, const char *name);
+  /* the reset address and the interrupt vectors */
+  void addDefaultEntries();
+  /* follows everything reachable from the entry points, then splits the
+     code into basic blocks and functions */
+  void analyze();
+
+  inline uint8_t getFlags(uint32_t phys) {
+    return flags[phys];
+  }
+  /* virtual address of an instruction */
+  static uint16_t virt(uint32_t phys);
+  /* the map high byte * 256 + low byte for a physical address,
+     CF_BANK_UNKNOWN if there is none */
+  static int bankOf(uint32_t phys);
+  /* physical address of pc with the given code bank mapped, CF_NONE if
+     it is not in the ROM */
+  uint32_t phys(uint16_t pc, int bank);
+
+  /* writes the DISASM_MAX_LEN bytes at phys to code, zero-padded past the
+     end of the ROM */
+  void fetch(uint32_t phys, uint8_t *code);
+
+  /* results of analyze() */
+  struct CodeEdge *edges;	/* sorted by from */
+  int num_edges;
+  struct CodeBlock *blocks;	/* sorted by start */
+  int num_blocks;
+  int *succ;
+  struct CodeFunc *funcs;	/* sorted by addr */
+  int num_funcs;
+  int *func_blocks;
+  struct BankSwitch *switches;	/* sorted by at */
+  int num_switches;
+
+  uint32_t num_insns;
+  uint32_t code_bytes;
+  /* paths given up on because they ran into the middle of an instruction
+     or out of the ROM */
+  uint32_t overlaps;
+  uint32_t out_of_rom;
+
+  /* index of the block starting at phys, -1 if none does */
+  int findBlock(uint32_t phys);
+  /* index of the first edge from phys or after it */
+  int findEdge(uint32_t phys);
+
+private:
+  struct Regs {
+    uint8_t val[256];
+    uint8_t known[256];
+  };
+  struct Work {
+    uint16_t pc;
+    int bank;
+  };
+
+  void push(uint16_t pc, int bank, uint32_t from, int kind);
+  void run(uint16_t pc, int bank);
+  void track(struct Regs *r, const uint8_t *c, int len, uint32_t at, int *bank);
+  void storeTo(struct Regs *r, uint16_t addr, uint8_t src, bool word, uint32_t at, int *bank);
+  bool visit(uint16_t pc, uint32_t phys, int bank);
+  void addEdge(uint32_t from, uint32_t to, uint16_t virt, int kind);
+  void addSwitch(uint32_t at, uint16_t reg, int value);
+  void buildBlocks();
+  void buildFuncs();
+
+  uint8_t *flags;
+
+  struct Work *work;
+  int num_work, work_size;
+  int edges_size, switches_size;
+
+  /* entry points: name per physical address */
+  struct Entry {
+    uint32_t phys;
+    char *name;
+  } *entries;
+  int num_entries;
+
+  /* (physical address, bank) pairs seen below 0xc000, where the same code
+     runs with any bank mapped */
+  uint64_t *seen;
+  uint32_t seen_size, seen_used;
+};
+
+#endif
@@ -17,15 +17,73 @@
 #include "keypad.h"
 #include "hsio.h"
 #include "hints.h"
+#include "framecheck.h"
+#include "buslog.h"
+#include "latency.h"
+#include "profiler.h"
+#include "disasm.h"
+#include "log.h"
+#include "metrics.h"
 #include <string.h>
+#include <unistd.h>
 
 Cpu::Cpu(UI *ui)
 {
   end_cycles = (uint64_t)-1LL;
+  log_set_cycles(&cycles);
   
   recording = replaying = false;
   record_file = NULL;
   record_file_name = NULL;
+  record_version = REC_VERSION;
+  events = NULL;
+  replay_end = 0;
+  replay_offset = 0;
+  resetPolledInputs();
+  state_version = STATE_VERSION;
+  keyframes = NULL;
+  num_keyframes = keyframes_size = 0;
+  keyframe_seconds = 30;
+  next_keyframe = (uint64_t)-1;
+  fast_forward = false;
+  seek_target = (uint64_t)-1;
+  seek_request = 0;
+  rewind = NULL;	/* -R */
+  rewinding = false;
+  next_rewind_snapshot = 0;
+  rewind_request = 0;
+  state_codec = CODEC_LZ;
+  frame_check = NULL;
+  bench = bench_replay = false;
+  bench_start = bench_io_time = bench_lcd_time = bench_event_time = 0;
+  bench_io_count = bench_timer_cost = 0;
+  io_read8 = &Cpu::ioRead8;
+  io_write8 = &Cpu::ioWrite8;
+  bus_log = NULL;
+  serial_latency = NULL;
+  profiler = NULL;
+  call_stack = NULL;
+  call_profile_name = NULL;
+  trace = NULL;
+  trace_record = NULL;
+  trace_state = TRACE_OFF;
+  trace_trigger = 0;
+  next_profile_sample = (uint64_t)-1;
+  watches = new Watchpoints();
+  memset(watch_data, 0, sizeof(watch_data));
+  memset(watch_code, 0, sizeof(watch_code));
+  watch_state = 0;
+  step_count = 0;
+  stop_reason = STOP_NONE;
+  stop_addr = 0;
+  halted = false;
+  halt_count = 0;
+  watch_resume_pc = (uint32_t)-1;
+  watch_queue = new Ring<char *>(16);
+  instructions = 0;
+  deterministic = false;
+  prng_state = 1;
+  extint_pos = 0;
   
   this->ui = ui;
   keypad = new Keypad(this, ui);
@@ -48,9 +106,26 @@ Cpu::Cpu(UI *ui)
 #ifdef LATENCY
   mem_latency = NULL;
   do_latency = false;
+#endif
+#ifdef MEMSTATS
+  mem_stats = NULL;
+#endif
+#ifdef FUZZ
+  fuzz = NULL;
 #endif
   record_file = NULL;
   mapped_ram = NULL;
+  dirty.addRegion(ram, 0xc000);
+  mapped_ram_page = dirty.addRegion(NULL, MAPPED_RAM_SIZE);
+  int lcd_page = lcd->setDirtyPages(&dirty);
+  mem_search = new MemSearch(&dirty);
+  mem_search->addRegion("ram", 0, 0);
+  mem_search->addRegion("mapped", mapped_ram_page, 0xcaf00000UL);
+  mem_search->addRegion("lcd", lcd_page, (uint32_t)-1);
+  replay_good_cycles = 0;
+  replay_diverged = false;
+  snapshot_base_id = 0;
+  next_snapshot_id = 1;
   
   current_event.cycles = 0;
   current_event.type = EVENT_INVALID;
@@ -59,6 +134,7 @@ Cpu::Cpu(UI *ui)
   hints = new Hints(this, ui);
   
   cmd_queue = new Ring<int>(10);
+  cmd_queue_lock = os_create_mutex();
 
   emulation_stopped = true;
 
@@ -68,6 +144,7 @@ Cpu::Cpu(UI *ui)
 void Cpu::reset()
 {
   pc = 0x2080;
+  watch_resume_pc = (uint32_t)-1;
   psw = 0;
   cycles = 0;
   int_mask = 0;
@@ -83,7 +160,6 @@ void Cpu::reset()
   timer2 = 0;
   
 #ifndef NDEBUG
-  watchpoint_lo = 0;
   trigger = 0;
 #endif
   
@@ -96,6 +172,7 @@ void Cpu::reset()
   data_hi = 0;
   
   code_ptr = rom;
+  code_phys = 0;
   data_ptr = (uint8_t *)rom;
   wsr = 0;
   wsr1 = 0;
@@ -115,10 +192,16 @@ void Cpu::reset()
   lcd->reset();
   if (serial)
     serial->reset();
+  dirty.markAll();
+  resetRewind();
+  if (call_stack)
+    call_stack->clear();
+  watchRemap(false);
 }
 
 Cpu::~Cpu()
 {
+  log_set_cycles(NULL);
   delete hsi;
   delete eeprom;
   delete lcd;
@@ -142,15 +225,54 @@ Cpu::~Cpu()
 #endif
   if (serial)
     delete serial;
+  if (bus_log)
+    delete bus_log;
   if (hints)
     delete hints;
-  if (record_file)
-    state_close(record_file);
+  if (recording && events)
+    finishRecording();
+  closeRecordFile();
   if (record_file_name)
     free(record_file_name);
+  if (keyframes)
+    free(keyframes);
+  if (rewind)
+    delete rewind;
+  if (frame_check)
+    delete frame_check;
+  if (profiler) {
+    profiler->save();
+    delete profiler;
+  }
+  if (call_stack) {
+    if (call_profile_name) {
+      call_stack->save(call_profile_name, getCycles());
+      free(call_profile_name);
+    }
+    delete call_stack;
+  }
+  if (trace)
+    delete trace;
+  if (serial_latency) {
+    serial_latency->save();
+    delete serial_latency;
+  }
+#ifdef MEMSTATS
+  if (mem_stats) {
+    mem_stats->save(getCycles());
+    delete mem_stats;
+  }
+#endif
+  state_save_wait();
   if (mapped_ram)
     free(mapped_ram);
+  delete watches;
+  while (!watch_queue->empty())
+    free(watch_queue->consume());
+  delete watch_queue;
+  delete mem_search;
   delete cmd_queue;
+  os_destroy_mutex(cmd_queue_lock);
 }
 
 void Cpu::setRomSize(size_t size)
@@ -173,6 +295,7 @@ void Cpu::setRomSize(size_t size)
 #endif
   rom_size = size;
   code_ptr = rom;
+  code_phys = 0;
   data_ptr = (uint8_t *)rom;	/* data_ptr can't be const, might point to RAM */
 }
 
@@ -181,6 +304,7 @@ void Cpu::setMappedRamSize(size_t size)
   if (mapped_ram)
     free(mapped_ram);
   mapped_ram = (uint8_t *)calloc(1, size);
+  dirty.moveRegion(mapped_ram_page, mapped_ram);
 }
 
 void Cpu::enableRecording(const char *rname)
@@ -195,7 +319,12 @@ void Cpu::enableRecording(const char *rname)
     ui->fatalError("Could not open %s for writing.", NULL, rname);
     return;
   }
+  EventStream::writeHeader(record_file);
   if (!loadSaveState(record_file, true)) {
+    events = new EventStream(record_file, true);
+    resetPolledInputs();
+    num_keyframes = 0;
+    next_keyframe = getCycles() + (uint64_t)keyframe_seconds * oclock / 2;
     recording = true;
     ui->setLED(LED_REC, true);
   }
@@ -203,6 +332,14 @@ void Cpu::enableRecording(const char *rname)
 
 void Cpu::disableRecording()
 {
+  if (recording && events)
+    finishRecording();
+  endRewind();
+  if (replaying || seek_target != (uint64_t)-1) {
+    /* we may have been fast-forwarding */
+    seek_target = (uint64_t)-1;
+    resetTiming();
+  }
   recording = replaying = false;
   ui->setLED(LED_REC, false);
   ui->setLED(LED_PLAY, false);
@@ -210,47 +347,399 @@ void Cpu::disableRecording()
     free(record_file_name);
     record_file_name = NULL;
   }
+  closeRecordFile();
+}
+
+void Cpu::closeRecordFile()
+{
+  if (events) {
+    delete events;
+    events = NULL;
+  }
   if (record_file) {
     state_close(record_file);
     record_file = NULL;
   }
 }
 
-void Cpu::enableReplaying(const char *rname)
+/* terminates the event stream and writes the keyframe index */
+void Cpu::finishRecording()
 {
-  disableRecording();
-  /* keep current name if rname == NULL
-     used by state loading, which changes record_file_name directly */
-  if (rname) {
-    record_file_name = strdup(rname);
+  events->writeEnd(getCycles());
+  events->flush();
+
+  state_finish(record_file);
+  uint64_t index_offset = state_offset(record_file);
+  uint32_t count = num_keyframes;
+  state_write(record_file, REC_INDEX_MAGIC, REC_INDEX_MAGIC_LEN);
+  state_write(record_file, &count, sizeof(count));
+  state_write(record_file, keyframes, count * sizeof(struct Keyframe));
+  closeRecordFile();
+
+  /* the index offset is appended uncompressed so it can be found without
+     decompressing the entire file */
+  FILE *fp = fopen(record_file_name, "ab");
+  if (!fp) {
+    ERROR("could not append keyframe index offset to %s\n", record_file_name);
+    return;
+  }
+  fwrite(&index_offset, sizeof(index_offset), 1, fp);
+  fwrite(REC_INDEX_MAGIC, REC_INDEX_MAGIC_LEN, 1, fp);
+  fclose(fp);
+  DEBUG(EVENT, "wrote %d keyframes\n", count);
+}
+
+void Cpu::writeKeyframe()
+{
+  statefile_t mem = state_open_mem(NULL, 0);
+  loadSaveState(mem, true);
+  size_t len;
+  const uint8_t *data = state_mem_data(mem, &len);
+
+  if (num_keyframes == keyframes_size) {
+    keyframes_size = keyframes_size ? keyframes_size * 2 : 64;
+    keyframes = (struct Keyframe *)realloc(keyframes, keyframes_size * sizeof(struct Keyframe));
   }
+  keyframes[num_keyframes].cycles = getCycles();
+  keyframes[num_keyframes].offset = events->writeKeyframe(getCycles(), data, len);
+  num_keyframes++;
+  state_close(mem);
+
+  DEBUG(EVENT, "keyframe %d at %llu, %d bytes\n", num_keyframes,
+        (unsigned long long)getCycles(), (int)len);
+  next_keyframe += (uint64_t)keyframe_seconds * oclock / 2;
+}
+
+void Cpu::setKeyframeInterval(int seconds)
+{
+  keyframe_seconds = seconds;
+}
 
-  record_file = state_open(record_file_name, "rb");
+/* opens record_file_name, either at the start, in which case the header
+   is skipped, or at a keyframe; the caller has to take care of the
+   machine state that follows */
+bool Cpu::openReplayFile(uint64_t offset)
+{
+  if (offset)
+    record_file = state_open_at(record_file_name, offset);
+  else
+    record_file = state_open(record_file_name, "rb");
   if (!record_file) {
     ERROR("could not open %s for reading\n", record_file_name);
-    exit(1);
+    return false;
   }
+  replay_offset = offset;
+  if (!offset)
+    record_version = EventStream::readHeader(record_file);
+  return true;
+}
+
+bool Cpu::loadKeyframeIndex()
+{
+  uint64_t index_offset;
+  char magic[REC_INDEX_MAGIC_LEN];
+  uint32_t count;
+
+  num_keyframes = 0;
+  FILE *fp = fopen(record_file_name, "rb");
+  if (!fp)
+    return false;
+  bool found = !fseek(fp, -(long)(sizeof(index_offset) + REC_INDEX_MAGIC_LEN), SEEK_END) &&
+               fread(&index_offset, sizeof(index_offset), 1, fp) == 1 &&
+               fread(magic, REC_INDEX_MAGIC_LEN, 1, fp) == 1 &&
+               !memcmp(magic, REC_INDEX_MAGIC, REC_INDEX_MAGIC_LEN);
+  fclose(fp);
+  if (!found) {
+    DEBUG(EVENT, "no keyframe index in %s\n", record_file_name);
+    return false;
+  }
+
+  statefile_t ix = state_open_at(record_file_name, index_offset);
+  if (!ix)
+    return false;
+  if (state_read(ix, magic, REC_INDEX_MAGIC_LEN) != REC_INDEX_MAGIC_LEN ||
+      memcmp(magic, REC_INDEX_MAGIC, REC_INDEX_MAGIC_LEN) ||
+      state_read(ix, &count, sizeof(count)) != sizeof(count)) {
+    ERROR("corrupt keyframe index in %s\n", record_file_name);
+    state_close(ix);
+    return false;
+  }
+  if ((int)count > keyframes_size) {
+    keyframes_size = count;
+    keyframes = (struct Keyframe *)realloc(keyframes, keyframes_size * sizeof(struct Keyframe));
+  }
+  num_keyframes = state_read(ix, keyframes, count * sizeof(struct Keyframe)) / sizeof(struct Keyframe);
+  state_close(ix);
+  DEBUG(EVENT, "%d keyframes in %s\n", num_keyframes, record_file_name);
+  return true;
+}
+
+/* continues the current replay from keyframe k */
+bool Cpu::loadKeyframe(int k)
+{
+  closeRecordFile();
+  if (!openReplayFile(keyframes[k].offset))
+    return false;
+
+  /* the keyframe has been saved while recording, so the state's idea of
+     the recording differs from ours */
+  char *name = strdup(record_file_name);
+  uint64_t end = replay_end;
+  uint64_t offset = replay_offset;
+  int version = record_version;
+  bool failed = loadSaveState(record_file, false);
+  free(record_file_name);
+  record_file_name = name;
+  replay_end = end;
+  replay_offset = offset;
+  record_version = version;
+  if (failed)
+    return false;
+
+  events = new EventStream(record_file, false, record_version);
+  current_event.cycles = getCycles();
+  current_event.type = EVENT_INVALID;
+  DEBUG(EVENT, "loaded keyframe %d at %llu\n", k, (unsigned long long)getCycles());
+  return true;
+}
+
+void Cpu::enableReplaying(const char *rname)
+{
+  disableRecording();
+  record_file_name = strdup(rname);
+
+  if (!openReplayFile())
+    exit(1);
   if (!loadSaveState(record_file, false)) {
+    events = new EventStream(record_file, false, record_version);
+    resetPolledInputs();
+    replay_end = 0;
+    current_event.type = EVENT_INVALID;
+    loadKeyframeIndex();
     replaying = true;
     ui->setLED(LED_PLAY, true);
   }
 }
 
+bool Cpu::seekReplay(uint64_t target)
+{
+  if (!replaying)
+    return false;
+
+  int k;
+  for (k = num_keyframes - 1; k >= 0; k--) {
+    if (keyframes[k].cycles <= target)
+      break;
+  }
+
+  if (k >= 0 && (target < getCycles() || keyframes[k].cycles > getCycles())) {
+    if (!loadKeyframe(k)) {
+      disableRecording();
+      return false;
+    }
+  }
+  else if (target < getCycles()) {
+    /* no keyframe to go back to, start over */
+    char *name = strdup(record_file_name);
+    enableReplaying(name);
+    free(name);
+  }
+
+  if (getCycles() < target) {
+    DEBUG(EVENT, "fast-forwarding from %llu to %llu\n",
+          (unsigned long long)getCycles(), (unsigned long long)target);
+    seek_target = target;
+  }
+  else
+    seekDone();
+  return true;
+}
+
+/* hash over everything that should be identical in a replay */
+uint32_t Cpu::stateHash()
+{
+  uint32_t regs[] = {
+    pc, psw,
+    code_lo | (code_hi << 8) | (data_lo << 16) | ((uint32_t)data_hi << 24),
+    wsr | (wsr1 << 8) | (int_mask << 16) | ((uint32_t)int_mask1 << 24),
+    (uint32_t)cycles, (uint32_t)(cycles >> 32),
+    ioc0 | (ioc1 << 8) | (ios0 << 16) | ((uint32_t)ios1 << 24),
+    ioport1 | (ioport2 << 8) | ((uint32_t)ad_result << 16),
+    timer1_offset, timer2,
+    prng_state, (uint32_t)extint_pos,
+  };
+  uint64_t h = DirtyPages::hashBuffer(regs, sizeof(regs), dirty.hash());
+  return h ^ (h >> 32);
+}
+
+/* records the state hash, or compares it to the recorded one */
+void Cpu::checkStateHash()
+{
+  uint32_t hash = stateHash();
+  if (!replaying) {
+    recordEvent(EVENT_STATEHASH, hash);
+    return;
+  }
+
+  struct Event ev = retrieveEvent(EVENT_STATEHASH);
+  if (ev.type == EVENT_INVALID) {
+    /* recording without hashes */
+    return;
+  }
+  if ((uint32_t)ev.value == hash) {
+    replay_good_cycles = getCycles();
+    return;
+  }
+  if (!replay_diverged) {
+    ERROR("replay diverged between cycles %llu and %llu, pc %04X (%08X), code bank %02X/%02X, data bank %02X/%02X\n",
+          (unsigned long long)replay_good_cycles, (unsigned long long)getCycles(),
+          pc, virtToPhys(pc, 1), code_hi, code_lo, data_hi, data_lo);
+    replay_diverged = true;
+  }
+}
+
+void Cpu::requestSeek(uint64_t target)
+{
+  seek_request = target;
+  sendCommand(CPU_CMD_SEEK);
+}
+
+void Cpu::seekDone()
+{
+  DEBUG(EVENT, "replay at %llu\n", (unsigned long long)getCycles());
+  seek_target = (uint64_t)-1;
+  endRewind();
+  resetTiming();
+  lcd->redraw();
+}
+
+void Cpu::setFastForward(bool on)
+{
+  fast_forward = on;
+  if (!on)
+    resetTiming();
+}
+
+void Cpu::setRewindMemory(size_t max_memory)
+{
+  if (rewind)
+    delete rewind;
+  rewind = max_memory ? new Rewind(max_memory) : NULL;
+  next_rewind_snapshot = getCycles();
+}
+
+void Cpu::takeRewindSnapshot()
+{
+  rewind->add(takeSnapshot(rewind->getBase()), poll_value);
+  next_rewind_snapshot = getCycles() + oclock / 2;
+}
+
+bool Cpu::goTo(uint64_t target)
+{
+  if (replaying && !rewinding)
+    return seekReplay(target);
+
+  if (target >= getCycles()) {
+    if (target > getCycles())
+      seek_target = target;
+    return true;
+  }
+
+  Snapshot *s = rewind ? rewind->rewindTo(target, poll_value) : NULL;
+  if (!s) {
+    ERROR("no rewind history, enable it with -R <kbytes>\n");
+    return false;
+  }
+  if (recording) {
+    /* a recording cannot go back in time */
+    DEBUG(WARN, "rewinding ends recording\n");
+    disableRecording();
+  }
+  if (s->getCycles() > target)
+    DEBUG(WARN, "rewind history only goes back to %llu\n", (unsigned long long)s->getCycles());
+
+  restoreSnapshot(s);
+  current_event.type = EVENT_INVALID;
+  next_rewind_snapshot = getCycles() + oclock / 2;
+  if (getCycles() < target) {
+    DEBUG(EVENT, "re-executing from %llu to %llu\n",
+          (unsigned long long)getCycles(), (unsigned long long)target);
+    rewinding = replaying = true;
+    seek_target = target;
+  }
+  else {
+    /* right at the snapshot, nothing to re-execute */
+    rewind->truncate(0);
+    seekDone();
+  }
+  return true;
+}
+
+void Cpu::requestRewind(int seconds)
+{
+  rewind_request = seconds;
+  sendCommand(CPU_CMD_REWIND);
+}
+
+/* continues live from the current point of a re-execution; whatever has
+   been logged after it never happens now */
+void Cpu::endRewind()
+{
+  if (!rewinding)
+    return;
+  rewind->truncate(current_event.type != EVENT_INVALID);
+  current_event.type = EVENT_INVALID;
+  rewinding = replaying = false;
+}
+
+/* the machine state has been replaced, so the history does not apply
+   anymore */
+void Cpu::resetRewind()
+{
+  if (rewinding) {
+    rewinding = replaying = false;
+    seek_target = (uint64_t)-1;
+  }
+  if (rewind)
+    rewind->clear();
+  next_rewind_snapshot = getCycles();
+}
+
 void Cpu::setSerial(Interface *iface, bool expect_echo)
 {
   serial = new Serial(this, iface, ui, hints);
   hints->setSerial(serial);
   ui->setSerial(serial);
   serial->setEcho(expect_echo);
+  serial->setBusLog(bus_log);
+  serial->setLatency(serial_latency);
+#ifdef FUZZ
+  serial->setFuzz(fuzz);
+#endif
 }
 
-#ifndef NDEBUG
-void Cpu::setWatchpoint(uint16_t lo, uint16_t hi)
+bool Cpu::enableBusCapture(const char *name)
+{
+  bus_log = new BusLog(name);
+  if (!bus_log->isOpen()) {
+    delete bus_log;
+    bus_log = NULL;
+    return false;
+  }
+  if (serial)
+    serial->setBusLog(bus_log);
+  return true;
+}
+
+void Cpu::enableSerialLatency(const char *name)
 {
-  watchpoint_lo = lo;
-  watchpoint_hi = hi;
+  if (serial_latency)
+    delete serial_latency;
+  serial_latency = new SerialLatency(name);
+  if (serial)
+    serial->setLatency(serial_latency);
 }
-#endif
+
 
 void Cpu::setMaximumCycles(uint64_t max)
 {
@@ -265,18 +754,8 @@ void Cpu::setDebugTrigger(uint32_t trigger, uint32_t level)
 }
 #endif
 
-uint32_t Cpu::virtToPhysSlow(uint16_t addr, int fetch)
+uint32_t Cpu::bankToPhys(uint8_t map_hi, uint8_t map_lo, uint16_t addr)
 {
-  uint8_t map_lo, map_hi;  
-  if (fetch) {
-    map_lo = code_lo;
-    map_hi = code_hi;
-  }
-  else {
-    map_lo = data_lo;
-    map_hi = data_hi;
-  }
-  
   if (map_hi == 9)
     return 0xc000 + (map_lo - 6) * 0x4000 + (addr - 0xc000);
   else if (map_hi == 0)
@@ -295,7 +774,31 @@ uint32_t Cpu::virtToPhysSlow(uint16_t addr, int fetch)
   else if (map_hi == 7 || map_hi == 0x1f || map_hi == 0x1e) {
     return 0xcaf00000UL + (map_lo % 0x20) * 0x4000 + (addr - 0xc000);
   }
+  else
+    return (uint32_t)-1;
+}
+
+uint32_t Cpu::virtToPhysSlow(uint16_t addr, int fetch)
+{
+  uint8_t map_lo, map_hi;  
+  if (fetch) {
+    map_lo = code_lo;
+    map_hi = code_hi;
+  }
   else {
+    map_lo = data_lo;
+    map_hi = data_hi;
+  }
+  
+  uint32_t phys = bankToPhys(map_hi, map_lo, addr);
+  if (phys == (uint32_t)-1) {
+#ifdef FUZZ
+    if (fuzz) {
+      /* the fuzzer stops the emulation before the next instruction */
+      fuzz->crash(FUZZ_UNMAPPED_BANK, (map_hi << 8) | map_lo);
+      return 0;
+    }
+#endif
     char buf[256];
     sprintf(buf, "Unimplemented memory mapping. (%02X/%02X)\nThe system will reset now.", map_hi, map_lo);
     ERROR(buf);
@@ -308,6 +811,7 @@ uint32_t Cpu::virtToPhysSlow(uint16_t addr, int fetch)
 #endif
     return 0;
   }
+  return phys;
 }
 
 uint8_t Cpu::mappedRead8(uint16_t addr, int fetch)
@@ -336,15 +840,16 @@ uint8_t Cpu::memRead8Bus(uint16_t addr, int fetch)
       (addr >= 0x205e && addr < 0x2080) ||
 #endif
       (addr >= 0x200 && addr < 0x2ff))
-    ret = ioRead8(addr);
+    ret = (this->*io_read8)(addr);
   else
     ret = ram[addr];
+  MEMSTATS_HOOK(access(fetch ? MEMSTATS_FETCH : MEMSTATS_READ, addr, virtToPhys(addr, fetch)));
 
-#ifndef NDEBUG
-  if (!fetch) DEBUG(MEM, "READ %02X <- %04X\n", ret, addr);
-  if (watchpoint_lo && watchpoint_lo <= addr && watchpoint_hi >= addr)
-    DEBUG(WARN, "%04X/%08X: WATCH READ %04X: %02X\n", opc, virtToPhys(opc, 1), addr, ret);
-#endif
+  if (!fetch) {
+    DEBUG(MEM, "READ %02X <- %04X\n", ret, addr);
+    if (unlikely(watch_data[addr >> WATCH_PAGE_SHIFT] & WATCH_READ))
+      watchAccess(addr, WATCH_READ, ret);
+  }
 
   return ret;
 }
@@ -353,18 +858,16 @@ void Cpu::memWrite8Slow(uint16_t addr, uint8_t value)
 {
   DEBUG(MEM, "WRITE %02X -> %04X\n", value, addr);
 
-#ifndef NDEBUG
-  if (watchpoint_lo && addr >= watchpoint_lo && addr <= watchpoint_hi)
-    DEBUG(WARN, "%04X/%08X: WATCH %04X: %02X -> %02X\n", opc, virtToPhys(opc, 1), addr, memRead8(addr), value);
-#endif
-    
   uint32_t effective_addr = virtToPhys(addr, 0);
   if (effective_addr >= 0xcaf00000UL) {
     DEBUG(MEM, "RAM write(!) of %02X to %04X not ignored\n", value, addr);
     mapped_ram[effective_addr - 0xcaf00000UL] = value;
+    dirty.markAddr(mapped_ram_page, effective_addr - 0xcaf00000UL);
   }
-  else
+  else {
     ram[effective_addr] = value;
+    dirty.mark(effective_addr >> DIRTY_PAGE_SHIFT);
+  }
 }
 
 
@@ -378,7 +881,7 @@ void Cpu::dumpMem()
   fwrite(ram, 0xc000, 1, fp);
   fclose(fp);
   fp = fopen("dump.ram", "w");
-  fwrite(mapped_ram, 524288, 1, fp);
+  fwrite(mapped_ram, MAPPED_RAM_SIZE, 1, fp);
   fclose(fp);
 #ifdef LATENCY
   fp = fopen("dump.lat", "w");
@@ -394,6 +897,14 @@ void Cpu::resetTiming()
   oldtime = nowtime - cycles * 2 * 1000 / clock;
 }
 
+void Cpu::setDeterministic(uint32_t seed)
+{
+  deterministic = true;
+  /* xorshift gets stuck at 0 */
+  prng_state = seed ? seed : 1;
+  DEBUG(WARN, "deterministic mode, seed %u\n", prng_state);
+}
+
 void Cpu::setSlowDown(float factor)
 {
   if (factor != slowdown) {
@@ -405,271 +916,97 @@ void Cpu::setSlowDown(float factor)
 }
 
 #ifndef NDEBUG
-static char buf[80];
 const char *Cpu::disassemble()
 {
-  uint8_t opcode = peek(0);
-
-#define OPUNIMP(x) sprintf(buf, x " undecoded");
-
-#define OP0(x) sprintf(buf, x);
-#define OP1(x) sprintf(buf, x " %02Xh", peek(1));
-#define OP1IM(x) sprintf(buf, x " #%04Xh", peek16(1));
-#define OP1IN(x) sprintf(buf, x " [%02Xh]%s", peek(1) & 0xfe, (peek(1) & 1) ? "+" : "");
-#define OP1IX(x) \
-  if (peek(1) & 1) \
-    sprintf(buf, x " %04Xh[%02Xh]", peek16(2), peek(1) & 0xfe); \
-  else \
-    sprintf(buf, x " %02Xh[%02Xh]", peek(2), peek(1));
-
-#define OP2D(x) sprintf(buf, x " %02Xh, %02Xh", peek(2), peek(1));
-
-#define OP2IM(x, byte) \
-  if (byte) \
-    sprintf(buf, x " %02Xh, #%02Xh", peek(2), peek(1)); \
-  else \
-    sprintf(buf, x " %02Xh, #%04Xh", peek(3), peek16(1)); \
-
-#define OP2IX(x) \
-  if (peek(1) & 1) \
-    sprintf(buf, x " %02Xh, %04Xh[%02Xh]", peek(4), peek16(2), peek(1) & 0xfe); \
-  else \
-    sprintf(buf, x " %02Xh, %02Xh[%02Xh]", peek(3), peek(2), peek(1));
-
-#define OP2SH(x) \
-  if (peek(1) > 15) \
-    sprintf(buf, x " %02Xh, #%02Xh", peek(2), peek(1)); \
-  else \
-    sprintf(buf, x " %02Xh, %02Xh", peek(2), peek(1));
-
-#define OPJ8(x) sprintf(buf, x " %04Xh (%02Xh)", opc + (int8_t)peek(1) + 2, peek(1));
-#define OPJ16(x) sprintf(buf, x " %04Xh (%04Xh)", (uint16_t)(opc + (int16_t)peek16(1) + 3), peek16(1));
-#define OPDJ8(x) sprintf(buf, x " %02Xh, %04Xh (%02Xh)", peek(1), opc + (int8_t)peek(2) + 3, peek(2));
-
-#define OPJ11(x) \
-        sprintf(buf, x " %04Xh", opc + (((int16_t)((peek(1) | ((peek(0) & 0x7) << 8)) << 5)) >> 5) + 2);
-
-#define OPJBIT(x) \
-        sprintf(buf, x " %02Xh, %u, %04Xh", peek(1), opcode & 7, opc + (int8_t)peek(2) + 3);
-
-#define OP3E(x, byte) \
-  switch (peek(0) & 3) { \
-    case 0: \
-      sprintf(buf, x " %02Xh, %02Xh, %02Xh", peek(3), peek(2), peek(1)); \
-      break; \
-    case 1: \
-      if (byte) \
-        sprintf(buf, x " %02Xh, %02Xh, #%02Xh", peek(3), peek(2), peek(1)); \
-      else \
-        sprintf(buf, x " %02Xh, %02Xh, #%04Xh", peek(4), peek(3), peek16(1)); \
-      break; \
-    case 2: \
-      sprintf(buf, x " %02Xh, %02Xh, [%02Xh]%s", peek(3), peek(2), peek(1) & 0xfe, (peek(1) & 1) ? "+" : ""); \
-      break; \
-    case 3: \
-      if (peek(1) & 1) \
-        sprintf(buf, x " %02Xh, %02Xh, %04Xh[%02Xh]", peek(5), peek(4), peek16(2), peek(1) & 0xfe); \
-      else \
-        sprintf(buf, x " %02Xh, %02Xh, %02Xh[%02Xh]", peek(4), peek(3), peek(2), peek(1)); \
-      break; \
-  }
-#define OP3(x) OP3E(x, 0)
-#define OP3B(x) OP3E(x, 1)
-
-#define OP2E(x, byte) \
-  switch (peek(0) & 3) { \
-    case 0: \
-      OP2D(x); \
-      break; \
-    case 1: \
-      OP2IM(x, byte); \
-      break; \
-    case 2: \
-      sprintf(buf, x " %02Xh, [%02Xh]%s", peek(2), peek(1) & 0xfe, (peek(1) & 1) ? "+" : ""); \
-      break; \
-    case 3: \
-      OP2IX(x); \
-      break; \
-  }
-
-#define OP2(x) OP2E(x, 0)
-#define OP2B(x) OP2E(x, 1)
-
-  switch (opcode) {
-    case 0x00: OP1("SKIP"); break;
-    case 0x01: OP1("CLR"); break;
-    case 0x02: OP1("NOT"); break;
-    case 0x03: OP1("NEG"); break;
-    case 0x04: OP2D("XCH"); break;
-    case 0x05: OP1("DEC"); break;
-    case 0x06: OP1("EXT"); break;
-    case 0x07: OP1("INC"); break;
-    case 0x08: OP2SH("SHR"); break;
-    case 0x09: OP2SH("SHL"); break;
-    case 0x0a: OP2SH("SHRA"); break;
-    case 0x0b: OP2IX("XCH"); break;
-    case 0x0c: OP2SH("SHRL"); break;
-    case 0x0d: OP2SH("SHLL"); break;
-    case 0x0e: OP2SH("SHRAL"); break;
-    case 0x0f: OP2SH("NORML"); break;
-    case 0x10: OP0("RESERVED"); break;
-    case 0x11: OP1("CLRB"); break;
-    case 0x12: OP1("NOTB"); break;
-    case 0x13: OP1("NEGB"); break;
-    case 0x14: OP2D("XCHB"); break;
-    case 0x15: OP1("DECB"); break;
-    case 0x16: OP1("EXTB"); break;
-    case 0x17: OP1("INCB"); break;
-    case 0x18: OP2SH("SHRB"); break;
-    case 0x19: OP2SH("SHLB"); break;
-    case 0x1a: OP2SH("SHRAB"); break;
-    case 0x1b: OP2IX("XCHB"); break;
-    case 0x1c ... 0x1f: OP0("RESERVED"); break;
-    case 0x20 ... 0x27: OPJ11("SJMP"); break;
-    case 0x28 ... 0x2f: OPJ11("SCALL"); break;
-    case 0x30 ... 0x37: OPJBIT("JBC"); break;
-    case 0x38 ... 0x3f: OPJBIT("JBS"); break;
-    case 0x40 ... 0x43: OP3("AND"); break;
-    case 0x44 ... 0x47: OP3("ADD"); break;
-    case 0x48 ... 0x4b: OP3("SUB"); break;
-    case 0x4c ... 0x4f: OP3("MULU"); break;
-    case 0x50 ... 0x53: OP3B("ANDB"); break;
-    case 0x54 ... 0x57: OP3B("ADDB"); break;
-    case 0x58 ... 0x5b: OP3B("SUBB"); break;
-    case 0x5c ... 0x5f: OP3B("MULUB"); break;
-    case 0x60 ... 0x63: OP2("AND"); break;
-    case 0x64 ... 0x67: OP2("ADD"); break;
-    case 0x68 ... 0x6b: OP2("SUB"); break;
-    case 0x6c ... 0x6f: OP2("MULU"); break;
-    case 0x70 ... 0x73: OP2B("ANDB"); break;
-    case 0x74 ... 0x77: OP2B("ADDB"); break;
-    case 0x78 ... 0x7b: OP2B("SUBB"); break;
-    case 0x7c ... 0x7f: OP2B("MULUB"); break;
-    case 0x80 ... 0x83: OP2("OR"); break;
-    case 0x84 ... 0x87: OP2("XOR"); break;
-    case 0x88 ... 0x8b: OP2("CMP"); break;
-    case 0x8c ... 0x8f: OP2("DIVU"); break;
-    case 0x90 ... 0x93: OP2B("ORB"); break;
-    case 0x94 ... 0x97: OP2B("XORB"); break;
-    case 0x98 ... 0x9b: OP2B("CMPB"); break;
-    case 0x9c ... 0x9f: OP2B("DIVUB"); break;
-    case 0xa0 ... 0xa3: OP2("LD"); break;
-    case 0xa4 ... 0xa7: OP2("ADDC"); break;
-    case 0xa8 ... 0xab: OP2("SUBC"); break;
-    case 0xac ... 0xaf: OP2("LDBZE"); break;
-    case 0xb0 ... 0xb3: OP2("LDB"); break;
-    case 0xb4 ... 0xb7: OP2("ADDCB"); break;
-    case 0xb8 ... 0xbb: OP2("SUBCB"); break;
-    case 0xbc ... 0xbf: OP2("LDBSE"); break;
-    case 0xc0: OP2("ST"); break;
-    case 0xc1: OP2D("BMOV"); break;
-    case 0xc2: OP2("ST"); break;
-    case 0xc3: OP2("ST"); break;
-    case 0xc4: OP2B("STB"); break;
-    case 0xc5: OP2D("CMPL"); break;
-    case 0xc6: OP2B("STB"); break;
-    case 0xc7: OP2B("STB"); break;
-    case 0xc8: OP1("PUSH"); break;
-    case 0xc9: OP1IM("PUSH"); break;
-    case 0xca: OP1IN("PUSH"); break;
-    case 0xcb: OP1IX("PUSH"); break;
-    case 0xcc: OP1("POP"); break;
-    case 0xcd: OP2D("BMOVI"); break;
-    case 0xce: OP1IN("POP"); break;
-    case 0xcf: OP1IX("POP"); break;
-    case 0xd0: OPJ8("JNST"); break;
-    case 0xd1: OPJ8("JNH"); break;
-    case 0xd2: OPJ8("JGT"); break;
-    case 0xd3: OPJ8("JNC"); break;
-    case 0xd4: OPJ8("JNVT"); break;
-    case 0xd5: OPJ8("JNV"); break;
-    case 0xd6: OPJ8("JGE"); break;
-    case 0xd7: OPJ8("JNE"); break;
-    case 0xd8: OPJ8("JST"); break;
-    case 0xd9: OPJ8("JH"); break;
-    case 0xda: OPJ8("JLE"); break;
-    case 0xdb: OPJ8("JC"); break;
-    case 0xdc: OPJ8("JVT"); break;
-    case 0xdd: OPJ8("JV"); break;
-    case 0xde: OPJ8("JLT"); break;
-    case 0xdf: OPJ8("JE"); break;
-    case 0xe0: OPDJ8("DJNZ"); break;
-    case 0xe1: OPDJ8("DJNZW"); break;
-    case 0xe2: OPUNIMP("TIJMP"); break;
-    case 0xe3: sprintf(buf, "BR [%02X]", peek(1)); break;
-    case 0xe4 ... 0xe6: OP0("RESERVED"); break;
-    case 0xe7: OPJ16("LJMP"); break;
-    case 0xe8 ... 0xeb: OP0("RESERVED"); break;
-    case 0xec: OPUNIMP("DPTS"); break;
-    case 0xed: OPUNIMP("EPTS"); break;
-    case 0xee: OP0("RESERVED NOP"); break;
-    case 0xef: OPJ16("LCALL"); break;
-    case 0xf0: OP0("RET"); break;
-    case 0xf1: OP0("RESERVED"); break;
-    case 0xf2: OP0("PUSHF"); break;
-    case 0xf3: OP0("POPF"); break;
-    case 0xf4: OP0("PUSHA"); break;
-    case 0xf5: OP0("POPA"); break;
-    case 0xf6: OPUNIMP("IDLPD"); break;
-    case 0xf7: OPUNIMP("TRAP"); break;
-    case 0xf8: OP0("CLRC"); break;
-    case 0xf9: OP0("SETC"); break;
-    case 0xfa: OP0("DI"); break;
-    case 0xfb: OP0("EI"); break;
-    case 0xfc: OP0("CLRVT"); break;
-    case 0xfd: OP0("NOP"); break;
-    case 0xfe: OPUNIMP("signed multiply/divide"); break;
-    case 0xff: OP0("RST"); break;
-    default:
-      sprintf(buf, "(UNHANDLED)");
-  }
-  return buf;
+  uint8_t code[DISASM_MAX_LEN];
+  for (int i = 0; i < DISASM_MAX_LEN; i++)
+    code[i] = peek(i);
+  return disasm(code, opc);
 }
 #endif
 
 void Cpu::recordEvent(int type, int value)
 {
-  if (!recording)
+  if (!recording && (!rewind || replaying))
     return;
   
   DEBUG(EVENT, "record   %d at %llu\n", type, (unsigned long long)getCycles());
 
+  if (eventIsPolled(type)) {
+    /* only record changes */
+    if (poll_value[type] == value)
+      return;
+    poll_value[type] = value;
+  }
+
   struct Event e;
   e.cycles = getCycles();
   e.type = type;
   e.value = value;
-#ifdef EVENT_COMPRESSED
-  gzwrite(record_file, &e, sizeof(struct Event));
-#else
-  fwrite(&e, sizeof(struct Event), 1, record_file);
-#endif
+  if (rewind && !replaying)
+    rewind->logEvent(e);
+  if (recording && events->write(e))
+    metrics->events_recorded++;
+}
+
+void Cpu::resetPolledInputs()
+{
+  for (int i = 0; i < EVENT_MAX; i++)
+    poll_value[i] = -1;
+}
+
+/* reads the next event from the recording into current_event */
+bool Cpu::fetchEvent()
+{
+  if (rewinding ? rewind->readEvent(current_event) : events->read(current_event)) {
+    if (!rewinding)
+      metrics->events_replayed++;
+    return true;
+  }
+  current_event.type = EVENT_INVALID;
+  if (!rewinding && events->getEndCycles())
+    replay_end = events->getEndCycles();
+  return false;
 }
 
 struct Event Cpu::retrieveEvent(int type)
 {
   static const struct Event event_none = {0, EVENT_INVALID, 0};
+  uint64_t now = getCycles();
   
-  DEBUG(EVENT, "retrieve %d at %llu\n", type, (unsigned long long)getCycles());
-
-  // Get next event if:
-  // - we don't have one yet, or
-  // - previous event has been returned already, or
-  // - we are past the previous event, and
-  // - there is a next event to begin with
-  if ((current_event.type == EVENT_INVALID || current_event.cycles < getCycles())) {
-    if (record_file) {
-      if (!state_eof(record_file))
-#ifdef EVENT_COMPRESSED
-        gzread(record_file, &current_event, sizeof(struct Event));
-#else
-        fread(&current_event, sizeof(struct Event), 1, record_file);
-#endif
-      else
-        disableRecording();
+  DEBUG(EVENT, "retrieve %d at %llu\n", type, (unsigned long long)now);
+
+  // Advance the stream up to the current cycle:
+  // - changes of polled inputs that are due are applied,
+  // - other events we are past have been missed and are dropped,
+  // - a non-polled event for this cycle is kept for its consumer.
+  while (events || rewinding) {
+    if (current_event.type == EVENT_INVALID) {
+      if (!fetchEvent()) {
+        if (!rewinding && now >= replay_end)
+          disableRecording();
+        break;
+      }
     }
+    if (current_event.cycles > now)
+      break;
+    if (eventIsPolled(current_event.type))
+      poll_value[current_event.type] = current_event.value;
+    else if (current_event.cycles == now)
+      break;
+    else
+      DEBUG(EVENT, "dropping missed event type %d at %llu\n", current_event.type, (unsigned long long)current_event.cycles);
+    current_event.type = EVENT_INVALID;
+  }
+
+  if (eventIsPolled(type)) {
+    if (poll_value[type] < 0)
+      return event_none;
+    struct Event ret = {now, type, poll_value[type]};
+    return ret;
   }
   
-  if (type == current_event.type && getCycles() == current_event.cycles) {
+  if (type == current_event.type && now == current_event.cycles) {
     DEBUG(EVENT, "found event type %d val %d at %llu\n", current_event.type, current_event.value, (unsigned long long)current_event.cycles);
     struct Event ret = current_event;
     current_event.type = EVENT_INVALID;
@@ -690,6 +1027,61 @@ int Cpu::retrieveEventValue(int type)
   return ev.value;
 }
 
+/* Rewrites a recording in the current format. The machine state embedded
+   in the recording is loaded and saved again, so the ROM has to be
+   available. */
+bool Cpu::convertRecording(const char *from, const char *to)
+{
+  statefile_t in = state_open(from, "rb");
+  if (!in) {
+    ERROR("could not open %s for reading\n", from);
+    return false;
+  }
+  int version = EventStream::readHeader(in);
+  if (loadSaveState(in, false)) {
+    ERROR("failed to load machine state from %s\n", from);
+    state_close(in);
+    return false;
+  }
+
+  statefile_t out = state_open(to, "wb");
+  if (!out) {
+    ERROR("could not open %s for writing\n", to);
+    state_close(in);
+    return false;
+  }
+  EventStream::writeHeader(out);
+  loadSaveState(out, true);
+
+  EventStream *reader = new EventStream(in, false, version);
+  EventStream *writer = new EventStream(out, true);
+  struct Event e;
+  unsigned long count = 0;
+  uint64_t end = 0;
+  resetPolledInputs();
+  while (reader->read(e)) {
+    end = e.cycles;
+    if (eventIsPolled(e.type)) {
+      if (poll_value[e.type] == e.value)
+        continue;
+      poll_value[e.type] = e.value;
+    }
+    if (writer->write(e))
+      count++;
+  }
+  if (reader->getEndCycles())
+    end = reader->getEndCycles();
+  writer->writeEnd(end);
+  delete writer;
+  delete reader;
+
+  DEBUG(WARN, "converted %lu events from %s (version %d) to %s (version %d)\n",
+        count, from, version, to, REC_VERSION);
+  state_close(out);
+  state_close(in);
+  return true;
+}
+
 #include <sys/stat.h>
 bool Cpu::loadRom(const char *name)
 {
@@ -797,7 +1189,7 @@ start_over:
   struct stat st;
   fstat(fileno(fp), &st);
   setRomSize(st.st_size);
-  setMappedRamSize(524288);
+  setMappedRamSize(MAPPED_RAM_SIZE);
   
   DEBUG(MEM, "allocated %lld bytes for ROM image\n", (long long)st.st_size);
   /* Win32 workaround; you can't just load a whole SEVERAL MEGABYTES in ONE
@@ -885,69 +1277,502 @@ bool Cpu::loadSaveState(const char *name, bool write)
 {
   statefile_t fp;
   
-  if (write)
-    fp = state_open(name, "wb");
-  else
-    fp = state_open(name, "rb");
-  bool ret = loadSaveState(fp, write);
+  if (write) {
+    /* serializing to memory is quick; compression and writing are left to
+       a background thread, so the emulation doesn't stall */
+    fp = state_open_mem(NULL, 0);
+    bool ret = loadSaveState(fp, true);
+    state_save_file(fp, name, state_codec);
+    return ret;
+  }
+
+  fp = state_load_file(name);
+  if (!fp) {
+    ERROR("could not load state from %s\n", name);
+    return true;
+  }
+  bool ret = loadSaveState(fp, false);
   state_close(fp);
   return ret;
 }
-bool Cpu::loadSaveState(statefile_t fp, bool write)
+
+void Cpu::setStateCodec(int codec)
 {
-  /* load/save the CPU state */    
-  STATE_RW(clock);
-  STATE_RW(oclock);
-  
-  STATE_RW(pc);
-  STATE_RW(opc);
-  STATE_RW(psw);
-  STATE_RW(code_hi); STATE_RW(code_lo);
-  STATE_RW(data_hi); STATE_RW(data_lo);
-  STATE_RW(wsr);
-  STATE_RW(wsr1);
-  STATE_RW(int_mask); STATE_RW(int_mask1);
-  STATE_RW(ad_command);
-  
-  STATE_RW(cycles);
-  STATE_RW(end_cycles);
-  
-  STATE_RW(ioc0); STATE_RW(ioc1); STATE_RW(ios0); STATE_RW(ios1);
-  STATE_RW(last_ios1_read);
-  
-  STATE_RW(ioport1); STATE_RW(ioport2);
-  STATE_RW(ad_result);
-  STATE_RW(timer1_offset);
-  STATE_RW(timer2);
-  STATE_RW(timer2_inc_factor);
-  
-  /* load/save timing information */
-  STATE_RW(starttime);
-  STATE_RW(oldtime);
-  uint32_t old_nowtime = nowtime;
-  STATE_RW(nowtime);
-  /* when reading, we have to compensate for the time that has passed since
-     the state had been written */
-  if (!write) {
-    int32_t timediff = old_nowtime - nowtime;
-    starttime += timediff;
-    oldtime += timediff;
-    nowtime += timediff;
+  state_codec = codec;
+}
+
+void Cpu::setBatchReplay(const char *golden)
+{
+  frame_check = new FrameCheck(golden);
+  /* not setDeterministic(), the recording brings its own PRNG state */
+  deterministic = true;
+  fast_forward = true;
+}
+
+void Cpu::enableBenchmark()
+{
+  bench = true;
+  deterministic = true;
+  fast_forward = true;
+  io_read8 = &Cpu::benchIoRead8;
+  io_write8 = &Cpu::benchIoWrite8;
+  /* what a timer call costs, to be taken out of the I/O figure and
+     reported separately */
+  uint64_t start = os_ntime();
+  for (int i = 0; i < 1000; i++)
+    os_ntime();
+  bench_timer_cost = (os_ntime() - start) / 1000;
+}
+
+uint8_t Cpu::benchIoRead8(uint16_t addr)
+{
+  if (++bench_io_count % BENCH_IO_SAMPLE)
+    return ioRead8(addr);
+  uint64_t start = os_ntime();
+  uint8_t ret = ioRead8(addr);
+  bench_io_time += os_ntime() - start;
+  return ret;
+}
+
+void Cpu::benchIoWrite8(uint16_t addr, uint8_t value)
+{
+  if (++bench_io_count % BENCH_IO_SAMPLE) {
+    ioWrite8(addr, value);
+    return;
   }
+  uint64_t start = os_ntime();
+  ioWrite8(addr, value);
+  bench_io_time += os_ntime() - start;
+}
 
-  STATE_RW(next_sampling);
-  STATE_RW(next_lcd_update);
-  STATE_RW(next_event_pumping);
+void Cpu::benchReport()
+{
+  uint64_t elapsed = os_ntime() - bench_start;
+  /* each sample contains about one timer call and costs two */
+  uint64_t samples = bench_io_count / BENCH_IO_SAMPLE;
+  uint64_t io_time = bench_io_time > samples * bench_timer_cost ?
+                     bench_io_time - samples * bench_timer_cost : 0;
+  /* scale up to all accesses */
+  if (samples)
+    io_time = (uint64_t)((double)io_time * bench_io_count / samples);
+  /* scripts/bench.py parses this */
+  ERROR("bench: cycles %llu instructions %llu ns %llu io_ns %llu lcd_ns %llu event_ns %llu timer_ns %llu\n",
+        (unsigned long long)getCycles(), (unsigned long long)instructions,
+        (unsigned long long)elapsed, (unsigned long long)io_time,
+        (unsigned long long)bench_lcd_time, (unsigned long long)bench_event_time,
+        (unsigned long long)(samples * 2 * bench_timer_cost));
+}
 
-  STATE_RW(slowdown);
+void Cpu::enableProfiling(const char *name, uint32_t interval)
+{
+  profiler = new Profiler(name, interval);
+  if (!call_stack)
+    call_stack = new CallStack();
+  next_profile_sample = getCycles() + profiler->getInterval();
+}
 
-  /* load/save peripheral states (except EEPROM, see below) */
-  lcd->loadSaveState(fp, write);
-  serial->loadSaveState(fp, write);
-  hsi->loadSaveState(fp, write);
-  keypad->loadSaveState(fp, write);
-  ui->loadSaveState(fp, write);
+void Cpu::enableCallProfile(const char *name)
+{
+  if (!call_stack)
+    call_stack = new CallStack();
+  call_profile_name = strdup(name);
+}
+
+void Cpu::enableTrace(const char *name, uint64_t records, uint32_t trigger)
+{
+  trace = new Trace(name, records);
+  if (!trace->isOpen()) {
+    delete trace;
+    trace = NULL;
+    return;
+  }
+  trace_trigger = trigger;
+  trace_state = trigger ? TRACE_ARMED : TRACE_ON;
+}
+
+void Cpu::traceInstruction()
+{
+  if (trace_state == TRACE_ARMED) {
+    if (virtToPhys(pc, 1) != trace_trigger)
+      return;
+    DEBUG(WARN, "trace triggered at %llu cycles\n", (unsigned long long)getCycles());
+    trace_state = TRACE_ON;
+  }
+  struct TraceRecord *r = trace->next();
+  r->cycles = getCycles();
+  r->phys_pc = virtToPhys(pc, 1);
+  r->pc = pc;
+  r->sp = ram[0x18] | (ram[0x19] << 8);
+  for (int i = 0; i < DISASM_MAX_LEN; i++)
+    r->code[i] = peek(i);
+  r->psw = psw;
+  r->flags = 0;
+  r->write_addr = r->write_value = 0;
+  r->reserved = 0;
+  trace_record = r;
+}
+
+void Cpu::traceDump()
+{
+  if (!trace)
+    return;
+  ERROR("last %llu instructions traced to %s\n",
+        (unsigned long long)trace->flush(), trace->getName());
+}
+
+int Cpu::addWatch(uint32_t lo, uint32_t hi, int flags)
+{
+  int id = watches->add(lo, hi, flags);
+  watchRemap(false);
+  return id;
+}
+
+bool Cpu::watchCommand(const char *cmd)
+{
+  uint32_t lo, hi;
+  int flags;
+  /* from the GDB stub, which does not want to hear about it */
+  bool quiet = !strncmp(cmd, "gdb ", 4);
+  if (quiet)
+    cmd += 4;
+  if (!strcmp(cmd, "list")) {
+    for (int i = 0; i < watches->count(); i++) {
+      const struct Watch *w = watches->get(i);
+      ERROR("%d: %s %08X-%08X\n", w->id, Watchpoints::flagString(w->flags), w->lo, w->hi);
+    }
+  }
+  else if (!strcmp(cmd, "clear")) {
+    watches->clear();
+    watchRemap(false);
+  }
+  else if (!strncmp(cmd, "delete ", 7)) {
+    if (!watches->remove(atoi(cmd + 7)))
+      return false;
+    watchRemap(false);
+  }
+  else if (!strncmp(cmd, "remove ", 7)) {
+    if (!Watchpoints::parse(cmd + 7, &lo, &hi, &flags) || !watches->removeMatch(lo, hi, flags))
+      return false;
+    watchRemap(false);
+  }
+  else if (!strcmp(cmd, "continue")) {
+    /* only after a breakpoint, not before a ROM has been loaded */
+    if (watch_state & WATCH_STATE_BREAK)
+      resume();
+  }
+  else if (!strncmp(cmd, "search ", 7))
+    return searchCommand(cmd + 7);
+  else if (Watchpoints::parse(cmd, &lo, &hi, &flags)) {
+    int id = addWatch(lo, hi, flags);
+    if (!quiet)
+      ERROR("watchpoint %d: %s %08X-%08X\n", id, Watchpoints::flagString(flags), lo, hi);
+  }
+  else
+    return false;
+  return true;
+}
+
+bool Cpu::requestWatchCommand(const char *cmd, int timeout)
+{
+  bool ok;
+  for (;;) {
+    /* each command needs its CPU_CMD_WATCH, so both rings are filled
+       under the same lock */
+    os_lock_mutex(cmd_queue_lock);
+    ok = !watch_queue->full() && !cmd_queue->full();
+    if (ok) {
+      watch_queue->add(strdup(cmd));
+      cmd_queue->add(CPU_CMD_WATCH);
+    }
+    os_unlock_mutex(cmd_queue_lock);
+    if (ok || timeout-- <= 0)
+      break;
+    os_msleep(1);
+  }
+  if (!ok)
+    ERROR("too many watchpoint commands pending, \"%s\" dropped\n", cmd);
+  return ok;
+}
+
+/* more candidates than that are only counted, not listed or watched */
+#define SEARCH_SHOW_MAX 32
+
+/* memory search commands: "new [8|16|32]" starts over with values of the
+   given number of bits, "eq <value>", "range <lo>-<hi>", "changed",
+   "unchanged", "increased" and "decreased" narrow the candidates down,
+   "list" shows them and "watch <flags>" puts watchpoints on them */
+bool Cpu::searchCommand(const char *cmd)
+{
+  char *end;
+  if (!strncmp(cmd, "new", 3)) {
+    unsigned long bits = 8;
+    if (cmd[3] == ' ') {
+      bits = strtoul(cmd + 4, &end, 0);
+      if (*end || (bits != 8 && bits != 16 && bits != 32))
+        return false;
+    }
+    else if (cmd[3])
+      return false;
+    mem_search->reset(bits / 8);
+    ERROR("search: %u %d-bit candidates\n", mem_search->count(), (int)bits);
+    return true;
+  }
+  if (!strcmp(cmd, "list")) {
+    searchList(SEARCH_SHOW_MAX);
+    return true;
+  }
+  if (!strncmp(cmd, "watch ", 6)) {
+    const char *spec = cmd + 6;
+    int flags;
+    if (!Watchpoints::parseFlags(&spec, &flags) || *spec)
+      return false;
+    if (!mem_search->isActive() || mem_search->count() > SEARCH_SHOW_MAX) {
+      ERROR("search: narrow it down to at most %d candidates first\n", SEARCH_SHOW_MAX);
+      return true;
+    }
+    int width = mem_search->getWidth();
+    for (uint32_t pos = 0; mem_search->next(&pos); pos += width) {
+      uint32_t phys, offset;
+      const char *region = mem_search->locate(pos, &phys, &offset);
+      if (phys == (uint32_t)-1) {
+        ERROR("search: %s %05X cannot be watched\n", region, offset);
+        continue;
+      }
+      ERROR("watchpoint %d: %s %08X-%08X\n", addWatch(phys, phys + width - 1, flags),
+            Watchpoints::flagString(flags), phys, phys + width - 1);
+    }
+    return true;
+  }
+
+  int op;
+  uint32_t a = 0, b = 0;
+  if (!strncmp(cmd, "eq ", 3)) {
+    op = SEARCH_EQUAL;
+    a = strtoul(cmd + 3, &end, 0);
+    if (end == cmd + 3 || *end)
+      return false;
+  }
+  else if (!strncmp(cmd, "range ", 6)) {
+    op = SEARCH_RANGE;
+    a = strtoul(cmd + 6, &end, 0);
+    if (end == cmd + 6 || *end != '-')
+      return false;
+    const char *hi = end + 1;
+    b = strtoul(hi, &end, 0);
+    if (end == hi || *end || b < a)
+      return false;
+  }
+  else if (!strcmp(cmd, "changed"))
+    op = SEARCH_CHANGED;
+  else if (!strcmp(cmd, "unchanged"))
+    op = SEARCH_UNCHANGED;
+  else if (!strcmp(cmd, "increased"))
+    op = SEARCH_INCREASED;
+  else if (!strcmp(cmd, "decreased"))
+    op = SEARCH_DECREASED;
+  else
+    return false;
+
+  if (!mem_search->isActive()) {
+    if (op != SEARCH_EQUAL && op != SEARCH_RANGE) {
+      ERROR("search: nothing to compare with, start with \"search new\"\n");
+      return true;
+    }
+    mem_search->reset(1);
+  }
+  /* negative values are meant as two's complement */
+  uint32_t mask = 0xffffffffUL >> (32 - 8 * mem_search->getWidth());
+  if (op == SEARCH_EQUAL)
+    a &= mask;
+  else if (b > mask)
+    b = mask;
+  uint32_t left = mem_search->search(op, a, b);
+  ERROR("search: %u candidates left\n", left);
+  if (left && left <= SEARCH_SHOW_MAX / 2)
+    searchList(SEARCH_SHOW_MAX / 2);
+  return true;
+}
+
+void Cpu::searchList(int max)
+{
+  int width = mem_search->getWidth();
+  int n = 0;
+  for (uint32_t pos = 0; n < max && mem_search->next(&pos); pos += width, n++) {
+    uint32_t phys, offset;
+    const char *region = mem_search->locate(pos, &phys, &offset);
+    if (phys == (uint32_t)-1)
+      ERROR("%-6s %05X         : %0*X (was %0*X)\n", region, offset,
+            width * 2, mem_search->value(pos), width * 2, mem_search->previous(pos));
+    else
+      ERROR("%-6s %05X %08X: %0*X (was %0*X)\n", region, offset, phys,
+            width * 2, mem_search->value(pos), width * 2, mem_search->previous(pos));
+  }
+  if (mem_search->count() > (uint32_t)n)
+    ERROR("... and %u more\n", mem_search->count() - n);
+}
+
+/* updates the page flags from the list of watchpoints; on a bank switch,
+   only the 0xc000 window needs to be looked at */
+void Cpu::watchRemap(bool window_only)
+{
+  int page = window_only ? 0xc000 >> WATCH_PAGE_SHIFT : 0;
+  if (!watches->count()) {
+    memset(watch_data + page, 0, WATCH_PAGES - page);
+    memset(watch_code + page, 0, WATCH_PAGES - page);
+    return;
+  }
+  for (; page < WATCH_PAGES; page++) {
+    uint16_t addr = page << WATCH_PAGE_SHIFT;
+    uint32_t data = virtToPhys(addr, 0);
+    uint32_t code = virtToPhys(addr, 1);
+    watch_data[page] = watches->rangeFlags(data, data + (1 << WATCH_PAGE_SHIFT) - 1) & (WATCH_READ | WATCH_WRITE);
+    watch_code[page] = watches->rangeFlags(code, code + (1 << WATCH_PAGE_SHIFT) - 1) & WATCH_EXEC;
+  }
+}
+
+void Cpu::watchAccess(uint16_t addr, int type, uint8_t value)
+{
+  uint32_t phys = virtToPhys(addr, 0);
+  const struct Watch *w = watches->find(phys, type);
+  if (!w)
+    return;	/* some other address in a watched page */
+  if (type == WATCH_WRITE) {
+    uint8_t old = addr >= 0xc000 ? data_ptr[addr - 0xc000] : ram[addr];
+    ERROR("%04X/%08X: WATCH %d %04X/%08X: %02X -> %02X\n", opc, virtToPhys(opc, 1), w->id, addr, phys, old, value);
+  }
+  else
+    ERROR("%04X/%08X: WATCH %d READ %04X/%08X: %02X\n", opc, virtToPhys(opc, 1), w->id, addr, phys, value);
+  if (w->flags & WATCH_BREAK)
+    watchBreak(type == WATCH_WRITE ? STOP_WATCH_WRITE : STOP_WATCH_READ, addr);
+}
+
+/* called before each instruction on a page with breakpoints, while
+   single-stepping or after a watchpoint hit; returns true if the
+   instruction must not be executed now */
+bool Cpu::watchExec()
+{
+  if (watch_state & WATCH_STATE_BREAK)
+    return true;
+  if (watch_state & WATCH_STATE_STEP) {
+    if (!step_count) {
+      __sync_fetch_and_and(&watch_state, ~WATCH_STATE_STEP);
+      watchBreak(STOP_STEP, pc);
+      return true;
+    }
+    step_count--;
+  }
+  uint32_t phys = virtToPhys(pc, 1);
+  if (phys == watch_resume_pc) {
+    /* just continued from here */
+    watch_resume_pc = (uint32_t)-1;
+    return false;
+  }
+  const struct Watch *w = watches->find(phys, WATCH_EXEC);
+  if (!w)
+    return false;
+  ERROR("%04X/%08X: BREAKPOINT %d at %llu\n", pc, phys, w->id, (unsigned long long)getCycles());
+  if (!(w->flags & WATCH_BREAK))
+    return false;
+  watch_resume_pc = phys;
+  watchBreak(STOP_BREAKPOINT, pc);
+  return true;
+}
+
+void Cpu::watchBreak(int reason, uint16_t addr)
+{
+  stop_reason = reason;
+  stop_addr = addr;
+  __sync_fetch_and_or(&watch_state, WATCH_STATE_BREAK);
+  stop();
+}
+
+void Cpu::requestBreak()
+{
+  watchBreak(STOP_REQUEST, 0);
+}
+
+void Cpu::step()
+{
+  step_count = 1;
+  __sync_fetch_and_or(&watch_state, WATCH_STATE_STEP);
+  resume();
+}
+
+#ifdef MEMSTATS
+void Cpu::enableMemStats(const char *name)
+{
+  if (mem_stats)
+    delete mem_stats;
+  mem_stats = new MemStats(name);
+}
+#endif
+
+#ifdef FUZZ
+void Cpu::setFuzz(Fuzz *fuzz)
+{
+  this->fuzz = fuzz;
+  if (serial)
+    serial->setFuzz(fuzz);
+}
+#endif
+
+void Cpu::callStackEnter(int call_len, bool interrupt)
+{
+  uint16_t sp = ram[0x18] | (ram[0x19] << 8);
+  /* the return address is not in RAM; nothing sensible to track, and the
+     matching return will not find the frame either */
+  if (sp >= 0xc000 - 1)
+    return;
+  uint16_t ret = ram[sp] | (ram[sp + 1] << 8);
+  call_stack->call(virtToPhys(pc, 1), virtToPhys(ret - call_len, 1), sp, getCycles(), interrupt);
+}
+
+void Cpu::profileSample()
+{
+  struct ProfileFrame frames[PROFILE_MAX_DEPTH];
+  frames[0].addr = virtToPhys(pc, 1);
+  int depth = 1;
+
+  /* innermost frame first; each frame's call site is the current address
+     of the frame enclosing it */
+  int i;
+  for (i = call_stack->getDepth() - 1; i >= 0 && depth < PROFILE_MAX_DEPTH; i--) {
+    const struct CallFrame *f = call_stack->getFrame(i);
+    frames[depth - 1].func = f->func;
+    frames[depth].addr = f->site;
+    depth++;
+  }
+  /* the function at the bottom of the stack was never seen being called */
+  frames[depth - 1].func = PROFILE_UNKNOWN_FUNC;
 
+  profiler->sample(frames, depth);
+}
+void Cpu::loadSaveStateHeader(statefile_t fp, bool write)
+{
+  char magic[STATE_MAGIC_LEN];
+  if (write) {
+    state_version = STATE_VERSION;
+    state_write(fp, STATE_MAGIC, STATE_MAGIC_LEN);
+    STATE_RW(state_version);
+    state_set_sections(fp, true);
+    return;
+  }
+
+  long start = state_tell(fp);
+  if (state_read(fp, magic, STATE_MAGIC_LEN) == STATE_MAGIC_LEN &&
+      !memcmp(magic, STATE_MAGIC, STATE_MAGIC_LEN)) {
+    STATE_RW(state_version);
+  }
+  else {
+    state_seek(fp, start, SEEK_SET);
+    state_version = 0;
+  }
+  state_set_sections(fp, state_version >= 4);
+  DEBUG(EVENT, "state version %d\n", state_version);
+}
+
+bool Cpu::loadSaveRomNames(statefile_t fp, bool write)
+{
   /* load/save ROM */
   /* we only save the name(s) of the ROM(s), not the entire contents */
   /* this is a bit shitty, we need to make a copy of rom_name because
@@ -970,7 +1795,11 @@ bool Cpu::loadSaveState(statefile_t fp, bool write)
       return true;
     }
   }
-  
+  return false;
+}
+
+void Cpu::loadSaveReplay(statefile_t fp, bool write)
+{
   /* load/save event replaying state */
   
   if (!write && recording) {
@@ -990,16 +1819,127 @@ bool Cpu::loadSaveState(statefile_t fp, bool write)
   uint32_t pos = 0;
   if (write && replaying) {
     /* writing: get current position in file */
-    pos = state_tell(record_file);
+    pos = events->tell();
   }
 
   /* save/load position in the event stream */
   STATE_RW(pos);
+  if (state_version >= 2) {
+    /* the position is relative to the keyframe we started from */
+    STATE_RW(replay_offset);
+    STATE_RW(record_version);
+  }
+  else
+    replay_offset = 0;
   
   if (!write && repl) {
-    /* reading: set current position in file */
-    enableReplaying(NULL);
-    state_seek(record_file, pos, SEEK_SET);
+    /* reading: reopen the recording and continue at the saved position;
+       current_event is the last event read from the stream, so its cycle
+       count is the base for the following delta */
+    closeRecordFile();
+    int version = record_version;
+    if (openReplayFile(replay_offset)) {
+      record_version = version;
+      loadKeyframeIndex();
+      events = new EventStream(record_file, false, record_version);
+      events->seek(pos, current_event.cycles);
+      replaying = true;
+      ui->setLED(LED_PLAY, true);
+    }
+  }
+}
+
+bool Cpu::loadSaveState(statefile_t fp, bool write, bool snapshot)
+{
+  loadSaveStateHeader(fp, write);
+  /* a breakpoint skipped on resuming belongs to the old state */
+  if (!write)
+    watch_resume_pc = (uint32_t)-1;
+
+  /* load/save the CPU state */    
+  state_begin_section(fp, write, "CPU ", 1);
+  STATE_RW(clock);
+  STATE_RW(oclock);
+  
+  STATE_RW(pc);
+  STATE_RW(opc);
+  STATE_RW(psw);
+  STATE_RW(code_hi); STATE_RW(code_lo);
+  STATE_RW(data_hi); STATE_RW(data_lo);
+  STATE_RW(wsr);
+  STATE_RW(wsr1);
+  STATE_RW(int_mask); STATE_RW(int_mask1);
+  STATE_RW(ad_command);
+  
+  STATE_RW(cycles);
+  STATE_RW(end_cycles);
+  
+  STATE_RW(ioc0); STATE_RW(ioc1); STATE_RW(ios0); STATE_RW(ios1);
+  STATE_RW(last_ios1_read);
+  
+  STATE_RW(ioport1); STATE_RW(ioport2);
+  STATE_RW(ad_result);
+  STATE_RW(timer1_offset);
+  STATE_RW(timer2);
+  STATE_RW(timer2_inc_factor);
+  
+  /* load/save timing information */
+  uint32_t old_starttime = starttime;
+  uint32_t old_oldtime = oldtime;
+  uint32_t old_nowtime = nowtime;
+  if (deterministic && write) {
+    /* keep host time out of the state so it can be compared */
+    starttime = oldtime = nowtime = 0;
+  }
+  STATE_RW(starttime);
+  STATE_RW(oldtime);
+  STATE_RW(nowtime);
+  if (deterministic) {
+    starttime = old_starttime;
+    oldtime = old_oldtime;
+    nowtime = old_nowtime;
+  }
+  else if (!write) {
+    /* when reading, we have to compensate for the time that has passed
+       since the state had been written */
+    int32_t timediff = old_nowtime - nowtime;
+    starttime += timediff;
+    oldtime += timediff;
+    nowtime += timediff;
+  }
+
+  STATE_RW(next_sampling);
+  STATE_RW(next_lcd_update);
+  STATE_RW(next_event_pumping);
+
+  STATE_RW(slowdown);
+  state_end_section(fp, write);
+
+  /* load/save peripheral states (except EEPROM, see below) */
+  state_begin_section(fp, write, "LCD ", 1);
+  lcd->loadSaveState(fp, write, !snapshot);
+  state_end_section(fp, write);
+  int serial_version = state_begin_section(fp, write, "SERL", 2);
+  serial->loadSaveState(fp, write, serial_version);
+  state_end_section(fp, write);
+  state_begin_section(fp, write, "HSIO", 1);
+  hsi->loadSaveState(fp, write);
+  state_end_section(fp, write);
+  state_begin_section(fp, write, "KEYP", 1);
+  keypad->loadSaveState(fp, write);
+  state_end_section(fp, write);
+  state_begin_section(fp, write, "UI  ", 1);
+  ui->loadSaveState(fp, write);
+  state_end_section(fp, write);
+
+  if (!snapshot) {
+    state_begin_section(fp, write, "ROMS", 1);
+    if (loadSaveRomNames(fp, write))
+      return true;
+    state_end_section(fp, write);
+    state_begin_section(fp, write, "RPLY", 1);
+    loadSaveReplay(fp, write);
+    state_end_section(fp, write);
   }
   
   if (!write) {
@@ -1010,25 +1950,176 @@ bool Cpu::loadSaveState(statefile_t fp, bool write)
     ioWrite8(0x273, data_hi);
   }
   
-  /* this is all reset by loadRom(), so we do it after reloading */
-  STATE_RWBUF(ram, 0xc000);
-  STATE_RWBUF(mapped_ram, 524288);
+  if (!snapshot) {
+    /* this is all reset by loadRom(), so we do it after reloading */
+    state_begin_section(fp, write, "RAM ", 1);
+    STATE_RWBUF(ram, 0xc000);
+    STATE_RWBUF(mapped_ram, MAPPED_RAM_SIZE);
+    state_end_section(fp, write);
+  }
+  state_begin_section(fp, write, "EEPR", 1);
   eeprom->loadSaveState(fp, write);
+  state_end_section(fp, write);
+
+  if (!snapshot) {
+    if (state_version >= 1) {
+      state_begin_section(fp, write, "POLL", 1);
+      STATE_RWBUF(poll_value, sizeof(poll_value));
+      STATE_RW(replay_end);
+      state_end_section(fp, write);
+    }
+    else if (!write) {
+      /* old recordings contain every single poll */
+      resetPolledInputs();
+      replay_end = 0;
+    }
+  }
+  if (state_version >= 3) {
+    state_begin_section(fp, write, "PRNG", 1);
+    STATE_RW(prng_state);
+    STATE_RW(extint_pos);
+    state_end_section(fp, write);
+  }
 
-  resume();
-  ui->machineRunning();
+  if (state_error(fp)) {
+    ERROR("corrupt state\n");
+    return true;
+  }
+
+  if (!write) {
+    dirty.markAll();
+    /* TIMER2 is up to date, don't advance it by the cycles run since */
+    oldcycles = cycles;
+    replay_good_cycles = getCycles();
+    replay_diverged = false;
+    if (!snapshot)
+      resetRewind();
+    if (call_stack)
+      call_stack->clear();
+  }
+
+  if (!snapshot) {
+    resume();
+    ui->machineRunning();
+  }
 
   return false;
 }
 
+Snapshot *Cpu::takeSnapshot(Snapshot *base)
+{
+  /* deltas against deltas are not supported, use their base instead */
+  if (base && base->base)
+    base = base->base;
+
+  Snapshot *s = new Snapshot(base, dirty.getPageCount());
+  s->cycles = getCycles();
+
+  statefile_t fp = state_open_mem(NULL, 0);
+  loadSaveState(fp, true, true);
+  size_t len;
+  const uint8_t *data = state_mem_data(fp, &len);
+  s->state = (uint8_t *)malloc(len);
+  memcpy(s->state, data, len);
+  s->state_len = len;
+  state_close(fp);
+
+  /* the DIRTY_SNAPSHOT bits tell us what has changed since the last full
+     snapshot taken or restored; for any other base, we have to compare
+     everything */
+  bool tracked = base && base->id == snapshot_base_id;
+  for (int page = 0; page < dirty.getPageCount(); page++) {
+    uint8_t *mem = dirty.getPage(page);
+    if (!mem)
+      continue;
+    if (!base) {
+      s->addPage(page, mem);
+      dirty.clean(page, DIRTY_SNAPSHOT);
+    }
+    else if (!tracked || dirty.isDirty(page, DIRTY_SNAPSHOT)) {
+      if (memcmp(mem, base->findPage(page), DIRTY_PAGE_SIZE))
+        s->addPage(page, mem);
+    }
+  }
+
+  if (!base) {
+    s->id = next_snapshot_id++;
+    snapshot_base_id = s->id;
+  }
+  DEBUG(EVENT, "snapshot at %llu, %d pages, %d bytes\n",
+        (unsigned long long)s->cycles, s->num_pages, (int)s->getSize());
+  return s;
+}
+
+void Cpu::restoreSnapshot(Snapshot *s, bool redraw)
+{
+  /* if the full snapshot is the one the DIRTY_SNAPSHOT bits refer to, only
+     the pages marked have to be copied back; that has to be done before
+     loadSaveState() marks everything dirty */
+  Snapshot *full = s->base ? s->base : s;
+  bool tracked = full->id == snapshot_base_id;
+  for (int page = 0; page < dirty.getPageCount(); page++) {
+    uint8_t *mem = dirty.getPage(page);
+    if (!mem)
+      continue;
+    const uint8_t *data = s->findPage(page);
+    if (data)
+      memcpy(mem, data, DIRTY_PAGE_SIZE);
+    else if (!tracked || dirty.isDirty(page, DIRTY_SNAPSHOT))
+      memcpy(mem, full->findPage(page), DIRTY_PAGE_SIZE);
+  }
+
+  statefile_t fp = state_open_mem(s->state, s->state_len);
+  loadSaveState(fp, false, true);
+  state_close(fp);
+
+  /* loadSaveState() has marked everything dirty for all consumers, but
+     only the pages of an incremental snapshot differ from the full one */
+  dirty.cleanAll(DIRTY_SNAPSHOT);
+  if (s != full) {
+    for (int i = 0; i < s->num_pages; i++)
+      dirty.mark(s->page_numbers[i]);
+  }
+  snapshot_base_id = full->id;
+  if (redraw)
+    lcd->redraw();
+}
+
 void Cpu::sync(bool exact)
 {
   static uint64_t last_diff_report = 0;
+  static uint32_t metrics_time = 0;
+  static uint64_t metrics_cycles = 0;
+  static uint32_t metrics_target = 0;
   nowtime = os_mtime();
   uint32_t passedtime = nowtime - oldtime;
   uint32_t targettime = cycles * 2 * 1000 / clock;
   int32_t diff = targettime - passedtime;
 
+  metrics->host_ms = nowtime;
+  metrics->cycles = cycles;
+  if (nowtime - metrics_time >= 1000) {
+    uint32_t elapsed = nowtime - metrics_time;
+    if (metrics_time && cycles >= metrics_cycles) {
+      metrics->emulated_hz = (cycles - metrics_cycles) * 1000 * 2 / elapsed;
+      metrics->speed_permille = (uint64_t)(uint32_t)(targettime - metrics_target) * 1000 / elapsed;
+    }
+    metrics_time = nowtime;
+    metrics_cycles = cycles;
+    metrics_target = targettime;
+  }
+
+  if (deterministic || seek_target != (uint64_t)-1 || (fast_forward && replaying))
+    return;
+
+  metrics->syncs++;
+  if (diff >= 0)
+    metrics->sync_lag[0]++;
+  else {
+    int bucket = 32 - __builtin_clz(-diff);
+    metrics->sync_lag[bucket < METRICS_LAG_BUCKETS ? bucket : METRICS_LAG_BUCKETS - 1]++;
+  }
+
 #ifndef NDEBUG
   if (cycles % (1048576 * 2) < 1000) {
     ui->updateTime(diff);
@@ -1038,6 +2129,7 @@ void Cpu::sync(bool exact)
   if (diff < -50 && getCycles() - last_diff_report > 500000) {
     DEBUG(WARN, "too slow (%d) at 0x%x\n", diff, virtToPhys(pc, 1));
     last_diff_report = getCycles();
+    metrics->timing_resets++;
     resetTiming();
   }
 #if 0
@@ -1048,13 +2140,24 @@ void Cpu::sync(bool exact)
 #ifndef BENCHMARK
   if (exact && diff > 0) {
     while(os_mtime() - oldtime < targettime) {}
+    metrics->spin_ms += os_mtime() - nowtime;
   }
-  else if (diff > 5)
+  else if (diff > 5) {
     os_msleep(diff - 1);
+    metrics->sleep_ms += diff - 1;
+  }
 #endif
 }
 
 void Cpu::sendCommand(int cmd)
 {
-  cmd_queue->add(cmd);
+  /* the UI, the keypad, the GDB stub and the memory search all send
+     commands, but a Ring has room for one producer only */
+  os_lock_mutex(cmd_queue_lock);
+  bool ok = !cmd_queue->full();
+  if (ok)
+    cmd_queue->add(cmd);
+  os_unlock_mutex(cmd_queue_lock);
+  if (!ok)
+    ERROR("command queue full, command %d dropped\n", cmd);
 }
@@ -15,6 +15,17 @@
 #include "debug.h"
 #include "state.h"
 #include "ring.h"
+#include "event.h"
+#include "dirty.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "codec.h"
+#include "callstack.h"
+#include "trace.h"
+#include "memstats.h"
+#include "fuzz.h"
+#include "watch.h"
+#include "memsearch.h"
 
 #ifdef LATENCY
 #include <sys/time.h>
@@ -32,6 +43,36 @@
 #define CPU_CMD_PLAY 9
 #define CPU_CMD_STOP_RECPLAY 10
 #define CPU_CMD_LOAD_ROM 11
+#define CPU_CMD_FAST_FORWARD 12
+#define CPU_CMD_SEEK 13
+#define CPU_CMD_REWIND 14
+#define CPU_CMD_WATCH 15
+
+/* watch_state */
+#define WATCH_STATE_BREAK 1	/* stop at the next instruction boundary */
+#define WATCH_STATE_STEP 2	/* stop after step_count more instructions */
+
+/* why the emulation stopped last, see getStopReason() */
+#define STOP_NONE 0
+#define STOP_REQUEST 1
+#define STOP_BREAKPOINT 2
+#define STOP_WATCH_READ 3
+#define STOP_WATCH_WRITE 4
+#define STOP_STEP 5
+
+#define MAPPED_RAM_SIZE 524288
+
+/* interval at which state hashes are recorded, must be a multiple of the
+   event pumping interval */
+#define STATE_HASH_INTERVAL (131072 * 8)
+
+/* in benchmark mode, every this many I/O accesses one is timed */
+#define BENCH_IO_SAMPLE 64
+
+/* instruction trace states */
+#define TRACE_OFF 0
+#define TRACE_ARMED 1	/* waiting for the trigger address */
+#define TRACE_ON 2
 
 /* documented in 272238 C-52 */
 #define PSW_ST (1<<0)
@@ -43,21 +84,6 @@
 #define PSW_N (1<<6)
 #define PSW_Z (1<<7)
 
-#define EVENT_INVALID 0
-#define EVENT_KEYDOWN 1
-#define EVENT_KEYUP 2
-#define EVENT_SERIALRX 3
-#define EVENT_SERIALRXBIT 4
-#define EVENT_SERIALSTAT 5
-#define EVENT_EEPROMREAD 6
-
-// recorded event structure
-struct Event {
-  uint64_t cycles;
-  int type;
-  int value;
-};
-
 extern uint32_t debug_level;
 extern uint32_t debug_level_unabridged;
 
@@ -69,9 +95,14 @@ class Interface;
 class UI;
 class Hsio;
 class Hints;
+class FrameCheck;
+class BusLog;
+class SerialLatency;
+class Profiler;
 
 class Cpu {
 friend class Keypad;
+friend class GdbStub;
 public:
   Cpu(UI *ui);
   ~Cpu();
@@ -86,10 +117,95 @@ public:
   void enableRecording(const char *rname);
   void disableRecording();
   void enableReplaying(const char *rname);
+  /* records the serial bus traffic to a capture file for IfaceReplay */
+  bool enableBusCapture(const char *name);
+  /* measures serial request/reply latencies and writes the histograms to
+     the given file on exit (see SerialLatency) */
+  void enableSerialLatency(const char *name);
+  bool convertRecording(const char *from, const char *to);
+  void setKeyframeInterval(int seconds);
+  void setFastForward(bool on);
+  /* seeks to the given cycle count in the current replay; may only be
+     called from the emulation thread, use requestSeek() otherwise */
+  bool seekReplay(uint64_t target);
+  /* goes to the given cycle count; in a replay, this is the same as
+     seekReplay(), otherwise the rewind history is used to go back, or the
+     emulation runs unpaced to go forward; emulation thread only */
+  bool goTo(uint64_t target);
+  void requestSeek(uint64_t target);
+  /* goes back the given number of seconds of emulated time */
+  void requestRewind(int seconds);
+  /* keeps a history of snapshots of up to max_memory bytes for going
+     back in time; 0 disables it */
+  void setRewindMemory(size_t max_memory);
+  /* codec used for saving state files, see codec.h */
+  void setStateCodec(int codec);
+  /* Replays the current recording unpaced and without rendering, checks
+     the LCD frames against a golden file (see FrameCheck) and exits when
+     the recording ends. */
+  void setBatchReplay(const char *golden);
+  /* Runs unpaced until the recording being replayed ends or, if there is
+     none, until the maximum cycle count is reached, timing the I/O
+     handlers (sampled), LCD updates and event handling, then prints a
+     summary for scripts/bench.py, including the estimated cost of the
+     timer calls, and exits. */
+  void enableBenchmark();
+  /* samples the firmware call stack every "interval" cycles and writes
+     the profile to the given file on exit (see Profiler) */
+  void enableProfiling(const char *name, uint32_t interval);
+  /* keeps track of the firmware call stack and writes a table of the
+     cycles spent per function to the given file on exit */
+  void enableCallProfile(const char *name);
+  /* records the instructions executed into a ring of the given number of
+     records in a trace file (see Trace), starting when the physical PC
+     reaches "trigger", or right away if it is 0 */
+  void enableTrace(const char *name, uint64_t records, uint32_t trigger);
+#ifdef MEMSTATS
+  /* counts memory, I/O register and bank switching accesses and writes
+     them to the given file on exit (see MemStats) */
+  void enableMemStats(const char *name);
+#endif
+#ifdef FUZZ
+  /* reports coverage and crashes to the fuzzer and stops when it says so
+     (see Fuzz); NULL to run normally */
+  void setFuzz(Fuzz *fuzz);
+#endif
   
   void setSerial(Interface *iface, bool expect_echo);
   
-  void setWatchpoint(uint16_t lo, uint16_t hi);
+  /* adds a watchpoint or breakpoint on a range of physical addresses
+     (see Watchpoints); returns its ID */
+  int addWatch(uint32_t lo, uint32_t hi, int flags);
+  /* executes a watchpoint command: "<flags> <lo>[-<hi>]" to add one,
+     "delete <id>", "remove <flags> <lo>[-<hi>]", "clear", "list",
+     "continue" or "search ..." (see searchCommand()); a "gdb " prefix
+     keeps it quiet. Emulation thread only, use requestWatchCommand()
+     otherwise */
+  bool watchCommand(const char *cmd);
+  /* queues a command for watchCommand(); may be called from any thread,
+     returns false if the queue is still full after timeout ms */
+  bool requestWatchCommand(const char *cmd, int timeout = 0);
+  /* true until the emulation thread has taken the queued commands */
+  inline bool watchCommandsPending() {
+    return !watch_queue->empty();
+  }
+  /* stops the emulation at the next instruction boundary; may be called
+     from any thread */
+  void requestBreak();
+  /* while stopped, continues for one instruction and stops again */
+  void step();
+  inline bool isHalted() {
+    return halted;
+  }
+  /* incremented every time the emulation thread comes to a halt */
+  inline uint32_t getHaltCount() {
+    return halt_count;
+  }
+  /* STOP_*, and the address of the access for STOP_WATCH_* */
+  inline int getStopReason(uint16_t *addr) {
+    *addr = stop_addr;
+    return stop_reason;
+  }
   void setMaximumCycles(uint64_t max);
   void setDebugTrigger(uint32_t trigger, uint32_t level);
   
@@ -98,6 +214,21 @@ public:
 
   void setSlowDown(float factor);
 
+  /* Takes an in-memory snapshot of the machine. If base is given, only the
+     memory pages that differ from it are stored; base must be kept around
+     as long as the new snapshot is in use. */
+  Snapshot *takeSnapshot(Snapshot *base = NULL);
+  /* Only the pages written since the snapshot's base has last been taken
+     or restored are copied back. Without redraw, the LCD is left alone
+     until its next update. */
+  void restoreSnapshot(Snapshot *s, bool redraw = true);
+  /* In deterministic mode, host time does not influence the machine state,
+     and the emulation runs unpaced. */
+  void setDeterministic(uint32_t seed);
+  inline bool isDeterministic() {
+    return deterministic;
+  }
+
   void recordEvent(int type, int value);
   struct Event retrieveEvent(int type);
   int retrieveEventValue(int type);
@@ -105,9 +236,20 @@ public:
   inline uint64_t getCycles() {
     return cycles;
   }
+  inline uint64_t getInstructions() {
+    return instructions;
+  }
   inline bool isReplaying() {
     return replaying;
   }
+  /* re-executing from the rewind history */
+  inline bool isRewinding() {
+    return rewinding;
+  }
+  /* version of the state currently being loaded or saved */
+  inline int getStateVersion() {
+    return state_version;
+  }
   inline uint32_t getClock() {
     return oclock;
   }
@@ -128,6 +270,9 @@ public:
   Lcd *getLcd() {
     return lcd;
   }
+  Serial *getSerial() {
+    return serial;
+  }
 
   void stop() {
     emulation_stopped = true;
@@ -165,10 +310,9 @@ protected:
   }
   
   uint8_t memRead8Ram(uint16_t addr) {
-#ifndef NDEBUG
-  if (watchpoint_lo && watchpoint_lo <= addr && watchpoint_hi >= addr)
-    DEBUG(WARN, "%04X/%08X: WATCH READ %04X: %02X\n", opc, virtToPhys(opc, 1), addr, ram[addr]);
-#endif
+    if (unlikely(watch_data[addr >> WATCH_PAGE_SHIFT] & WATCH_READ))
+      watchAccess(addr, WATCH_READ, ram[addr]);
+    MEMSTATS_HOOK(access(MEMSTATS_READ, addr, addr));
     return ram[addr];
   }
   uint8_t memRead8Null(uint16_t addr) {
@@ -178,6 +322,9 @@ protected:
     return memRead8Bus(addr, 0);
   }
   uint8_t memRead8Mapped(uint16_t addr) {
+    if (unlikely(watch_data[addr >> WATCH_PAGE_SHIFT] & WATCH_READ))
+      watchAccess(addr, WATCH_READ, data_ptr[addr - 0xc000]);
+    MEMSTATS_HOOK(access(MEMSTATS_READ, addr, virtToPhysSlow(addr, 0)));
     return data_ptr[addr - 0xc000];
   }
   
@@ -189,8 +336,10 @@ protected:
   } 
   
   inline uint8_t fetch(void) {
-    if (pc >= 0xc000)
+    if (pc >= 0xc000) {
+      MEMSTATS_HOOK(access(MEMSTATS_FETCH, pc, virtToPhysSlow(pc, 1)));
       return code_ptr[pc++ - 0xc000];
+    }
     else
       return memRead8Bus(pc++, 1);
   }
@@ -207,10 +356,15 @@ protected:
   
   typedef void (Cpu::*memWriter)(uint16_t addr, uint8_t value);
   inline void memWrite8(uint16_t addr, uint8_t value) {
+    if (unlikely(trace_record))
+      Trace::addWrite(trace_record, addr, value);
+    MEMSTATS_HOOK(access(MEMSTATS_WRITE, addr, virtToPhys(addr, 0)));
+    if (unlikely(watch_data[addr >> WATCH_PAGE_SHIFT] & WATCH_WRITE))
+      watchAccess(addr, WATCH_WRITE, value);
     switch (addr) {
       case 0 ... 0x17:
       case 0x200 ... 0x2ff:
-        ioWrite8(addr, value);
+        (this->*io_write8)(addr, value);
         break;
       case 0x18 ... 0xff:
       case 0x2000 ... 0xbfff:
@@ -227,15 +381,15 @@ protected:
   void memWrite8Slow(uint16_t addr, uint8_t value);
   void memWrite8Mapped(uint16_t addr, uint8_t value) {
     DEBUG(MEM, "WRITE %02X -> %04X\n", value, addr);
-    data_ptr[addr - 0xc000] = value;
+    uint8_t *p = &data_ptr[addr - 0xc000];
+    *p = value;
+    if (p >= mapped_ram && p < mapped_ram + MAPPED_RAM_SIZE)
+      dirty.markAddr(mapped_ram_page, p - mapped_ram);
   }
   void memWrite8Ram(uint16_t addr, uint8_t value) {
     DEBUG(MEM, "WRITE %02X -> %04X\n", value, addr);
-#ifndef NDEBUG
-    if (watchpoint_lo && addr >= watchpoint_lo && addr <= watchpoint_hi)
-      DEBUG(WARN, "%04X/%08X: WATCH %04X: %02X -> %02X\n", opc, virtToPhys(opc, 1), addr, memRead8(addr), value);
-#endif
     ram[addr] = value;
+    dirty.mark(addr >> DIRTY_PAGE_SHIFT);
   }
   
   inline void memWrite16(uint16_t addr, uint16_t value) {
@@ -275,6 +429,33 @@ protected:
   }
 
   uint32_t virtToPhysSlow(uint16_t addr, int fetch);
+  /* physical address of addr (0xc000 and up) with the given mapping,
+     (uint32_t)-1 if that mapping is not implemented */
+  uint32_t bankToPhys(uint8_t map_hi, uint8_t map_lo, uint16_t addr);
+  void profileSample();
+  void watchRemap(bool window_only);
+  void watchAccess(uint16_t addr, int type, uint8_t value);
+  bool watchExec();
+  void watchBreak(int reason, uint16_t addr);
+  bool searchCommand(const char *cmd);
+  void searchList(int max);
+
+  /* shadow call stack bookkeeping, see CallStack; traceCall() goes after
+     pushing the return address and jumping to the target, with the length
+     of the call instruction (0 for interrupts), traceReturn() before
+     popping the return address */
+  inline void traceCall(int call_len, bool interrupt) {
+    if (call_stack)
+      callStackEnter(call_len, interrupt);
+  }
+  inline void traceReturn() {
+    if (call_stack)
+      call_stack->ret(ram[0x18] | (ram[0x19] << 8), getCycles());
+  }
+  void callStackEnter(int call_len, bool interrupt);
+  void traceInstruction();
+  /* makes sure the trace is on disk after something went wrong */
+  void traceDump();
   
   inline void cycle(int c) {
     cycles += c;
@@ -303,12 +484,31 @@ private:
   }
   
   bool loadSaveState(const char *name, bool write);
-  bool loadSaveState(statefile_t fp, bool write);
+  /* in snapshot mode, the ROM, the replay state and the memories tracked by
+     DirtyPages are left out */
+  bool loadSaveState(statefile_t fp, bool write, bool snapshot = false);
+
+  bool loadSaveRomNames(statefile_t fp, bool write);
+  void loadSaveReplay(statefile_t fp, bool write);
+  bool openReplayFile(uint64_t offset = 0);
+  bool loadKeyframeIndex();
+  bool loadKeyframe(int k);
+  void writeKeyframe();
+  void finishRecording();
+  void seekDone();
+  void takeRewindSnapshot();
+  void endRewind();
+  void resetRewind();
+  uint32_t stateHash();
+  void checkStateHash();
+  void resetPolledInputs();
+  bool fetchEvent();
+  void loadSaveStateHeader(statefile_t fp, bool write);
+  void closeRecordFile();
   
   uint32_t clock, oclock;
   
 #ifndef NDEBUG
-  uint16_t watchpoint_lo, watchpoint_hi;
   uint32_t trigger;
   uint32_t trigger_level;
   uint8_t *mem_profile;
@@ -332,7 +532,18 @@ private:
   bool do_latency;
 #endif
   uint8_t *mapped_ram;
+  /* write tracking for ram (starting at page 0), mapped_ram and LCD */
+  DirtyPages dirty;
+  int mapped_ram_page;
+  /* full snapshot the DIRTY_SNAPSHOT bits refer to */
+  uint32_t snapshot_base_id;
+  uint32_t next_snapshot_id;
+  /* last cycle count at which the replay was known to be in sync */
+  uint64_t replay_good_cycles;
+  bool replay_diverged;
   const uint8_t *code_ptr;
+  /* physical address of the code window at 0xc000 */
+  uint32_t code_phys;
   uint8_t *data_ptr;
   uint16_t pc;
   uint16_t opc; /* PC at start of insn */
@@ -347,6 +558,8 @@ private:
 
   uint64_t cycles;
   uint64_t end_cycles;
+  /* executed so far, for performance statistics */
+  uint64_t instructions;
   
   uint8_t ioc0, ioc1, ios0, ios1;
   uint16_t last_ios1_read;
@@ -358,6 +571,18 @@ private:
   uint32_t timer2;
   int32_t timer2_inc_factor;
 
+  /* xorshift32; used for I/O registers we don't know how to emulate, the
+     state is saved so that replays return the same values */
+  inline uint32_t prng() {
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 17;
+    prng_state ^= prng_state << 5;
+    return prng_state;
+  }
+  uint32_t prng_state;
+  int extint_pos;
+  bool deterministic;
+
   Eeprom* eeprom;
   
   uint32_t starttime;
@@ -381,7 +606,90 @@ private:
   bool recording, replaying;
   char *record_file_name;
   statefile_t record_file;
+  int record_version;
+  EventStream *events;
   struct Event current_event;
+  /* last recorded or replayed value of each polled input, -1 if unknown */
+  int poll_value[EVENT_MAX];
+  /* cycle count at which the recording ends, 0 if unknown */
+  uint64_t replay_end;
+  /* raw file offset the replay file has been opened at */
+  uint64_t replay_offset;
+
+  /* keyframes for seeking in recordings */
+  struct Keyframe *keyframes;
+  int num_keyframes;
+  int keyframes_size;
+  int keyframe_seconds;
+  uint64_t next_keyframe;
+  /* replay unpaced */
+  bool fast_forward;
+  /* cycle count we are fast-forwarding to, -1 if none */
+  uint64_t seek_target;
+  uint64_t seek_request;
+
+  /* history for going back in time, NULL if disabled */
+  Rewind *rewind;
+  bool rewinding;
+  uint64_t next_rewind_snapshot;
+  int rewind_request;
+
+  int state_version;
+  int state_codec;
+  FrameCheck *frame_check;
+  /* benchmark mode, see enableBenchmark(); times in nanoseconds. Only
+     every BENCH_IO_SAMPLE-th I/O access is timed, so that the timer
+     calls do not swamp what is being measured. */
+  bool bench;
+  bool bench_replay;
+  uint64_t bench_start;
+  uint64_t bench_io_time, bench_lcd_time, bench_event_time;
+  uint64_t bench_io_count;
+  uint64_t bench_timer_cost;	/* of one os_ntime() call */
+  /* ioRead8()/ioWrite8(), or the timing wrappers in benchmark mode;
+     dispatched through these so normal runs do not test for it */
+  memReader io_read8;
+  memWriter io_write8;
+  uint8_t benchIoRead8(uint16_t addr);
+  void benchIoWrite8(uint16_t addr, uint8_t value);
+  void benchReport();
+  BusLog *bus_log;
+  SerialLatency *serial_latency;
+  Profiler *profiler;
+  CallStack *call_stack;
+  char *call_profile_name;
+  Trace *trace;
+  /* record of the instruction being executed, NULL if not tracing */
+  struct TraceRecord *trace_record;
+  int trace_state;
+  uint32_t trace_trigger;
+  uint64_t next_profile_sample;
+
+  Watchpoints *watches;
+  /* WATCH_* flags of the watchpoints on each virtual page, for data
+     accesses and for instructions; for 0xc000 and up, they depend on the
+     mapping and are updated by watchRemap() */
+  uint8_t watch_data[WATCH_PAGES];
+  uint8_t watch_code[WATCH_PAGES];
+  /* WATCH_STATE_*, tested along with watch_code[] before every
+     instruction */
+  volatile uint8_t watch_state;
+  int step_count;
+  int stop_reason;
+  uint16_t stop_addr;
+  /* the emulation thread is parked in the stopped loop */
+  volatile bool halted;
+  volatile uint32_t halt_count;
+  /* physical PC of the last breakpoint, not to be hit again right away */
+  uint32_t watch_resume_pc;
+  Ring<char *> *watch_queue;
+  MemSearch *mem_search;
+#ifdef MEMSTATS
+  MemStats *mem_stats;
+#endif
+#ifdef FUZZ
+  Fuzz *fuzz;
+#endif
   
   uint32_t rom_size;
   uint32_t exrom_size;
@@ -389,6 +697,7 @@ private:
   char *exrom_name;
 
   Ring<int> *cmd_queue;
+  void *cmd_queue_lock;		/* serializes the producers of both queues */
   bool emulation_stopped;
 };
 
@@ -10,11 +10,14 @@
 
 #include "cpu.h"
 #include "os.h"
+#include <string.h>
 #include "ui.h"
 #include "lcd.h"
 #include "keypad.h"
 #include "hsio.h"
 #include "eeprom.h"
+#include "framecheck.h"
+#include "profiler.h"
 
 int Cpu::emulate(void)
 {
@@ -48,6 +51,12 @@ int Cpu::emulate(void)
     resume();
     ui->machineRunning();
   }
+  if (frame_check)
+    frame_check->start();
+  if (bench) {
+    bench_replay = replaying;
+    bench_start = os_ntime();
+  }
 
 #ifndef NDEBUG
   int abridging = 0;
@@ -63,15 +72,29 @@ int Cpu::emulate(void)
       next_sampling += 65536;
       sync(false);
     }
+
+    if (cycles >= next_profile_sample) {
+      next_profile_sample = cycles + profiler->getInterval();
+      profileSample();
+    }
+
+    if (cycles >= seek_target)
+      seekDone();
     
 #if !defined(NDEBUG) || defined(BENCHMARK)
-    if (getCycles() > end_cycles) {
+    if (getCycles() > end_cycles && !bench) {
       DEBUG(WARN, "maximum cycles exceeded\n");
+#ifndef BENCHMARK
       dumpMem();
+#endif
       ERROR("%llu state times in %u ms, %llu Hz\n", (unsigned long long)getCycles(), nowtime - starttime, (unsigned long long)getCycles() * 1000 * 2 / (nowtime - starttime));
       return 0;
     }
 #endif
+#ifdef FUZZ
+    if (unlikely(fuzz != NULL) && fuzz->finished(getCycles()))
+      return 0;
+#endif
     
     if ((int_mask & (1 << 5)) && (psw & PSW_INTE)) {
       for (int i = 0; i < 4; i++) {
@@ -88,13 +111,27 @@ int Cpu::emulate(void)
           ios1 |= 1 << i;
           push16(pc);
           pc = memRead16(0x200a);
+          traceCall(0, true);
           /* XXX: cycles? */
         }
       }
     }
     
     if (cycles >= next_lcd_update) {
-      lcd->update();
+      if (frame_check)
+        frame_check->frame(getCycles(), lcd->frameHash());
+      else if (unlikely(bench)) {
+        uint64_t start = os_ntime();
+        lcd->update();
+        bench_lcd_time += os_ntime() - start;
+      }
+#ifdef FUZZ
+      else if (fuzz) {
+        /* nobody is watching */
+      }
+#endif
+      else
+        lcd->update();
 #ifdef BENCHMARK
       next_lcd_update += 52428800;
 #else
@@ -102,7 +139,8 @@ int Cpu::emulate(void)
 #endif
     }
       
-    if (cycles >= next_event_pumping) {
+    if (cycles >= next_event_pumping || unlikely(watch_state & WATCH_STATE_BREAK)) {
+      uint64_t event_start = bench ? os_ntime() : 0;
       bool remember_to_reset_machine_state_in_ui = false;
       if (emulation_stopped) {
         ui->machineStopped();
@@ -117,6 +155,7 @@ int Cpu::emulate(void)
           switch (cmd) {
             case CPU_CMD_EXIT:
               DEBUG(KEY, "exiting by user request\n");
+              state_save_wait();
 #ifndef NDEBUG
               dumpMem();
 #endif
@@ -173,25 +212,75 @@ int Cpu::emulate(void)
             case CPU_CMD_LOAD_ROM:
               ui->loadRom();
               break;
+            case CPU_CMD_FAST_FORWARD:
+              setFastForward(!fast_forward);
+              break;
+            case CPU_CMD_SEEK:
+              goTo(seek_request);
+              break;
+            case CPU_CMD_REWIND: {
+                uint64_t back = (uint64_t)rewind_request * oclock / 2;
+                goTo(getCycles() > back ? getCycles() - back : 0);
+                break;
+              }
+            case CPU_CMD_WATCH: {
+                char *watch_cmd = watch_queue->consume();
+                if (!watchCommand(watch_cmd) && strncmp(watch_cmd, "gdb ", 4))
+                  ui->showWarning("Invalid watchpoint command \"%s\"", watch_cmd);
+                free(watch_cmd);
+                break;
+              }
             default:
               break;
           }
         }
-        if (emulation_stopped)
-          os_msleep(100);
+        if (emulation_stopped) {
+          if (!halted) {
+            halted = true;
+            halt_count++;
+          }
+          /* a debugger may be waiting for us */
+          os_msleep(watch_state & WATCH_STATE_BREAK ? 1 : 100);
+        }
       } while (emulation_stopped);
+      halted = false;
       if (remember_to_reset_machine_state_in_ui)
         ui->machineRunning();
+      if (watch_state & WATCH_STATE_BREAK) {
+        __sync_fetch_and_and(&watch_state, ~WATCH_STATE_BREAK);
+        /* stopped in between event pumpings */
+        if (cycles < next_event_pumping)
+          continue;
+      }
+      if ((recording || replaying || rewind) && next_event_pumping % STATE_HASH_INTERVAL == 0)
+        checkStateHash();
+      /* states saved here are restored by the commands above, so they
+         have to be taken before next_event_pumping is advanced */
+      if (recording && cycles >= next_keyframe)
+        writeKeyframe();
+      if (rewind && !replaying && cycles >= next_rewind_snapshot)
+        takeRewindSnapshot();
       next_event_pumping += 131072;
+      if (frame_check && !replaying) {
+        int ret = frame_check->finish(getCycles(), instructions, replay_diverged);
+        ui->quit();
+        return ret;
+      }
+      if (unlikely(bench)) {
+        bench_event_time += os_ntime() - event_start;
+        if (bench_replay ? !replaying : getCycles() > end_cycles) {
+          benchReport();
+          ui->quit();
+          return 0;
+        }
+      }
     }
     
 #ifdef NDEBUG
     for (int i = 10; i; i--) {
 #endif
 
-#if !defined(NDEBUG) || defined(LATENCY)
     opc = pc;
-#endif
 #ifndef NDEBUG
 
     if (virtToPhys(pc, 1) == trigger)
@@ -233,6 +322,12 @@ int Cpu::emulate(void)
       gettimeofday(&tv, NULL);
     }
 #endif
+    FUZZ_HOOK(cover(pc < 0xc000 ? pc : code_phys + (pc - 0xc000)));
+    if (unlikely(watch_code[pc >> WATCH_PAGE_SHIFT] | watch_state) && watchExec())
+      continue;
+    if (trace_state)
+      traceInstruction();
+    instructions++;
     opcode = fetch();
 #ifndef NDEBUG
     debug_level = old_debug_level;
@@ -577,6 +672,13 @@ int Cpu::emulate(void)
         rel16 = ((int16_t)((fetch() | ((opcode & 0x7) << 8)) << 5)) >> 5;
         target = pc + rel16;
         if (target == pc - 2) {
+#ifdef FUZZ
+          if (fuzz) {
+            /* no need to wait for the budget to run out */
+            fuzz->crash(FUZZ_HANG, virtToPhys(pc - 2, 1));
+            break;
+          }
+#endif
           ERROR("ENDLESS LOOP at %04X (%08X) at %lld cycles!\n", pc - 2, virtToPhys(pc - 2, 1), (long long)cycles);
           ui->showWarning("Endless loop, resetting.");
           DEBUG(WARN, "resetting\n");
@@ -592,6 +694,7 @@ int Cpu::emulate(void)
         target = pc + rel16;
         push16(pc);
         pc = target;
+        traceCall(2, false);
         cycle(11);
         break;
       case 0x30 ... 0x37: /* jbc rel8 */
@@ -1849,9 +1952,11 @@ set_psw_sub8:
         DEBUG(OP, "LCALL %04X\n", target);
         push16(pc);
         pc = target;
+        traceCall(3, false);
         cycle(13);
         break;
       case 0xf0: /* ret */
+        traceReturn();
         pc = pop16();
         cycle(14);
         break;
@@ -1933,14 +2038,26 @@ set_psw_sub8:
             /* XXX overflow? */
             break;
           default:
+#ifdef FUZZ
+            if (fuzz)
+              goto illegal;
+#endif
             ERROR("ILLEGAL OPCODE %02X %02X at %04X (%08X)\n", opcode, eopcode, opc, virtToPhys(opc, 1));
             goto illegal_out;
         };
         break;
       default:
 illegal:
+#ifdef FUZZ
+        if (fuzz) {
+          /* expected every now and then, no need to make a fuss */
+          fuzz->crash(FUZZ_ILLEGAL_OPCODE, virtToPhys(opc, 1));
+          break;
+        }
+#endif
         ERROR("ILLEGAL OPCODE %02X at %04X (%08X)\n", opcode, opc, virtToPhys(opc, 1));
 illegal_out:
+        traceDump();
 #ifdef NDEBUG
         char iop[40];
         sprintf(iop, "Illegal opcode %02X at %04X", opcode, opc);
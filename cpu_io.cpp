@@ -24,7 +24,6 @@
 #endif  
 
 const uint8_t extint_queue[8] = {0, 0xf1, 0xf7, 0x01, 0x42, 0, 0, 0};
-static int extint_pos = 0;
 
 static uint8_t printable_char(uint8_t c)
 {
@@ -40,6 +39,7 @@ uint8_t Cpu::ioRead8(uint16_t addr)
 #ifndef NDEBUG
   const char* reg;
 #endif
+  MEMSTATS_HOOK(io(MEMSTATS_READ, addr, wsr));
 
   switch(addr) {
     case 0x02:  /* AD_RESULT (LO, 0) AD_COMMAND (15) */
@@ -289,11 +289,11 @@ uint8_t Cpu::ioRead8(uint16_t addr)
       break;
     case 0x236:
       REG("IO236");
-      ret = (rand() % 0xff) & 0xef; //| 0x10;
+      ret = (prng() % 0xff) & 0xef; //| 0x10;
       break;
     case 0x201:
       REG("IO201");
-      ret = (rand() % 0xff) | 0x08;
+      ret = (prng() % 0xff) | 0x08;
       break;
     case 0x240:
       REG("IO240");
@@ -345,6 +345,9 @@ void Cpu::ioWrite8(uint16_t addr, uint8_t value)
 #ifndef NDEBUG
   const char *reg;
 #endif
+  MEMSTATS_HOOK(io(MEMSTATS_WRITE, addr, wsr));
+  /* some I/O registers are backed by ram */
+  dirty.mark(addr >> DIRTY_PAGE_SHIFT);
   switch (addr) {
     case 0x00:
     case 0x01:
@@ -731,16 +734,25 @@ void Cpu::ioWrite8(uint16_t addr, uint8_t value)
       hints->beep();
       break;
     case 0x270:
+      MEMSTATS_HOOK(bank(code_hi, value, data_hi, data_lo, value != code_lo));
       code_lo = value;
-      code_ptr = &rom[virtToPhysSlow(0xc000, 1)];
+      code_phys = virtToPhysSlow(0xc000, 1);
+      code_ptr = &rom[code_phys];
+      if (watches->count())
+        watchRemap(true);
       return; /* well understood, no debug output */
     case 0x271:
       REG("CODEMAP_HI");
+      MEMSTATS_HOOK(bank(value, code_lo, data_hi, data_lo, value != code_hi));
       code_hi = value;
-      code_ptr = &rom[virtToPhysSlow(0xc000, 1)];
+      code_phys = virtToPhysSlow(0xc000, 1);
+      code_ptr = &rom[code_phys];
+      if (watches->count())
+        watchRemap(true);
       break;
     case 0x272:
       REG("DATAMAP_LO");
+      MEMSTATS_HOOK(bank(code_hi, code_lo, data_hi, value, value != data_lo));
       data_lo = value;
       {
         uint32_t phys = virtToPhysSlow(0xc000, 0);
@@ -756,6 +768,8 @@ void Cpu::ioWrite8(uint16_t addr, uint8_t value)
           data_ptr = (uint8_t *)rom;
         }
       }
+      if (watches->count())
+        watchRemap(true);
 #if 0
       if (value == 0x9a) {
         debug_level |= DEBUG_TRACE|DEBUG_OP|DEBUG_MEM;
@@ -765,6 +779,7 @@ void Cpu::ioWrite8(uint16_t addr, uint8_t value)
       break;
     case 0x273:
       REG("DATAMAP_HI");
+      MEMSTATS_HOOK(bank(code_hi, code_lo, value, data_lo, value != data_hi));
       data_hi = value;
       {
         uint32_t phys = virtToPhysSlow(0xc000, 0);
@@ -775,6 +790,8 @@ void Cpu::ioWrite8(uint16_t addr, uint8_t value)
         else
           data_ptr = (uint8_t *)&rom[phys];
       }
+      if (watches->count())
+        watchRemap(true);
       break;
     case 0x200:
     case 0x201:
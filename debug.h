@@ -39,6 +39,10 @@ extern FILE *win_stderr;
 
 #ifdef NDEBUG
 #define DEBUG(level, bla...) do {} while(0)
+#elif defined(ASYNC_LOG)
+#include "log.h"
+#define DEBUG(level, bla...) \
+  do { if (unlikely(debug_level & DEBUG_ ##level)) log_write(bla); } while(0)
 #else
 #ifdef __MINGW32__
 #define DEBUG(level, bla...) \
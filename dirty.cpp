@@ -0,0 +1,126 @@
+/*
+ * dirty.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "dirty.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+DirtyPages::DirtyPages()
+{
+  num_regions = 0;
+  num_pages = 0;
+  flags = NULL;
+  page_hash = NULL;
+  total_hash = 0;
+}
+
+DirtyPages::~DirtyPages()
+{
+  free(flags);
+  free(page_hash);
+}
+
+int DirtyPages::addRegion(uint8_t *mem, uint32_t size)
+{
+  if (num_regions == DIRTY_MAX_REGIONS) {
+    ERROR("too many dirty page regions\n");
+    exit(1);
+  }
+  Region *r = &regions[num_regions++];
+  r->mem = mem;
+  r->base = num_pages;
+  r->pages = (size + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+  num_pages += r->pages;
+
+  flags = (uint8_t *)realloc(flags, num_pages);
+  memset(flags + r->base, DIRTY_ALL, r->pages);
+  page_hash = (uint64_t *)realloc(page_hash, num_pages * sizeof(uint64_t));
+  memset(page_hash + r->base, 0, r->pages * sizeof(uint64_t));
+  return r->base;
+}
+
+void DirtyPages::moveRegion(int base, uint8_t *mem)
+{
+  for (int i = 0; i < num_regions; i++) {
+    if (regions[i].base == base) {
+      regions[i].mem = mem;
+      memset(flags + base, DIRTY_ALL, regions[i].pages);
+      return;
+    }
+  }
+}
+
+void DirtyPages::markAll()
+{
+  memset(flags, DIRTY_ALL, num_pages);
+}
+
+void DirtyPages::cleanAll(uint8_t consumer)
+{
+  for (int page = 0; page < num_pages; page++)
+    flags[page] &= ~consumer;
+}
+
+uint8_t *DirtyPages::getPage(int page)
+{
+  for (int i = num_regions - 1; i >= 0; i--) {
+    if (page >= regions[i].base) {
+      if (!regions[i].mem)
+        return NULL;
+      return regions[i].mem + ((page - regions[i].base) << DIRTY_PAGE_SHIFT);
+    }
+  }
+  return NULL;
+}
+
+/* not cryptographic, just fast; the memories are word-aligned and a
+   multiple of 4 bytes in size */
+uint64_t DirtyPages::hashBuffer(const void *buf, uint32_t len, uint64_t h)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+  for (uint32_t i = 0; i + 4 <= len; i += 4) {
+    uint32_t w;
+    memcpy(&w, p + i, 4);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (uint32_t i = len & ~3; i < len; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+/* spreads a page hash so that summing them up doesn't cancel out */
+static inline uint64_t mix(uint64_t h, int page)
+{
+  h ^= (uint64_t)page * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t DirtyPages::hash()
+{
+  for (int i = 0; i < num_regions; i++) {
+    Region *r = &regions[i];
+    if (!r->mem)
+      continue;
+    for (int page = r->base; page < r->base + r->pages; page++) {
+      if (!(flags[page] & DIRTY_HASH))
+        continue;
+      flags[page] &= ~DIRTY_HASH;
+      uint64_t h = hashBuffer(r->mem + ((page - r->base) << DIRTY_PAGE_SHIFT),
+                              DIRTY_PAGE_SIZE, 0xcbf29ce484222325ULL);
+      total_hash += mix(h, page) - mix(page_hash[page], page);
+      page_hash[page] = h;
+    }
+  }
+  return total_hash;
+}
@@ -0,0 +1,85 @@
+/*
+ * dirty.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _DIRTY_H
+#define _DIRTY_H
+
+#include <stdint.h>
+
+/* Page-granular write tracking for the emulated memories (RAM, mapped RAM,
+   LCD memory). All regions are numbered consecutively in one page space.
+   Every page has a byte of flags, one bit per consumer; a write sets all of
+   them, and each consumer clears its own bit once it has dealt with the
+   page. That way, a write costs a single store no matter how many
+   consumers there are. */
+
+#define DIRTY_PAGE_SHIFT 8
+#define DIRTY_PAGE_SIZE (1 << DIRTY_PAGE_SHIFT)
+#define DIRTY_MAX_REGIONS 4
+
+/* consumers */
+#define DIRTY_HASH (1 << 0)
+#define DIRTY_SNAPSHOT (1 << 1)
+#define DIRTY_SEARCH (1 << 2)
+#define DIRTY_ALL 0xff
+
+class DirtyPages {
+public:
+  DirtyPages();
+  ~DirtyPages();
+
+  /* registers a memory region, returns the number of its first page */
+  int addRegion(uint8_t *mem, uint32_t size);
+  /* memory of a region has been reallocated */
+  void moveRegion(int base, uint8_t *mem);
+
+  inline void mark(int page) {
+    flags[page] = DIRTY_ALL;
+  }
+  inline void markAddr(int base, uint32_t offset) {
+    flags[base + (offset >> DIRTY_PAGE_SHIFT)] = DIRTY_ALL;
+  }
+  void markAll();
+
+  inline bool isDirty(int page, uint8_t consumer) {
+    return flags[page] & consumer;
+  }
+  inline void clean(int page, uint8_t consumer) {
+    flags[page] &= ~consumer;
+  }
+  void cleanAll(uint8_t consumer);
+
+  int getPageCount() {
+    return num_pages;
+  }
+  uint8_t *getPage(int page);
+
+  /* returns a hash over all pages, rehashing only those that have changed
+     since the last call */
+  uint64_t hash();
+
+  static uint64_t hashBuffer(const void *buf, uint32_t len, uint64_t h);
+
+private:
+  struct Region {
+    uint8_t *mem;
+    int base;
+    int pages;
+  } regions[DIRTY_MAX_REGIONS];
+  int num_regions;
+
+  uint8_t *flags;
+  int num_pages;
+
+  uint64_t *page_hash;
+  uint64_t total_hash;
+};
+
+#endif
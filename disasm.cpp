@@ -0,0 +1,296 @@
+/*
+ * disasm.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "disasm.h"
+#include <stdio.h>
+#include <string.h>
+
+#define peek(n) (code[n])
+#define peek16(n) ((uint16_t)(code[n] | (code[(n) + 1] << 8)))
+
+static char buf[80];
+const char *disasm(const uint8_t *code, uint16_t opc, int *len)
+{
+  uint8_t opcode = peek(0);
+  int l = 1;
+
+#define OPUNIMP(x) sprintf(buf, x " undecoded");
+
+#define OP0(x) sprintf(buf, x);
+#define OP1(x) sprintf(buf, x " %02Xh", peek(1)); l = 2;
+#define OP1IM(x) sprintf(buf, x " #%04Xh", peek16(1)); l = 3;
+#define OP1IN(x) sprintf(buf, x " [%02Xh]%s", peek(1) & 0xfe, (peek(1) & 1) ? "+" : ""); l = 2;
+#define OP1IX(x) \
+  if (peek(1) & 1) \
+    sprintf(buf, x " %04Xh[%02Xh]", peek16(2), peek(1) & 0xfe); \
+  else \
+    sprintf(buf, x " %02Xh[%02Xh]", peek(2), peek(1)); \
+  l = (peek(1) & 1) ? 4 : 3;
+
+#define OP2D(x) sprintf(buf, x " %02Xh, %02Xh", peek(2), peek(1)); l = 3;
+
+#define OP2IM(x, byte) \
+  if (byte) \
+    sprintf(buf, x " %02Xh, #%02Xh", peek(2), peek(1)); \
+  else \
+    sprintf(buf, x " %02Xh, #%04Xh", peek(3), peek16(1)); \
+  l = (byte) ? 3 : 4;
+
+#define OP2IX(x) \
+  if (peek(1) & 1) \
+    sprintf(buf, x " %02Xh, %04Xh[%02Xh]", peek(4), peek16(2), peek(1) & 0xfe); \
+  else \
+    sprintf(buf, x " %02Xh, %02Xh[%02Xh]", peek(3), peek(2), peek(1)); \
+  l = (peek(1) & 1) ? 5 : 4;
+
+#define OP2SH(x) \
+  if (peek(1) > 15) \
+    sprintf(buf, x " %02Xh, #%02Xh", peek(2), peek(1)); \
+  else \
+    sprintf(buf, x " %02Xh, %02Xh", peek(2), peek(1)); \
+  l = 3;
+
+#define OPJ8(x) sprintf(buf, x " %04Xh (%02Xh)", opc + (int8_t)peek(1) + 2, peek(1)); l = 2;
+#define OPJ16(x) sprintf(buf, x " %04Xh (%04Xh)", (uint16_t)(opc + (int16_t)peek16(1) + 3), peek16(1)); l = 3;
+#define OPDJ8(x) sprintf(buf, x " %02Xh, %04Xh (%02Xh)", peek(1), opc + (int8_t)peek(2) + 3, peek(2)); l = 3;
+
+#define OPJ11(x) \
+        sprintf(buf, x " %04Xh", opc + (((int16_t)((peek(1) | ((peek(0) & 0x7) << 8)) << 5)) >> 5) + 2); l = 2;
+
+#define OPJBIT(x) \
+        sprintf(buf, x " %02Xh, %u, %04Xh", peek(1), opcode & 7, opc + (int8_t)peek(2) + 3); l = 3;
+
+#define OP3E(x, byte) \
+  switch (peek(0) & 3) { \
+    case 0: \
+      sprintf(buf, x " %02Xh, %02Xh, %02Xh", peek(3), peek(2), peek(1)); \
+      l = 4; \
+      break; \
+    case 1: \
+      if (byte) \
+        sprintf(buf, x " %02Xh, %02Xh, #%02Xh", peek(3), peek(2), peek(1)); \
+      else \
+        sprintf(buf, x " %02Xh, %02Xh, #%04Xh", peek(4), peek(3), peek16(1)); \
+      l = (byte) ? 4 : 5; \
+      break; \
+    case 2: \
+      sprintf(buf, x " %02Xh, %02Xh, [%02Xh]%s", peek(3), peek(2), peek(1) & 0xfe, (peek(1) & 1) ? "+" : ""); \
+      l = 4; \
+      break; \
+    case 3: \
+      if (peek(1) & 1) \
+        sprintf(buf, x " %02Xh, %02Xh, %04Xh[%02Xh]", peek(5), peek(4), peek16(2), peek(1) & 0xfe); \
+      else \
+        sprintf(buf, x " %02Xh, %02Xh, %02Xh[%02Xh]", peek(4), peek(3), peek(2), peek(1)); \
+      l = (peek(1) & 1) ? 6 : 5; \
+      break; \
+  }
+#define OP3(x) OP3E(x, 0)
+#define OP3B(x) OP3E(x, 1)
+
+#define OP2E(x, byte) \
+  switch (peek(0) & 3) { \
+    case 0: \
+      OP2D(x); \
+      break; \
+    case 1: \
+      OP2IM(x, byte); \
+      break; \
+    case 2: \
+      sprintf(buf, x " %02Xh, [%02Xh]%s", peek(2), peek(1) & 0xfe, (peek(1) & 1) ? "+" : ""); \
+      l = 3; \
+      break; \
+    case 3: \
+      OP2IX(x); \
+      break; \
+  }
+
+#define OP2(x) OP2E(x, 0)
+#define OP2B(x) OP2E(x, 1)
+
+  switch (opcode) {
+    case 0x00: OP1("SKIP"); break;
+    case 0x01: OP1("CLR"); break;
+    case 0x02: OP1("NOT"); break;
+    case 0x03: OP1("NEG"); break;
+    case 0x04: OP2D("XCH"); break;
+    case 0x05: OP1("DEC"); break;
+    case 0x06: OP1("EXT"); break;
+    case 0x07: OP1("INC"); break;
+    case 0x08: OP2SH("SHR"); break;
+    case 0x09: OP2SH("SHL"); break;
+    case 0x0a: OP2SH("SHRA"); break;
+    case 0x0b: OP2IX("XCH"); break;
+    case 0x0c: OP2SH("SHRL"); break;
+    case 0x0d: OP2SH("SHLL"); break;
+    case 0x0e: OP2SH("SHRAL"); break;
+    case 0x0f: OP2SH("NORML"); break;
+    case 0x10: OP0("RESERVED"); break;
+    case 0x11: OP1("CLRB"); break;
+    case 0x12: OP1("NOTB"); break;
+    case 0x13: OP1("NEGB"); break;
+    case 0x14: OP2D("XCHB"); break;
+    case 0x15: OP1("DECB"); break;
+    case 0x16: OP1("EXTB"); break;
+    case 0x17: OP1("INCB"); break;
+    case 0x18: OP2SH("SHRB"); break;
+    case 0x19: OP2SH("SHLB"); break;
+    case 0x1a: OP2SH("SHRAB"); break;
+    case 0x1b: OP2IX("XCHB"); break;
+    case 0x1c ... 0x1f: OP0("RESERVED"); break;
+    case 0x20 ... 0x27: OPJ11("SJMP"); break;
+    case 0x28 ... 0x2f: OPJ11("SCALL"); break;
+    case 0x30 ... 0x37: OPJBIT("JBC"); break;
+    case 0x38 ... 0x3f: OPJBIT("JBS"); break;
+    case 0x40 ... 0x43: OP3("AND"); break;
+    case 0x44 ... 0x47: OP3("ADD"); break;
+    case 0x48 ... 0x4b: OP3("SUB"); break;
+    case 0x4c ... 0x4f: OP3("MULU"); break;
+    case 0x50 ... 0x53: OP3B("ANDB"); break;
+    case 0x54 ... 0x57: OP3B("ADDB"); break;
+    case 0x58 ... 0x5b: OP3B("SUBB"); break;
+    case 0x5c ... 0x5f: OP3B("MULUB"); break;
+    case 0x60 ... 0x63: OP2("AND"); break;
+    case 0x64 ... 0x67: OP2("ADD"); break;
+    case 0x68 ... 0x6b: OP2("SUB"); break;
+    case 0x6c ... 0x6f: OP2("MULU"); break;
+    case 0x70 ... 0x73: OP2B("ANDB"); break;
+    case 0x74 ... 0x77: OP2B("ADDB"); break;
+    case 0x78 ... 0x7b: OP2B("SUBB"); break;
+    case 0x7c ... 0x7f: OP2B("MULUB"); break;
+    case 0x80 ... 0x83: OP2("OR"); break;
+    case 0x84 ... 0x87: OP2("XOR"); break;
+    case 0x88 ... 0x8b: OP2("CMP"); break;
+    case 0x8c ... 0x8f: OP2("DIVU"); break;
+    case 0x90 ... 0x93: OP2B("ORB"); break;
+    case 0x94 ... 0x97: OP2B("XORB"); break;
+    case 0x98 ... 0x9b: OP2B("CMPB"); break;
+    case 0x9c ... 0x9f: OP2B("DIVUB"); break;
+    case 0xa0 ... 0xa3: OP2("LD"); break;
+    case 0xa4 ... 0xa7: OP2("ADDC"); break;
+    case 0xa8 ... 0xab: OP2("SUBC"); break;
+    case 0xac ... 0xaf: OP2B("LDBZE"); break;
+    case 0xb0 ... 0xb3: OP2B("LDB"); break;
+    case 0xb4 ... 0xb7: OP2B("ADDCB"); break;
+    case 0xb8 ... 0xbb: OP2B("SUBCB"); break;
+    case 0xbc ... 0xbf: OP2B("LDBSE"); break;
+    case 0xc0: OP2("ST"); break;
+    case 0xc1: OP2D("BMOV"); break;
+    case 0xc2: OP2("ST"); break;
+    case 0xc3: OP2("ST"); break;
+    case 0xc4: OP2B("STB"); break;
+    case 0xc5: OP2D("CMPL"); break;
+    case 0xc6: OP2B("STB"); break;
+    case 0xc7: OP2B("STB"); break;
+    case 0xc8: OP1("PUSH"); break;
+    case 0xc9: OP1IM("PUSH"); break;
+    case 0xca: OP1IN("PUSH"); break;
+    case 0xcb: OP1IX("PUSH"); break;
+    case 0xcc: OP1("POP"); break;
+    case 0xcd: OP2D("BMOVI"); break;
+    case 0xce: OP1IN("POP"); break;
+    case 0xcf: OP1IX("POP"); break;
+    case 0xd0: OPJ8("JNST"); break;
+    case 0xd1: OPJ8("JNH"); break;
+    case 0xd2: OPJ8("JGT"); break;
+    case 0xd3: OPJ8("JNC"); break;
+    case 0xd4: OPJ8("JNVT"); break;
+    case 0xd5: OPJ8("JNV"); break;
+    case 0xd6: OPJ8("JGE"); break;
+    case 0xd7: OPJ8("JNE"); break;
+    case 0xd8: OPJ8("JST"); break;
+    case 0xd9: OPJ8("JH"); break;
+    case 0xda: OPJ8("JLE"); break;
+    case 0xdb: OPJ8("JC"); break;
+    case 0xdc: OPJ8("JVT"); break;
+    case 0xdd: OPJ8("JV"); break;
+    case 0xde: OPJ8("JLT"); break;
+    case 0xdf: OPJ8("JE"); break;
+    case 0xe0: OPDJ8("DJNZ"); break;
+    case 0xe1: OPDJ8("DJNZW"); break;
+    case 0xe2: OPUNIMP("TIJMP"); l = 4; break;
+    case 0xe3: sprintf(buf, "BR [%02X]", peek(1)); l = 2; break;
+    case 0xe4 ... 0xe6: OP0("RESERVED"); break;
+    case 0xe7: OPJ16("LJMP"); break;
+    case 0xe8 ... 0xeb: OP0("RESERVED"); break;
+    case 0xec: OPUNIMP("DPTS"); break;
+    case 0xed: OPUNIMP("EPTS"); break;
+    case 0xee: OP0("RESERVED NOP"); break;
+    case 0xef: OPJ16("LCALL"); break;
+    case 0xf0: OP0("RET"); break;
+    case 0xf1: OP0("RESERVED"); break;
+    case 0xf2: OP0("PUSHF"); break;
+    case 0xf3: OP0("POPF"); break;
+    case 0xf4: OP0("PUSHA"); break;
+    case 0xf5: OP0("POPA"); break;
+    case 0xf6: OPUNIMP("IDLPD"); l = 2; break;
+    case 0xf7: OPUNIMP("TRAP"); break;
+    case 0xf8: OP0("CLRC"); break;
+    case 0xf9: OP0("SETC"); break;
+    case 0xfa: OP0("DI"); break;
+    case 0xfb: OP0("EI"); break;
+    case 0xfc: OP0("CLRVT"); break;
+    case 0xfd: OP0("NOP"); break;
+    case 0xfe:
+      /* signed multiply/divide, the unsigned one with a prefix */
+      if (peek(1) == 0xfe) {
+        OP0("RESERVED");
+        break;
+      }
+      disasm(code + 1, opc + 1, &l);
+      if (peek(1) >= 0x40 && peek(1) < 0xa0 && (peek(1) & 0x0c) == 0x0c)
+        memmove(buf + 3, buf + 4, strlen(buf + 4) + 1);	/* MULU -> MUL */
+      l++;
+      break;
+    case 0xff: OP0("RST"); break;
+    default:
+      sprintf(buf, "(UNHANDLED)");
+  }
+  if (len)
+    *len = l;
+  return buf;
+}
+
+int disasmFlow(const uint8_t *code, uint16_t opc, uint16_t *target)
+{
+  uint8_t opcode = peek(0);
+  switch (opcode) {
+    case 0x20 ... 0x2f:
+      *target = opc + (((int16_t)((peek(1) | ((opcode & 0x7) << 8)) << 5)) >> 5) + 2;
+      return opcode < 0x28 ? FLOW_JUMP : FLOW_CALL;	/* SJMP, SCALL */
+    case 0x30 ... 0x3f:	/* JBC, JBS */
+    case 0xe0 ... 0xe1:	/* DJNZ, DJNZW */
+      *target = opc + (int8_t)peek(2) + 3;
+      return FLOW_BRANCH;
+    case 0xd0 ... 0xdf:
+      *target = opc + (int8_t)peek(1) + 2;
+      return FLOW_BRANCH;
+    case 0xe2:	/* TIJMP */
+    case 0xe3:	/* BR [] */
+      return FLOW_INDIRECT;
+    case 0xe7:
+    case 0xef:
+      *target = opc + (int16_t)peek16(1) + 3;
+      return opcode == 0xe7 ? FLOW_JUMP : FLOW_CALL;	/* LJMP, LCALL */
+    case 0xf0:
+      return FLOW_RETURN;
+    case 0xfe:
+      return peek(1) == 0xfe ? FLOW_STOP : FLOW_NEXT;
+    case 0x10:
+    case 0x1c ... 0x1f:
+    case 0xe4 ... 0xe6:
+    case 0xe8 ... 0xeb:
+    case 0xf1:
+    case 0xff:	/* RST */
+      return FLOW_STOP;
+    default:
+      return FLOW_NEXT;
+  }
+}
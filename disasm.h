@@ -0,0 +1,37 @@
+/*
+ * disasm.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _DISASM_H
+#define _DISASM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* longest instruction, including prefix */
+#define DISASM_MAX_LEN 8
+
+/* how an instruction passes on control, see disasmFlow() */
+#define FLOW_NEXT 0		/* to the next instruction */
+#define FLOW_JUMP 1		/* to the target */
+#define FLOW_BRANCH 2		/* to the target or the next instruction */
+#define FLOW_CALL 3		/* to the target, which returns to the next one */
+#define FLOW_INDIRECT 4		/* to an address computed at run time */
+#define FLOW_RETURN 5
+#define FLOW_STOP 6		/* nowhere: reset and reserved opcodes */
+
+/* Disassembles the instruction in code, which must hold DISASM_MAX_LEN
+   bytes, located at address opc. Returns a static buffer; if len is
+   given, it is set to the length of the instruction. */
+const char *disasm(const uint8_t *code, uint16_t opc, int *len = NULL);
+/* Returns the FLOW_* of the instruction in code, located at address opc,
+   and sets target for the direct jumps, branches and calls. */
+int disasmFlow(const uint8_t *code, uint16_t opc, uint16_t *target);
+
+#endif
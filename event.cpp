@@ -0,0 +1,284 @@
+/*
+ * event.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "event.h"
+#include "debug.h"
+#include <string.h>
+
+/* How values that don't fit into the tag are stored. */
+#define MODEL_BIT 0	/* always fits into the tag */
+#define MODEL_BYTE 1	/* one byte */
+#define MODEL_VARINT 2	/* zigzag-encoded LEB128 varint */
+
+static const uint8_t value_model[EVENT_MAX] = {
+  MODEL_VARINT,	/* EVENT_INVALID */
+  MODEL_VARINT,	/* EVENT_KEYDOWN */
+  MODEL_VARINT,	/* EVENT_KEYUP */
+  MODEL_BYTE,	/* EVENT_SERIALRX */
+  MODEL_BIT,	/* EVENT_SERIALRXBIT */
+  MODEL_BYTE,	/* EVENT_SERIALSTAT */
+  MODEL_BIT,	/* EVENT_EEPROMREAD */
+  MODEL_VARINT,	/* EVENT_STATEHASH */
+};
+
+static inline int modelOf(int type)
+{
+  if (type < EVENT_MAX)
+    return value_model[type];
+  else
+    return MODEL_VARINT;
+}
+
+EventStream::EventStream(statefile_t fp, bool write, int version)
+{
+  this->fp = fp;
+  writing = write;
+  this->version = version;
+  need_timebase = true;
+  last_cycles = 0;
+  end_cycles = 0;
+  buf_pos = buf_len = 0;
+}
+
+EventStream::~EventStream()
+{
+  if (writing)
+    flush();
+}
+
+void EventStream::writeHeader(statefile_t fp)
+{
+  uint8_t v = REC_VERSION;
+  state_write(fp, REC_MAGIC, REC_MAGIC_LEN);
+  state_write(fp, &v, 1);
+}
+
+int EventStream::readHeader(statefile_t fp)
+{
+  char magic[REC_MAGIC_LEN];
+  uint8_t v;
+  long start = state_tell(fp);
+  if (state_read(fp, magic, REC_MAGIC_LEN) == REC_MAGIC_LEN &&
+      !memcmp(magic, REC_MAGIC, REC_MAGIC_LEN) &&
+      state_read(fp, &v, 1) == 1) {
+    DEBUG(EVENT, "recording format version %d\n", v);
+    return v;
+  }
+  /* no header, this is an old-style recording */
+  state_seek(fp, start, SEEK_SET);
+  DEBUG(EVENT, "legacy recording format\n");
+  return REC_VERSION_LEGACY;
+}
+
+void EventStream::putVarint(uint64_t v)
+{
+  while (v >= 0x80) {
+    putByte((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  putByte(v);
+}
+
+bool EventStream::getVarint(uint64_t &v)
+{
+  int shift = 0;
+  int b;
+  v = 0;
+  do {
+    b = getByte();
+    if (b < 0 || shift > 63)
+      return false;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return true;
+}
+
+bool EventStream::write(const struct Event &e)
+{
+  uint32_t v = e.value;
+  if (modelOf(e.type) == MODEL_BYTE && v > 0xff) {
+    /* a truncated value would replay as a different input */
+    ERROR("event type %d value 0x%x does not fit into a byte, dropped\n", e.type, v);
+    return false;
+  }
+
+  if (need_timebase || e.cycles < last_cycles) {
+    /* start of stream, or the machine has been reset */
+    putByte(REC_TAG_CONTROL | (REC_CTRL_TIMEBASE << 4));
+    putVarint(e.cycles);
+    last_cycles = e.cycles;
+    need_timebase = false;
+  }
+
+  if (v < 15)
+    putByte(e.type | ((v + 1) << 4));
+  else {
+    putByte(e.type);
+    if (modelOf(e.type) == MODEL_BYTE)
+      putByte(v);
+    else
+      putVarint(((uint32_t)e.value << 1) ^ (uint32_t)(e.value >> 31));
+  }
+
+  putVarint(e.cycles - last_cycles);
+  last_cycles = e.cycles;
+  return true;
+}
+
+void EventStream::writeEnd(uint64_t cycles)
+{
+  if (cycles < last_cycles)
+    cycles = last_cycles;
+  putByte(REC_TAG_CONTROL | (REC_CTRL_END << 4));
+  putVarint(cycles - last_cycles);
+}
+
+long EventStream::writeKeyframe(uint64_t cycles, const uint8_t *state, uint32_t len)
+{
+  putByte(REC_TAG_CONTROL | (REC_CTRL_KEYFRAME << 4));
+  putVarint(cycles);
+  putVarint(len);
+  flush();
+
+  state_finish(fp);
+  long offset = state_offset(fp);
+  state_write(fp, state, len);
+
+  /* a reader starting at the keyframe needs a timebase */
+  putByte(REC_TAG_CONTROL | (REC_CTRL_TIMEBASE << 4));
+  putVarint(cycles);
+  last_cycles = cycles;
+  need_timebase = false;
+  return offset;
+}
+
+bool EventStream::readLegacy(struct Event &e)
+{
+  uint8_t *p = (uint8_t *)&e;
+  for (unsigned int i = 0; i < sizeof(struct Event); i++) {
+    int b = getByte();
+    if (b < 0)
+      return false;
+    p[i] = b;
+  }
+  last_cycles = e.cycles;
+  return true;
+}
+
+bool EventStream::read(struct Event &e)
+{
+  if (version == REC_VERSION_LEGACY)
+    return readLegacy(e);
+
+  for (;;) {
+    int tag = getByte();
+    if (tag < 0)
+      return false;
+    int type = tag & 0xf;
+    int payload = tag >> 4;
+    uint64_t v;
+
+    if (type == REC_TAG_CONTROL) {
+      switch (payload) {
+        case REC_CTRL_TIMEBASE:
+          if (!getVarint(v))
+            return false;
+          last_cycles = v;
+          break;
+        case REC_CTRL_END:
+          if (getVarint(v))
+            end_cycles = last_cycles + v;
+          return false;
+        case REC_CTRL_KEYFRAME: {
+          uint64_t len;
+          if (!getVarint(v) || !getVarint(len) || !skip(len))
+            return false;
+          last_cycles = v;
+          break;
+        }
+        default:
+          ERROR("unknown control record %d in event stream\n", payload);
+          return false;
+      }
+      continue;
+    }
+
+    int value;
+    if (payload)
+      value = payload - 1;
+    else if (modelOf(type) == MODEL_BYTE) {
+      int b = getByte();
+      if (b < 0)
+        return false;
+      value = b;
+    }
+    else {
+      if (!getVarint(v))
+        return false;
+      value = (int)((uint32_t)v >> 1) ^ -(int)(v & 1);
+    }
+
+    if (!getVarint(v))
+      return false;
+    last_cycles += v;
+
+    e.cycles = last_cycles;
+    e.type = type;
+    e.value = value;
+    return true;
+  }
+}
+
+bool EventStream::fill()
+{
+  buf_pos = 0;
+  buf_len = state_read(fp, buf, buf_size);
+  if (buf_len < 0)
+    buf_len = 0;
+  return buf_len > 0;
+}
+
+bool EventStream::skip(uint32_t n)
+{
+  uint32_t avail = buf_len - buf_pos;
+  if (n <= avail) {
+    buf_pos += n;
+    return true;
+  }
+  n -= avail;
+  buf_pos = buf_len = 0;
+  return state_seek(fp, n, SEEK_CUR) >= 0;
+}
+
+void EventStream::flush()
+{
+  if (writing && buf_pos) {
+    state_write(fp, buf, buf_pos);
+    buf_pos = 0;
+  }
+}
+
+uint32_t EventStream::tell()
+{
+  if (writing)
+    return state_tell(fp) + buf_pos;
+  else
+    return state_tell(fp) - (buf_len - buf_pos);
+}
+
+void EventStream::seek(uint32_t pos, uint64_t base)
+{
+  flush();
+  state_seek(fp, pos, SEEK_SET);
+  buf_pos = buf_len = 0;
+  last_cycles = base;
+  need_timebase = true;
+}
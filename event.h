@@ -0,0 +1,141 @@
+/*
+ * event.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _EVENT_H
+#define _EVENT_H
+
+#include <stdint.h>
+#include "state.h"
+
+#define EVENT_INVALID 0
+#define EVENT_KEYDOWN 1
+#define EVENT_KEYUP 2
+#define EVENT_SERIALRX 3
+#define EVENT_SERIALRXBIT 4
+#define EVENT_SERIALSTAT 5
+#define EVENT_EEPROMREAD 6
+#define EVENT_STATEHASH 7	/* for detecting replay divergence */
+#define EVENT_MAX 8
+
+/* Polled inputs are read by the firmware in tight loops; for these, only
+   changes are recorded, and the replayer uses the most recent value at
+   or before the current cycle. */
+static inline bool eventIsPolled(int type)
+{
+  return type == EVENT_SERIALSTAT || type == EVENT_SERIALRXBIT ||
+         type == EVENT_EEPROMREAD;
+}
+
+// recorded event structure
+struct Event {
+  uint64_t cycles;
+  int type;
+  int value;
+};
+
+/* Recording files start with REC_MAGIC and a version byte, followed by the
+   machine state and the event stream.  Files without the magic are
+   assumed to be REC_VERSION_LEGACY, i.e. raw struct Events. */
+#define REC_MAGIC "CASCREC"
+#define REC_MAGIC_LEN 8
+#define REC_VERSION_LEGACY 0
+#define REC_VERSION 3
+
+/* Event stream format (REC_VERSION 1):
+   Each record starts with a tag byte.  The low nibble is the event type,
+   the high nibble carries the value if it is small enough for the type's
+   value model (see event.cpp).  The tag is followed by the value (if it
+   didn't fit into the tag) and the number of cycles since the previous
+   record as an unsigned LEB128 varint.
+   Tag type 15 marks a control record, with the record kind in the high
+   nibble.
+   Since REC_VERSION 2, polled inputs are only recorded when their value
+   changes, and the stream is terminated with an end record.
+   Since REC_VERSION 3, the stream contains keyframes, i.e. complete machine
+   states, at regular intervals. With compression, each keyframe starts a
+   new gzip member, so a reader can start decompressing right there.  After
+   the end record, a keyframe index (REC_INDEX_MAGIC, number of keyframes,
+   struct Keyframes) is written, and its raw file offset is appended
+   uncompressed to the end of the file, followed by REC_INDEX_MAGIC. */
+#define REC_TAG_CONTROL 15
+#define REC_CTRL_TIMEBASE 0	/* absolute cycle count follows */
+#define REC_CTRL_END 1		/* cycles since last record follow */
+#define REC_CTRL_KEYFRAME 2	/* absolute cycle count and state length
+				   follow, then the state */
+
+#define REC_INDEX_MAGIC "CIDX"
+#define REC_INDEX_MAGIC_LEN 4
+
+struct Keyframe {
+  uint64_t cycles;
+  uint64_t offset;	/* raw file offset of the state */
+};
+
+class EventStream {
+public:
+  EventStream(statefile_t fp, bool write, int version = REC_VERSION);
+  ~EventStream();
+
+  static void writeHeader(statefile_t fp);
+  static int readHeader(statefile_t fp);
+
+  /* returns false if the value cannot be represented and the event has
+     not been written */
+  bool write(const struct Event &e);
+  void writeEnd(uint64_t cycles);
+  /* returns the raw file offset of the keyframe */
+  long writeKeyframe(uint64_t cycles, const uint8_t *state, uint32_t len);
+  bool read(struct Event &e);
+  /* cycle count of the end record, 0 if none has been read */
+  uint64_t getEndCycles() {
+    return end_cycles;
+  }
+  void flush();
+
+  /* position in the (uncompressed) file, for state saving */
+  uint32_t tell();
+  /* base is the cycle count of the last record read before pos */
+  void seek(uint32_t pos, uint64_t base);
+
+  int getVersion() {
+    return version;
+  }
+
+private:
+  inline void putByte(uint8_t b) {
+    if (buf_pos == buf_size)
+      flush();
+    buf[buf_pos++] = b;
+  }
+  inline int getByte() {
+    if (buf_pos == buf_len && !fill())
+      return -1;
+    return buf[buf_pos++];
+  }
+  void putVarint(uint64_t v);
+  bool getVarint(uint64_t &v);
+  bool skip(uint32_t n);
+  bool fill();
+  bool readLegacy(struct Event &e);
+
+  statefile_t fp;
+  bool writing;
+  int version;
+  bool need_timebase;
+  uint64_t last_cycles;
+  uint64_t end_cycles;
+
+  static const int buf_size = 4096;
+  uint8_t buf[buf_size];
+  int buf_pos;
+  int buf_len;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * framecheck.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "framecheck.h"
+#include "debug.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+FrameCheck::FrameCheck(const char *golden)
+{
+  name = strdup(golden);
+  fp = fopen(golden, "r");
+  writing = !fp;
+  if (writing) {
+    fp = fopen(golden, "w");
+    if (!fp)
+      ERROR("could not create golden file %s\n", golden);
+  }
+  failed = !fp;
+  frames = 0;
+  /* no frame has this hash, so the first one is always logged */
+  last_hash = 0;
+  start_time = os_mtime();
+}
+
+FrameCheck::~FrameCheck()
+{
+  if (fp)
+    fclose(fp);
+  free(name);
+}
+
+void FrameCheck::start()
+{
+  start_time = os_mtime();
+}
+
+void FrameCheck::frame(uint64_t cycles, uint64_t hash)
+{
+  if (hash == last_hash || failed)
+    return;
+  last_hash = hash;
+  frames++;
+
+  if (writing) {
+    fprintf(fp, "%llu %016llx\n", (unsigned long long)cycles, (unsigned long long)hash);
+    return;
+  }
+
+  unsigned long long golden_cycles, golden_hash;
+  if (fscanf(fp, "%llu %llx", &golden_cycles, &golden_hash) != 2) {
+    ERROR("%s: extra frame at cycle %llu\n", name, (unsigned long long)cycles);
+    failed = true;
+  }
+  else if (golden_cycles != cycles || golden_hash != hash) {
+    ERROR("%s: frame %d differs, expected %016llx at %llu, got %016llx at %llu\n",
+          name, frames, golden_hash, golden_cycles,
+          (unsigned long long)hash, (unsigned long long)cycles);
+    failed = true;
+  }
+}
+
+int FrameCheck::finish(uint64_t cycles, uint64_t instructions, bool diverged)
+{
+  unsigned long long dummy;
+  if (!writing && !failed && fscanf(fp, "%llu", &dummy) == 1) {
+    ERROR("%s: replay ended after %d frames, golden file has more\n", name, frames);
+    failed = true;
+  }
+
+  uint32_t ms = os_mtime() - start_time;
+  int ret = !fp ? BATCH_ERROR : (failed || diverged) ? BATCH_FAIL : BATCH_PASS;
+  static const char *results[] = {"PASS", "FAIL", "ERROR"};
+  /* scripts/regress.py parses this; the mismatches above are errors, the
+     summary is not */
+  printf("batch: %s %s frames %d cycles %llu instructions %llu ms %u mips %.2f%s%s\n",
+         results[ret], name, frames, (unsigned long long)cycles,
+         (unsigned long long)instructions, ms,
+         ms ? instructions / 1000.0 / ms : 0.0,
+         writing ? " (created)" : "", diverged ? " (diverged)" : "");
+  fflush(stdout);
+  return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ * framecheck.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _FRAMECHECK_H
+#define _FRAMECHECK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BATCH_PASS 0
+#define BATCH_FAIL 1
+#define BATCH_ERROR 2
+
+/* Checks the LCD frames of a batch replay against a golden file, or
+   creates the golden file if there is none yet. The golden file has one
+   line per frame that differs from the previous one, with the cycle count
+   and the frame hash. */
+class FrameCheck {
+public:
+  FrameCheck(const char *golden);
+  ~FrameCheck();
+
+  /* the emulation is about to start */
+  void start();
+  void frame(uint64_t cycles, uint64_t hash);
+  /* prints a summary line and returns one of the BATCH_* codes */
+  int finish(uint64_t cycles, uint64_t instructions, bool diverged);
+
+private:
+  char *name;
+  FILE *fp;
+  bool writing;
+  bool failed;
+  int frames;
+  uint64_t last_hash;
+  uint32_t start_time;
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * fuzz.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "fuzz.h"
+#include <stdlib.h>
+#include <string.h>
+
+Fuzz::Fuzz()
+{
+  map = (uint8_t *)calloc(FUZZ_MAP_SIZE, 1);
+  covered = 0;
+  armed = false;
+  result = FUZZ_RUNNING;
+  end_cycles = (uint64_t)-1;
+  crash_addr = 0;
+  replies_left = 0;
+  reply_len = 0;
+}
+
+Fuzz::~Fuzz()
+{
+  free(map);
+}
+
+void Fuzz::crash(int kind, uint32_t where)
+{
+  /* the first one counts, whatever happens after it does not */
+  if (result == FUZZ_RUNNING) {
+    result = kind;
+    crash_addr = where;
+  }
+}
+
+bool Fuzz::replyPoint(const int *r)
+{
+  if (armed || result != FUZZ_RUNNING || --replies_left > 0)
+    return false;
+  reply_len = 0;
+  while (reply_len < FUZZ_MAX_REPLY && r[reply_len] != -1) {
+    reply[reply_len] = r[reply_len];
+    reply_len++;
+  }
+  result = FUZZ_REPLY_POINT;
+  return true;
+}
+
+void Fuzz::waitForReply(int count, uint64_t now, uint64_t cycles)
+{
+  armed = false;
+  result = FUZZ_RUNNING;
+  replies_left = count;
+  end_cycles = now + cycles;
+}
+
+void Fuzz::begin(uint64_t now, uint64_t cycles)
+{
+  armed = true;
+  result = FUZZ_RUNNING;
+  end_cycles = now + cycles;
+}
@@ -0,0 +1,115 @@
+/*
+ * fuzz.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _FUZZ_H
+#define _FUZZ_H
+
+#include <stdint.h>
+#include "debug.h"
+
+/* coverage map entries; physical PCs are hashed into it */
+#define FUZZ_MAP_BITS 22
+#define FUZZ_MAP_SIZE (1 << FUZZ_MAP_BITS)
+
+#define FUZZ_MAX_REPLY 256
+
+/* how an execution ended */
+#define FUZZ_RUNNING 0
+#define FUZZ_REPLY_POINT 1	/* the fake interface is about to reply */
+#define FUZZ_DONE 2		/* the firmware has sent something again */
+#define FUZZ_HANG 3		/* out of state times, or jumping to itself */
+#define FUZZ_ILLEGAL_OPCODE 4
+#define FUZZ_UNMAPPED_BANK 5
+
+/* Collects what the fuzzer (see fuzzer.cpp) needs to know from inside the
+   emulation: which instructions have ever been executed, and when and why
+   an execution has ended. Until armed with begin(), the emulation runs
+   towards the reply point, where the fake interface is about to answer a
+   request; the fuzzer then takes over, supplying its inputs as the reply.
+   Only available if built with FUZZ. */
+class Fuzz {
+public:
+  Fuzz();
+  ~Fuzz();
+
+  /* called before every instruction with its physical address; the map
+     is never cleared, so a zero entry is coverage never seen before */
+  inline void cover(uint32_t phys) {
+    uint32_t i = (phys * 0x9e3779b1U) >> (32 - FUZZ_MAP_BITS);
+    if (unlikely(!map[i])) {
+      map[i] = 1;
+      covered++;
+    }
+  }
+  inline bool finished(uint64_t cycles) {
+    if (result != FUZZ_RUNNING)
+      return true;
+    if (cycles >= end_cycles) {
+      result = FUZZ_HANG;
+      return true;
+    }
+    return false;
+  }
+  void crash(int kind, uint32_t where);
+  /* the firmware has written a byte to the serial port */
+  inline void sent() {
+    if (armed && result == FUZZ_RUNNING)
+      result = FUZZ_DONE;
+  }
+  /* the fake interface is about to send the given reply (terminated by
+     -1); returns true if it should not */
+  bool replyPoint(const int *reply);
+
+  /* runs towards the "count"th reply point for at most "cycles" state
+     times from "now" */
+  void waitForReply(int count, uint64_t now, uint64_t cycles);
+  /* starts an execution of at most "cycles" state times from "now" */
+  void begin(uint64_t now, uint64_t cycles);
+
+  int getResult() {
+    return result;
+  }
+  /* where the crash was: the physical PC of an illegal opcode or an
+     endless loop, the mapping (high byte * 256 + low byte) for an unmapped
+     bank */
+  uint32_t getCrashAddr() {
+    return crash_addr;
+  }
+  /* number of map entries set so far */
+  uint32_t getCovered() {
+    return covered;
+  }
+  /* the reply the fake interface would have sent at the reply point */
+  const uint8_t *getReply(int *len) {
+    *len = reply_len;
+    return reply;
+  }
+
+private:
+  uint8_t *map;
+  uint32_t covered;
+
+  bool armed;
+  int result;
+  uint64_t end_cycles;
+  uint32_t crash_addr;
+  int replies_left;
+
+  uint8_t reply[FUZZ_MAX_REPLY];
+  int reply_len;
+};
+
+#ifdef FUZZ
+#define FUZZ_HOOK(x) do { if (unlikely(fuzz != NULL)) fuzz->x; } while (0)
+#else
+#define FUZZ_HOOK(x) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,476 @@
+/*
+ * fuzzer.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+/* Coverage-guided fuzzer for the firmware's handling of ECU replies; built
+   instead of the emulator with CONFIG+=fuzz ("make fuzz").
+
+   The ROM is started (or a recording replayed) with the fake interface,
+   which answers the firmware's requests with its canned replies until the
+   "request"th one after the start (or the end of the recording). There,
+   instead of the canned reply, the machine state is saved, and from then
+   on every execution restores that snapshot, hands an input to the serial
+   port as the reply and runs until
+     - the firmware sends something again (it is done with the reply),
+     - an illegal opcode or an unimplemented memory mapping is hit (crash),
+     - the state time budget is used up (hang).
+   Inputs are mutated from a corpus that starts out with the canned reply
+   and any input files given; an input is added to it if it makes the
+   firmware execute an instruction it has never executed before (see
+   Fuzz::cover()). With -o, corpus entries, crashes (one per location) and
+   hangs (those reaching new code) are written to files starting with the
+   given prefix. With -R, a single input is run and its outcome reported.
+
+   Progress is reported every second; the summary at the end (after -n
+   executions, -d seconds or an interrupt) includes the executions per
+   second and the share of the time spent restoring the snapshot.
+
+   usage: cascade-fuzz [-r request] [-t budget] [-w wait] [-n execs]
+                       [-d seconds] [-s seed] [-k] [-o prefix] [-R input]
+                       rom|recording.rec [input...]
+
+   -k replaces the last byte of every input by the 8-bit sum of the others,
+   the checksum of ISO 9141 and KWP2000 messages, so that the mutations get
+   past the checksum test. Budget and wait are in state times. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include "os.h"
+#include "debug.h"
+#include "cpu.h"
+#include "ui.h"
+#include "serial.h"
+#include "iface_fake.h"
+#include "fuzz.h"
+
+uint32_t debug_level;
+uint32_t debug_level_unabridged;
+FILE *win_stderr;
+
+struct Input {
+  uint8_t *data;
+  int len;
+};
+
+struct Corpus {
+  struct Input *inputs;
+  int count;
+  int size;
+};
+
+/* what is needed to run an input */
+struct Target {
+  Cpu *cpu;
+  IfaceFake *iface;
+  Fuzz *fuzz;
+  Snapshot *snapshot;
+  uint64_t budget;
+  uint64_t restore_ns;
+  uint64_t run_ns;
+  uint64_t cycles;
+};
+
+static const char *result_names[] = {
+  "running", "reply point", "done", "hang", "illegal opcode", "unmapped bank"
+};
+
+static const uint8_t interesting[] = {
+  0x00, 0x01, 0x02, 0x7f, 0x80, 0x81, 0xfe, 0xff
+};
+
+static volatile bool interrupted;
+static uint32_t rng_state = 1;
+
+static void onInterrupt(int sig)
+{
+  interrupted = true;
+}
+
+static uint32_t rng()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void corpusAdd(struct Corpus *c, const uint8_t *data, int len)
+{
+  if (c->count == c->size) {
+    c->size = c->size ? c->size * 2 : 64;
+    c->inputs = (struct Input *)realloc(c->inputs, c->size * sizeof(struct Input));
+  }
+  struct Input *in = &c->inputs[c->count++];
+  in->data = (uint8_t *)malloc(len + 1);
+  memcpy(in->data, data, len);
+  in->len = len;
+}
+
+static bool readInput(const char *name, uint8_t *buf, int *len)
+{
+  FILE *fp = fopen(name, "rb");
+  if (!fp) {
+    ERROR("failed to open %s\n", name);
+    return false;
+  }
+  *len = fread(buf, 1, FUZZ_MAX_REPLY, fp);
+  fclose(fp);
+  return true;
+}
+
+static void writeInput(const char *prefix, const char *kind, int num, const char *suffix,
+                       const uint8_t *data, int len)
+{
+  char name[1024];
+  snprintf(name, sizeof(name), "%s%s-%05d%s.bin", prefix, kind, num, suffix);
+  FILE *fp = fopen(name, "wb");
+  if (!fp || fwrite(data, 1, len, fp) != (size_t)len)
+    ERROR("failed to write %s\n", name);
+  if (fp)
+    fclose(fp);
+}
+
+static void fixChecksum(uint8_t *buf, int len)
+{
+  if (len < 2)
+    return;
+  uint8_t sum = 0;
+  for (int i = 0; i < len - 1; i++)
+    sum += buf[i];
+  buf[len - 1] = sum;
+}
+
+/* a few random changes, some of them aimed at length and type fields */
+static int mutate(struct Corpus *c, uint8_t *buf, int len)
+{
+  int changes = 1 << (rng() % 4);
+  for (int n = 0; n < changes; n++) {
+    int pos = len ? rng() % len : 0;
+    switch (rng() % 9) {
+      case 0:
+        if (len)
+          buf[pos] ^= 1 << (rng() % 8);
+        break;
+      case 1:
+        if (len)
+          buf[pos] = rng();
+        break;
+      case 2:
+        if (len)
+          buf[pos] = interesting[rng() % sizeof(interesting)];
+        break;
+      case 3:
+        if (len)
+          buf[pos] += (int)(rng() % 33) - 16;
+        break;
+      case 4:
+        if (len)
+          buf[pos] = len - rng() % 4;
+        break;
+      case 5: {
+        /* insert bytes */
+        int count = 1 + rng() % 4;
+        if (len + count > FUZZ_MAX_REPLY)
+          break;
+        memmove(buf + pos + count, buf + pos, len - pos);
+        for (int i = 0; i < count; i++)
+          buf[pos + i] = rng();
+        len += count;
+        break;
+      }
+      case 6: {
+        /* delete bytes */
+        if (!len)
+          break;
+        int count = 1 + rng() % 4;
+        if (count > len - pos)
+          count = len - pos;
+        memmove(buf + pos, buf + pos + count, len - pos - count);
+        len -= count;
+        break;
+      }
+      case 7: {
+        /* duplicate a chunk */
+        if (!len)
+          break;
+        int count = 1 + rng() % (len - pos);
+        if (len + count > FUZZ_MAX_REPLY)
+          break;
+        memmove(buf + pos + count, buf + pos, len - pos);
+        len += count;
+        break;
+      }
+      case 8: {
+        /* splice with the tail of another input */
+        struct Input *other = &c->inputs[rng() % c->count];
+        if (!other->len)
+          break;
+        int from = rng() % other->len;
+        int count = other->len - from;
+        if (pos + count > FUZZ_MAX_REPLY)
+          count = FUZZ_MAX_REPLY - pos;
+        memcpy(buf + pos, other->data + from, count);
+        len = pos + count;
+        break;
+      }
+    }
+  }
+  return len;
+}
+
+static int execute(struct Target *t, const uint8_t *data, int len)
+{
+  uint64_t start = os_ntime();
+  t->cpu->restoreSnapshot(t->snapshot, false);
+  t->iface->reset();
+  uint64_t restored = os_ntime();
+  Serial *serial = t->cpu->getSerial();
+  for (int i = 0; i < len; i++)
+    serial->addRxData(data[i]);
+  t->fuzz->begin(t->cpu->getCycles(), t->budget);
+  t->cpu->emulate();
+  uint64_t end = os_ntime();
+  t->restore_ns += restored - start;
+  t->run_ns += end - restored;
+  t->cycles += t->cpu->getCycles() - t->snapshot->getCycles();
+  return t->fuzz->getResult();
+}
+
+/* locations of the crashes found so far */
+static uint64_t *crashes;
+static int num_crashes;
+
+static bool newCrash(int result, uint32_t addr)
+{
+  uint64_t key = ((uint64_t)result << 32) | addr;
+  for (int i = 0; i < num_crashes; i++) {
+    if (crashes[i] == key)
+      return false;
+  }
+  crashes = (uint64_t *)realloc(crashes, (num_crashes + 1) * sizeof(uint64_t));
+  crashes[num_crashes++] = key;
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  int request = 1;
+  uint64_t budget = 20000000;
+  uint64_t wait = 600000000;
+  uint64_t max_execs = 0;
+  unsigned int max_seconds = 0;
+  bool fix_checksum = false;
+  const char *prefix = NULL;
+  const char *reproduce = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "r:t:w:n:d:s:ko:R:")) != -1) {
+    switch (c) {
+      case 'r':
+        request = atoi(optarg);
+        break;
+      case 't':
+        budget = strtoull(optarg, NULL, 0);
+        break;
+      case 'w':
+        wait = strtoull(optarg, NULL, 0);
+        break;
+      case 'n':
+        max_execs = strtoull(optarg, NULL, 0);
+        break;
+      case 'd':
+        max_seconds = atoi(optarg);
+        break;
+      case 's':
+        rng_state = strtoul(optarg, NULL, 0);
+        if (!rng_state)
+          rng_state = 1;
+        break;
+      case 'k':
+        fix_checksum = true;
+        break;
+      case 'o':
+        prefix = optarg;
+        break;
+      case 'R':
+        reproduce = optarg;
+        break;
+      default:
+        ERROR("usage: %s [-r request] [-t budget] [-w wait] [-n execs] [-d seconds] [-s seed] [-k] [-o prefix] [-R input] rom|recording.rec [input...]\n", argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1) {
+    ERROR("no ROM or recording given\n");
+    return 1;
+  }
+  if (request < 1)
+    request = 1;
+
+  /* quiet, except for errors */
+  debug_level = 0;
+
+  UI::initToolkit();
+  UI ui;
+  ui.hide();
+
+  /* rewind stays off (it is opt-in), the fuzzer restores its own snapshot
+     for every input */
+  Cpu cpu(&ui);
+  ui.setCpu(&cpu);
+  IfaceFake *iface = new IfaceFake(&cpu, &ui);
+  cpu.setSerial(iface, false);
+  int len = strlen(argv[0]);
+  if (len > 4 && !strcmp(argv[0] + len - 4, ".rec"))
+    cpu.enableReplaying(argv[0]);
+  else if (!cpu.loadRom(argv[0])) {
+    ERROR("failed to load ROM image\n");
+    delete iface;
+    return 1;
+  }
+  cpu.setDeterministic(1);
+
+  Fuzz fuzz;
+  cpu.setFuzz(&fuzz);
+  iface->setFuzz(&fuzz);
+
+  /* get to the reply point */
+  fuzz.waitForReply(request, cpu.getCycles(), wait);
+  cpu.emulate();
+  if (fuzz.getResult() != FUZZ_REPLY_POINT) {
+    ERROR("no reply point: %s after %llu state times\n", result_names[fuzz.getResult()],
+          (unsigned long long)cpu.getCycles());
+    delete iface;
+    return 1;
+  }
+
+  struct Target t;
+  t.cpu = &cpu;
+  t.iface = iface;
+  t.fuzz = &fuzz;
+  t.snapshot = cpu.takeSnapshot();
+  t.budget = budget;
+  t.restore_ns = t.run_ns = t.cycles = 0;
+
+  uint8_t buf[FUZZ_MAX_REPLY];
+  if (reproduce) {
+    int ret = 1;
+    if (readInput(reproduce, buf, &len)) {
+      int result = execute(&t, buf, len);
+      printf("%s: %s", reproduce, result_names[result]);
+      if (result == FUZZ_ILLEGAL_OPCODE || result == FUZZ_UNMAPPED_BANK)
+        printf(" at %08X", fuzz.getCrashAddr());
+      printf(" after %llu state times\n", (unsigned long long)(cpu.getCycles() - t.snapshot->getCycles()));
+      ret = result == FUZZ_DONE ? 0 : 2;
+    }
+    delete t.snapshot;
+    delete iface;
+    return ret;
+  }
+
+  struct Corpus corpus;
+  memset(&corpus, 0, sizeof(corpus));
+  const uint8_t *reply = fuzz.getReply(&len);
+  corpusAdd(&corpus, reply, len);
+  for (int i = 1; i < argc; i++) {
+    if (readInput(argv[i], buf, &len))
+      corpusAdd(&corpus, buf, len);
+  }
+  printf("reply point at %llu state times, replacing a %d byte reply\n",
+         (unsigned long long)t.snapshot->getCycles(), corpus.inputs[0].len);
+
+  signal(SIGINT, onInterrupt);
+  uint64_t execs = 0;
+  int hangs = 0, saved_hangs = 0;
+  unsigned int start = os_mtime();
+  unsigned int last_report = start;
+  /* the initial corpus goes first, unchanged */
+  int initial = corpus.count;
+  while (!interrupted && (!max_execs || execs < max_execs)) {
+    if (execs < (uint64_t)initial) {
+      len = corpus.inputs[execs].len;
+      memcpy(buf, corpus.inputs[execs].data, len);
+    }
+    else {
+      struct Input *in = &corpus.inputs[rng() % corpus.count];
+      memcpy(buf, in->data, in->len);
+      len = mutate(&corpus, buf, in->len);
+    }
+    if (fix_checksum)
+      fixChecksum(buf, len);
+
+    uint32_t covered = fuzz.getCovered();
+    int result = execute(&t, buf, len);
+    execs++;
+    bool fresh = fuzz.getCovered() > covered;
+
+    if (result == FUZZ_ILLEGAL_OPCODE || result == FUZZ_UNMAPPED_BANK) {
+      if (newCrash(result, fuzz.getCrashAddr())) {
+        printf("%s at %08X\n", result_names[result], fuzz.getCrashAddr());
+        if (prefix) {
+          char suffix[32];
+          sprintf(suffix, "-%s-%08x", result == FUZZ_ILLEGAL_OPCODE ? "illegal" : "unmapped",
+                  fuzz.getCrashAddr());
+          writeInput(prefix, "crash", num_crashes, suffix, buf, len);
+        }
+      }
+    }
+    else if (result == FUZZ_HANG) {
+      hangs++;
+      if (fresh || !saved_hangs) {
+        saved_hangs++;
+        if (prefix)
+          writeInput(prefix, "hang", saved_hangs, "", buf, len);
+      }
+    }
+    else if (fresh && execs > (uint64_t)initial) {
+      corpusAdd(&corpus, buf, len);
+      if (prefix)
+        writeInput(prefix, "queue", corpus.count, "", buf, len);
+    }
+
+    unsigned int now = os_mtime();
+    if (now - last_report >= 1000) {
+      /* the UI's queued signals pile up otherwise */
+      ui.processEvents();
+      printf("%llu execs, %llu/s, %u covered, %d in corpus, %d crashes, %d hangs\n",
+             (unsigned long long)execs, (unsigned long long)execs * 1000 / (now - start),
+             fuzz.getCovered(), corpus.count, num_crashes, hangs);
+      fflush(stdout);
+      last_report = now;
+      if (max_seconds && now - start >= max_seconds * 1000)
+        break;
+    }
+  }
+
+  unsigned int ms = os_mtime() - start;
+  if (!ms)
+    ms = 1;
+  uint64_t total_ns = t.restore_ns + t.run_ns;
+  printf("%llu execs in %u ms, %.1f execs/s, %.1f us and %llu state times per exec, %.1f%% restoring\n",
+         (unsigned long long)execs, ms, execs * 1000.0 / ms,
+         execs ? total_ns / 1e3 / execs : 0.0,
+         (unsigned long long)(execs ? t.cycles / execs : 0),
+         total_ns ? t.restore_ns * 100.0 / total_ns : 0.0);
+  printf("%u covered, %d in corpus, %d crashes, %d hangs (%d saved)\n",
+         fuzz.getCovered(), corpus.count, num_crashes, hangs, saved_hangs);
+
+  for (int i = 0; i < corpus.count; i++)
+    free(corpus.inputs[i].data);
+  free(corpus.inputs);
+  free(crashes);
+  delete t.snapshot;
+  delete iface;
+  return num_crashes ? 2 : 0;
+}
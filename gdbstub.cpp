@@ -0,0 +1,665 @@
+/*
+ * gdbstub.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "gdbstub.h"
+#include "cpu.h"
+#include "debug.h"
+#include "os.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* GDB has no idea what an 8096 is, so we have to tell it about the
+   registers */
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>\n"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+  "<target version=\"1.0\">\n"
+  "<feature name=\"org.cascade.i8096.core\">\n"
+  "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\" regnum=\"0\"/>\n"
+  "<reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+  "<reg name=\"psw\" bitsize=\"8\" type=\"uint8\"/>\n"
+  "<reg name=\"int_mask\" bitsize=\"8\" type=\"uint8\"/>\n"
+  "<reg name=\"int_mask1\" bitsize=\"8\" type=\"uint8\"/>\n"
+  "<reg name=\"wsr\" bitsize=\"8\" type=\"uint8\"/>\n"
+  "<reg name=\"codemap\" bitsize=\"16\" type=\"uint16\"/>\n"
+  "<reg name=\"datamap\" bitsize=\"16\" type=\"uint16\"/>\n"
+  "<reg name=\"physpc\" bitsize=\"32\" type=\"uint32\"/>\n"
+  "</feature>\n"
+  "</target>\n";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char *putHex(char *p, uint32_t value, int bytes)
+{
+  /* target byte order, i.e. little-endian */
+  for (int i = 0; i < bytes; i++) {
+    uint8_t b = value >> (i * 8);
+    *p++ = hex_digits[b >> 4];
+    *p++ = hex_digits[b & 0xf];
+  }
+  return p;
+}
+
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* parses a little-endian register value of the given size */
+static bool getHex(const char **p, uint32_t *value, int bytes)
+{
+  *value = 0;
+  for (int i = 0; i < bytes; i++) {
+    int hi = hexDigit((*p)[0]);
+    int lo = hi < 0 ? -1 : hexDigit((*p)[1]);
+    if (lo < 0)
+      return false;
+    *value |= (uint32_t)(hi << 4 | lo) << (i * 8);
+    *p += 2;
+  }
+  return true;
+}
+
+GdbStub::GdbStub(Cpu *cpu, int port)
+{
+  this->cpu = cpu;
+  sock = -1;
+  no_ack = false;
+  quit = false;
+  thread = NULL;
+  in_pos = in_len = 0;
+  pkt_len = 0;
+  gdb_watches = NULL;
+  num_watches = size_watches = 0;
+  our_halt = 0;
+
+  listen_sock = os_tcp_listen(port);
+  if (listen_sock < 0) {
+    ERROR("could not listen for GDB on port %d\n", port);
+    return;
+  }
+  thread = os_create_thread(threadRunner, this);
+  if (!thread) {
+    ERROR("failed to create GDB stub thread\n");
+    os_tcp_close(listen_sock);
+    listen_sock = -1;
+    return;
+  }
+  ERROR("waiting for GDB on port %d\n", port);
+}
+
+GdbStub::~GdbStub()
+{
+  quit = true;
+  if (thread)
+    os_wait_thread(thread, NULL);
+  if (listen_sock >= 0)
+    os_tcp_close(listen_sock);
+  free(gdb_watches);
+}
+
+int GdbStub::threadRunner(void *data)
+{
+  GdbStub *stub = (GdbStub *)data;
+  while (!stub->quit) {
+    if (os_tcp_wait(stub->listen_sock, 100) <= 0)
+      continue;
+    stub->sock = os_tcp_accept(stub->listen_sock);
+    if (stub->sock < 0)
+      continue;
+    DEBUG(OS, "GDB connected\n");
+    stub->session();
+    os_tcp_close(stub->sock);
+    stub->sock = -1;
+    DEBUG(OS, "GDB disconnected\n");
+  }
+  return 0;
+}
+
+void GdbStub::session()
+{
+  no_ack = false;
+  in_pos = in_len = 0;
+
+  /* GDB expects the target to be stopped when it connects */
+  bool was_halted = cpu->isHalted();
+  cpu->requestBreak();
+  if (waitHalt(cpu->getHaltCount() - 1, true)) {
+    if (was_halted)
+      our_halt--;	/* stopped by the UI, not by us */
+    while (getPacket()) {
+      if (!handlePacket())
+        break;
+    }
+  }
+
+  /* Don't leave anything behind that would stop the emulation again. A
+     breakpoint hit before the emulation thread has removed it would stop
+     the emulation with nobody there to continue it, so it is stopped
+     while they are removed. */
+  bool ours = cpu->isHalted() && cpu->getHaltCount() == our_halt;
+  if (!cpu->isHalted()) {
+    uint32_t since = cpu->getHaltCount();
+    cpu->requestBreak();
+    for (int ms = 0; (!cpu->isHalted() || cpu->getHaltCount() == since) && ms < 1000; ms++)
+      os_msleep(1);
+    ours = cpu->isHalted();
+  }
+  clearWatches();
+  syncWatches();
+  /* a halt the UI asked for is none of our business */
+  if (ours && cpu->rom)
+    cpu->resume();
+}
+
+int GdbStub::getChar(int timeout)
+{
+  while (in_pos == in_len) {
+    if (quit)
+      return -1;
+    int wait = timeout >= 0 && timeout < 100 ? timeout : 100;
+    int ret = os_tcp_wait(sock, wait);
+    if (ret < 0)
+      return -1;
+    if (!ret) {
+      if (timeout >= 0 && (timeout -= wait) <= 0)
+        return -2;
+      continue;
+    }
+    in_len = os_tcp_recv(sock, in_buf, sizeof(in_buf));
+    in_pos = 0;
+    if (in_len <= 0) {
+      in_len = 0;
+      return -1;
+    }
+  }
+  return (uint8_t)in_buf[in_pos++];
+}
+
+bool GdbStub::getPacket()
+{
+  for (;;) {
+    int c;
+    /* skip acknowledgements, and interrupts that came too late */
+    do {
+      c = getChar(-1);
+      if (c == -1)
+        return false;
+    } while (c != '$');
+
+    uint8_t sum = 0;
+    pkt_len = 0;
+    for (;;) {
+      c = getChar(-1);
+      if (c == -1)
+        return false;
+      if (c == '#')
+        break;
+      sum += c;
+      if (pkt_len < GDB_PACKET_SIZE - 1)
+        pkt[pkt_len++] = c;
+    }
+    pkt[pkt_len] = 0;
+
+    int hi = getChar(-1);
+    int lo = hi < 0 ? -1 : getChar(-1);
+    if (lo < 0)
+      return false;
+    if (no_ack)
+      return true;
+    if (hexDigit(hi) * 16 + hexDigit(lo) == sum) {
+      os_tcp_send(sock, "+", 1);
+      return true;
+    }
+    os_tcp_send(sock, "-", 1);
+  }
+}
+
+void GdbStub::putPacket(const char *data, int len)
+{
+  if (len < 0)
+    len = strlen(data);
+  char *buf = (char *)malloc(len + 4);
+  uint8_t sum = 0;
+  buf[0] = '$';
+  for (int i = 0; i < len; i++) {
+    buf[i + 1] = data[i];
+    sum += data[i];
+  }
+  buf[len + 1] = '#';
+  putHex(buf + len + 2, sum, 1);
+
+  for (;;) {
+    if (os_tcp_send(sock, buf, len + 4) != len + 4)
+      break;
+    if (no_ack)
+      break;
+    int c = getChar(-1);
+    if (c != '-')
+      break;	/* acknowledged, or the connection is gone */
+  }
+  free(buf);
+}
+
+bool GdbStub::waitHalt(uint32_t since, bool insist)
+{
+  int ms = 0;
+  while (!cpu->isHalted() || cpu->getHaltCount() == since) {
+    int c;
+    if (in_pos < in_len) {
+      c = -2;
+      os_msleep(1);
+    }
+    else
+      c = getChar(1);
+    if (c == -1)
+      return false;
+    if (c >= 0 && c != 0x03) {
+      /* packets are for after the halt */
+      in_pos--;
+      c = -2;
+    }
+    if (c == 0x03 || (insist && c == -2 && ++ms % 100 == 0))
+      cpu->requestBreak();	/* insisting because loading a ROM resumes */
+  }
+  our_halt = cpu->getHaltCount();
+  return true;
+}
+
+void GdbStub::stopReply()
+{
+  uint16_t addr;
+  char buf[64];
+  switch (cpu->getStopReason(&addr)) {
+    case STOP_WATCH_READ:
+    case STOP_WATCH_WRITE: {
+      /* report the watchpoint by the address GDB knows it by */
+      uint32_t phys = toPhys(addr, false);
+      for (int i = 0; i < num_watches; i++) {
+        struct GdbWatch *w = &gdb_watches[i];
+        if (w->type >= 2 && phys >= w->phys && phys < w->phys + w->len) {
+          static const char *kinds[] = { "watch", "rwatch", "awatch" };
+          sprintf(buf, "T05%s:%x;", kinds[w->type - 2], w->addr);
+          putPacket(buf);
+          return;
+        }
+      }
+      putPacket("T05");
+      break;
+    }
+    case STOP_REQUEST:
+      putPacket("T02");
+      break;
+    default:
+      putPacket("T05");
+      break;
+  }
+}
+
+uint32_t GdbStub::toPhys(uint32_t addr, bool fetch)
+{
+  if (addr & GDB_BANK) {
+    if ((addr & 0xffff) < 0xc000)
+      return (uint32_t)-1;
+    return cpu->bankToPhys((addr >> 24) & 0x7f, (addr >> 16) & 0xff, addr & 0xffff);
+  }
+  if (addr >= 0x10000)
+    return (uint32_t)-1;
+  if (addr < 0xc000)
+    return addr;
+  if (fetch)
+    return cpu->bankToPhys(cpu->code_hi, cpu->code_lo, addr);
+  else
+    return cpu->bankToPhys(cpu->data_hi, cpu->data_lo, addr);
+}
+
+uint8_t *GdbStub::memPtr(uint32_t addr, bool *writable)
+{
+  *writable = false;
+  if (!(addr & GDB_BANK) && addr < 0xc000) {
+    /* I/O registers read back what was last written; writing them
+       would bypass the device behind them */
+    *writable = addr >= 0x18 && (addr < 0x200 || addr >= 0x300);
+    return &cpu->ram[addr];
+  }
+  /* memory packets see what the firmware's data accesses see */
+  uint32_t phys = toPhys(addr, false);
+  if (phys == (uint32_t)-1)
+    return NULL;
+  if (phys >= 0xcaf00000UL) {
+    if (!cpu->mapped_ram || phys - 0xcaf00000UL >= MAPPED_RAM_SIZE)
+      return NULL;
+    *writable = true;
+    return &cpu->mapped_ram[phys - 0xcaf00000UL];
+  }
+  else if (phys >= 0xbab00000UL) {
+    if (phys - 0xbab00000UL >= cpu->exrom_size)
+      return NULL;
+    return (uint8_t *)&cpu->exrom[phys - 0xbab00000UL];
+  }
+  else if (phys < cpu->rom_size)
+    return (uint8_t *)&cpu->rom[phys];
+  return NULL;
+}
+
+uint32_t GdbStub::getReg(int reg, int *bytes)
+{
+  *bytes = 1;
+  switch (reg) {
+    case GDB_REG_PC: *bytes = 2; return cpu->pc;
+    case GDB_REG_SP: *bytes = 2; return cpu->ram[0x18] | (cpu->ram[0x19] << 8);
+    case GDB_REG_PSW: return cpu->psw;
+    case GDB_REG_INT_MASK: return cpu->int_mask;
+    case GDB_REG_INT_MASK1: return cpu->int_mask1;
+    case GDB_REG_WSR: return cpu->wsr;
+    case GDB_REG_CODEMAP: *bytes = 2; return cpu->code_hi << 8 | cpu->code_lo;
+    case GDB_REG_DATAMAP: *bytes = 2; return cpu->data_hi << 8 | cpu->data_lo;
+    case GDB_REG_PHYSPC: *bytes = 4; return toPhys(cpu->pc, true);
+    default: *bytes = 0; return 0;
+  }
+}
+
+/* the mappings and WSR are left alone, changing them takes more than
+   setting the register */
+void GdbStub::setReg(int reg, uint32_t value)
+{
+  switch (reg) {
+    case GDB_REG_PC: cpu->pc = value; break;
+    case GDB_REG_SP:
+      cpu->ram[0x18] = value;
+      cpu->ram[0x19] = value >> 8;
+      cpu->dirty.mark(0x18 >> DIRTY_PAGE_SHIFT);
+      break;
+    case GDB_REG_PSW: cpu->psw = value; break;
+    case GDB_REG_INT_MASK: cpu->int_mask = value; break;
+    case GDB_REG_INT_MASK1: cpu->int_mask1 = value; break;
+    default: break;
+  }
+}
+
+/* Z0/Z1 are breakpoints, Z2 write, Z3 read and Z4 access watchpoints */
+bool GdbStub::insertWatch(int type, uint32_t addr, int len)
+{
+  static const int flags[] = {
+    WATCH_EXEC, WATCH_EXEC, WATCH_WRITE, WATCH_READ, WATCH_READ | WATCH_WRITE
+  };
+  if (type < 0 || type > 4)
+    return false;
+  uint32_t phys = toPhys(addr, type < 2);
+  if (phys == (uint32_t)-1)
+    return false;
+  if (type < 2)
+    len = 1;	/* the kind is an instruction length, we only need the start */
+  else if (len < 1)
+    len = 1;
+
+  if (num_watches == size_watches) {
+    size_watches = size_watches ? size_watches * 2 : 16;
+    gdb_watches = (struct GdbWatch *)realloc(gdb_watches, size_watches * sizeof(struct GdbWatch));
+  }
+  struct GdbWatch *w = &gdb_watches[num_watches++];
+  w->type = type;
+  w->addr = addr;
+  w->len = len;
+  w->phys = phys;
+  w->flags = flags[type] | WATCH_BREAK;
+  watchCommand("", w);
+  return true;
+}
+
+bool GdbStub::removeWatch(int type, uint32_t addr, int len)
+{
+  for (int i = 0; i < num_watches; i++) {
+    struct GdbWatch *w = &gdb_watches[i];
+    if (w->type == type && w->addr == addr && (type < 2 || w->len == len)) {
+      watchCommand("remove ", w);
+      memmove(w, w + 1, (num_watches - i - 1) * sizeof(struct GdbWatch));
+      num_watches--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void GdbStub::clearWatches()
+{
+  for (int i = 0; i < num_watches; i++)
+    watchCommand("remove ", &gdb_watches[i]);
+  num_watches = 0;
+}
+
+/* The watchpoint tables belong to the emulation thread, which may be
+   running any time the UI feels like it, so changes go through its
+   command queue. */
+void GdbStub::watchCommand(const char *verb, struct GdbWatch *w)
+{
+  char cmd[64];
+  sprintf(cmd, "gdb %s%s 0x%X-0x%X", verb, Watchpoints::flagString(w->flags),
+          w->phys, w->phys + w->len - 1);
+  /* the queue is short, and GDB may have many breakpoints to remove */
+  cpu->requestWatchCommand(cmd, 1000);
+}
+
+void GdbStub::syncWatches()
+{
+  /* the emulation thread carries out the commands it has taken before it
+     continues */
+  for (int ms = 0; cpu->watchCommandsPending() && ms < 1000; ms++)
+    os_msleep(1);
+}
+
+bool GdbStub::handlePacket()
+{
+  static char reply[GDB_PACKET_SIZE];
+  const char *p = pkt + 1;
+  char *r = reply;
+  uint32_t addr, len;
+
+  /* everything but resuming inspects the machine, which the emulation
+     thread must not be running for; the UI may have resumed it */
+  if (!cpu->isHalted() && strchr("gGpPmMZz", pkt[0])) {
+    putPacket("E01");
+    return true;
+  }
+
+  switch (pkt[0]) {
+    case '?':
+      stopReply();
+      break;
+
+    case 'g':
+      for (int i = 0; i < GDB_NUM_REGS; i++) {
+        int bytes;
+        uint32_t value = getReg(i, &bytes);
+        r = putHex(r, value, bytes);
+      }
+      putPacket(reply, r - reply);
+      break;
+    case 'G':
+      for (int i = 0; i < GDB_NUM_REGS; i++) {
+        int bytes;
+        uint32_t value;
+        getReg(i, &bytes);
+        if (!getHex(&p, &value, bytes))
+          break;
+        setReg(i, value);
+      }
+      putPacket("OK");
+      break;
+    case 'p': {
+      int bytes;
+      uint32_t value = getReg(strtoul(p, NULL, 16), &bytes);
+      if (!bytes) {
+        putPacket("E01");
+        break;
+      }
+      r = putHex(r, value, bytes);
+      putPacket(reply, r - reply);
+      break;
+    }
+    case 'P': {
+      char *end;
+      int reg = strtoul(p, &end, 16);
+      int bytes;
+      uint32_t value;
+      getReg(reg, &bytes);
+      p = end + 1;
+      if (!bytes || *end != '=' || !getHex(&p, &value, bytes)) {
+        putPacket("E01");
+        break;
+      }
+      setReg(reg, value);
+      putPacket("OK");
+      break;
+    }
+
+    case 'm':
+      if (sscanf(p, "%x,%x", &addr, &len) != 2) {
+        putPacket("E01");
+        break;
+      }
+      if (len > sizeof(reply) / 2)
+        len = sizeof(reply) / 2;
+      for (uint32_t i = 0; i < len; i++) {
+        bool writable;
+        uint8_t *m = memPtr(addr + i, &writable);
+        if (!m)
+          break;
+        r = putHex(r, *m, 1);
+      }
+      if (r == reply && len)
+        putPacket("E02");
+      else
+        putPacket(reply, r - reply);
+      break;
+    case 'M': {
+      if (sscanf(p, "%x,%x:", &addr, &len) != 2 || !(p = strchr(p, ':'))) {
+        putPacket("E01");
+        break;
+      }
+      p++;
+      bool ok = true;
+      for (uint32_t i = 0; i < len && ok; i++) {
+        bool writable;
+        uint32_t value;
+        uint8_t *m = memPtr(addr + i, &writable);
+        if (!m || !writable || !getHex(&p, &value, 1)) {
+          ok = false;
+          break;
+        }
+        *m = value;
+        /* keep the rewind history in the loop */
+        if (m >= cpu->mapped_ram && m < cpu->mapped_ram + MAPPED_RAM_SIZE)
+          cpu->dirty.markAddr(cpu->mapped_ram_page, m - cpu->mapped_ram);
+        else
+          cpu->dirty.mark((addr + i) >> DIRTY_PAGE_SHIFT);
+      }
+      putPacket(ok ? "OK" : "E03");
+      break;
+    }
+
+    case 'c':
+    case 's': {
+      if (!cpu->rom) {
+        putPacket("E01");
+        break;
+      }
+      if (*p && cpu->isHalted())
+        cpu->pc = strtoul(p, NULL, 16);
+      /* the breakpoints GDB has just inserted must be in place */
+      syncWatches();
+      uint32_t since = cpu->getHaltCount();
+      if (pkt[0] == 's')
+        cpu->step();
+      else
+        cpu->resume();
+      if (!waitHalt(since, false))
+        return false;
+      stopReply();
+      break;
+    }
+
+    case 'Z':
+    case 'z': {
+      int type;
+      if (sscanf(p, "%d,%x,%x", &type, &addr, &len) != 3) {
+        putPacket("E01");
+        break;
+      }
+      bool ok = pkt[0] == 'Z' ? insertWatch(type, addr, len) : removeWatch(type, addr, len);
+      putPacket(ok ? "OK" : "E01");
+      break;
+    }
+
+    case 'q':
+      if (!strncmp(p, "Supported", 9)) {
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+        putPacket(reply);
+      }
+      else if (!strncmp(p, "Xfer:features:read:target.xml:", 30)) {
+        if (sscanf(p + 30, "%x,%x", &addr, &len) != 2) {
+          putPacket("E01");
+          break;
+        }
+        uint32_t size = sizeof(target_xml) - 1;
+        if (addr > size)
+          addr = size;
+        if (len > sizeof(reply) - 2)
+          len = sizeof(reply) - 2;
+        if (len > size - addr)
+          len = size - addr;
+        reply[0] = addr + len < size ? 'm' : 'l';
+        memcpy(reply + 1, target_xml + addr, len);
+        putPacket(reply, len + 1);
+      }
+      else if (!strcmp(p, "Attached"))
+        putPacket("1");
+      else if (!strcmp(p, "C"))
+        putPacket("QC1");
+      else if (!strcmp(p, "fThreadInfo"))
+        putPacket("m1");
+      else if (!strcmp(p, "sThreadInfo"))
+        putPacket("l");
+      else
+        putPacket("");
+      break;
+    case 'Q':
+      if (!strcmp(p, "StartNoAckMode")) {
+        putPacket("OK");
+        no_ack = true;
+      }
+      else
+        putPacket("");
+      break;
+    case 'H':
+    case 'T':
+      putPacket("OK");	/* there is only one thread */
+      break;
+
+    case 'D':
+      putPacket("OK");
+      return false;
+    case 'k':
+      return false;
+
+    default:
+      /* unsupported, including vCont, which makes GDB use c and s */
+      putPacket("");
+      break;
+  }
+  return true;
+}
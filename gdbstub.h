@@ -0,0 +1,108 @@
+/*
+ * gdbstub.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _GDBSTUB_H
+#define _GDBSTUB_H
+
+#include <stdint.h>
+
+class Cpu;
+
+#define GDB_PACKET_SIZE 4096
+
+/* GDB addresses below 0x10000 are what the CPU sees, with the window at
+   0xc000 mapped as for instruction fetches (except for data watchpoints,
+   which use the data mapping). Any window address in any mapping can be
+   named with GDB_BANK | map_hi << 24 | map_lo << 16 | addr. */
+#define GDB_BANK 0x80000000UL
+
+/* registers as reported to GDB, see the target description in gdbstub.cpp;
+   the maps are map_hi << 8 | map_lo, physpc is virtToPhys(pc, 1) */
+#define GDB_REG_PC 0
+#define GDB_REG_SP 1
+#define GDB_REG_PSW 2
+#define GDB_REG_INT_MASK 3
+#define GDB_REG_INT_MASK1 4
+#define GDB_REG_WSR 5
+#define GDB_REG_CODEMAP 6
+#define GDB_REG_DATAMAP 7
+#define GDB_REG_PHYSPC 8
+#define GDB_NUM_REGS 9
+
+/* A GDB remote serial protocol server on a TCP port on the loopback
+   interface. Breakpoints and watchpoints are implemented with the
+   emulator's own (see Watchpoints), so the emulation is not slowed down
+   while no debugger is attached. Only one debugger at a time. */
+class GdbStub {
+public:
+  GdbStub(Cpu *cpu, int port);
+  ~GdbStub();
+
+private:
+  static int threadRunner(void *data);
+  void session();
+
+  /* returns the next byte from the debugger, -1 if it has gone away or we
+     are quitting, -2 if nothing arrived within timeout ms */
+  int getChar(int timeout);
+  /* reads a packet into pkt; returns false if the debugger has gone
+     away */
+  bool getPacket();
+  void putPacket(const char *data, int len = -1);
+  /* returns false if the debugger asked us to detach */
+  bool handlePacket();
+
+  /* waits for the emulation to come to a halt after halt count since,
+     forwarding Ctrl-C and, if insist is set, repeating the break request;
+     returns false if the debugger has gone away */
+  bool waitHalt(uint32_t since, bool insist);
+  void stopReply();
+
+  uint32_t toPhys(uint32_t addr, bool fetch);
+  uint8_t *memPtr(uint32_t addr, bool *writable);
+  uint32_t getReg(int reg, int *bytes);
+  void setReg(int reg, uint32_t value);
+
+  struct GdbWatch {
+    int type;
+    uint32_t addr;
+    int len;
+    uint32_t phys;
+    int flags;
+  };
+  bool insertWatch(int type, uint32_t addr, int len);
+  bool removeWatch(int type, uint32_t addr, int len);
+  void clearWatches();
+  /* queues "gdb <verb><flags> <range>" for the emulation thread */
+  void watchCommand(const char *verb, struct GdbWatch *w);
+  /* waits for the emulation thread to take the queued commands */
+  void syncWatches();
+
+  Cpu *cpu;
+  int listen_sock;
+  int sock;
+  bool no_ack;
+  bool quit;
+  void *thread;
+  /* halt count of the last halt we waited for, i.e. caused */
+  uint32_t our_halt;
+
+  char in_buf[GDB_PACKET_SIZE];
+  int in_pos, in_len;
+  char pkt[GDB_PACKET_SIZE];
+  int pkt_len;
+
+  /* the Z packets we have turned into Watchpoints */
+  struct GdbWatch *gdb_watches;
+  int num_watches;
+  int size_watches;
+};
+
+#endif
@@ -12,7 +12,9 @@ QT += network
 HEADERS += autotty.h \
            cpu.h \
            debug.h \
+           dirty.h \
            eeprom.h \
+           event.h \
            hints.h \
            hsio.h \
            iface.h \
@@ -21,12 +23,30 @@ HEADERS += autotty.h \
            iface_kl_tty.h \
            iface_kcan.h \
            iface_can.h \
+           iface_replay.h \
+           buslog.h \
+           latency.h \
            interface.h \
            keypad.h \
            lcd.h \
            os.h \
            ring.h \
            serial.h \
+           snapshot.h \
+           rewind.h \
+           codec.h \
+           framecheck.h \
+           profiler.h \
+           callstack.h \
+           trace.h \
+           disasm.h \
+           log.h \
+           memstats.h \
+           fuzz.h \
+           metrics.h \
+           watch.h \
+           memsearch.h \
+           gdbstub.h \
            state.h \
            ui.h \
 
@@ -34,7 +54,9 @@ SOURCES += autotty.cpp \
            cpu.cpp \
            cpu_emu.cpp \
            cpu_io.cpp \
+           dirty.cpp \
            eeprom.cpp \
+           event.cpp \
            hints.cpp \
            hsio.cpp \
            iface.cpp \
@@ -42,12 +64,31 @@ SOURCES += autotty.cpp \
            iface_kl_tty.cpp \
            iface_kcan.cpp \
            iface_can.cpp \
+           iface_replay.cpp \
+           buslog.cpp \
+           latency.cpp \
            keypad.cpp \
            lcd.cpp \
            main.cpp \
            os_qt.cpp \
            os_serial.cpp \
            serial.cpp \
+           snapshot.cpp \
+           rewind.cpp \
+           codec.cpp \
+           framecheck.cpp \
+           profiler.cpp \
+           callstack.cpp \
+           trace.cpp \
+           disasm.cpp \
+           log.cpp \
+           memstats.cpp \
+           fuzz.cpp \
+           metrics.cpp \
+           watch.cpp \
+           memsearch.cpp \
+           gdbstub.cpp \
+           state.cpp \
            ui.cpp
 
 QMAKE_CXXFLAGS += -I/usr/include/libusb-1.0
@@ -55,6 +96,7 @@ QMAKE_CXXFLAGS_WARN_ON += -Wno-unused
 
 linux-*-g++ {
   SOURCES += os_serial_linux.cpp os_linux.cpp
+  LIBS += -lrt
 }
 
 linux*arm*-g++ {
@@ -69,7 +111,7 @@ win32-g++* {
 
   RC_FILE += cascade.rc
   QMAKE_LIBDIR += $${PWD}/ftd2xx_win32 /lib
-  LIBS += -lsetupapi -liphlpapi -lftd2xx
+  LIBS += -lsetupapi -liphlpapi -lftd2xx -lws2_32
   QMAKE_CXXFLAGS_DEBUG += -mconsole
 }
 
@@ -83,7 +125,51 @@ QMAKE_CXXFLAGS_DEBUG += -O3
   HEADERS += iface_kl_ftdi.h
 }
 
+memstats {
+  DEFINES += MEMSTATS
+}
+
+# microbenchmarks instead of the emulator, see bench.cpp
+bench {
+  TARGET = cascade-bench
+  DEFINES += BENCHMARK
+  SOURCES -= main.cpp
+  SOURCES += bench.cpp
+}
+
+# K-line timing harness instead of the emulator, see kltiming.cpp
+kltiming {
+  TARGET = cascade-kltiming
+  SOURCES -= main.cpp
+  SOURCES += kltiming.cpp
+  LIBS += -lutil
+}
+
+# serial reply fuzzer instead of the emulator, see fuzzer.cpp
+fuzz {
+  TARGET = cascade-fuzz
+  DEFINES += FUZZ
+  SOURCES -= main.cpp
+  SOURCES += fuzzer.cpp
+}
+
+!synclog {
+  DEFINES += ASYNC_LOG
+}
+
 !nozlib {
   LIBS += -lz
   DEFINES += EVENT_COMPRESSED
 }
+
+# offline ROM disassembler instead of the emulator, see romdis.cpp; last,
+# so that it replaces everything the blocks above add
+romdis {
+  TARGET = cascade-romdis
+  CONFIG -= qt
+  CONFIG += console
+  HEADERS = codeflow.h debug.h disasm.h
+  SOURCES = romdis.cpp codeflow.cpp disasm.cpp
+  LIBS =
+  DEFINES =
+}
@@ -41,6 +41,10 @@ public:
   virtual void sendSlowInit(uint8_t target);
   virtual void slowInitImminent();
 
+  virtual const char *name() {
+    return "elm";
+  }
+
 protected:
   int *getObdReply();
   void sendObdMessage();
@@ -12,6 +12,7 @@
 #include "os.h"
 #include "serial.h"
 #include "autotty.h"
+#include "metrics.h"
 
 IfaceCAN::IfaceCAN(Cpu *c, UI *ui, AutoTTY* atty) : Interface(ui)
 {
@@ -91,6 +92,7 @@ int IfaceCAN::readThreadRunner(void *data)
   int rx_data_ptr = 0;
   for (;;) {
     int count = iface->atty->readToBuffer(&byte, 1);
+    metrics->iface_wakeups++;
     if (count == 1) {
       if (state == RDST_IDLE) {
         DEBUG(IFACE, "rx msg type %02X\n", byte);
@@ -40,6 +40,10 @@ public:
   
   virtual void sendByte(uint8_t byte);
 
+  virtual const char *name() {
+    return "can";
+  }
+
 private:
   void msgIn();
   void msgOut();
@@ -12,6 +12,7 @@
 #include "debug.h"
 #include "os.h"
 #include "serial.h"
+#include "fuzz.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -23,9 +24,27 @@ IfaceFake::IfaceFake(Cpu *c, UI *ui) : Interface(ui)
   in_buf_start = in_buf_end = 0;
   cpu = c;
   hyundai = true;
+#ifdef FUZZ
+  fuzz = NULL;
+#endif
   ui->setPort("FAKE");
 }
 
+void IfaceFake::reset()
+{
+  astate = FAKE_ASTATE_IDLE;
+  obd_ptr = can_ptr = 0;
+  delay = 0;
+  baud_divisor = serial->getBaudDivisor();
+}
+
+#ifdef FUZZ
+void IfaceFake::setFuzz(Fuzz *fuzz)
+{
+  this->fuzz = fuzz;
+}
+#endif
+
 static int obd_replies[][2][200] = {
   /* Hyundai keep-alive */
   {{0x68, 0x6a, 0xf1, 0x01, 0x01, 0xc5, -1}, {0x48, 0x6b, 0x12, 0x41, 0x01, 0x01, 0x04, 0x00, 0x00, 0x0c, -1}},
@@ -214,8 +233,13 @@ void IfaceFake::checkInput()
   }
   else if (astate == FAKE_ASTATE_OBD_ANSWERING) {
     obd_reply = get_obd_reply(obd_request);
-    serial->addRxData(obd_reply);
     astate = FAKE_ASTATE_IDLE;
+#ifdef FUZZ
+    /* the fuzzer replies instead */
+    if (fuzz && fuzz->replyPoint(obd_reply))
+      return;
+#endif
+    serial->addRxData(obd_reply);
   }
   else if (astate == FAKE_ASTATE_SLOW_INIT_KW_SENT) {
     DEBUG(IFACE, "IFACE adding slow init msg\n");
@@ -303,9 +327,13 @@ void IfaceFake::checkInput()
         can_reply[14] = -1;
         break;
     };
+    astate = FAKE_ASTATE_IDLE;
+#ifdef FUZZ
+    if (fuzz && fuzz->replyPoint(can_reply))
+      return;
+#endif
     serial->addRxData(can_reply);
     //serial->addRxData(can_reply + 1);
-    astate = FAKE_ASTATE_IDLE;
   }
 }
 
@@ -31,6 +31,7 @@ typedef enum {
 
 class Serial;
 class Cpu;
+class Fuzz;
 
 class IfaceFake : public Interface {
 public:
@@ -44,6 +45,18 @@ public:
   virtual void sendSlowInit(uint8_t target);
   virtual void slowInitImminent();
 
+  virtual const char *name() {
+    return "fake";
+  }
+
+  /* forgets about any exchange in progress; for when the machine state
+     has been restored behind the interface's back */
+  void reset();
+#ifdef FUZZ
+  /* lets the fuzzer take over at a reply point (see Fuzz) */
+  void setFuzz(Fuzz *fuzz);
+#endif
+
 private:
   bool isInInputBuffer(uint8_t byte);
   char *getInputBuffer();
@@ -72,6 +85,10 @@ private:
   int can_length;
   int can_ptr;
   int can_message[128];
+
+#ifdef FUZZ
+  Fuzz *fuzz;
+#endif
 };
 
 #endif
@@ -38,6 +38,11 @@ public:
        are rumored to have is definitely absent on the K+CAN */
   }
 
+  /* that of the interface for the current mode */
+  virtual const char *name() {
+    return iface->name();
+  }
+
 private:
   bool can_enabled;
   Cpu *cpu;
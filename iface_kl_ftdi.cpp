@@ -14,6 +14,7 @@
 #include "serial.h"
 #include "cpu.h"
 #include "os.h"
+#include "metrics.h"
 
 IfaceKLFTDI::IfaceKLFTDI(Cpu *cpu, UI *ui, bool sampling) : IfaceKL(ui)
 {
@@ -152,6 +153,7 @@ int IfaceKLFTDI::readThreadRunner(void *data)
     else {
       /* regular byte-wise serial port'ing */
       count = ftdi_read_data(&iface->ftdic, &byte, 1);
+      metrics->iface_wakeups++;
       if (count == 1) {
         DEBUG(IFACE, "runner found a byte: %02X\n", byte);
         /* only add it if we haven't been disabled in the meantime */
@@ -160,9 +162,12 @@ int IfaceKLFTDI::readThreadRunner(void *data)
             /* remove this byte from the echo buffer and ignore it */
             iface->echo_buf->consume();
             DEBUG(IFACE, "ignoring echo %02X\n", byte);
+            metrics->echo_cancelled++;
           }
           else {
             iface->serial->addRxData(byte);
+            if (!iface->echo_buf->empty())
+              metrics->echo_mismatches++;
             DEBUG(IFACE, "byte received: %02X", byte);
             if (!iface->echo_buf->empty())
               DEBUG(IFACE, " (echo buf %02X)", iface->echo_buf->snoop());
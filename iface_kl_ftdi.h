@@ -28,6 +28,10 @@ public:
   virtual int getRxState();
   
   virtual void setRxBitbang(bool);
+
+  virtual const char *name() {
+    return "ftdi";
+  }
   
 protected:
   virtual void setBitbang(bool);
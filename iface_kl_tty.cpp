@@ -15,6 +15,7 @@
 #include "serial.h"
 #include "cpu.h"
 #include "autotty.h"
+#include "metrics.h"
 
 IfaceKLTTY::IfaceKLTTY(Cpu *cpu, UI *ui, const char *driver) : IfaceKL(ui)
 {
@@ -108,15 +109,19 @@ int IfaceKLTTY::readThreadRunner(void *data)
       continue;
     }
     count = iface->atty->readToBuffer(&byte, 1);
+    metrics->iface_wakeups++;
     if (count == 1) {
       DEBUG(IFACE, "runner found a byte: %02X\n", byte);
       if (!iface->echo_buf->empty() && iface->echo_buf->snoop() == byte) {
         /* remove this byte from the echo buffer and ignore it */
         iface->echo_buf->consume();
         DEBUG(IFACE, "ignoring echo %02X\n", byte);
+        metrics->echo_cancelled++;
       }
       else if (!iface->ignore_breaks || byte != 0) {
         iface->serial->addRxData(byte);
+        if (!iface->echo_buf->empty())
+          metrics->echo_mismatches++;
         DEBUG(IFACE, "byte received: %02X", byte);
         if (!iface->echo_buf->empty()) {
           DEBUG(IFACE, " (echo buf %02X)", iface->echo_buf->snoop());
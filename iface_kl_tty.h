@@ -29,6 +29,10 @@ public:
   
   virtual void setL(uint8_t bit);
 
+  virtual const char *name() {
+    return "kl";
+  }
+
 private:
   void init();
   static int readThreadRunner(void *data);
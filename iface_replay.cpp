@@ -0,0 +1,137 @@
+/*
+ * iface_replay.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "iface_replay.h"
+#include "debug.h"
+#include "serial.h"
+#include "ui.h"
+#include <stdlib.h>
+
+IfaceReplay::IfaceReplay(Cpu *c, UI *ui, const char *capture, double time_scale) : Interface(ui)
+{
+  cpu = c;
+  this->time_scale = time_scale;
+  baud_divisor = 0;
+  pos = 0;
+  requests = mismatches = dropped = 0;
+  at_end = false;
+  entries = buslog_load(capture, &num_entries);
+  if (!entries) {
+    /* behave like a vehicle that never answers */
+    num_entries = 0;
+  }
+  /* anything the vehicle sent before the first request is timed relative
+     to the start of the capture */
+  trigger_capture = num_entries ? entries[0].cycles : 0;
+  trigger_cycles = cpu->getCycles();
+  ui->setPort("REPLAY");
+}
+
+IfaceReplay::~IfaceReplay()
+{
+  ERROR("bus replay: %d requests, %d mismatched, %d response bytes dropped, %d of %d entries left\n",
+        requests, mismatches, dropped, num_entries - pos, num_entries);
+  if (entries)
+    free(entries);
+}
+
+void IfaceReplay::setBaudDivisor(int divisor)
+{
+  if (baud_divisor != divisor) {
+    baud_divisor = divisor;
+    serial->flushRxBuf();
+  }
+  ui->setBaudrate(cpu->serDivToBaud(divisor), cpu->serDivToBaud(divisor));
+}
+
+/* returns the position of the next request of the given type that starts
+   with the given value, -1 if there is none */
+int IfaceReplay::findRequest(char type, uint8_t value)
+{
+  for (int i = pos; i < num_entries; i++) {
+    if (entries[i].type == type && entries[i].value == value &&
+        (i == 0 || entries[i - 1].type != BUSLOG_TX))
+      return i;
+  }
+  return -1;
+}
+
+bool IfaceReplay::expect(char type, uint8_t value)
+{
+  /* the firmware did not wait for the rest of the response */
+  while (pos < num_entries && entries[pos].type == BUSLOG_RX) {
+    dropped++;
+    pos++;
+  }
+
+  if (pos < num_entries && entries[pos].type == type && entries[pos].value == value) {
+    /* a byte following another one sent is part of the same request */
+    if (type != BUSLOG_TX || pos == 0 || entries[pos - 1].type != BUSLOG_TX)
+      requests++;
+  }
+  else {
+    mismatches++;
+    if (pos >= num_entries) {
+      if (!at_end)
+        ERROR("bus replay: end of capture reached\n");
+      at_end = true;
+      return false;
+    }
+    ERROR("bus replay: expected %c %02X at cycle %llu, got %c %02X\n",
+          entries[pos].type, entries[pos].value,
+          (unsigned long long)entries[pos].cycles, type, value);
+    /* resynchronize with the next request that starts like this */
+    int next = findRequest(type, value);
+    if (next < 0)
+      return false;
+    requests++;
+    pos = next;
+  }
+
+  trigger_capture = entries[pos].cycles;
+  trigger_cycles = cpu->getCycles();
+  pos++;
+  return true;
+}
+
+void IfaceReplay::sendByte(uint8_t byte)
+{
+  DEBUG(IFACE, "IFACE replay: byte sent %02X\n", byte);
+  expect(BUSLOG_TX, byte);
+}
+
+void IfaceReplay::sendSlowInit(uint8_t target)
+{
+  DEBUG(IFACE, "IFACE replay: slow init to %02X\n", target);
+  expect(BUSLOG_SLOW_INIT, target);
+}
+
+void IfaceReplay::slowInitImminent()
+{
+}
+
+void IfaceReplay::checkInput()
+{
+  while (pos < num_entries && entries[pos].type == BUSLOG_RX) {
+    if (time_scale > 0) {
+      /* the reader thread may have logged a response a tad before the
+         request */
+      uint64_t delta = entries[pos].cycles > trigger_capture ?
+                       entries[pos].cycles - trigger_capture : 0;
+      uint64_t due = trigger_cycles + (uint64_t)(delta * time_scale);
+      if (cpu->getCycles() < due)
+        return;
+    }
+    else if (!serial->rxBufEmpty())
+      return;
+    serial->addRxData(entries[pos].value);
+    pos++;
+  }
+}
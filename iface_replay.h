@@ -0,0 +1,68 @@
+/*
+ * iface_replay.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _IFACE_REPLAY_H_
+#define _IFACE_REPLAY_H_
+
+#include <stdint.h>
+#include "cpu.h"
+#include "interface.h"
+#include "buslog.h"
+
+class Serial;
+class Cpu;
+
+/* Plays back a bus capture (see buslog.h) as if it came from the vehicle.
+   The firmware's requests are checked against the captured ones, and the
+   captured responses are sent with their original timing relative to the
+   end of the request, multiplied by time_scale. With a time scale of 0,
+   each response byte is sent as soon as the firmware has read the
+   previous one. */
+class IfaceReplay : public Interface {
+public:
+  IfaceReplay(Cpu *p, UI *ui, const char *capture, double time_scale);
+  virtual ~IfaceReplay();
+
+  virtual void setBaudDivisor(int divisor);
+
+  virtual void checkInput();
+  virtual void sendByte(uint8_t byte);
+
+  virtual void sendSlowInit(uint8_t target);
+  virtual void slowInitImminent();
+
+  virtual const char *name() {
+    return "replay";
+  }
+
+private:
+  bool expect(char type, uint8_t value);
+  int findRequest(char type, uint8_t value);
+
+  Cpu *cpu;
+  BusLogEntry *entries;
+  int num_entries;
+  int pos;		/* next entry to be sent or expected */
+  double time_scale;
+  int baud_divisor;
+
+  /* capture and emulation time of the last request byte; responses are
+     timed relative to these */
+  uint64_t trigger_capture;
+  uint64_t trigger_cycles;
+
+  /* statistics */
+  int requests;
+  int mismatches;
+  int dropped;
+  bool at_end;
+};
+
+#endif
@@ -59,6 +59,11 @@ public:
   
   virtual void setRxBitbang(bool) {
   }
+
+  /* the interface type as given to option -i, for statistics */
+  virtual const char *name() {
+    return "unknown";
+  }
   
 protected:
   Serial *serial;
@@ -11,6 +11,9 @@
 #include "keypad.h"
 #include "ui.h"
 
+/* how far the rewind key goes back */
+#define REWIND_KEY_SECONDS 5
+
 Keypad::Keypad(Cpu *cpu, UI *ui)
 {
   this->cpu = cpu;
@@ -18,6 +21,22 @@ Keypad::Keypad(Cpu *cpu, UI *ui)
   key[0] = key[1] = key[2] = key[3] = 0x7f;
 }
 
+/* keys that control the emulator rather than the emulated machine */
+static bool isCommandKey(int key)
+{
+  switch (key) {
+    case UIKEY_F7 ... UIKEY_F11:
+    case UIKEY_s:
+    case UIKEY_l:
+    case UIKEY_m:
+    case UIKEY_t:
+    case UIKEY_w:
+      return true;
+    default:
+      return false;
+  }
+}
+
 void Keypad::update()
 {
   struct Event e;
@@ -40,8 +59,15 @@ void Keypad::update()
           break;
         }
       }
-      if (!found_event && !ui->pollEvent(e))
-        break;
+      if (!found_event) {
+        if (!ui->pollEvent(e))
+          break;
+        /* in deterministic mode, the machine only gets recorded input;
+           when re-executing after a rewind, live input would be missing
+           from the rewind history */
+        if ((cpu->isDeterministic() || cpu->isRewinding()) && !isCommandKey(e.value))
+          continue;
+      }
     }
     else {
       if (!ui->pollEvent(e))
@@ -62,6 +88,7 @@ void Keypad::update()
           DEBUG(WARN, "NMI triggered!\n");
           cpu->push16(cpu->pc);
           cpu->pc = cpu->memRead16(0x203e);
+          cpu->traceCall(0, true);
           //debug_level |= DEBUG_TRACE | DEBUG_MEM;
           break;
         case UIKEY_LSHIFT:
@@ -144,6 +171,10 @@ void Keypad::update()
           cpu->sendCommand(CPU_CMD_PLAY); break;
         case UIKEY_F9:
           cpu->sendCommand(CPU_CMD_STOP_RECPLAY); break;
+        case UIKEY_F11:
+          cpu->sendCommand(CPU_CMD_FAST_FORWARD); break;
+        case UIKEY_w:
+          cpu->requestRewind(REWIND_KEY_SECONDS); break;
 #ifdef LATENCY
         case UIKEY_l:
           cpu->do_latency = true;
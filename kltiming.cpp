@@ -0,0 +1,475 @@
+/*
+ * kltiming.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+/* K-line timing accuracy harness; built instead of the emulator with
+   CONFIG+=kltiming ("make kltiming"), Linux only.
+
+   A synthetic ROM sends fixed-length messages through the serial port the
+   way a tester does: write a byte, poll SP_STAT until it has gone out,
+   wait P4, next byte, and wait P3 after the last one. IfaceKLTTY talks to
+   the slave side of a pseudo-terminal; on the master side, a reader
+   thread timestamps every byte as it comes out and sends it back, like
+   the echo on a real K-line.
+
+   The time the firmware intended a byte to go out is the cycle count at
+   which it wrote it to SBUF (the bus capture has it), i.e. its TI time
+   (ti_set_time in Serial) less the constant time it takes to send it. For
+   consecutive bytes, the actual gap is compared with the intended one,
+   converted to host time at the emulated clock rate. The distribution of
+   the errors is reported for gaps inside messages (P4) and between them
+   (P3), for each configuration given; with -o, the individual gaps are
+   written to a CSV file.
+
+   usage: cascade-kltiming [-n messages] [-l length] [-4 P4 ms] [-3 P3 ms]
+                           [-o file] [configuration...]
+
+   A configuration is a comma-separated list of
+     exact     paced as usual (the default)
+     unpaced   not paced at all (deterministic mode)
+     load=<n>  <n> threads competing for the host CPUs
+     rt        real-time scheduling for the emulation thread
+   for instance "exact,load=4" or "unpaced". */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pty.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/select.h>
+#include "os.h"
+#include "debug.h"
+#include "cpu.h"
+#include "ui.h"
+#include "buslog.h"
+#include "iface_kl_tty.h"
+
+uint32_t debug_level;
+uint32_t debug_level_unabridged;
+FILE *win_stderr;
+
+#define KL_ROM_NAME "kltiming.rom"
+#define KL_ROM_SIZE 0x40000
+#define KL_CAPTURE_NAME "kltiming.cap"
+#define KL_LOOP 0x2100
+#define KL_MESSAGE 0x2200
+/* approximate state times per iteration of the delay loops; the intended
+   gaps are taken from the actual cycle counts anyway */
+#define KL_DELAY_STATES 13
+
+/* at the reset vector: serial port on at 10400 baud */
+static const uint8_t setup_code[] = {
+  0xb1, 0x20, 0x30,		/* 2080: LDB 30h, #20h */
+  0xc4, 0x16, 0x30,		/* 2083: STB 30h, 16h (IOC1) */
+  0xb1, 0x77, 0x30,		/* 2086: LDB 30h, #77h */
+  0xc4, 0x0e, 0x30,		/* 2089: STB 30h, 0Eh (BAUD_RATE) */
+  0xb1, 0x80, 0x30,		/* 208c: LDB 30h, #80h */
+  0xc4, 0x0e, 0x30,		/* 208f: STB 30h, 0Eh (BAUD_RATE) */
+  0xb1, 0x09, 0x30,		/* 2092: LDB 30h, #09h */
+  0xc4, 0x11, 0x30,		/* 2095: STB 30h, 11h (SP_CON) */
+  0xe7, 0x65, 0x00,		/* 2098: LJMP 2100h */
+};
+
+/* the message loop; the length and the delays are patched in */
+#define KL_LEN_OFFSET 5
+#define KL_P4_OFFSET 0x14
+#define KL_P3_OFFSET 0x21
+static const uint8_t loop_code[] = {
+  0xa1, 0x00, 0x22, 0x40,	/* 2100: LD 40h, #2200h */
+  0xb1, 0x00, 0x42,		/* 2104: LDB 42h, #length */
+  0xb2, 0x41, 0x30,		/* 2107: LDB 30h, [40h]+ */
+  0xc4, 0x07, 0x30,		/* 210a: STB 30h, 07h (SBUF) */
+  0xb0, 0x11, 0x31,		/* 210d: LDB 31h, 11h (SP_STAT) */
+  0x35, 0x31, 0xfa,		/* 2110: JBC 31h, 5, 210Dh */
+  0xa1, 0x00, 0x00, 0x44,	/* 2113: LD 44h, #P4 */
+  0x69, 0x01, 0x00, 0x44,	/* 2117: SUB 44h, #1 */
+  0xd7, 0xfa,			/* 211b: JNE 2117h */
+  0xe0, 0x42, 0xe7,		/* 211d: DJNZ 42h, 2107h */
+  0xa1, 0x00, 0x00, 0x44,	/* 2120: LD 44h, #P3 */
+  0x69, 0x01, 0x00, 0x44,	/* 2124: SUB 44h, #1 */
+  0xd7, 0xfa,			/* 2128: JNE 2124h */
+  0x27, 0xd4,			/* 212a: SJMP 2100h */
+};
+
+struct Config {
+  char *name;
+  bool paced;
+  int load;
+  bool rt;
+};
+
+/* the master side of the pseudo-terminal */
+struct FarSide {
+  int fd;
+  volatile bool quit;
+  uint64_t *times;
+  uint8_t *bytes;
+  volatile int count;
+  int max;
+};
+
+static bool rt_requested;
+static volatile bool load_quit;
+static volatile uint32_t load_sink;
+
+static bool parseConfig(const char *spec, struct Config *c)
+{
+  c->name = strdup(spec);
+  c->paced = true;
+  c->load = 0;
+  c->rt = false;
+  char *s = strdup(spec);
+  bool ok = true;
+  for (char *w = strtok(s, ","); w; w = strtok(NULL, ",")) {
+    if (!strcmp(w, "exact"))
+      c->paced = true;
+    else if (!strcmp(w, "unpaced"))
+      c->paced = false;
+    else if (!strncmp(w, "load=", 5))
+      c->load = atoi(w + 5);
+    else if (!strcmp(w, "rt"))
+      c->rt = true;
+    else {
+      ERROR("unknown configuration item %s\n", w);
+      ok = false;
+    }
+  }
+  free(s);
+  return ok;
+}
+
+static bool writeRom(int length, int p4_ms, int p3_ms, uint32_t clock)
+{
+  uint8_t *rom = (uint8_t *)calloc(KL_ROM_SIZE, 1);
+  memcpy(rom + 0x2080, setup_code, sizeof(setup_code));
+  memcpy(rom + KL_LOOP, loop_code, sizeof(loop_code));
+  /* one state time is 2 clock cycles */
+  uint32_t p4 = (uint64_t)p4_ms * clock / 2 / 1000 / KL_DELAY_STATES;
+  uint32_t p3 = (uint64_t)p3_ms * clock / 2 / 1000 / KL_DELAY_STATES;
+  p4 = p4 < 1 ? 1 : p4 > 0xffff ? 0xffff : p4;
+  p3 = p3 < 1 ? 1 : p3 > 0xffff ? 0xffff : p3;
+  rom[KL_LOOP + KL_LEN_OFFSET] = length;
+  rom[KL_LOOP + KL_P4_OFFSET] = p4 & 0xff;
+  rom[KL_LOOP + KL_P4_OFFSET + 1] = p4 >> 8;
+  rom[KL_LOOP + KL_P3_OFFSET] = p3 & 0xff;
+  rom[KL_LOOP + KL_P3_OFFSET + 1] = p3 >> 8;
+  /* something like a KWP2000 request with a checksum */
+  uint8_t sum = 0;
+  for (int i = 0; i < length; i++) {
+    uint8_t b = i == length - 1 ? sum : 0x80 + i;
+    rom[KL_MESSAGE + i] = b;
+    sum += b;
+  }
+  FILE *fp = fopen(KL_ROM_NAME, "wb");
+  if (!fp) {
+    ERROR("failed to create %s\n", KL_ROM_NAME);
+    free(rom);
+    return false;
+  }
+  bool ok = fwrite(rom, KL_ROM_SIZE, 1, fp) == 1;
+  fclose(fp);
+  free(rom);
+  return ok;
+}
+
+static int farSideRunner(void *data)
+{
+  struct FarSide *far = (struct FarSide *)data;
+  while (!far->quit) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(far->fd, &fds);
+    struct timeval tv = { 0, 100000 };
+    if (select(far->fd + 1, &fds, NULL, NULL, &tv) <= 0)
+      continue;
+    uint8_t buf[64];
+    int n = read(far->fd, buf, sizeof(buf));
+    uint64_t now = os_ntime();
+    if (n <= 0)
+      continue;
+    for (int i = 0; i < n && far->count < far->max; i++) {
+      far->times[far->count] = now;
+      far->bytes[far->count] = buf[i];
+      far->count++;
+    }
+    /* the K-line echoes everything */
+    if (write(far->fd, buf, n) != n)
+      ERROR("far side failed to echo\n");
+  }
+  return 0;
+}
+
+static int loadRunner(void *data)
+{
+  uint32_t x = 0;
+  while (!load_quit)
+    x++;
+  load_sink = x;
+  return 0;
+}
+
+static int emuRunner(void *data)
+{
+  if (rt_requested) {
+    struct sched_param p;
+    p.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &p))
+      ERROR("could not switch to real-time scheduling\n");
+  }
+  return ((Cpu *)data)->emulate();
+}
+
+struct Gap {
+  bool p3;		/* between messages */
+  double intended_us;
+  double actual_us;
+};
+
+/* runs one configuration; returns the gaps between the bytes, NULL on
+   error */
+static struct Gap *runConfig(UI *ui, struct Config *c, int messages, int length,
+                             int p4_ms, int p3_ms, int *num_gaps)
+{
+  int master, slave;
+  char slave_name[256];
+  if (openpty(&master, &slave, slave_name, NULL, NULL) < 0) {
+    ERROR("failed to create a pseudo-terminal\n");
+    return NULL;
+  }
+
+  struct FarSide far;
+  far.fd = master;
+  far.quit = false;
+  far.count = 0;
+  far.max = messages * length;
+  far.times = (uint64_t *)calloc(far.max, sizeof(uint64_t));
+  far.bytes = (uint8_t *)calloc(far.max, 1);
+  void *far_thread = os_create_thread(farSideRunner, &far);
+
+  uint32_t clock;
+  {
+    Cpu cpu(ui);
+    ui->setCpu(&cpu);
+    clock = cpu.getClock();
+    Interface *iface = new IfaceKLTTY(&cpu, ui, slave_name);
+    cpu.setSerial(iface, false);
+    cpu.enableBusCapture(KL_CAPTURE_NAME);
+    bool ok = writeRom(length, p4_ms, p3_ms, clock) && cpu.loadRom(KL_ROM_NAME);
+    unlink(KL_ROM_NAME);
+    if (!ok) {
+      delete iface;
+      far.quit = true;
+      os_wait_thread(far_thread, NULL);
+      close(master);
+      close(slave);
+      free(far.times);
+      free(far.bytes);
+      return NULL;
+    }
+    if (!c->paced)
+      cpu.setDeterministic(1);
+
+    /* give the interface time to open the TTY, or it drops the first
+       bytes */
+    os_msleep(200);
+
+    load_quit = false;
+    void **load_threads = (void **)calloc(c->load + 1, sizeof(void *));
+    for (int i = 0; i < c->load; i++)
+      load_threads[i] = os_create_thread(loadRunner, NULL);
+    rt_requested = c->rt;
+
+    void *emu_thread = os_create_thread(emuRunner, &cpu);
+    /* that should be plenty */
+    unsigned int timeout = os_mtime() + 5000 +
+                           messages * (p3_ms + length * (p4_ms + 2)) * 3;
+    while (far.count < far.max && (int)(timeout - os_mtime()) > 0)
+      os_msleep(10);
+    cpu.sendCommand(CPU_CMD_EXIT);
+    os_wait_thread(emu_thread, NULL);
+
+    load_quit = true;
+    for (int i = 0; i < c->load; i++)
+      os_wait_thread(load_threads[i], NULL);
+    free(load_threads);
+    delete iface;
+  }
+  /* the EEPROM has been saved next to the ROM */
+  unlink(KL_ROM_NAME ".eep");
+  far.quit = true;
+  os_wait_thread(far_thread, NULL);
+  close(master);
+  close(slave);
+
+  int count;
+  BusLogEntry *log = buslog_load(KL_CAPTURE_NAME, &count);
+  unlink(KL_CAPTURE_NAME);
+  if (!log) {
+    free(far.times);
+    free(far.bytes);
+    return NULL;
+  }
+
+  struct Gap *gaps = (struct Gap *)calloc(far.max, sizeof(struct Gap));
+  *num_gaps = 0;
+  int sent = 0;
+  uint64_t last_cycles = 0;
+  for (int i = 0; i < count && sent < far.count; i++) {
+    if (log[i].type != BUSLOG_TX)
+      continue;
+    if (log[i].value != far.bytes[sent]) {
+      ERROR("%s: byte %d is %02X, but %02X was sent\n", c->name, sent,
+            far.bytes[sent], log[i].value);
+      break;
+    }
+    if (sent) {
+      struct Gap *g = &gaps[(*num_gaps)++];
+      g->p3 = sent % length == 0;
+      g->intended_us = (log[i].cycles - last_cycles) * 2e6 / clock;
+      g->actual_us = (far.times[sent] - far.times[sent - 1]) / 1e3;
+    }
+    last_cycles = log[i].cycles;
+    sent++;
+  }
+  if (sent < far.max)
+    ERROR("%s: only %d of %d bytes came through\n", c->name, sent, far.max);
+  free(log);
+  free(far.times);
+  free(far.bytes);
+  return gaps;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, const char *kind, struct Gap *gaps, int num, bool p3)
+{
+  double *err = (double *)malloc((num + 1) * sizeof(double));
+  int n = 0;
+  double intended = 0, sum = 0, sq = 0;
+  for (int i = 0; i < num; i++) {
+    if (gaps[i].p3 != p3)
+      continue;
+    err[n] = gaps[i].actual_us - gaps[i].intended_us;
+    intended += gaps[i].intended_us;
+    sum += err[n];
+    sq += err[n] * err[n];
+    n++;
+  }
+  if (!n) {
+    free(err);
+    return;
+  }
+  qsort(err, n, sizeof(double), compareDouble);
+  double mean = sum / n;
+  double sd = n > 1 ? sqrt((sq - sum * sum / n) / (n - 1)) : 0;
+#define PCT(p) err[(int)((n - 1) * (p))]
+  printf("%-24s %-3s %6d %9.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f\n",
+         name, kind, n, intended / n, mean, sd, err[0], PCT(0.5), PCT(0.9),
+         PCT(0.99), err[n - 1]);
+#undef PCT
+  free(err);
+}
+
+int main(int argc, char **argv)
+{
+  int messages = 100;
+  int length = 6;
+  int p4_ms = 5;
+  int p3_ms = 55;
+  const char *out_name = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "n:l:4:3:o:")) != -1) {
+    switch (c) {
+      case 'n':
+        messages = atoi(optarg);
+        break;
+      case 'l':
+        length = atoi(optarg);
+        break;
+      case '4':
+        p4_ms = atoi(optarg);
+        break;
+      case '3':
+        p3_ms = atoi(optarg);
+        break;
+      case 'o':
+        out_name = optarg;
+        break;
+      default:
+        ERROR("usage: %s [-n messages] [-l length] [-4 P4 ms] [-3 P3 ms] [-o file] [configuration...]\n", argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (messages < 2)
+    messages = 2;
+  if (length < 2 || length > 255)
+    length = 6;
+
+  int num_configs = argc ? argc : 1;
+  struct Config *configs = (struct Config *)calloc(num_configs, sizeof(struct Config));
+  for (int i = 0; i < num_configs; i++) {
+    if (!parseConfig(argc ? argv[i] : "exact", &configs[i]))
+      return 1;
+  }
+
+  FILE *out = NULL;
+  if (out_name) {
+    out = fopen(out_name, "w");
+    if (!out) {
+      ERROR("failed to create %s\n", out_name);
+      return 1;
+    }
+    fprintf(out, "config,kind,intended_us,actual_us\n");
+  }
+
+  /* quiet, except for errors */
+  debug_level = 0;
+
+  UI::initToolkit();
+  UI ui;
+  ui.hide();
+
+  printf("%d messages of %d bytes, P4 %d ms, P3 %d ms; errors (actual - intended gap) in us\n",
+         messages, length, p4_ms, p3_ms);
+  printf("%-24s %-3s %6s %9s %8s %8s %8s %8s %8s %8s %8s\n", "configuration", "gap",
+         "count", "intended", "mean", "stddev", "min", "median", "p90", "p99", "max");
+  int failed = 0;
+  for (int i = 0; i < num_configs; i++) {
+    int num;
+    struct Gap *gaps = runConfig(&ui, &configs[i], messages, length, p4_ms, p3_ms, &num);
+    if (!gaps) {
+      ERROR("%s failed\n", configs[i].name);
+      failed++;
+      continue;
+    }
+    report(configs[i].name, "P4", gaps, num, false);
+    report(configs[i].name, "P3", gaps, num, true);
+    for (int j = 0; out && j < num; j++) {
+      fprintf(out, "\"%s\",%s,%.1f,%.1f\n", configs[i].name, gaps[j].p3 ? "P3" : "P4",
+              gaps[j].intended_us, gaps[j].actual_us);
+    }
+    free(gaps);
+  }
+  if (out)
+    fclose(out);
+  for (int i = 0; i < num_configs; i++)
+    free(configs[i].name);
+  free(configs);
+  return failed ? 1 : 0;
+}
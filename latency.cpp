@@ -0,0 +1,183 @@
+/*
+ * latency.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "latency.h"
+#include "debug.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *kind_names[LATENCY_KINDS] = {"iface", "total"};
+
+SerialLatency::SerialLatency(const char *name)
+{
+  this->name = strdup(name);
+  memset(entries, 0, sizeof(entries));
+  num_entries = 0;
+  lock = os_create_mutex();
+  current = NULL;
+  sent_cycles = sent_ns = 0;
+  wait_arrival = wait_delivery = false;
+}
+
+SerialLatency::~SerialLatency()
+{
+  os_destroy_mutex(lock);
+  free(name);
+}
+
+struct LatencyEntry *SerialLatency::entry(const char *iface, int line)
+{
+  for (int i = 0; i < num_entries; i++) {
+    if (entries[i].line == line && !strcmp(entries[i].iface, iface))
+      return &entries[i];
+  }
+  if (num_entries == LATENCY_MAX_ENTRIES)
+    return NULL;
+  struct LatencyEntry *e = &entries[num_entries++];
+  e->iface = iface;
+  e->line = line;
+  return e;
+}
+
+static void histogramAdd(struct LatencyHistogram *h, uint64_t value)
+{
+  int bucket = 0;
+  for (uint64_t v = value; v && bucket < LATENCY_BUCKETS - 1; v >>= 1)
+    bucket++;
+  h->buckets[bucket]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+void SerialLatency::add(int kind, uint64_t cycles)
+{
+  histogramAdd(&current->cycles[kind], cycles - sent_cycles);
+  histogramAdd(&current->host_us[kind], (os_ntime() - sent_ns) / 1000);
+}
+
+void SerialLatency::sent(const char *iface, int line, uint64_t cycles)
+{
+  os_lock_mutex(lock);
+  current = entry(iface, line);
+  sent_cycles = cycles;
+  sent_ns = os_ntime();
+  wait_arrival = wait_delivery = current != NULL;
+  os_unlock_mutex(lock);
+}
+
+void SerialLatency::arrived(uint64_t cycles)
+{
+  os_lock_mutex(lock);
+  if (wait_arrival) {
+    wait_arrival = false;
+    /* a reply cannot come in before it has been asked for; the cycle
+       count may be a little behind if we are on a reader thread */
+    if (cycles < sent_cycles)
+      cycles = sent_cycles;
+    add(LATENCY_IFACE, cycles);
+  }
+  os_unlock_mutex(lock);
+}
+
+void SerialLatency::delivered(uint64_t cycles)
+{
+  os_lock_mutex(lock);
+  if (wait_delivery) {
+    wait_delivery = false;
+    add(LATENCY_TOTAL, cycles);
+  }
+  os_unlock_mutex(lock);
+}
+
+bool SerialLatency::save()
+{
+  FILE *fp = fopen(name, "w");
+  if (!fp) {
+    ERROR("could not create serial latency file %s\n", name);
+    return false;
+  }
+  int len = strlen(name);
+  bool ok;
+  /* a reader thread may still be adding to them */
+  os_lock_mutex(lock);
+  if (len > 5 && !strcmp(name + len - 5, ".json"))
+    ok = saveJSON(fp);
+  else
+    ok = saveCSV(fp);
+  os_unlock_mutex(lock);
+  if (fclose(fp) || !ok) {
+    ERROR("could not write serial latency file %s\n", name);
+    return false;
+  }
+  return true;
+}
+
+/* one line per non-empty bucket; the lower bound of bucket n is
+   2^(n-1), the upper one 2^n - 1, and none (an empty hi) for the last */
+bool SerialLatency::saveCSV(FILE *fp)
+{
+  fprintf(fp, "iface,line,kind,unit,lo,hi,count\n");
+  for (int i = 0; i < num_entries; i++) {
+    for (int k = 0; k < LATENCY_KINDS; k++) {
+      for (int u = 0; u < 2; u++) {
+        struct LatencyHistogram *h = u ? &entries[i].host_us[k] : &entries[i].cycles[k];
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+          if (!h->buckets[b])
+            continue;
+          char hi[24] = "";
+          if (b < LATENCY_BUCKETS - 1)
+            sprintf(hi, "%llu", b ? (1ULL << b) - 1 : 0ULL);
+          fprintf(fp, "%s,%d,%s,%s,%llu,%s,%llu\n", entries[i].iface,
+                  entries[i].line, kind_names[k], u ? "us" : "cycles",
+                  b ? 1ULL << (b - 1) : 0ULL, hi,
+                  (unsigned long long)h->buckets[b]);
+        }
+      }
+    }
+  }
+  return !ferror(fp);
+}
+
+static void saveHistogramJSON(FILE *fp, const char *key, struct LatencyHistogram *h)
+{
+  fprintf(fp, "\"%s\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu, \"buckets\": [",
+          key, (unsigned long long)h->count, (unsigned long long)h->sum,
+          (unsigned long long)h->max);
+  int last = LATENCY_BUCKETS - 1;
+  while (last > 0 && !h->buckets[last])
+    last--;
+  for (int b = 0; b <= last; b++)
+    fprintf(fp, "%s%llu", b ? ", " : "", (unsigned long long)h->buckets[b]);
+  fprintf(fp, "]}");
+}
+
+bool SerialLatency::saveJSON(FILE *fp)
+{
+  fprintf(fp, "{\n  \"buckets\": \"0, then 2^(n-1) to 2^n - 1, the last one >= 2^(n-1)\",\n  \"entries\": [");
+  for (int i = 0; i < num_entries; i++) {
+    fprintf(fp, "%s\n    {\"iface\": \"%s\", \"line\": %d",
+            i ? "," : "", entries[i].iface, entries[i].line);
+    for (int k = 0; k < LATENCY_KINDS; k++) {
+      char key[32];
+      fprintf(fp, ",\n     ");
+      sprintf(key, "%s_cycles", kind_names[k]);
+      saveHistogramJSON(fp, key, &entries[i].cycles[k]);
+      fprintf(fp, ",\n     ");
+      sprintf(key, "%s_us", kind_names[k]);
+      saveHistogramJSON(fp, key, &entries[i].host_us[k]);
+    }
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  return !ferror(fp);
+}
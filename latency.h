@@ -0,0 +1,88 @@
+/*
+ * latency.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* bucket 0 counts latencies of 0, bucket n those of 2^(n-1) to 2^n - 1,
+   except for the last one, which counts everything >= 2^(n-1) */
+#define LATENCY_BUCKETS 32
+
+/* what is measured, each in emulated state times and in host
+   microseconds */
+#define LATENCY_IFACE 0		/* last byte sent to first reply byte received
+				   from the interface */
+#define LATENCY_TOTAL 1		/* last byte sent to first reply byte read by
+				   the firmware */
+#define LATENCY_KINDS 2
+
+/* combinations of interface type and comm line kept apart; fixed, so that
+   the entries do not move under arrived() */
+#define LATENCY_MAX_ENTRIES 64
+
+struct LatencyHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+};
+
+/* the histograms of one interface type on one comm line */
+struct LatencyEntry {
+  const char *iface;
+  int line;
+  struct LatencyHistogram cycles[LATENCY_KINDS];
+  struct LatencyHistogram host_us[LATENCY_KINDS];
+};
+
+/* Serial transaction latencies: for every byte the firmware sends, the
+   time until the first byte of the reply comes in from the interface and
+   until the firmware reads it. Echos produced by Serial do not count as
+   replies. A new byte sent restarts the measurement, so for a multi-byte
+   request it is taken from the last one. sent() and delivered() are
+   called from the emulation thread, arrived() may be called from an
+   interface's reader thread; the measurement is kept under a lock. */
+class SerialLatency {
+public:
+  SerialLatency(const char *name);
+  ~SerialLatency();
+
+  /* iface must be a string constant, see Interface::name() */
+  void sent(const char *iface, int line, uint64_t cycles);
+  void arrived(uint64_t cycles);
+  void delivered(uint64_t cycles);
+
+  /* writes the histograms as JSON if the file name ends in ".json", as
+     CSV otherwise */
+  bool save();
+
+private:
+  struct LatencyEntry *entry(const char *iface, int line);
+  void add(int kind, uint64_t cycles);
+  bool saveCSV(FILE *fp);
+  bool saveJSON(FILE *fp);
+
+  char *name;
+  struct LatencyEntry entries[LATENCY_MAX_ENTRIES];
+  int num_entries;
+
+  /* the transaction being measured */
+  void *lock;
+  struct LatencyEntry *current;
+  uint64_t sent_cycles;
+  uint64_t sent_ns;
+  bool wait_arrival;
+  bool wait_delivery;
+};
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "lcd.h"
 #include "debug.h"
+#include "metrics.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -35,9 +36,17 @@ Lcd::Lcd(UI *ui)
 {
   mem = (uint8_t *)malloc(65536);
   this->ui = ui;
+  pages = NULL;
   reset();
 }
 
+int Lcd::setDirtyPages(DirtyPages *pages)
+{
+  this->pages = pages;
+  pages_base = pages->addRegion(mem, 65536);
+  return pages_base;
+}
+
 Lcd::~Lcd()
 {
   free(mem);
@@ -113,6 +122,8 @@ void Lcd::write(int a0, uint8_t val)
       case CMD_MWRITE:
         DEBUG(LCD, "LCD memwrite %02X ('%c') -> %04X (%d/%d)\n", val, val, cursor, coords_x(cursor), coords_y(cursor));
         mem[cursor] = val;
+        if (pages)
+          pages->markAddr(pages_base, cursor);
         dirty = true;
         cursor++;
         break;
@@ -166,13 +177,24 @@ void Lcd::write(int a0, uint8_t val)
   }
 }
 
+uint64_t Lcd::frameHash()
+{
+  uint8_t frame[SRC_WIDTH * SRC_HEIGHT / 8];
+  for (int i = 0; i < SRC_WIDTH * SRC_HEIGHT / 8; i++)
+    frame[i] = mem[i] ^ mem[LAYER2_OFFSET + i];
+  return DirtyPages::hashBuffer(frame, sizeof(frame), 0xcbf29ce484222325ULL);
+}
+
 void Lcd::update()
 {
   if (dirty) {
     uint16_t *pp = (uint16_t *)ui->getPixels();
-    if (!pp)	/* painting disabled */
+    if (!pp) {	/* painting disabled */
+      metrics->lcd_skipped++;
       return;
+    }
     dirty = false;
+    metrics->lcd_frames++;
     
     int i, j, lc;
 #ifdef SCALE_SCREEN
@@ -211,14 +233,17 @@ void Lcd::update()
 #endif
     ui->setDirty();
   }
+  else
+    metrics->lcd_unchanged++;
   ui->flip();
 }
 
 #include "state.h"
 
-void Lcd::loadSaveState(statefile_t fp, bool write)
+void Lcd::loadSaveState(statefile_t fp, bool write, bool memory)
 {
-  STATE_RWBUF(mem, 65536);
+  if (memory)
+    STATE_RWBUF(mem, 65536);
   STATE_RW(state);
   STATE_RW(next_param);
   STATE_RW(cursor);
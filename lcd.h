@@ -12,6 +12,7 @@
 #define __LCD_H
 
 #include "ui.h"
+#include "dirty.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -94,11 +95,17 @@ public:
 
   void update();
   void redraw();
+  /* hash over the picture update() would render */
+  uint64_t frameHash();
 
-  void loadSaveState(statefile_t fp, bool write);
+  void loadSaveState(statefile_t fp, bool write, bool memory = true);
+  /* returns the number of the first page of the LCD memory */
+  int setDirtyPages(DirtyPages *pages);
   
 private:
   uint8_t *mem;
+  DirtyPages *pages;
+  int pages_base;
   state_t state;
   int next_param;
   uint16_t cursor;
@@ -0,0 +1,387 @@
+/*
+ * log.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "log.h"
+#include "debug.h"
+#include "os.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __MINGW32__
+#define log_snprintf __mingw_snprintf
+#define log_vfprintf __mingw_vfprintf
+#define log_stderr win_stderr
+#else
+#define log_snprintf snprintf
+#define log_vfprintf vfprintf
+#define log_stderr stderr
+#endif
+
+/* argument types, as far as passing them through varargs is concerned */
+#define LOG_ARG_INT 0
+#define LOG_ARG_LONG 1
+#define LOG_ARG_LLONG 2
+#define LOG_ARG_DOUBLE 3
+#define LOG_ARG_STRING 4
+#define LOG_ARG_POINTER 5
+
+struct LogRecord {
+  const char *fmt;
+  uint64_t seq;		/* global order of records */
+  uint64_t cycles;
+  uint32_t mtime;
+  int num_args;
+  union {
+    int i;
+    long l;
+    long long ll;
+    double d;
+    const void *p;
+    int str;		/* offset into str */
+  } args[LOG_MAX_ARGS];
+  char str[LOG_STR_SIZE];
+};
+
+/* single producer (the owning thread), single consumer (the writer) */
+struct LogRing {
+  struct LogRecord records[LOG_RING_SIZE];
+  volatile uint32_t head;	/* written by the producer */
+  volatile uint32_t tail;	/* written by the consumer */
+  volatile uint32_t dropped;
+  volatile int in_use;		/* owned by a thread */
+  struct LogRing *next;
+};
+
+static __thread struct LogRing *thread_ring = NULL;
+static struct LogRing *volatile rings = NULL;
+static volatile uint64_t log_seq = 0;
+static const uint64_t *volatile log_cycles = NULL;
+
+static volatile bool log_running = false;
+static volatile bool log_quit = false;
+static void *log_thread = NULL;
+static FILE *log_fp = NULL;
+static bool log_prefix = false;
+
+void log_set_cycles(const uint64_t *cycles)
+{
+  log_cycles = cycles;
+}
+
+static struct LogRing *get_ring()
+{
+  if (thread_ring)
+    return thread_ring;
+  /* rings are never removed, so the writer need not care which thread
+     owns one; a ring given up by a thread that has ended is taken over
+     by the next, with whatever it still holds */
+  struct LogRing *r;
+  for (r = rings; r; r = r->next) {
+    if (!r->in_use && __sync_bool_compare_and_swap(&r->in_use, 0, 1)) {
+      thread_ring = r;
+      return r;
+    }
+  }
+  r = (struct LogRing *)calloc(1, sizeof(struct LogRing));
+  if (!r)
+    return NULL;
+  r->in_use = 1;
+  /* lock-free insertion at the head of the list */
+  do {
+    r->next = rings;
+  } while (!__sync_bool_compare_and_swap(&rings, r->next, r));
+  thread_ring = r;
+  return r;
+}
+
+void log_thread_exit()
+{
+  if (!thread_ring)
+    return;
+  /* the records written so far before the ring can change hands */
+  __sync_synchronize();
+  thread_ring->in_use = 0;
+  thread_ring = NULL;
+}
+
+/* Parses a printf conversion specification starting after the '%'.
+   Returns the length of the specification and sets *type to the
+   argument type, or -1 if it takes none. An asterisk for width or
+   precision counts as an int argument of its own, returned in *stars. */
+static int parse_spec(const char *f, int *type, int *stars)
+{
+  const char *p = f;
+  int longs = 0;
+  *stars = 0;
+  while (*p && strchr("-+ #0'", *p))
+    p++;
+  for (; *p && (strchr("0123456789.", *p) || *p == '*'); p++) {
+    if (*p == '*')
+      (*stars)++;
+  }
+  for (; *p && strchr("hlLqjzt", *p); p++) {
+    if (*p == 'l')
+      longs++;
+    else if (*p == 'q' || *p == 'L' || *p == 'j')
+      longs = 2;
+    else if (*p == 'z' || *p == 't')
+      longs = 1;
+  }
+  switch (*p) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+      *type = longs >= 2 ? LOG_ARG_LLONG : longs ? LOG_ARG_LONG : LOG_ARG_INT;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      *type = LOG_ARG_DOUBLE;
+      break;
+    case 's':
+      *type = LOG_ARG_STRING;
+      break;
+    case 'p':
+      *type = LOG_ARG_POINTER;
+      break;
+    case '\0':
+      return p - f;
+    default:	/* %%, and %n, which we do not support */
+      *type = -1;
+      break;
+  }
+  return p - f + 1;
+}
+
+void log_write(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+
+  struct LogRing *ring;
+  if (!log_running || !(ring = get_ring())) {
+    log_vfprintf(log_stderr, fmt, ap);
+    va_end(ap);
+    return;
+  }
+
+  if (ring->head - ring->tail >= LOG_RING_SIZE) {
+    ring->dropped++;
+    va_end(ap);
+    return;
+  }
+
+  struct LogRecord *r = &ring->records[ring->head % LOG_RING_SIZE];
+  r->fmt = fmt;
+  r->num_args = 0;
+  int str_pos = 0;
+  for (const char *f = fmt; *f; f++) {
+    if (*f != '%')
+      continue;
+    int type, stars;
+    f += parse_spec(f + 1, &type, &stars);
+    if (r->num_args + stars + 1 > LOG_MAX_ARGS)
+      break;	/* the writer prints the rest of the format as is */
+    while (stars--)
+      r->args[r->num_args++].i = va_arg(ap, int);
+    switch (type) {
+      case LOG_ARG_INT:
+        r->args[r->num_args++].i = va_arg(ap, int);
+        break;
+      case LOG_ARG_LONG:
+        r->args[r->num_args++].l = va_arg(ap, long);
+        break;
+      case LOG_ARG_LLONG:
+        r->args[r->num_args++].ll = va_arg(ap, long long);
+        break;
+      case LOG_ARG_DOUBLE:
+        r->args[r->num_args++].d = va_arg(ap, double);
+        break;
+      case LOG_ARG_POINTER:
+        r->args[r->num_args++].p = va_arg(ap, void *);
+        break;
+      case LOG_ARG_STRING: {
+          /* strings are often temporary, so they are copied */
+          const char *s = va_arg(ap, const char *);
+          if (!s)
+            s = "(null)";
+          int len = strlen(s);
+          if (len > LOG_STR_SIZE - 1 - str_pos)
+            len = LOG_STR_SIZE - 1 - str_pos;
+          memcpy(r->str + str_pos, s, len);
+          r->str[str_pos + len] = 0;
+          r->args[r->num_args++].str = str_pos;
+          str_pos += len + (str_pos + len < LOG_STR_SIZE - 1);
+          break;
+        }
+      default:
+        break;
+    }
+  }
+  va_end(ap);
+
+  r->seq = __sync_fetch_and_add(&log_seq, 1);
+  const uint64_t *cycles = log_cycles;
+  r->cycles = cycles ? *cycles : 0;
+  r->mtime = os_mtime();
+
+  /* make the record visible before the new head */
+  __sync_synchronize();
+  ring->head++;
+}
+
+static bool at_line_start = true;
+
+static void put_text(const char *s, int len, const struct LogRecord *r)
+{
+  while (len > 0) {
+    if (at_line_start && log_prefix) {
+      fprintf(log_fp, "%10u %12llu ", r->mtime, (unsigned long long)r->cycles);
+      at_line_start = false;
+    }
+    const char *nl = (const char *)memchr(s, '\n', len);
+    int n = nl ? nl - s + 1 : len;
+    fwrite(s, 1, n, log_fp);
+    if (nl)
+      at_line_start = true;
+    s += n;
+    len -= n;
+  }
+}
+
+static void format_record(const struct LogRecord *r)
+{
+  char spec[32];
+  char out[256];
+  int arg = 0;
+  const char *f = r->fmt;
+  while (*f) {
+    const char *pct = strchr(f, '%');
+    if (!pct) {
+      put_text(f, strlen(f), r);
+      break;
+    }
+    put_text(f, pct - f, r);
+
+    int type, stars;
+    int len = parse_spec(pct + 1, &type, &stars) + 1;
+    if (arg + stars + (type >= 0) > r->num_args || len >= (int)sizeof(spec)) {
+      /* arguments not captured */
+      put_text(pct, strlen(pct), r);
+      break;
+    }
+    memcpy(spec, pct, len);
+    spec[len] = 0;
+
+    int star[2] = {0, 0};
+    for (int i = 0; i < stars && i < 2; i++)
+      star[i] = r->args[arg++].i;
+    int n;
+#define LOG_FORMAT(value) \
+    (stars == 2 ? log_snprintf(out, sizeof(out), spec, star[0], star[1], value) : \
+     stars == 1 ? log_snprintf(out, sizeof(out), spec, star[0], value) : \
+                  log_snprintf(out, sizeof(out), spec, value))
+    switch (type) {
+      case LOG_ARG_INT: n = LOG_FORMAT(r->args[arg].i); break;
+      case LOG_ARG_LONG: n = LOG_FORMAT(r->args[arg].l); break;
+      case LOG_ARG_LLONG: n = LOG_FORMAT(r->args[arg].ll); break;
+      case LOG_ARG_DOUBLE: n = LOG_FORMAT(r->args[arg].d); break;
+      case LOG_ARG_POINTER: n = LOG_FORMAT(r->args[arg].p); break;
+      case LOG_ARG_STRING: n = LOG_FORMAT(r->str + r->args[arg].str); break;
+      default:
+        n = spec[1] == '%' ? log_snprintf(out, sizeof(out), "%%") : 0;
+        break;
+    }
+#undef LOG_FORMAT
+    if (type >= 0)
+      arg++;
+    if (n > (int)sizeof(out) - 1)
+      n = sizeof(out) - 1;
+    if (n > 0)
+      put_text(out, n, r);
+    f = pct + len;
+  }
+}
+
+/* writes out the oldest record of all threads; returns false if there
+   is none */
+static bool write_next()
+{
+  struct LogRing *oldest = NULL;
+  for (struct LogRing *ring = rings; ring; ring = ring->next) {
+    if (ring->dropped) {
+      /* not exact, the producer may be incrementing it right now */
+      fprintf(log_fp, "[%u log messages lost]\n", ring->dropped);
+      ring->dropped = 0;
+    }
+    if (ring->head == ring->tail)
+      continue;
+    if (!oldest || ring->records[ring->tail % LOG_RING_SIZE].seq <
+                   oldest->records[oldest->tail % LOG_RING_SIZE].seq)
+      oldest = ring;
+  }
+  if (!oldest)
+    return false;
+
+  __sync_synchronize();
+  format_record(&oldest->records[oldest->tail % LOG_RING_SIZE]);
+  /* done with the record before the producer may reuse it */
+  __sync_synchronize();
+  oldest->tail++;
+  return true;
+}
+
+static int log_writer(void *data)
+{
+  for (;;) {
+    if (write_next())
+      continue;
+    fflush(log_fp);
+    if (log_quit)
+      break;
+    os_msleep(1);
+  }
+  return 0;
+}
+
+bool log_start(const char *file)
+{
+  if (file) {
+    log_fp = fopen(file, "w");
+    if (!log_fp) {
+      ERROR("could not create log file %s\n", file);
+      return false;
+    }
+    log_prefix = true;
+  }
+  else {
+    log_fp = log_stderr;
+    log_prefix = false;
+  }
+  log_quit = false;
+  log_running = true;
+  log_thread = os_create_thread(log_writer, NULL);
+  return true;
+}
+
+void log_stop()
+{
+  if (!log_running)
+    return;
+  /* threads still logging from now on write synchronously */
+  log_running = false;
+  log_quit = true;
+  os_wait_thread(log_thread, NULL);
+  /* what was logged by threads that had just passed the log_running
+     check when the writer quit */
+  while (write_next())
+    ;
+  fflush(log_fp);
+  if (log_fp != log_stderr)
+    fclose(log_fp);
+  log_fp = NULL;
+}
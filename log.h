@@ -0,0 +1,44 @@
+/*
+ * log.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stdint.h>
+
+/* Asynchronous backend for DEBUG(). Messages are not formatted by the
+   thread logging them; the format string and the arguments are copied to
+   a ring buffer owned by that thread, and a writer thread formats them
+   and writes them out. A thread whose ring is full loses messages rather
+   than waiting. Before log_start() and after log_stop(), messages are
+   written out synchronously. */
+
+#define LOG_RING_SIZE 4096	/* records per thread */
+#define LOG_MAX_ARGS 8
+#define LOG_STR_SIZE 96		/* room for copies of string arguments */
+
+/* starts the writer thread; if file is not NULL, the log goes there
+   instead of stderr, each line prefixed with the host time in ms and the
+   cycle count */
+bool log_start(const char *file);
+/* writes out everything logged so far and stops the writer thread */
+void log_stop();
+
+/* gives up the ring of the calling thread so that a thread started later
+   can use it; called by threads created with os_create_thread() when
+   they end */
+void log_thread_exit();
+
+/* cycle count shown in log files, NULL if none */
+void log_set_cycles(const uint64_t *cycles);
+
+void log_write(const char *fmt, ...) __attribute__((format(gnu_printf, 1, 2)));
+
+#endif
@@ -30,6 +30,11 @@
 #endif
 #include "iface_fake.h"
 #include "iface_kcan.h"
+#include "iface_replay.h"
+#include "framecheck.h"
+#include "log.h"
+#include "metrics.h"
+#include "gdbstub.h"
 
 uint32_t debug_level;
 uint32_t debug_level_unabridged;
@@ -63,6 +68,7 @@ int main(int argc, char **argv)
 #define IFACE_FTDI 2
 #define IFACE_FAKE 3
 #define IFACE_KCAN 4
+#define IFACE_REPLAY 5
 #if defined(NDEBUG) && defined(__MINGW32__)
   int iface_type = IFACE_KCAN;
 #else
@@ -70,12 +76,21 @@ int main(int argc, char **argv)
 #endif
   bool expect_echo = false;
   bool ftdi_sampling_enabled = false;
+  /* bus replay timing factor, 0 means as fast as possible */
+  double replay_time_scale = 1.0;
 
   debug_level = DEBUG_DEFAULT;
 #ifndef NDEBUG
   uint32_t trigger = 0;
 #endif
-  while ((c = getopt (argc, argv, "d:t:w:s:m:r:p:i:ex:v:S")) != -1) {
+  char *convert_from = NULL;
+  char *convert_to = NULL;
+  uint64_t seek_to = 0;
+  const char *golden = NULL;
+  bool benchmark = false;
+  const char *log_file = NULL;
+  int gdb_port = 0;
+  while ((c = getopt (argc, argv, "d:t:w:s:m:r:p:C:K:Fg:D:R:z:B:b:y:P:c:T:L:M:A:G:i:ex:v:SQH:")) != -1) {
     switch (c) {
       case 'd':
         {
@@ -122,16 +137,25 @@ int main(int argc, char **argv)
       case 't':
         trigger = strtol(optarg, NULL, 0);
         break;
+#endif
       case 'w':
         {
+          /* -w <lo>,<hi>[,<flags>], flags as in Watchpoints::parse(),
+             default "rw" */
           char *a = strtok(optarg, ",");
           char *b = strtok(NULL, ",");
-          cpu.setWatchpoint(strtol(a, NULL, 0),
-                            strtol(b, NULL, 0)
-                           );
+          char *f = strtok(NULL, ",");
+          uint32_t lo, hi;
+          int flags;
+          char spec[80];
+          snprintf(spec, sizeof(spec), "%s %s-%s", f ? f : "rw", a, b ? b : a);
+          if (!Watchpoints::parse(spec, &lo, &hi, &flags)) {
+            ERROR("usage: -w <lo>,<hi>[,<flags r/w/x/b>]\n");
+            exit(1);
+          }
+          cpu.addWatch(lo, hi, flags);
         }
         break;
-#endif
       case 's':
         tty = strdup(optarg);
         break;
@@ -144,6 +168,93 @@ int main(int argc, char **argv)
       case 'p':
         cpu.enableReplaying(optarg);
         break;
+      case 'K':
+        cpu.setKeyframeInterval(atoi(optarg));
+        break;
+      case 'F':
+        cpu.setFastForward(true);
+        break;
+      case 'g':
+        seek_to = strtoull(optarg, NULL, 0);
+        break;
+      case 'D':
+        cpu.setDeterministic(strtoul(optarg, NULL, 0));
+        break;
+      case 'R':
+        /* rewind history size in kilobytes, off by default */
+        cpu.setRewindMemory((size_t)strtoul(optarg, NULL, 0) * 1024);
+        break;
+      case 'z': {
+          int codec = codec_find(optarg);
+          if (codec < 0) {
+            ERROR("unknown state codec %s\n", optarg);
+            exit(1);
+          }
+          cpu.setStateCodec(codec);
+          break;
+        }
+      case 'B':
+        golden = optarg;
+        break;
+      case 'b':
+        if (!cpu.enableBusCapture(optarg))
+          exit(1);
+        break;
+      case 'H':
+        cpu.enableSerialLatency(optarg);
+        break;
+      case 'y':
+        replay_time_scale = strtod(optarg, NULL);
+        break;
+      case 'P':
+        {
+          /* -P <file>[,<interval in cycles>] */
+          char *name = strtok(optarg, ",");
+          char *interval = strtok(NULL, ",");
+          cpu.enableProfiling(name, interval ? strtoul(interval, NULL, 0) : 0);
+        }
+        break;
+      case 'c':
+        cpu.enableCallProfile(optarg);
+        break;
+      case 'T':
+        {
+          /* -T <file>[,<records>[,<trigger address>]] */
+          char *name = optarg[0] == ',' ? NULL : strtok(optarg, ",");
+          if (!name) {
+            ERROR("usage: -T <file>[,<records>[,<trigger address>]]\n");
+            exit(1);
+          }
+          char *records = strtok(NULL, ",");
+          char *trigger = strtok(NULL, ",");
+          cpu.enableTrace(name, records ? strtoull(records, NULL, 0) : 0,
+                          trigger ? strtoul(trigger, NULL, 0) : 0);
+        }
+        break;
+      case 'L':
+        log_file = optarg;
+        break;
+      case 'A':
+        if (!metrics_open(optarg))
+          exit(1);
+        break;
+      case 'G':
+        /* GDB remote protocol server on this port on localhost */
+        gdb_port = atoi(optarg);
+        break;
+#ifdef MEMSTATS
+      case 'M':
+        cpu.enableMemStats(optarg);
+        break;
+#endif
+      case 'C':
+        convert_from = strtok(optarg, ",");
+        convert_to = strtok(NULL, ",");
+        if (!convert_from || !convert_to) {
+          ERROR("usage: -C <old recording>,<new recording>\n");
+          exit(1);
+        }
+        break;
       case 'i':
         if (!strcmp(optarg, "elm"))
           iface_type = IFACE_ELM;
@@ -157,6 +268,8 @@ int main(int argc, char **argv)
           iface_type = IFACE_KCAN;
         else if (!strcmp(optarg, "fake"))
           iface_type = IFACE_FAKE;
+        else if (!strcmp(optarg, "replay"))
+          iface_type = IFACE_REPLAY;
         else {
           ERROR("unknown interface type %s specified\n", optarg);
           exit(1);
@@ -177,6 +290,9 @@ int main(int argc, char **argv)
       case 'S':
         ftdi_sampling_enabled = true;
         break;
+      case 'Q':
+        benchmark = true;
+        break;
       default:
         ERROR("bad shit\n");
         exit(1);
@@ -218,13 +334,48 @@ int main(int argc, char **argv)
     case IFACE_KCAN:
       iface = new IfaceKCAN(&cpu, &ui, tty);
       break;
+    case IFACE_REPLAY:
+      /* the capture file takes the place of the serial port */
+      if (!tty) {
+        ERROR("bus replay needs a capture file (-s)\n");
+        exit(1);
+      }
+      iface = new IfaceReplay(&cpu, &ui, tty, replay_time_scale);
+      break;
     default:
       ERROR("internal error");
       exit(1);
   }
   cpu.setSerial(iface, expect_echo);
 
+  if (convert_from) {
+    int ret = cpu.convertRecording(convert_from, convert_to) ? 0 : 1;
+    delete iface;
+    return ret;
+  }
+  if (seek_to)
+    cpu.requestSeek(seek_to);
+  if (golden) {
+    if (!cpu.isReplaying()) {
+      ERROR("batch replay needs a recording (-p)\n");
+      delete iface;
+      return BATCH_ERROR;
+    }
+    cpu.setBatchReplay(golden);
+    ui.hide();
+  }
+  else if (benchmark) {
+    cpu.enableBenchmark();
+    ui.hide();
+  }
+
+  if (!log_start(log_file)) {
+    delete iface;
+    return 1;
+  }
+
   void *emu = os_create_thread(runEmu, &cpu);
+  GdbStub *gdb = gdb_port ? new GdbStub(&cpu, gdb_port) : NULL;
 
   DEBUG(OS, "UI::run() start\n");
   ui.run();
@@ -233,9 +384,12 @@ int main(int argc, char **argv)
   int ret;
   os_wait_thread(emu, &ret);
   DEBUG(OS, "emu thread finished\n");
+  delete gdb;
 
   delete iface;
   DEBUG(OS, "iface deleted\n");
+  log_stop();
+  metrics_close();
 
 #ifdef __MINGW32__
   fclose(win_stderr);
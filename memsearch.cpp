@@ -0,0 +1,228 @@
+/*
+ * memsearch.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "memsearch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* 16 bytes at a time, which GCC turns into SSE2 or NEON code, or plain
+   integer code where there is neither; the emulated memories are
+   little-endian like the hosts we run on, so the lanes are the values */
+typedef uint8_t vec8 __attribute__((vector_size(16)));
+typedef uint16_t vec16 __attribute__((vector_size(16)));
+typedef uint32_t vec32 __attribute__((vector_size(16)));
+
+MemSearch::MemSearch(DirtyPages *pages)
+{
+  this->pages = pages;
+  num_regions = 0;
+  width = 0;
+  num_pages = 0;
+  prev = cand = NULL;
+  page_count = NULL;
+  candidates = 0;
+}
+
+MemSearch::~MemSearch()
+{
+  free(prev);
+  free(cand);
+  free(page_count);
+}
+
+void MemSearch::addRegion(const char *name, int base, uint32_t phys)
+{
+  if (num_regions == SEARCH_MAX_REGIONS)
+    return;
+  regions[num_regions].name = name;
+  regions[num_regions].base = base;
+  regions[num_regions].phys = phys;
+  num_regions++;
+}
+
+void MemSearch::reset(int width)
+{
+  this->width = width;
+  if (num_pages != pages->getPageCount()) {
+    num_pages = pages->getPageCount();
+    prev = (uint8_t *)realloc(prev, num_pages << DIRTY_PAGE_SHIFT);
+    cand = (uint8_t *)realloc(cand, num_pages << DIRTY_PAGE_SHIFT);
+    page_count = (uint16_t *)realloc(page_count, num_pages * sizeof(uint16_t));
+  }
+  candidates = 0;
+  for (int p = 0; p < num_pages; p++) {
+    uint8_t *mem = pages->getPage(p);
+    if (mem) {
+      memcpy(prev + (p << DIRTY_PAGE_SHIFT), mem, DIRTY_PAGE_SIZE);
+      memset(cand + (p << DIRTY_PAGE_SHIFT), 0xff, DIRTY_PAGE_SIZE);
+      page_count[p] = DIRTY_PAGE_SIZE / width;
+    }
+    else {
+      memset(cand + (p << DIRTY_PAGE_SHIFT), 0, DIRTY_PAGE_SIZE);
+      page_count[p] = 0;
+    }
+    candidates += page_count[p];
+  }
+  pages->cleanAll(DIRTY_SEARCH);
+}
+
+/* returns the number of candidate bytes left */
+template <typename V, int OP> static uint32_t scanPage(const uint8_t *mem, uint8_t *prev, uint8_t *cand, V a, V b)
+{
+  /* a candidate byte is 0xff, so subtracting counts it; with 16 vectors
+     per page, a lane cannot overflow */
+  vec8 bytes = {0};
+  for (int i = 0; i < DIRTY_PAGE_SIZE; i += sizeof(V)) {
+    V cur, old, c, keep;
+    memcpy(&cur, mem + i, sizeof(V));
+    memcpy(&old, prev + i, sizeof(V));
+    memcpy(&c, cand + i, sizeof(V));
+    switch (OP) {
+      case SEARCH_EQUAL: keep = (V)(cur == a); break;
+      case SEARCH_RANGE: keep = (V)(cur >= a) & (V)(cur <= b); break;
+      case SEARCH_CHANGED: keep = (V)(cur != old); break;
+      case SEARCH_UNCHANGED: keep = (V)(cur == old); break;
+      case SEARCH_INCREASED: keep = (V)(cur > old); break;
+      case SEARCH_DECREASED: keep = (V)(cur < old); break;
+    }
+    c &= keep;
+    bytes -= (vec8)c;
+    memcpy(cand + i, &c, sizeof(V));
+    memcpy(prev + i, &cur, sizeof(V));
+  }
+  uint8_t lanes[sizeof(vec8)];
+  memcpy(lanes, &bytes, sizeof(vec8));
+  uint32_t count = 0;
+  for (unsigned int i = 0; i < sizeof(vec8); i++)
+    count += lanes[i];
+  return count;
+}
+
+template <typename V, typename T> static uint32_t scanPageWidth(int op, const uint8_t *mem, uint8_t *prev, uint8_t *cand, uint32_t a, uint32_t b)
+{
+  T la[sizeof(V) / sizeof(T)], lb[sizeof(V) / sizeof(T)];
+  for (unsigned int i = 0; i < sizeof(V) / sizeof(T); i++) {
+    la[i] = a;
+    lb[i] = b;
+  }
+  V va, vb;
+  memcpy(&va, la, sizeof(V));
+  memcpy(&vb, lb, sizeof(V));
+  switch (op) {
+    case SEARCH_EQUAL: return scanPage<V, SEARCH_EQUAL>(mem, prev, cand, va, vb);
+    case SEARCH_RANGE: return scanPage<V, SEARCH_RANGE>(mem, prev, cand, va, vb);
+    case SEARCH_CHANGED: return scanPage<V, SEARCH_CHANGED>(mem, prev, cand, va, vb);
+    case SEARCH_UNCHANGED: return scanPage<V, SEARCH_UNCHANGED>(mem, prev, cand, va, vb);
+    case SEARCH_INCREASED: return scanPage<V, SEARCH_INCREASED>(mem, prev, cand, va, vb);
+    case SEARCH_DECREASED: return scanPage<V, SEARCH_DECREASED>(mem, prev, cand, va, vb);
+  }
+  return 0;
+}
+
+/* filters the candidates of a page and returns how many are left */
+uint32_t MemSearch::scan(int page, const uint8_t *mem, int op, uint32_t a, uint32_t b)
+{
+  uint8_t *p = prev + (page << DIRTY_PAGE_SHIFT);
+  uint8_t *c = cand + (page << DIRTY_PAGE_SHIFT);
+  uint32_t bytes = 0;
+  switch (width) {
+    case 1: bytes = scanPageWidth<vec8, uint8_t>(op, mem, p, c, a, b); break;
+    case 2: bytes = scanPageWidth<vec16, uint16_t>(op, mem, p, c, a, b); break;
+    case 4: bytes = scanPageWidth<vec32, uint32_t>(op, mem, p, c, a, b); break;
+  }
+  /* every byte of a candidate is set */
+  return bytes / width;
+}
+
+uint32_t MemSearch::search(int op, uint32_t a, uint32_t b)
+{
+  candidates = 0;
+  for (int p = 0; p < num_pages; p++) {
+    if (!page_count[p])
+      continue;
+    uint8_t *mem = pages->getPage(p);
+    bool keep_all = false;
+    if (mem && !pages->isDirty(p, DIRTY_SEARCH)) {
+      /* nothing written since the last search, the values are those in
+         prev */
+      if (op == SEARCH_UNCHANGED)
+        keep_all = true;
+      else if (op != SEARCH_EQUAL && op != SEARCH_RANGE)
+        mem = NULL;
+    }
+    if (!mem) {
+      memset(cand + (p << DIRTY_PAGE_SHIFT), 0, DIRTY_PAGE_SIZE);
+      page_count[p] = 0;
+    }
+    else if (!keep_all) {
+      page_count[p] = scan(p, mem, op, a, b);
+      pages->clean(p, DIRTY_SEARCH);
+    }
+    candidates += page_count[p];
+  }
+  return candidates;
+}
+
+bool MemSearch::next(uint32_t *pos)
+{
+  uint32_t end = num_pages << DIRTY_PAGE_SHIFT;
+  uint32_t i = *pos;
+  while (i < end) {
+    if (!page_count[i >> DIRTY_PAGE_SHIFT]) {
+      i = ((i >> DIRTY_PAGE_SHIFT) + 1) << DIRTY_PAGE_SHIFT;
+      continue;
+    }
+    if (cand[i]) {
+      *pos = i;
+      return true;
+    }
+    i += width;
+  }
+  return false;
+}
+
+const char *MemSearch::locate(uint32_t pos, uint32_t *phys, uint32_t *offset)
+{
+  int page = pos >> DIRTY_PAGE_SHIFT;
+  int r = -1;
+  for (int i = 0; i < num_regions; i++) {
+    if (regions[i].base <= page && (r < 0 || regions[i].base > regions[r].base))
+      r = i;
+  }
+  if (r < 0) {
+    *phys = (uint32_t)-1;
+    *offset = pos;
+    return "?";
+  }
+  *offset = pos - (regions[r].base << DIRTY_PAGE_SHIFT);
+  *phys = regions[r].phys == (uint32_t)-1 ? (uint32_t)-1 : regions[r].phys + *offset;
+  return regions[r].name;
+}
+
+static uint32_t readLE(const uint8_t *p, int width)
+{
+  uint32_t v = 0;
+  for (int i = width - 1; i >= 0; i--)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+uint32_t MemSearch::value(uint32_t pos)
+{
+  uint8_t *mem = pages->getPage(pos >> DIRTY_PAGE_SHIFT);
+  if (!mem)
+    return 0;
+  return readLE(mem + (pos & (DIRTY_PAGE_SIZE - 1)), width);
+}
+
+uint32_t MemSearch::previous(uint32_t pos)
+{
+  return readLE(prev + pos, width);
+}
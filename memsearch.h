@@ -0,0 +1,94 @@
+/*
+ * memsearch.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _MEMSEARCH_H
+#define _MEMSEARCH_H
+
+#include <stdint.h>
+#include "dirty.h"
+
+/* search operations */
+#define SEARCH_EQUAL 0		/* == a */
+#define SEARCH_RANGE 1		/* a <= value <= b, unsigned */
+#define SEARCH_CHANGED 2	/* since the last search */
+#define SEARCH_UNCHANGED 3
+#define SEARCH_INCREASED 4
+#define SEARCH_DECREASED 5
+
+#define SEARCH_MAX_REGIONS DIRTY_MAX_REGIONS
+
+/* Narrows down the locations of a value in the emulated memories (RAM,
+   mapped RAM, LCD memory) over a series of searches, like the cheat
+   finders of other emulators do. The candidates are the naturally aligned
+   8, 16 or 32-bit little-endian values in the page space of DirtyPages;
+   every search keeps those that pass it and remembers the current values
+   for the next one. Pages without candidates are skipped, and pages that
+   have not been written since the last search are dealt with without
+   looking at them, so a search is cheap enough to run between frames. */
+class MemSearch {
+public:
+  MemSearch(DirtyPages *pages);
+  ~MemSearch();
+
+  /* names a region of the page space and gives its physical address as
+     used by Watchpoints, (uint32_t)-1 if it has none */
+  void addRegion(const char *name, int base, uint32_t phys);
+
+  /* makes every location a candidate and remembers all values; width is
+     in bytes */
+  void reset(int width);
+  /* keeps the candidates passing op (SEARCH_*); returns the number of
+     candidates left */
+  uint32_t search(int op, uint32_t a = 0, uint32_t b = 0);
+
+  inline bool isActive() {
+    return width != 0;
+  }
+  inline int getWidth() {
+    return width;
+  }
+  inline uint32_t count() {
+    return candidates;
+  }
+
+  /* iterates over the candidates: start with *pos = 0, returns false
+     once there are no more */
+  bool next(uint32_t *pos);
+  /* region name, physical address (or (uint32_t)-1) and offset into the
+     region of a candidate position */
+  const char *locate(uint32_t pos, uint32_t *phys, uint32_t *offset);
+  /* current value at a candidate position, and the one remembered by the
+     last search */
+  uint32_t value(uint32_t pos);
+  uint32_t previous(uint32_t pos);
+
+private:
+  uint32_t scan(int page, const uint8_t *mem, int op, uint32_t a, uint32_t b);
+
+  DirtyPages *pages;
+  struct {
+    const char *name;
+    int base;
+    uint32_t phys;
+  } regions[SEARCH_MAX_REGIONS];
+  int num_regions;
+
+  int width;
+  int num_pages;
+  /* one byte each per byte of the page space: the values as of the last
+     search, and all ones for every byte of a candidate */
+  uint8_t *prev;
+  uint8_t *cand;
+  /* candidates per page */
+  uint16_t *page_count;
+  uint32_t candidates;
+};
+
+#endif
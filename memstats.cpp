@@ -0,0 +1,236 @@
+/*
+ * memstats.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "memstats.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMSTATS_EMPTY ((uint64_t)-1)
+
+MemStatsTable::MemStatsTable()
+{
+  size = 1024;
+  used = 0;
+  entries = (struct MemStatsEntry *)malloc(size * sizeof(struct MemStatsEntry));
+  memset(entries, 0xff, size * sizeof(struct MemStatsEntry));
+  last = NULL;
+}
+
+MemStatsTable::~MemStatsTable()
+{
+  free(entries);
+}
+
+static inline uint32_t memstats_hash(uint32_t key)
+{
+  key ^= key >> 16;
+  key *= 0x45d9f3b;
+  key ^= key >> 16;
+  return key;
+}
+
+uint64_t *MemStatsTable::lookup(uint32_t key)
+{
+  if (used * 2 >= size) {
+    /* grow and rehash */
+    struct MemStatsEntry *old = entries;
+    int old_size = size;
+    size *= 2;
+    entries = (struct MemStatsEntry *)malloc(size * sizeof(struct MemStatsEntry));
+    memset(entries, 0xff, size * sizeof(struct MemStatsEntry));
+    for (int i = 0; i < old_size; i++) {
+      if (old[i].key == MEMSTATS_EMPTY)
+        continue;
+      uint32_t h = memstats_hash(old[i].key) & (size - 1);
+      while (entries[h].key != MEMSTATS_EMPTY)
+        h = (h + 1) & (size - 1);
+      entries[h] = old[i];
+    }
+    free(old);
+  }
+
+  uint32_t h = memstats_hash(key) & (size - 1);
+  while (entries[h].key != key) {
+    if (entries[h].key == MEMSTATS_EMPTY) {
+      entries[h].key = key;
+      memset(entries[h].count, 0, sizeof(entries[h].count));
+      used++;
+      break;
+    }
+    h = (h + 1) & (size - 1);
+  }
+  last = &entries[h];
+  return last->count;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  uint64_t ka = ((const struct MemStatsEntry *)a)->key;
+  uint64_t kb = ((const struct MemStatsEntry *)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
+
+struct MemStatsEntry *MemStatsTable::sorted(int *count)
+{
+  struct MemStatsEntry *s = (struct MemStatsEntry *)malloc((used + 1) * sizeof(struct MemStatsEntry));
+  int n = 0;
+  for (int i = 0; i < size; i++) {
+    if (entries[i].key != MEMSTATS_EMPTY)
+      s[n++] = entries[i];
+  }
+  qsort(s, n, sizeof(struct MemStatsEntry), compare_entries);
+  *count = n;
+  return s;
+}
+
+MemStats::MemStats(const char *name)
+{
+  this->name = strdup(name);
+  memset(low, 0, sizeof(low));
+}
+
+MemStats::~MemStats()
+{
+  free(name);
+}
+
+bool MemStats::save(uint64_t cycles)
+{
+  FILE *fp = fopen(name, "w");
+  if (!fp) {
+    ERROR("could not create memory statistics file %s\n", name);
+    return false;
+  }
+  int len = strlen(name);
+  bool ok;
+  if (len > 5 && !strcmp(name + len - 5, ".json"))
+    ok = saveJSON(fp, cycles);
+  else
+    ok = saveCSV(fp);
+  if (fclose(fp) || !ok) {
+    ERROR("could not write memory statistics file %s\n", name);
+    return false;
+  }
+  return true;
+}
+
+/* one table with a "kind" column; fields that do not apply to a kind are
+   left empty */
+bool MemStats::saveCSV(FILE *fp)
+{
+  struct MemStatsEntry *e;
+  int count;
+
+  fprintf(fp, "kind,addr,wsr,codemap,datamap,reads,writes,fetches,switches,redundant\n");
+
+  e = pages.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    fprintf(fp, "page,0x%08llX,,,,%llu,%llu,%llu,,\n",
+            (unsigned long long)e[i].key << MEMSTATS_PAGE_SHIFT,
+            (unsigned long long)e[i].count[MEMSTATS_READ],
+            (unsigned long long)e[i].count[MEMSTATS_WRITE],
+            (unsigned long long)e[i].count[MEMSTATS_FETCH]);
+  }
+  free(e);
+
+  for (int i = 0; i < MEMSTATS_LOW_SIZE; i++) {
+    if (!low[i][MEMSTATS_READ] && !low[i][MEMSTATS_WRITE] && !low[i][MEMSTATS_FETCH])
+      continue;
+    fprintf(fp, "addr,0x%04X,,,,%llu,%llu,%llu,,\n", i,
+            (unsigned long long)low[i][MEMSTATS_READ],
+            (unsigned long long)low[i][MEMSTATS_WRITE],
+            (unsigned long long)low[i][MEMSTATS_FETCH]);
+  }
+
+  e = io_regs.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    uint16_t addr = e[i].key & 0xffff;
+    if (addr < MEMSTATS_SFR_SIZE)
+      fprintf(fp, "io,0x%04X,%u,,,", addr, (unsigned int)(e[i].key >> 16));
+    else
+      fprintf(fp, "io,0x%04X,,,,", addr);
+    fprintf(fp, "%llu,%llu,,,\n",
+            (unsigned long long)e[i].count[MEMSTATS_READ],
+            (unsigned long long)e[i].count[MEMSTATS_WRITE]);
+  }
+  free(e);
+
+  e = banks.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    fprintf(fp, "bank,,,0x%04X,0x%04X,,,,%llu,%llu\n",
+            (unsigned int)(e[i].key >> 16), (unsigned int)(e[i].key & 0xffff),
+            (unsigned long long)e[i].count[MEMSTATS_SWITCH],
+            (unsigned long long)e[i].count[MEMSTATS_REDUNDANT]);
+  }
+  free(e);
+
+  return !ferror(fp);
+}
+
+bool MemStats::saveJSON(FILE *fp, uint64_t cycles)
+{
+  struct MemStatsEntry *e;
+  int count;
+
+  fprintf(fp, "{\n  \"cycles\": %llu,\n  \"page_size\": %d,\n", (unsigned long long)cycles, 1 << MEMSTATS_PAGE_SHIFT);
+
+  fprintf(fp, "  \"pages\": [");
+  e = pages.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    fprintf(fp, "%s\n    {\"addr\": %llu, \"reads\": %llu, \"writes\": %llu, \"fetches\": %llu}",
+            i ? "," : "",
+            (unsigned long long)e[i].key << MEMSTATS_PAGE_SHIFT,
+            (unsigned long long)e[i].count[MEMSTATS_READ],
+            (unsigned long long)e[i].count[MEMSTATS_WRITE],
+            (unsigned long long)e[i].count[MEMSTATS_FETCH]);
+  }
+  free(e);
+
+  fprintf(fp, "\n  ],\n  \"addresses\": [");
+  bool first = true;
+  for (int i = 0; i < MEMSTATS_LOW_SIZE; i++) {
+    if (!low[i][MEMSTATS_READ] && !low[i][MEMSTATS_WRITE] && !low[i][MEMSTATS_FETCH])
+      continue;
+    fprintf(fp, "%s\n    {\"addr\": %d, \"reads\": %llu, \"writes\": %llu, \"fetches\": %llu}",
+            first ? "" : ",", i,
+            (unsigned long long)low[i][MEMSTATS_READ],
+            (unsigned long long)low[i][MEMSTATS_WRITE],
+            (unsigned long long)low[i][MEMSTATS_FETCH]);
+    first = false;
+  }
+
+  fprintf(fp, "\n  ],\n  \"io\": [");
+  e = io_regs.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    uint16_t addr = e[i].key & 0xffff;
+    fprintf(fp, "%s\n    {\"addr\": %u, ", i ? "," : "", addr);
+    if (addr < MEMSTATS_SFR_SIZE)
+      fprintf(fp, "\"wsr\": %u, ", (unsigned int)(e[i].key >> 16));
+    fprintf(fp, "\"reads\": %llu, \"writes\": %llu}",
+            (unsigned long long)e[i].count[MEMSTATS_READ],
+            (unsigned long long)e[i].count[MEMSTATS_WRITE]);
+  }
+  free(e);
+
+  fprintf(fp, "\n  ],\n  \"banks\": [");
+  e = banks.sorted(&count);
+  for (int i = 0; i < count; i++) {
+    fprintf(fp, "%s\n    {\"codemap\": %u, \"datamap\": %u, \"switches\": %llu, \"redundant\": %llu}",
+            i ? "," : "",
+            (unsigned int)(e[i].key >> 16), (unsigned int)(e[i].key & 0xffff),
+            (unsigned long long)e[i].count[MEMSTATS_SWITCH],
+            (unsigned long long)e[i].count[MEMSTATS_REDUNDANT]);
+  }
+  free(e);
+  fprintf(fp, "\n  ]\n}\n");
+
+  return !ferror(fp);
+}
@@ -0,0 +1,103 @@
+/*
+ * memstats.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _MEMSTATS_H
+#define _MEMSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MEMSTATS_PAGE_SHIFT 8
+/* register file and I/O space, counted per address */
+#define MEMSTATS_LOW_SIZE 0x300
+/* SFRs whose meaning depends on the window selected by WSR */
+#define MEMSTATS_SFR_SIZE 0x18
+
+#define MEMSTATS_READ 0
+#define MEMSTATS_WRITE 1
+#define MEMSTATS_FETCH 2
+/* for bank switches: writes to the mapping registers changing the
+   mapping, and those that do not */
+#define MEMSTATS_SWITCH 0
+#define MEMSTATS_REDUNDANT 1
+
+struct MemStatsEntry {
+  uint64_t key;
+  uint64_t count[3];
+};
+
+/* counters indexed by a sparse key */
+class MemStatsTable {
+public:
+  MemStatsTable();
+  ~MemStatsTable();
+
+  inline uint64_t *get(uint32_t key) {
+    if (last && last->key == key)
+      return last->count;
+    return lookup(key);
+  }
+
+  /* returns the used entries sorted by key; free() the result */
+  struct MemStatsEntry *sorted(int *count);
+
+private:
+  uint64_t *lookup(uint32_t key);
+
+  struct MemStatsEntry *entries;
+  struct MemStatsEntry *last;
+  int size;
+  int used;
+};
+
+/* Memory access statistics: reads, writes and instruction fetches per
+   physical page and per address in the register file and I/O space, I/O
+   register accesses per WSR window, and bank switches per CODEMAP/DATAMAP
+   combination. Only available if built with MEMSTATS. */
+class MemStats {
+public:
+  MemStats(const char *name);
+  ~MemStats();
+
+  inline void access(int type, uint16_t addr, uint32_t phys) {
+    pages.get(phys >> MEMSTATS_PAGE_SHIFT)[type]++;
+    if (addr < MEMSTATS_LOW_SIZE)
+      low[addr][type]++;
+  }
+  inline void io(int type, uint16_t addr, uint8_t wsr) {
+    io_regs.get(addr < MEMSTATS_SFR_SIZE ? (wsr << 16) | addr : addr)[type]++;
+  }
+  inline void bank(uint8_t code_hi, uint8_t code_lo, uint8_t data_hi, uint8_t data_lo, bool changed) {
+    banks.get(((uint32_t)code_hi << 24) | (code_lo << 16) | (data_hi << 8) | data_lo)
+         [changed ? MEMSTATS_SWITCH : MEMSTATS_REDUNDANT]++;
+  }
+
+  /* writes the statistics as JSON if the file name ends in ".json", as
+     CSV otherwise */
+  bool save(uint64_t cycles);
+
+private:
+  bool saveCSV(FILE *fp);
+  bool saveJSON(FILE *fp, uint64_t cycles);
+
+  char *name;
+  MemStatsTable pages;
+  MemStatsTable io_regs;
+  MemStatsTable banks;
+  uint64_t low[MEMSTATS_LOW_SIZE][3];
+};
+
+#ifdef MEMSTATS
+#define MEMSTATS_HOOK(x) do { if (unlikely(mem_stats != NULL)) mem_stats->x; } while (0)
+#else
+#define MEMSTATS_HOOK(x) do {} while (0)
+#endif
+
+#endif
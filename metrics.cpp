@@ -0,0 +1,42 @@
+/*
+ * metrics.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "metrics.h"
+#include "debug.h"
+#include "os.h"
+#include <string.h>
+
+static struct Metrics metrics_mem;
+struct Metrics *metrics = &metrics_mem;
+
+bool metrics_open(const char *name)
+{
+  struct Metrics *m = (struct Metrics *)os_map_file(name, sizeof(struct Metrics));
+  if (!m) {
+    ERROR("could not create metrics file %s\n", name);
+    return false;
+  }
+  *m = *metrics;
+  memcpy(m->magic, METRICS_MAGIC, sizeof(m->magic));
+  m->version = METRICS_VERSION;
+  m->size = sizeof(struct Metrics);
+  metrics = m;
+  return true;
+}
+
+void metrics_close()
+{
+  if (metrics == &metrics_mem)
+    return;
+  struct Metrics *m = metrics;
+  metrics_mem = *m;
+  metrics = &metrics_mem;
+  os_unmap_file(m, sizeof(struct Metrics));
+}
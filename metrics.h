@@ -0,0 +1,92 @@
+/*
+ * metrics.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_MAGIC "CASCMET"
+#define METRICS_VERSION 1
+#define METRICS_LAG_BUCKETS 16
+
+/* Runtime counters, always maintained. With metrics_open(), they live in
+   a memory-mapped file that other processes can read while the emulator
+   is running (see scripts/metrics.py). Rates are derived by the reader
+   from the difference between two samples. Counters written by more
+   than one thread (marked "shared") are only changed with the atomic
+   metrics_add() and metrics_max(), the others with plain increments;
+   readers may see a counter that is a little behind the others. The
+   layout is that of the file, in host byte order. */
+struct Metrics {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;		/* sizeof(struct Metrics) */
+
+  /* updated by Cpu::sync() */
+  uint64_t host_ms;		/* host time of the last update */
+  uint64_t cycles;		/* emulated state times */
+  uint64_t emulated_hz;		/* over the last second of host time */
+  uint64_t speed_permille;	/* emulated time per host time, 1000 means real time */
+  uint64_t syncs;
+  /* how far behind schedule sync() found the emulation; bucket 0 counts
+     the times it was on time, bucket n a lag of 2^(n-1) to 2^n - 1 ms */
+  uint64_t sync_lag[METRICS_LAG_BUCKETS];
+  uint64_t timing_resets;	/* times the emulation gave up catching up */
+  uint64_t sleep_ms;		/* time spent sleeping for pacing */
+  uint64_t spin_ms;		/* time spent busy-waiting for exact pacing */
+
+  /* serial port; bytes are received by the emulation thread and by the
+     interface read threads */
+  uint64_t rx_bytes;		/* shared */
+  uint64_t rx_overflows;	/* shared; bytes lost to a full RX ring */
+  uint64_t rx_depth;		/* bytes in the RX ring after the last addition */
+  uint64_t rx_depth_max;	/* shared */
+  uint64_t tx_bytes;
+
+  /* interface read threads */
+  uint64_t iface_wakeups;	/* returns from reading the interface */
+  uint64_t echo_cancelled;	/* interface echos recognized and dropped */
+  uint64_t echo_mismatches;	/* bytes received while expecting a different echo */
+
+  /* LCD */
+  uint64_t lcd_frames;		/* frames rendered */
+  uint64_t lcd_unchanged;	/* updates skipped because nothing changed */
+  uint64_t lcd_skipped;		/* updates skipped because painting is disabled */
+
+  /* recording and replaying */
+  uint64_t events_recorded;
+  uint64_t events_replayed;
+};
+
+extern struct Metrics *metrics;
+
+static inline void metrics_add(uint64_t *counter, uint64_t n)
+{
+  __sync_fetch_and_add(counter, n);
+}
+
+static inline void metrics_max(uint64_t *counter, uint64_t value)
+{
+  uint64_t old = *counter;
+  while (value > old) {
+    uint64_t seen = __sync_val_compare_and_swap(counter, old, value);
+    if (seen == old)
+      break;
+    old = seen;
+  }
+}
+
+/* moves the metrics into the given file */
+bool metrics_open(const char *name);
+/* moves them back into memory */
+void metrics_close();
+
+#endif
@@ -8,6 +8,8 @@
  * License 1.0.  Read the file "LICENSE" for details.
  */
 
+#include <stdint.h>
+
 int os_serial_open(const char *tty, bool nonblock = true);
 int os_serial_close(int handle);
 int os_serial_send(int handle, const char *msg);
@@ -25,9 +27,31 @@ int os_serial_find_port(const char *driver, char **tty);
 
 void os_msleep(int ms);
 unsigned int os_mtime(void);
+/* monotonic host time in nanoseconds, for measuring short intervals */
+uint64_t os_ntime(void);
 void *os_create_thread(int (*fn)(void *), void *data);
 void os_wait_thread(void *thread, int *status);
 void os_kill_thread(void *thread, int *status);
+void *os_create_mutex(void);
+void os_lock_mutex(void *mutex);
+void os_unlock_mutex(void *mutex);
+void os_destroy_mutex(void *mutex);
+
+/* maps a file of the given size into memory, creating or truncating it;
+   what is written there ends up in the file even if we crash */
+void *os_map_file(const char *name, unsigned long size);
+void os_sync_file(void *addr, unsigned long size);
+void os_unmap_file(void *addr, unsigned long size);
+
+/* TCP server on the loopback interface */
+int os_tcp_listen(int port);
+int os_tcp_accept(int sock);
+/* waits up to timeout ms for data; returns 1 if there is some, 0 on
+   timeout, -1 on error */
+int os_tcp_wait(int sock, int timeout);
+int os_tcp_recv(int sock, void *buf, int len);
+int os_tcp_send(int sock, const void *buf, int len);
+void os_tcp_close(int sock);
 
 int os_serial_set_break(int fd);
 int os_serial_clear_break(int fd);
@@ -10,7 +10,16 @@
 
 #include "os.h"
 #include <sys/time.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 void os_msleep(int ms)
 {
@@ -23,3 +32,90 @@ unsigned int os_mtime()
   gettimeofday(&tv, NULL);
   return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
+
+uint64_t os_ntime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void *os_map_file(const char *name, unsigned long size)
+{
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, size)) {
+    close(fd);
+    return NULL;
+  }
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return addr == MAP_FAILED ? NULL : addr;
+}
+
+void os_sync_file(void *addr, unsigned long size)
+{
+  msync(addr, size, MS_SYNC);
+}
+
+void os_unmap_file(void *addr, unsigned long size)
+{
+  munmap(addr, size);
+}
+
+int os_tcp_listen(int port)
+{
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+    return -1;
+  int one = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) || listen(sock, 1)) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+int os_tcp_accept(int sock)
+{
+  int conn = accept(sock, NULL, NULL);
+  if (conn >= 0) {
+    /* the protocols spoken here are request/response */
+    int one = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return conn;
+}
+
+int os_tcp_wait(int sock, int timeout)
+{
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(sock, &fds);
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  return select(sock + 1, &fds, NULL, NULL, &tv);
+}
+
+int os_tcp_recv(int sock, void *buf, int len)
+{
+  return recv(sock, buf, len, 0);
+}
+
+int os_tcp_send(int sock, const void *buf, int len)
+{
+  return send(sock, buf, len, MSG_NOSIGNAL);
+}
+
+void os_tcp_close(int sock)
+{
+  close(sock);
+}
@@ -9,7 +9,9 @@
  */
 
 #include "os.h"
+#include "log.h"
 #include <QtConcurrentRun>
+#include <QMutex>
 
 class OsThread : public QThread
 {
@@ -20,6 +22,7 @@ public:
   }
   void run() {
     res = fun(data);
+    log_thread_exit();
   }
   int result() {
     return res;
@@ -54,3 +57,23 @@ void os_kill_thread(void *thread, int *status)
   if (status)
     *status = thr->result();
 }
+
+void *os_create_mutex(void)
+{
+  return (void *)new QMutex();
+}
+
+void os_lock_mutex(void *mutex)
+{
+  ((QMutex *)mutex)->lock();
+}
+
+void os_unlock_mutex(void *mutex)
+{
+  ((QMutex *)mutex)->unlock();
+}
+
+void os_destroy_mutex(void *mutex)
+{
+  delete (QMutex *)mutex;
+}
@@ -9,7 +9,9 @@
  */
 
 #include <SDL/SDL.h>
+#include <stdlib.h>
 #include "os.h"
+#include "log.h"
 
 void os_msleep(int ms)
 {
@@ -21,12 +23,49 @@ unsigned int os_mtime(void)
   return SDL_GetTicks();
 }
 
+struct thread_start {
+  int (*fn)(void *);
+  void *data;
+};
+
+static int thread_runner(void *data)
+{
+  struct thread_start start = *(struct thread_start *)data;
+  free(data);
+  int ret = start.fn(start.data);
+  log_thread_exit();
+  return ret;
+}
+
 void *os_create_thread(int (*fn)(void *), void *data)
 {
-  return (void *)SDL_CreateThread(fn, data);
+  struct thread_start *start = (struct thread_start *)malloc(sizeof(struct thread_start));
+  start->fn = fn;
+  start->data = data;
+  return (void *)SDL_CreateThread(thread_runner, start);
 }
 
 void os_wait_thread(void *thread, int *status)
 {
   SDL_WaitThread((SDL_Thread *)thread, status);
 }
+
+void *os_create_mutex(void)
+{
+  return (void *)SDL_CreateMutex();
+}
+
+void os_lock_mutex(void *mutex)
+{
+  SDL_mutexP((SDL_mutex *)mutex);
+}
+
+void os_unlock_mutex(void *mutex)
+{
+  SDL_mutexV((SDL_mutex *)mutex);
+}
+
+void os_destroy_mutex(void *mutex)
+{
+  SDL_DestroyMutex((SDL_mutex *)mutex);
+}
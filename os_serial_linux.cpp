@@ -93,6 +93,24 @@ int os_serial_flush(int fd)
   return tcflush(fd, TCIOFLUSH);
 }
 
+/* pseudo-terminals have neither modem lines nor a baud rate divisor;
+   pretending to set them lets one stand in for an interface (see
+   kltiming.cpp). Anything else failing these calls is a real error. */
+static bool no_uart(int fd)
+{
+  static bool warned = false;
+  if (errno != ENOTTY && errno != EINVAL)
+    return false;
+  const char *tty = ttyname(fd);
+  if (!tty || strncmp(tty, "/dev/pts/", 9))
+    return false;
+  if (!warned) {
+    ERROR("%s is a pseudo-terminal, ignoring baud rate and modem lines\n", tty);
+    warned = true;
+  }
+  return true;
+}
+
 int os_serial_set_baudrate(int fd, int baudrate)
 {
   struct termios tios;
@@ -100,29 +118,32 @@ int os_serial_set_baudrate(int fd, int baudrate)
     ERROR("tcgetattr failed\n");
     return -1;
   }
-  struct serial_struct ser;
-  if (ioctl(fd, TIOCGSERIAL, &ser)) {
-    ERROR("TIOCGSERIAL failed\n");
-    return -1;
-  }
-  
-  ser.custom_divisor = ser.baud_base / baudrate;
-  ser.flags &= ~ASYNC_SPD_MASK;
-  ser.flags |= ASYNC_SPD_CUST | ASYNC_LOW_LATENCY;
-  
   tios.c_cflag &= ~CBAUD;
   tios.c_cflag |= B38400;
   
-  if (ioctl(fd, TIOCSSERIAL, &ser)) {
-    ERROR("TIOCSSERIAL failed\n");
-    return -1;
-  }
+  struct serial_struct ser;
   if (ioctl(fd, TIOCGSERIAL, &ser)) {
-    ERROR("TIOCGSERIAL failed\n");
-    return -1;
+    if (!no_uart(fd)) {
+      ERROR("TIOCGSERIAL failed\n");
+      return -1;
+    }
   }
-  if (ser.custom_divisor != ser.baud_base / baudrate) {
-    ERROR("failed to set baudrate divisor, is %d, should be %d\n", ser.custom_divisor, ser.baud_base / baudrate);
+  else {
+    ser.custom_divisor = ser.baud_base / baudrate;
+    ser.flags &= ~ASYNC_SPD_MASK;
+    ser.flags |= ASYNC_SPD_CUST | ASYNC_LOW_LATENCY;
+    
+    if (ioctl(fd, TIOCSSERIAL, &ser)) {
+      ERROR("TIOCSSERIAL failed\n");
+      return -1;
+    }
+    if (ioctl(fd, TIOCGSERIAL, &ser)) {
+      ERROR("TIOCGSERIAL failed\n");
+      return -1;
+    }
+    if (ser.custom_divisor != ser.baud_base / baudrate) {
+      ERROR("failed to set baudrate divisor, is %d, should be %d\n", ser.custom_divisor, ser.baud_base / baudrate);
+    }
   }
   if (tcsetattr(fd, TCSANOW, &tios) < 0) {
     ERROR("tcsetattr failed\n");
@@ -149,48 +170,37 @@ int os_serial_set_break(int fd)
   return 0;
 }
 
-int os_serial_set_rts(int fd)
+static int set_modem_lines(int fd, int set, int clear)
 {
   int flags;
   if (ioctl(fd, TIOCMGET, &flags)) {
+    if (no_uart(fd))
+      return 0;
     ERROR("CMBIC: %s\n", strerror(errno));
     return -1;
   }
-  flags |= TIOCM_RTS;
+  flags = (flags | set) & ~clear;
   return ioctl(fd, TIOCMSET, &flags);
 }
 
+int os_serial_set_rts(int fd)
+{
+  return set_modem_lines(fd, TIOCM_RTS, 0);
+}
+
 int os_serial_clear_rts(int fd)
 {
-  int flags;
-  if (ioctl(fd, TIOCMGET, &flags)) {
-    ERROR("CMBIC: %s\n", strerror(errno));
-    return -1;
-  }
-  flags &= ~TIOCM_RTS;
-  return ioctl(fd, TIOCMSET, &flags);
+  return set_modem_lines(fd, 0, TIOCM_RTS);
 }
 
 int os_serial_set_dtr(int fd)
 {
-  int flags;
-  if (ioctl(fd, TIOCMGET, &flags)) {
-    ERROR("CMBIC: %s\n", strerror(errno));
-    return -1;
-  }
-  flags |= TIOCM_DTR;
-  return ioctl(fd, TIOCMSET, &flags);
+  return set_modem_lines(fd, TIOCM_DTR, 0);
 }
 
 int os_serial_clear_dtr(int fd)
 {
-  int flags;
-  if (ioctl(fd, TIOCMGET, &flags)) {
-    ERROR("CMBIC: %s\n", strerror(errno));
-    return -1;
-  }
-  flags &= ~TIOCM_DTR;
-  return ioctl(fd, TIOCMSET, &flags);
+  return set_modem_lines(fd, 0, TIOCM_DTR);
 }
 
 const char *os_serial_get_error(void)
@@ -207,6 +217,15 @@ int os_serial_find_port(const char *driver, char **tty_found)
   sprintf(sysfs_dir, SYS_DRIVER_PATH "%s", driver);
   DEBUG(IFACE, "checking %s for tty\n", sysfs_dir);
 
+  /* a device given directly, e.g. a pseudo-terminal */
+  if (driver[0] == '/') {
+    delete sysfs_dir;
+    sh = os_serial_open(driver, false);
+    if (sh >= 0 && tty_found)
+      *tty_found = strdup(driver);
+    return sh;
+  }
+
   for (;;) {
     DIR *dir = opendir(sysfs_dir);
     if (!dir) {
@@ -9,8 +9,10 @@
  */
 
 #include "os.h"
+#include <winsock2.h>
 #include <windows.h>
 #include "debug.h"
+#include <string.h>
 
 void os_msleep(int ms)
 {
@@ -35,3 +37,99 @@ unsigned int os_mtime()
   }
   return time.QuadPart * 1000 / freq.QuadPart;
 }
+
+uint64_t os_ntime()
+{
+  os_mtime();	/* makes sure we have the frequency */
+  LARGE_INTEGER time;
+  QueryPerformanceCounter(&time);
+  /* split up so that the multiplication does not overflow */
+  return (time.QuadPart / freq.QuadPart) * 1000000000ULL +
+         (time.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+}
+
+void *os_map_file(const char *name, unsigned long size)
+{
+  HANDLE file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, size, NULL);
+  CloseHandle(file);
+  if (!mapping)
+    return NULL;
+  /* the view keeps the mapping and the file open */
+  void *addr = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+  CloseHandle(mapping);
+  return addr;
+}
+
+void os_sync_file(void *addr, unsigned long size)
+{
+  FlushViewOfFile(addr, size);
+}
+
+void os_unmap_file(void *addr, unsigned long size)
+{
+  UnmapViewOfFile(addr);
+}
+
+int os_tcp_listen(int port)
+{
+  static bool wsa_started = false;
+  if (!wsa_started) {
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa))
+      return -1;
+    wsa_started = true;
+  }
+  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock == INVALID_SOCKET)
+    return -1;
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) || listen(sock, 1)) {
+    closesocket(sock);
+    return -1;
+  }
+  return (int)sock;
+}
+
+int os_tcp_accept(int sock)
+{
+  SOCKET conn = accept(sock, NULL, NULL);
+  if (conn == INVALID_SOCKET)
+    return -1;
+  BOOL one = TRUE;
+  setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+  return (int)conn;
+}
+
+int os_tcp_wait(int sock, int timeout)
+{
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET((SOCKET)sock, &fds);
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  return select(0, &fds, NULL, NULL, &tv);
+}
+
+int os_tcp_recv(int sock, void *buf, int len)
+{
+  return recv(sock, (char *)buf, len, 0);
+}
+
+int os_tcp_send(int sock, const void *buf, int len)
+{
+  return send(sock, (const char *)buf, len, 0);
+}
+
+void os_tcp_close(int sock)
+{
+  closesocket(sock);
+}
@@ -0,0 +1,324 @@
+/*
+ * profiler.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "profiler.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+Profiler::Profiler(const char *name, uint32_t interval)
+{
+  this->name = strdup(name);
+  this->interval = interval ? interval : PROFILE_DEFAULT_INTERVAL;
+  total = 0;
+  stacks = NULL;
+  num_stacks = 0;
+  table_size = 1024;
+  table = (uint32_t *)calloc(table_size, sizeof(uint32_t));
+  frames_size = 4096;
+  frames = (struct ProfileFrame *)malloc(frames_size * sizeof(struct ProfileFrame));
+  num_frames = 0;
+}
+
+Profiler::~Profiler()
+{
+  free(name);
+  free(stacks);
+  free(table);
+  free(frames);
+}
+
+static uint32_t hash_frames(const struct ProfileFrame *f, int depth)
+{
+  uint32_t h = 2166136261U;
+  for (int i = 0; i < depth; i++) {
+    h = (h ^ f[i].func) * 16777619U;
+    h = (h ^ f[i].addr) * 16777619U;
+  }
+  return h;
+}
+
+uint32_t *Profiler::findSlot(const struct ProfileFrame *f, int depth, uint32_t hash)
+{
+  uint32_t mask = table_size - 1;
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+    if (!table[i])
+      return &table[i];
+    struct Stack *s = &stacks[table[i] - 1];
+    if (s->hash == hash && s->depth == (uint32_t)depth &&
+        !memcmp(&frames[s->offset], f, depth * sizeof(*f)))
+      return &table[i];
+  }
+}
+
+void Profiler::grow()
+{
+  free(table);
+  table_size *= 2;
+  table = (uint32_t *)calloc(table_size, sizeof(uint32_t));
+  for (int i = 0; i < num_stacks; i++) {
+    struct Stack *s = &stacks[i];
+    *findSlot(&frames[s->offset], s->depth, s->hash) = i + 1;
+  }
+}
+
+void Profiler::sample(const struct ProfileFrame *f, int depth)
+{
+  total++;
+  uint32_t hash = hash_frames(f, depth);
+  uint32_t *slot = findSlot(f, depth, hash);
+  if (*slot) {
+    stacks[*slot - 1].count++;
+    return;
+  }
+
+  /* new stack */
+  if (num_frames + depth > frames_size) {
+    frames_size *= 2;
+    frames = (struct ProfileFrame *)realloc(frames, frames_size * sizeof(struct ProfileFrame));
+  }
+  memcpy(&frames[num_frames], f, depth * sizeof(*f));
+  /* the stacks array grows in powers of two */
+  if (!(num_stacks & (num_stacks - 1)))
+    stacks = (struct Stack *)realloc(stacks, (num_stacks ? num_stacks * 2 : 1) * sizeof(struct Stack));
+  struct Stack *s = &stacks[num_stacks++];
+  s->hash = hash;
+  s->offset = num_frames;
+  s->depth = depth;
+  s->count = 1;
+  num_frames += depth;
+  *slot = num_stacks;
+
+  if (num_stacks * 2 > table_size)
+    grow();
+}
+
+static void frame_name(char *buf, const struct ProfileFrame *f)
+{
+  if (f->func == PROFILE_UNKNOWN_FUNC)
+    sprintf(buf, "[%06X]", f->addr);
+  else
+    sprintf(buf, "%06X", f->func);
+}
+
+/* one line per stack, outermost frame first, as expected by
+   flamegraph.pl and friends */
+bool Profiler::saveFolded(FILE *fp)
+{
+  char buf[16];
+  for (int i = 0; i < num_stacks; i++) {
+    struct Stack *s = &stacks[i];
+    for (int j = s->depth - 1; j >= 0; j--) {
+      frame_name(buf, &frames[s->offset + j]);
+      fprintf(fp, j ? "%s;" : "%s", buf);
+    }
+    fprintf(fp, " %llu\n", (unsigned long long)s->count);
+  }
+  return !ferror(fp);
+}
+
+/* minimal protocol buffer encoder for the pprof profile.proto format */
+struct PbBuf {
+  uint8_t *data;
+  size_t len;
+  size_t size;
+};
+
+static void pb_put(struct PbBuf *b, const void *data, size_t len)
+{
+  if (b->len + len > b->size) {
+    b->size = (b->len + len) * 2;
+    b->data = (uint8_t *)realloc(b->data, b->size);
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static void pb_varint(struct PbBuf *b, uint64_t v)
+{
+  uint8_t buf[10];
+  int n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = v;
+  pb_put(b, buf, n);
+}
+
+static void pb_uint(struct PbBuf *b, int field, uint64_t v)
+{
+  pb_varint(b, field << 3);
+  pb_varint(b, v);
+}
+
+static void pb_bytes(struct PbBuf *b, int field, const void *data, size_t len)
+{
+  pb_varint(b, (field << 3) | 2);
+  pb_varint(b, len);
+  pb_put(b, data, len);
+}
+
+/* appends sub as an embedded message and empties it for reuse */
+static void pb_msg(struct PbBuf *b, int field, struct PbBuf *sub)
+{
+  pb_bytes(b, field, sub->data, sub->len);
+  sub->len = 0;
+}
+
+/* maps 64-bit keys to consecutive IDs starting at 1 */
+struct IdMap {
+  uint64_t *keys;
+  uint32_t *ids;
+  uint32_t size;
+  uint32_t count;
+};
+
+static void idmap_init(struct IdMap *m, uint32_t max)
+{
+  for (m->size = 16; m->size < max * 2; m->size *= 2) {}
+  m->keys = (uint64_t *)malloc(m->size * sizeof(uint64_t));
+  m->ids = (uint32_t *)calloc(m->size, sizeof(uint32_t));
+  m->count = 0;
+}
+
+static void idmap_free(struct IdMap *m)
+{
+  free(m->keys);
+  free(m->ids);
+}
+
+/* sets *is_new if the key has not been seen before */
+static uint32_t idmap_get(struct IdMap *m, uint64_t key, bool *is_new)
+{
+  uint32_t mask = m->size - 1;
+  uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 40) & mask;
+  for (; m->ids[i]; i = (i + 1) & mask) {
+    if (m->keys[i] == key) {
+      *is_new = false;
+      return m->ids[i];
+    }
+  }
+  m->keys[i] = key;
+  m->ids[i] = ++m->count;
+  *is_new = true;
+  return m->ids[i];
+}
+
+bool Profiler::savePprof(FILE *fp)
+{
+  struct PbBuf prof = {NULL, 0, 0};
+  struct PbBuf msg = {NULL, 0, 0};
+  struct PbBuf sub = {NULL, 0, 0};
+  struct PbBuf strings = {NULL, 0, 0};
+  struct IdMap locations, functions;
+  idmap_init(&locations, num_frames);
+  idmap_init(&functions, num_frames);
+
+  /* string table: fixed strings first, then one name per function */
+  static const char *fixed_strings[] = {"", "samples", "count", "cycles"};
+  const int num_fixed_strings = 4;
+  for (int i = 0; i < num_fixed_strings; i++)
+    pb_bytes(&strings, 6, fixed_strings[i], strlen(fixed_strings[i]));
+
+  /* sample types: number of samples and estimated cycles */
+  pb_uint(&msg, 1, 1);
+  pb_uint(&msg, 2, 2);
+  pb_msg(&prof, 1, &msg);
+  pb_uint(&msg, 1, 3);
+  pb_uint(&msg, 2, 3);
+  pb_msg(&prof, 1, &msg);
+
+  char buf[16];
+  for (int i = 0; i < num_stacks; i++) {
+    struct Stack *s = &stacks[i];
+    for (uint32_t j = 0; j < s->depth; j++) {
+      struct ProfileFrame *f = &frames[s->offset + j];
+      bool is_new;
+      uint32_t loc = idmap_get(&locations, ((uint64_t)f->func << 32) | f->addr, &is_new);
+      pb_varint(&sub, loc);
+      if (!is_new)
+        continue;
+
+      uint32_t func = idmap_get(&functions, f->func == PROFILE_UNKNOWN_FUNC ?
+                                ((uint64_t)1 << 32) | f->addr : f->func, &is_new);
+      if (is_new) {
+        frame_name(buf, f);
+        pb_bytes(&strings, 6, buf, strlen(buf));
+        struct PbBuf fn = {NULL, 0, 0};
+        pb_uint(&fn, 1, func);
+        pb_uint(&fn, 2, num_fixed_strings + func - 1);
+        pb_uint(&fn, 3, num_fixed_strings + func - 1);
+        pb_msg(&msg, 5, &fn);
+        free(fn.data);
+      }
+      struct PbBuf loc_msg = {NULL, 0, 0};
+      struct PbBuf line = {NULL, 0, 0};
+      pb_uint(&loc_msg, 1, loc);
+      pb_uint(&loc_msg, 3, f->addr);
+      pb_uint(&line, 1, func);
+      pb_msg(&loc_msg, 4, &line);
+      pb_msg(&msg, 4, &loc_msg);
+      free(loc_msg.data);
+      free(line.data);
+    }
+
+    /* sample: location IDs (packed, innermost first), then values */
+    struct PbBuf sample = {NULL, 0, 0};
+    pb_msg(&sample, 1, &sub);
+    pb_varint(&sub, s->count);
+    pb_varint(&sub, s->count * interval);
+    pb_msg(&sample, 2, &sub);
+    pb_msg(&prof, 2, &sample);
+    free(sample.data);
+  }
+
+  /* locations and functions, collected above */
+  pb_put(&prof, msg.data, msg.len);
+  msg.len = 0;
+  pb_put(&prof, strings.data, strings.len);
+
+  /* period type and period */
+  pb_uint(&msg, 1, 3);
+  pb_uint(&msg, 2, 2);
+  pb_msg(&prof, 11, &msg);
+  pb_uint(&prof, 12, interval);
+
+  bool ret = fwrite(prof.data, 1, prof.len, fp) == prof.len;
+  free(prof.data);
+  free(msg.data);
+  free(sub.data);
+  free(strings.data);
+  idmap_free(&locations);
+  idmap_free(&functions);
+  return ret;
+}
+
+bool Profiler::save()
+{
+  FILE *fp = fopen(name, "wb");
+  if (!fp) {
+    ERROR("could not create profile %s\n", name);
+    return false;
+  }
+  const char *ext = strrchr(name, '.');
+  bool ret;
+  if (ext && (!strcmp(ext, ".pb") || !strcmp(ext, ".pprof")))
+    ret = savePprof(fp);
+  else
+    ret = saveFolded(fp);
+  if (fclose(fp) || !ret) {
+    ERROR("failed to write profile %s\n", name);
+    return false;
+  }
+  DEBUG(WARN, "profile: %llu samples, %d stacks written to %s\n",
+        (unsigned long long)total, num_stacks, name);
+  return true;
+}
@@ -0,0 +1,77 @@
+/*
+ * profiler.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILE_DEFAULT_INTERVAL 10007	/* prime, so we don't beat with periodic tasks */
+#define PROFILE_MAX_DEPTH 32
+
+/* entry of a function we only know a call site of */
+#define PROFILE_UNKNOWN_FUNC 0xffffffffUL
+
+/* One level of a firmware call stack; physical addresses. func is the
+   entry point of the function, addr the PC in the innermost frame and the
+   call site in the others. */
+struct ProfileFrame {
+  uint32_t func;
+  uint32_t addr;
+};
+
+/* Counts identical call stacks sampled from the firmware and writes them
+   in folded ("flame graph") or pprof format. */
+class Profiler {
+public:
+  Profiler(const char *name, uint32_t interval);
+  ~Profiler();
+
+  inline uint32_t getInterval() {
+    return interval;
+  }
+
+  /* frames[0] is the innermost frame */
+  void sample(const struct ProfileFrame *frames, int depth);
+
+  /* writes the profile to the file given in the constructor; files ending
+     in ".pb" or ".pprof" get pprof format, all others folded stacks */
+  bool save();
+
+private:
+  struct Stack {
+    uint32_t hash;
+    uint32_t offset;	/* into frames */
+    uint32_t depth;
+    uint64_t count;
+  };
+
+  uint32_t *findSlot(const struct ProfileFrame *f, int depth, uint32_t hash);
+  void grow();
+  bool saveFolded(FILE *fp);
+  bool savePprof(FILE *fp);
+
+  char *name;
+  uint32_t interval;
+  uint64_t total;
+
+  struct Stack *stacks;
+  int num_stacks;
+  /* hash table of indices into stacks plus one, 0 means empty */
+  uint32_t *table;
+  int table_size;
+
+  struct ProfileFrame *frames;
+  uint32_t num_frames;
+  uint32_t frames_size;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * rewind.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "rewind.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+Rewind::Rewind(size_t max_memory)
+{
+  this->max_memory = max_memory;
+  entries = NULL;
+  num_entries = entries_size = 0;
+  last_full = -1;
+  read_pos = 0;
+  size = 0;
+}
+
+Rewind::~Rewind()
+{
+  clear();
+  free(entries);
+}
+
+void Rewind::freeEntry(struct RewindEntry *e)
+{
+  size -= e->snapshot->getSize() + e->events_size * sizeof(struct Event);
+  delete e->snapshot;
+  free(e->events);
+}
+
+void Rewind::clear()
+{
+  while (num_entries)
+    freeEntry(&entries[--num_entries]);
+  last_full = -1;
+  read_pos = 0;
+}
+
+Snapshot *Rewind::getBase()
+{
+  if (last_full < 0 || num_entries - last_full >= REWIND_FULL_INTERVAL)
+    return NULL;
+  Snapshot *full = entries[last_full].snapshot;
+  /* the longer ago the full snapshot has been taken, the larger the
+     deltas get; at some point, a new one is cheaper */
+  Snapshot *last = entries[num_entries - 1].snapshot;
+  if (last != full && last->getSize() > full->getSize() / 2)
+    return NULL;
+  /* nothing can be dropped until there is a second full snapshot */
+  if (size > max_memory && last_full == 0)
+    return NULL;
+  return full;
+}
+
+/* drops the oldest full snapshot and the ones based on it */
+void Rewind::dropOldest()
+{
+  int n = 1;
+  while (n < num_entries && entries[n].snapshot->getBase())
+    n++;
+  for (int i = 0; i < n; i++)
+    freeEntry(&entries[i]);
+  num_entries -= n;
+  memmove(entries, entries + n, num_entries * sizeof(struct RewindEntry));
+  last_full -= n;
+}
+
+void Rewind::add(Snapshot *s, const int *poll_value)
+{
+  if (num_entries == entries_size) {
+    entries_size = entries_size ? entries_size * 2 : 64;
+    entries = (struct RewindEntry *)realloc(entries, entries_size * sizeof(struct RewindEntry));
+  }
+  struct RewindEntry *e = &entries[num_entries];
+  e->snapshot = s;
+  memcpy(e->poll_value, poll_value, sizeof(e->poll_value));
+  e->events = NULL;
+  e->num_events = e->events_size = 0;
+  size += s->getSize();
+  if (!s->getBase())
+    last_full = num_entries;
+  num_entries++;
+
+  while (size > max_memory && last_full > 0)
+    dropOldest();
+  DEBUG(EVENT, "rewind history from %llu, %d entries, %d bytes\n",
+        (unsigned long long)entries[0].snapshot->getCycles(), num_entries, (int)size);
+}
+
+void Rewind::logEvent(const struct Event &ev)
+{
+  if (!num_entries)
+    return;
+  struct RewindEntry *e = &entries[num_entries - 1];
+  if (e->num_events == e->events_size) {
+    int old_size = e->events_size;
+    e->events_size = e->events_size ? e->events_size * 2 : 256;
+    e->events = (struct Event *)realloc(e->events, e->events_size * sizeof(struct Event));
+    size += (e->events_size - old_size) * sizeof(struct Event);
+  }
+  e->events[e->num_events++] = ev;
+}
+
+Snapshot *Rewind::rewindTo(uint64_t cycles, int *poll_value)
+{
+  if (!num_entries)
+    return NULL;
+
+  int i = num_entries - 1;
+  while (i > 0 && entries[i].snapshot->getCycles() > cycles)
+    i--;
+  while (num_entries > i + 1)
+    freeEntry(&entries[--num_entries]);
+  if (last_full > i) {
+    /* the first entry is always a full snapshot */
+    for (last_full = i; entries[last_full].snapshot->getBase(); last_full--) {}
+  }
+
+  memcpy(poll_value, entries[i].poll_value, sizeof(entries[i].poll_value));
+  read_pos = 0;
+  return entries[i].snapshot;
+}
+
+bool Rewind::readEvent(struct Event &ev)
+{
+  if (!num_entries)
+    return false;
+  struct RewindEntry *e = &entries[num_entries - 1];
+  if (read_pos >= e->num_events)
+    return false;
+  ev = e->events[read_pos++];
+  return true;
+}
+
+void Rewind::truncate(int unused)
+{
+  if (num_entries)
+    entries[num_entries - 1].num_events = read_pos - unused;
+  read_pos = 0;
+}
+
+uint64_t Rewind::getOldestCycles()
+{
+  if (!num_entries)
+    return 0;
+  return entries[0].snapshot->getCycles();
+}
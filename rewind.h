@@ -0,0 +1,81 @@
+/*
+ * rewind.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _REWIND_H
+#define _REWIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "event.h"
+#include "snapshot.h"
+
+/* every n-th snapshot is a full one, the others are incremental */
+#define REWIND_FULL_INTERVAL 10
+
+/* A snapshot and the input events that have occurred since it was taken.
+   poll_value holds the polled inputs as they were at the time, so that
+   unchanged values need not be logged. */
+struct RewindEntry {
+  Snapshot *snapshot;
+  int poll_value[EVENT_MAX];
+  struct Event *events;
+  int num_events;
+  int events_size;
+};
+
+/* Bounded history of snapshots for going back in time. Going to an earlier
+   point means restoring the newest snapshot before it and re-executing
+   the events logged since. When the memory limit is exceeded, the oldest
+   full snapshot is dropped together with the incremental ones based on
+   it. */
+class Rewind {
+public:
+  Rewind(size_t max_memory);
+  ~Rewind();
+
+  void clear();
+
+  /* base for the next snapshot, NULL if a full one is due */
+  Snapshot *getBase();
+  /* adds a new entry; events logged from now on belong to it */
+  void add(Snapshot *s, const int *poll_value);
+  void logEvent(const struct Event &e);
+
+  /* Drops all entries newer than the given cycle count and returns the
+     snapshot of the newest one left (or the oldest one if there is none
+     that old), NULL if the history is empty. The poll values are copied
+     to poll_value, and readEvent() returns the events logged since. */
+  Snapshot *rewindTo(uint64_t cycles, int *poll_value);
+  bool readEvent(struct Event &e);
+  /* ends re-execution; the events that have not been read yet, plus
+     "unused" ones that have, are discarded */
+  void truncate(int unused);
+
+  uint64_t getOldestCycles();
+  inline size_t getSize() {
+    return size;
+  }
+
+private:
+  void freeEntry(struct RewindEntry *e);
+  void dropOldest();
+
+  struct RewindEntry *entries;
+  int num_entries;
+  int entries_size;
+  /* index of the newest full snapshot, -1 if none */
+  int last_full;
+  int read_pos;
+
+  size_t size;
+  size_t max_memory;
+};
+
+#endif
@@ -51,9 +51,12 @@ public:
   bool empty() {
     return start == end;
   }
+  bool full() {
+    return (end + 1) % size == start;
+  }
   int count() {
     if (start > end)
-      return size - end + start;
+      return size - start + end;
     else
       return end - start;
   }
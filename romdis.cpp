@@ -0,0 +1,367 @@
+/*
+ * romdis.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+/* Offline ROM disassembler; built instead of the emulator with
+   CONFIG+=romdis ("make romdis").
+
+   Disassembles everything reachable from the reset address and the
+   interrupt vectors across all banks (see CodeFlow) and writes one of
+     list  a listing with function and block labels and the bank switches
+     json  functions with their basic blocks, successors and calls, and
+           the jumps that could not be resolved
+     dot   the control flow graph, one cluster per function
+     syms  "<address> <name>" per function
+   Addresses are physical, as in the profiler output and the watchpoints,
+   so the names in syms can be matched with the functions there.
+
+   usage: cascade-romdis [-f list|json|dot|syms] [-o file] [-F function]
+                         [-e address[=name]]... rom
+
+   -F limits json and dot to the function at the given address, -e adds
+   entry points the disassembler cannot find by itself, like the targets
+   of jump tables. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "disasm.h"
+#include "codeflow.h"
+
+uint32_t debug_level;
+uint32_t debug_level_unabridged;
+FILE *win_stderr;
+
+#define FORMAT_LIST 0
+#define FORMAT_JSON 1
+#define FORMAT_DOT 2
+#define FORMAT_SYMS 3
+
+static const char *reg_names[] = {"CODEMAP_LO", "CODEMAP_HI", "DATAMAP_LO", "DATAMAP_HI"};
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: cascade-romdis [-f list|json|dot|syms] [-o file] [-F function]\n"
+                  "                      [-e address[=name]]... rom\n");
+  exit(1);
+}
+
+static uint8_t *readRom(const char *name, uint32_t *size)
+{
+  FILE *fp = fopen(name, "rb");
+  if (!fp) {
+    ERROR("failed to open %s\n", name);
+    return NULL;
+  }
+  struct stat st;
+  fstat(fileno(fp), &st);
+  *size = st.st_size;
+  uint8_t *rom = (uint8_t *)malloc(*size ? *size : 1);
+  if (fread(rom, 1, *size, fp) != *size) {
+    ERROR("failed to read %s\n", name);
+    free(rom);
+    rom = NULL;
+  }
+  fclose(fp);
+  return rom;
+}
+
+static struct CodeFunc *findFunc(CodeFlow *cf, uint32_t addr)
+{
+  int lo = 0, hi = cf->num_funcs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cf->funcs[mid].addr < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < cf->num_funcs && cf->funcs[lo].addr == addr ? &cf->funcs[lo] : NULL;
+}
+
+/* writes a function name, which may come from -e, as a JSON or DOT string;
+   both want quotes and backslashes escaped */
+static void writeQuoted(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', fp);
+    fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void writeList(CodeFlow *cf, FILE *fp)
+{
+  uint32_t end = 0;
+  int sw = 0;
+  for (uint32_t p = 0; p < cf->size; p++) {
+    uint8_t flags = cf->getFlags(p);
+    if (!(flags & CF_INSN))
+      continue;
+    if (p != end)
+      fprintf(fp, "\n");
+    if (flags & CF_FUNC)
+      fprintf(fp, "%s%s:\n", p == end ? "\n" : "", findFunc(cf, p)->name);
+    else if (flags & CF_BLOCK)
+      fprintf(fp, "loc_%06X:\n", p);
+
+    uint8_t code[DISASM_MAX_LEN];
+    cf->fetch(p, code);
+    int len;
+    const char *text = disasm(code, CodeFlow::virt(p), &len);
+    char bytes[3 * DISASM_MAX_LEN + 1];
+    for (int i = 0; i < len; i++)
+      sprintf(bytes + 3 * i, "%02X ", code[i]);
+    fprintf(fp, "  %06X %04X  %-21s %s", p, CodeFlow::virt(p), bytes, text);
+
+    while (sw < cf->num_switches && cf->switches[sw].at < p)
+      sw++;
+    for (; sw < cf->num_switches && cf->switches[sw].at == p; sw++) {
+      if (cf->switches[sw].value < 0)
+        fprintf(fp, "  ; %s = ?", reg_names[cf->switches[sw].reg - 0x270]);
+      else
+        fprintf(fp, "  ; %s = %02Xh", reg_names[cf->switches[sw].reg - 0x270], cf->switches[sw].value);
+    }
+    for (int e = cf->findEdge(p); e < cf->num_edges && cf->edges[e].from == p; e++) {
+      if (cf->edges[e].to != CF_NONE)
+        continue;
+      if ((flags >> CF_FLOW_SHIFT) == FLOW_INDIRECT)
+        fprintf(fp, "  ; target unknown");
+      else
+        fprintf(fp, "  ; bank of %04X unknown", cf->edges[e].virt);
+    }
+    fprintf(fp, "\n");
+    end = p + len;
+  }
+}
+
+static void writeSyms(CodeFlow *cf, FILE *fp)
+{
+  for (int i = 0; i < cf->num_funcs; i++)
+    fprintf(fp, "%06X %s\n", cf->funcs[i].addr, cf->funcs[i].name);
+}
+
+static void writeJSON(CodeFlow *cf, FILE *fp, struct CodeFunc *only)
+{
+  fprintf(fp, "{\n  \"functions\": [");
+  bool first_func = true;
+  for (int i = 0; i < cf->num_funcs; i++) {
+    struct CodeFunc *fn = &cf->funcs[i];
+    if (only && fn != only)
+      continue;
+    fprintf(fp, "%s\n    {\"addr\": \"%06X\", \"name\": ", first_func ? "" : ",", fn->addr);
+    writeQuoted(fp, fn->name);
+    fprintf(fp, ", \"insns\": %d, \"bytes\": %u,", fn->insns, fn->bytes);
+    first_func = false;
+
+    fprintf(fp, "\n     \"calls\": [");
+    bool first = true;
+    for (int j = 0; j < fn->num_blocks; j++) {
+      struct CodeBlock *b = &cf->blocks[cf->func_blocks[fn->first_block + j]];
+      for (int e = cf->findEdge(b->start); e < cf->num_edges && cf->edges[e].from < b->end; e++) {
+        if (cf->edges[e].kind != EDGE_CALL)
+          continue;
+        if (cf->edges[e].to == CF_NONE)
+          fprintf(fp, "%s{\"from\": \"%06X\", \"virt\": \"%04X\"}", first ? "" : ", ",
+                  cf->edges[e].from, cf->edges[e].virt);
+        else
+          fprintf(fp, "%s{\"from\": \"%06X\", \"to\": \"%06X\"}", first ? "" : ", ",
+                  cf->edges[e].from, cf->edges[e].to);
+        first = false;
+      }
+    }
+    fprintf(fp, "],\n     \"blocks\": [");
+    for (int j = 0; j < fn->num_blocks; j++) {
+      struct CodeBlock *b = &cf->blocks[cf->func_blocks[fn->first_block + j]];
+      fprintf(fp, "%s\n       {\"addr\": \"%06X\", \"end\": \"%06X\", \"insns\": %d, \"succ\": [",
+              j ? "," : "", b->start, b->end, b->insns);
+      for (int s = 0; s < b->num_succ; s++)
+        fprintf(fp, "%s\"%06X\"", s ? ", " : "", cf->blocks[cf->succ[b->first_succ + s]].start);
+      fprintf(fp, "]}");
+    }
+    fprintf(fp, "]}");
+  }
+  fprintf(fp, "\n  ],\n  \"unresolved\": [");
+  bool first = true;
+  for (int e = 0; e < cf->num_edges; e++) {
+    if (cf->edges[e].to != CF_NONE)
+      continue;
+    if (only) {
+      /* only those from the blocks of the function */
+      bool inside = false;
+      for (int j = 0; j < only->num_blocks && !inside; j++) {
+        struct CodeBlock *b = &cf->blocks[cf->func_blocks[only->first_block + j]];
+        inside = cf->edges[e].from >= b->start && cf->edges[e].from < b->end;
+      }
+      if (!inside)
+        continue;
+    }
+    if ((cf->getFlags(cf->edges[e].from) >> CF_FLOW_SHIFT) == FLOW_INDIRECT)
+      fprintf(fp, "%s\n    {\"from\": \"%06X\"}", first ? "" : ",", cf->edges[e].from);
+    else
+      fprintf(fp, "%s\n    {\"from\": \"%06X\", \"virt\": \"%04X\"}", first ? "" : ",",
+              cf->edges[e].from, cf->edges[e].virt);
+    first = false;
+  }
+  fprintf(fp, "\n  ]\n}\n");
+}
+
+static void writeDot(CodeFlow *cf, FILE *fp, struct CodeFunc *only)
+{
+  /* a block in more than one function goes into the cluster of the first */
+  int *placed = (int *)calloc(cf->num_blocks, sizeof(int));
+  fprintf(fp, "digraph cfg {\n  node [shape=box, fontname=monospace];\n");
+  for (int i = 0; i < cf->num_funcs; i++) {
+    struct CodeFunc *fn = &cf->funcs[i];
+    if (only && fn != only)
+      continue;
+    fprintf(fp, "  subgraph cluster_%06X {\n    label=", fn->addr);
+    writeQuoted(fp, fn->name);
+    fprintf(fp, ";\n");
+    for (int j = 0; j < fn->num_blocks; j++) {
+      int bi = cf->func_blocks[fn->first_block + j];
+      if (placed[bi])
+        continue;
+      placed[bi] = 1;
+      struct CodeBlock *b = &cf->blocks[bi];
+      fprintf(fp, "    b%06X [label=\"%06X-%06X\\n%d insns\"];\n", b->start, b->start, b->end - 1, b->insns);
+    }
+    fprintf(fp, "  }\n");
+  }
+  for (int i = 0; i < cf->num_funcs; i++) {
+    struct CodeFunc *fn = &cf->funcs[i];
+    if (only && fn != only)
+      continue;
+    for (int j = 0; j < fn->num_blocks; j++) {
+      int bi = cf->func_blocks[fn->first_block + j];
+      if (placed[bi] != 1)
+        continue;
+      placed[bi] = 2;	/* edges once */
+      struct CodeBlock *b = &cf->blocks[bi];
+      for (int s = 0; s < b->num_succ; s++)
+        fprintf(fp, "  b%06X -> b%06X;\n", b->start, cf->blocks[cf->succ[b->first_succ + s]].start);
+      for (int e = cf->findEdge(b->start); e < cf->num_edges && cf->edges[e].from < b->end; e++) {
+        if (cf->edges[e].kind != EDGE_CALL || cf->edges[e].to == CF_NONE)
+          continue;
+        if (only) {
+          /* the target may not have been decoded, e.g. when it lies
+             within another instruction */
+          struct CodeFunc *to = findFunc(cf, cf->edges[e].to);
+          char label[16];
+          sprintf(label, "%06X", cf->edges[e].to);
+          fprintf(fp, "  f%06X [label=", cf->edges[e].to);
+          writeQuoted(fp, to ? to->name : label);
+          fprintf(fp, ", shape=ellipse];\n");
+        }
+        fprintf(fp, "  b%06X -> %c%06X [style=dashed];\n", b->start, only ? 'f' : 'b', cf->edges[e].to);
+      }
+    }
+  }
+  fprintf(fp, "}\n");
+  free(placed);
+}
+
+int main(int argc, char **argv)
+{
+  int format = FORMAT_LIST;
+  const char *out_name = NULL;
+  uint32_t only_addr = CF_NONE;
+  const char *entries[256];
+  int num_entries = 0;
+
+  win_stderr = stderr;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:o:F:e:")) != -1) {
+    switch (opt) {
+      case 'f':
+        if (!strcmp(optarg, "list"))
+          format = FORMAT_LIST;
+        else if (!strcmp(optarg, "json"))
+          format = FORMAT_JSON;
+        else if (!strcmp(optarg, "dot"))
+          format = FORMAT_DOT;
+        else if (!strcmp(optarg, "syms"))
+          format = FORMAT_SYMS;
+        else
+          usage();
+        break;
+      case 'o':
+        out_name = optarg;
+        break;
+      case 'F':
+        only_addr = strtoul(optarg, NULL, 16);
+        break;
+      case 'e':
+        if (num_entries == 256)
+          usage();
+        entries[num_entries++] = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind != argc - 1)
+    usage();
+
+  uint32_t size;
+  uint8_t *rom = readRom(argv[optind], &size);
+  if (!rom)
+    return 1;
+
+  clock_t start = clock();
+  CodeFlow cf(rom, size);
+  cf.addDefaultEntries();
+  for (int i = 0; i < num_entries; i++) {
+    char *end;
+    uint32_t phys = strtoul(entries[i], &end, 16);
+    if (end == entries[i] || (*end && *end != '='))
+      usage();
+    cf.addEntry(CodeFlow::virt(phys), CodeFlow::bankOf(phys), *end ? end + 1 : NULL);
+  }
+  cf.analyze();
+  ERROR("%d functions, %d blocks, %u instructions in %u of %u bytes, "
+        "%d bank switches, %u overlaps, %u out of ROM, %u ms\n",
+        cf.num_funcs, cf.num_blocks, cf.num_insns, cf.code_bytes, size,
+        cf.num_switches, cf.overlaps, cf.out_of_rom,
+        (unsigned int)((clock() - start) * 1000 / CLOCKS_PER_SEC));
+
+  struct CodeFunc *only = NULL;
+  if (only_addr != CF_NONE && !(only = findFunc(&cf, only_addr))) {
+    ERROR("no function at %06X\n", only_addr);
+    free(rom);
+    return 1;
+  }
+
+  FILE *fp = out_name ? fopen(out_name, "w") : stdout;
+  if (!fp) {
+    ERROR("could not create %s\n", out_name);
+    free(rom);
+    return 1;
+  }
+  switch (format) {
+    case FORMAT_LIST: writeList(&cf, fp); break;
+    case FORMAT_JSON: writeJSON(&cf, fp, only); break;
+    case FORMAT_DOT: writeDot(&cf, fp, only); break;
+    case FORMAT_SYMS: writeSyms(&cf, fp); break;
+  }
+  int ret = 0;
+  if (ferror(fp) || (out_name && fclose(fp))) {
+    ERROR("could not write %s\n", out_name ? out_name : "output");
+    ret = 1;
+  }
+  free(rom);
+  return ret;
+}
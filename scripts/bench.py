@@ -0,0 +1,207 @@
+# measure the emulator's speed on whole sessions
+#
+# usage: bench.py [-n runs] [-w warmup] [-e emulator] [-d workdir]
+#                 [-o result.json] [-c previous.json] workload...
+#
+# A workload is either a recording (foo.rec), which is replayed to its end,
+# or a list file with one workload per line:
+#
+#   foo.rec [extra emulator options]
+#   rom.bin <cycles> [extra emulator options]
+#
+# The second form runs the ROM for the given number of state times, with
+# any input coming from the extra options (e.g. "-i replay -s car.cap -y 0"
+# to feed it a bus capture). Paths in list files are relative to the list
+# file; '#' starts a comment. The emulator is run in workdir (default:
+# current directory), where the ROMs named in the recordings have to be
+# found.
+#
+# Each workload is run unpaced (emulator option -Q) "runs" times, one at a
+# time, after "warmup" runs that are not counted. Reported are instructions
+# and emulated state times per second and the share of the time spent in
+# I/O handlers, LCD updates and event handling, with 95% confidence
+# intervals. The I/O share is estimated from a sample of the accesses;
+# the share taken by the timer calls themselves is reported as "tmr %",
+# it is included in the run time the other figures are based on. With -o, the results are saved; with -c, they are compared
+# against a previously saved result file.
+
+from __future__ import print_function
+import getopt
+import json
+import math
+import os
+import re
+import shlex
+import subprocess
+import sys
+
+emulator = './hiscanemu'
+workdir = '.'
+runs = 5
+warmup = 0
+
+summary_re = re.compile(r'bench: cycles (\d+) instructions (\d+) ns (\d+) '
+                        r'io_ns (\d+) lcd_ns (\d+) event_ns (\d+) '
+                        r'timer_ns (\d+)')
+
+# two-sided 95% quantiles of Student's t distribution by degrees of freedom
+t_table = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+           2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+           2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+           2.048, 2.045, 2.042]
+
+# what is reported for each workload: key, heading, scale, format
+metrics = [
+  ('mips', 'MIPS', 1e-6, '%8.2f'),
+  ('mcps', 'Mst/s', 1e-6, '%8.2f'),
+  ('io', 'I/O %', 100, '%6.1f'),
+  ('lcd', 'LCD %', 100, '%6.1f'),
+  ('event', 'evt %', 100, '%6.1f'),
+  ('timer', 'tmr %', 100, '%6.1f'),
+]
+
+def read_list(name):
+  base = os.path.dirname(os.path.abspath(name))
+  workloads = []
+  for l in open(name):
+    l = l.split('#')[0].strip()
+    if not l:
+      continue
+    words = shlex.split(l)
+    path = os.path.join(base, words[0])
+    # the same ROM may be used with different inputs
+    wname = ' '.join(words)
+    if words[0].endswith('.rec'):
+      workloads.append((wname, ['-p', path] + words[1:]))
+    elif len(words) >= 2:
+      workloads.append((wname, ['-m', words[1]] + words[2:] + [path]))
+    else:
+      print('%s: ROM workload %s needs a cycle count' % (name, words[0]))
+      sys.exit(2)
+  return workloads
+
+def run_once(args):
+  cmd = [emulator, '-Q'] + args
+  if not os.environ.get('DISPLAY') and not os.environ.get('QWS_DISPLAY'):
+    # Qt insists on a display, even if we never show anything
+    cmd = ['xvfb-run', '-a'] + cmd
+  p = subprocess.Popen(cmd, cwd=workdir, stdout=subprocess.PIPE,
+                       stderr=subprocess.STDOUT, universal_newlines=True)
+  out = p.communicate()[0]
+  m = summary_re.search(out)
+  if not m:
+    print('  failed: ' + ' '.join(cmd))
+    for l in out.strip().split('\n')[-3:]:
+      print('    ' + l)
+    return None
+  cycles, insns, ns, io, lcd, event, timer = [int(g) for g in m.groups()]
+  ns = max(ns, 1)
+  return {'cycles': cycles, 'instructions': insns, 'ns': ns,
+          'mips': insns * 1e9 / ns, 'mcps': cycles * 1e9 / ns,
+          'io': float(io) / ns, 'lcd': float(lcd) / ns,
+          'event': float(event) / ns, 'timer': float(timer) / ns}
+
+def stats(values):
+  n = len(values)
+  mean = sum(values) / n
+  if n < 2:
+    return {'mean': mean, 'stddev': 0.0, 'ci': 0.0}
+  stddev = math.sqrt(sum((v - mean) ** 2 for v in values) / (n - 1))
+  t = t_table[n - 2] if n - 2 < len(t_table) else 1.960
+  return {'mean': mean, 'stddev': stddev, 'ci': t * stddev / math.sqrt(n)}
+
+def bench(name, args):
+  for i in range(warmup):
+    run_once(args)
+  results = []
+  for i in range(runs):
+    r = run_once(args)
+    if not r:
+      return None
+    results.append(r)
+  if len(set(r['instructions'] for r in results)) > 1:
+    print('  warning: %s did not run the same instructions every time' % name)
+  return {'name': name, 'args': args, 'runs': results,
+          'stats': dict((k, stats([r[k] for r in results]))
+                        for k, _, _, _ in metrics)}
+
+def show(w):
+  line = '%-30s' % w['name']
+  for key, _, scale, fmt in metrics:
+    s = w['stats'][key]
+    line += ' ' + fmt % (s['mean'] * scale) + ' +-' + fmt % (s['ci'] * scale)
+  print(line)
+
+def compare(results, old):
+  old = dict((w['name'], w) for w in old['workloads'])
+  print('\n%-30s %8s %8s %6s' % ('vs. previous', 'MIPS', 'speedup', 'tmr %'))
+  for w in results:
+    if w['name'] not in old:
+      continue
+    new, prev = w['stats']['mips'], old[w['name']]['stats']['mips']
+    if not prev['mean']:
+      continue
+    speedup = new['mean'] / prev['mean']
+    # only claim a difference if the confidence intervals do not overlap
+    overlap = abs(new['mean'] - prev['mean']) <= new['ci'] + prev['ci']
+    # the timer overhead is in both, but need not be the same
+    print('%-30s %8.2f %7.3fx %6.1f %s' % (w['name'], new['mean'] * 1e-6,
+          speedup, w['stats']['timer']['mean'] * 100,
+          '(within noise)' if overlap else
+          'faster' if speedup > 1 else 'SLOWER'))
+
+def main():
+  global emulator, workdir, runs, warmup
+  opts, args = getopt.getopt(sys.argv[1:], 'n:w:e:d:o:c:')
+  output = previous = None
+  for o, a in opts:
+    if o == '-n':
+      runs = int(a)
+    elif o == '-w':
+      warmup = int(a)
+    elif o == '-e':
+      emulator = os.path.abspath(a)
+    elif o == '-d':
+      workdir = a
+    elif o == '-o':
+      output = a
+    elif o == '-c':
+      previous = json.load(open(a))
+  if not args or runs < 1:
+    print('usage: bench.py [-n runs] [-w warmup] [-e emulator] [-d workdir] '
+          '[-o result.json] [-c previous.json] workload...')
+    sys.exit(2)
+
+  workloads = []
+  for a in args:
+    if a.endswith('.rec'):
+      workloads.append((os.path.basename(a), ['-p', os.path.abspath(a)]))
+    else:
+      workloads += read_list(a)
+
+  header = '%-30s' % 'workload'
+  for _, heading, _, fmt in metrics:
+    width = 2 * len(fmt % 0) + 3
+    header += ' ' + heading.center(width)
+  print(header)
+  results = []
+  failed = 0
+  for name, wargs in workloads:
+    w = bench(name, wargs)
+    if not w:
+      failed += 1
+      continue
+    show(w)
+    results.append(w)
+
+  if output:
+    f = open(output, 'w')
+    json.dump({'version': 1, 'runs': runs, 'workloads': results}, f,
+              indent=1)
+    f.close()
+  if previous:
+    compare(results, previous)
+  sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+  main()
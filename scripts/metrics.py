@@ -0,0 +1,97 @@
+# show the runtime metrics of a running emulator started with "-A file"
+#
+# usage: metrics.py [-i interval] [-n count] [-r] file
+#
+# Prints the counters every interval seconds (default 1), as rates per
+# second where that makes sense. -n stops after count reports, -r prints a
+# single report of the raw counters.
+
+from __future__ import print_function
+import getopt
+import mmap
+import struct
+import sys
+import time
+
+LAG_BUCKETS = 16
+FIELDS = ['host_ms', 'cycles', 'emulated_hz', 'speed_permille', 'syncs'] + \
+         ['sync_lag%d' % i for i in range(LAG_BUCKETS)] + \
+         ['timing_resets', 'sleep_ms', 'spin_ms',
+          'rx_bytes', 'rx_overflows', 'rx_depth', 'rx_depth_max', 'tx_bytes',
+          'iface_wakeups', 'echo_cancelled', 'echo_mismatches',
+          'lcd_frames', 'lcd_unchanged', 'lcd_skipped',
+          'events_recorded', 'events_replayed']
+HEADER = struct.Struct('=8sII')
+COUNTERS = struct.Struct('=%dQ' % len(FIELDS))
+
+def read(m):
+  magic, version, size = HEADER.unpack_from(m, 0)
+  if magic.rstrip(b'\0') != b'CASCMET' or version != 1 or \
+     size != HEADER.size + COUNTERS.size:
+    sys.exit('not a metrics file, or a different version')
+  return dict(zip(FIELDS, COUNTERS.unpack_from(m, HEADER.size)))
+
+def lag_summary(m):
+  # upper bound of the lag below which the given share of syncs was
+  lags = [m['sync_lag%d' % i] for i in range(LAG_BUCKETS)]
+  total = sum(lags)
+  if not total:
+    return '-'
+  out = []
+  for share in (0.5, 0.99):
+    seen = 0
+    for i, n in enumerate(lags):
+      seen += n
+      if seen >= share * total:
+        out.append('p%d<%dms' % (share * 100, 1 << i if i else 1))
+        break
+  return ' '.join(out)
+
+def report(a, b):
+  dt = (b['host_ms'] - a['host_ms']) / 1000.0
+  if dt <= 0:
+    print('no progress (emulator stopped or paused?)')
+    return
+  rate = lambda k: (b[k] - a[k]) / dt
+  print('%.3f MHz %5.1f%% lag %s resets %d sleep %.0f%% spin %.0f%% | '
+        'rx %.0f/s depth %d/%d ovf %d tx %.0f/s wake %.0f/s echo %d/%d | '
+        'lcd %.1f/s unch %.1f/s skip %.1f/s | rec %.0f/s play %.0f/s' % (
+        b['emulated_hz'] / 1e6, b['speed_permille'] / 10.0, lag_summary(b),
+        b['timing_resets'] - a['timing_resets'],
+        rate('sleep_ms') / 10.0, rate('spin_ms') / 10.0,
+        rate('rx_bytes'), b['rx_depth'], b['rx_depth_max'],
+        b['rx_overflows'] - a['rx_overflows'], rate('tx_bytes'),
+        rate('iface_wakeups'), b['echo_cancelled'] - a['echo_cancelled'],
+        b['echo_mismatches'] - a['echo_mismatches'],
+        rate('lcd_frames'), rate('lcd_unchanged'), rate('lcd_skipped'),
+        rate('events_recorded'), rate('events_replayed')))
+  sys.stdout.flush()
+
+interval = 1.0
+count = 0
+raw = False
+opts, args = getopt.getopt(sys.argv[1:], 'i:n:r')
+for o, a in opts:
+  if o == '-i':
+    interval = float(a)
+  elif o == '-n':
+    count = int(a)
+  elif o == '-r':
+    raw = True
+if len(args) != 1:
+  sys.exit('usage: metrics.py [-i interval] [-n count] [-r] file')
+
+with open(args[0], 'rb') as f:
+  m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+  last = read(m)
+  if raw:
+    for k in FIELDS:
+      print(k, last[k])
+    sys.exit(0)
+  n = 0
+  while not count or n < count:
+    time.sleep(interval)
+    cur = read(m)
+    report(last, cur)
+    last = cur
+    n += 1
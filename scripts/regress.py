@@ -0,0 +1,87 @@
+# replay a directory of recordings in parallel and check their LCD frames
+# against golden files
+#
+# usage: regress.py [-j jobs] [-u] [-e emulator] [-d workdir] recdir
+#
+# Each recording foo.rec is checked against foo.frames next to it; if there
+# is no such file, it is created (and the recording reported as new). With
+# -u, all golden files are recreated. The emulator is run in workdir
+# (default: current directory), where the ROMs named in the recordings
+# have to be found.
+
+from __future__ import print_function
+import getopt
+import multiprocessing
+import os
+import re
+import subprocess
+import sys
+import time
+
+emulator = './hiscanemu'
+workdir = '.'
+jobs = multiprocessing.cpu_count()
+update = False
+
+summary_re = re.compile(r'batch: (\w+) (.*) frames (\d+) cycles (\d+) '
+                        r'instructions (\d+) ms (\d+) mips ([0-9.]+)')
+
+def replay(rec):
+  golden = os.path.splitext(rec)[0] + '.frames'
+  if update and os.path.exists(golden):
+    os.unlink(golden)
+  new = not os.path.exists(golden)
+  cmd = [emulator, '-B', golden, '-p', rec]
+  if not os.environ.get('DISPLAY') and not os.environ.get('QWS_DISPLAY'):
+    # Qt insists on a display, even if we never show anything
+    cmd = ['xvfb-run', '-a'] + cmd
+  p = subprocess.Popen(cmd, cwd=workdir, stdout=subprocess.PIPE,
+                       stderr=subprocess.STDOUT, universal_newlines=True)
+  out = p.communicate()[0]
+  m = summary_re.search(out)
+  if not m:
+    return (rec, 'ERROR', 0, 0, 0.0, out.strip().split('\n')[-3:])
+  result = m.group(1)
+  if result == 'PASS' and new:
+    result = 'NEW'
+  details = [l for l in out.split('\n') if golden in l and 'batch:' not in l]
+  return (rec, result, int(m.group(3)), int(m.group(6)),
+          float(m.group(7)), details)
+
+def main():
+  global emulator, workdir, jobs, update
+  opts, args = getopt.getopt(sys.argv[1:], 'j:ue:d:')
+  for o, a in opts:
+    if o == '-j':
+      jobs = int(a)
+    elif o == '-u':
+      update = True
+    elif o == '-e':
+      emulator = os.path.abspath(a)
+    elif o == '-d':
+      workdir = a
+  if len(args) != 1:
+    print('usage: regress.py [-j jobs] [-u] [-e emulator] [-d workdir] recdir')
+    sys.exit(2)
+
+  recs = sorted(os.path.abspath(os.path.join(args[0], f))
+                for f in os.listdir(args[0]) if f.endswith('.rec'))
+  start = time.time()
+  pool = multiprocessing.Pool(jobs)
+  results = pool.map(replay, recs, 1)
+  pool.close()
+
+  failed = 0
+  for rec, result, frames, ms, mips, details in results:
+    print('%-5s %-40s %6d frames %8.1f s %8.2f MIPS' %
+          (result, os.path.basename(rec), frames, ms / 1000.0, mips))
+    if result in ('FAIL', 'ERROR'):
+      failed += 1
+      for l in details:
+        print('      ' + l)
+  print('%d recordings, %d failed, %.1f s' %
+        (len(results), failed, time.time() - start))
+  sys.exit(1 if failed else 0)
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,97 @@
+/* prints an instruction trace written with "hiscanemu -T"
+ *
+ * usage: tracedump [-n last] [-a lo-hi] [-c from-to] [-w] trace
+ *
+ * -n only prints the last n instructions, -a those with a physical PC in
+ * the given range, -c those in the given range of cycles. -w shows the
+ * memory writes.
+ */
+
+#include "trace.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void parse_range(const char *arg, uint64_t *lo, uint64_t *hi)
+{
+  char *end;
+  *lo = strtoull(arg, &end, 0);
+  *hi = *end == '-' ? strtoull(end + 1, NULL, 0) : *lo;
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t last = 0;
+  uint64_t addr_lo = 0, addr_hi = (uint64_t)-1;
+  uint64_t cycles_lo = 0, cycles_hi = (uint64_t)-1;
+  bool writes = false;
+  int c;
+  while ((c = getopt(argc, argv, "n:a:c:w")) != -1) {
+    switch (c) {
+      case 'n':
+        last = strtoull(optarg, NULL, 0);
+        break;
+      case 'a':
+        parse_range(optarg, &addr_lo, &addr_hi);
+        break;
+      case 'c':
+        parse_range(optarg, &cycles_lo, &cycles_hi);
+        break;
+      case 'w':
+        writes = true;
+        break;
+      default:
+        fprintf(stderr, "usage: tracedump [-n last] [-a lo-hi] [-c from-to] [-w] trace\n");
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: tracedump [-n last] [-a lo-hi] [-c from-to] [-w] trace\n");
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[optind], "rb");
+  if (!fp) {
+    perror(argv[optind]);
+    return 1;
+  }
+  struct TraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) ||
+      h.version != TRACE_VERSION || h.record_size != sizeof(struct TraceRecord)) {
+    fprintf(stderr, "%s: not a trace file, or a different version\n", argv[optind]);
+    return 1;
+  }
+
+  /* the ring is in chronological order starting at the oldest record */
+  uint64_t count = h.count < h.capacity ? h.count : h.capacity;
+  uint64_t first = h.count < h.capacity ? 0 : h.count % h.capacity;
+  uint64_t skip = last && last < count ? count - last : 0;
+
+  for (uint64_t i = skip; i < count; i++) {
+    struct TraceRecord r;
+    uint64_t idx = (first + i) % h.capacity;
+    if (fseek(fp, sizeof(h) + idx * sizeof(r), SEEK_SET) || fread(&r, sizeof(r), 1, fp) != 1) {
+      fprintf(stderr, "%s: truncated\n", argv[optind]);
+      return 1;
+    }
+    if (r.phys_pc < addr_lo || r.phys_pc > addr_hi ||
+        r.cycles < cycles_lo || r.cycles > cycles_hi)
+      continue;
+    printf("%12llu %04X (%08X) SP %04X PSW %02X  ",
+           (unsigned long long)r.cycles, r.pc, r.phys_pc, r.sp, r.psw);
+    printf(writes ? "%-36s" : "%s", disasm(r.code, r.pc));
+    if (writes) {
+      if (r.flags & TRACE_WRITE16)
+        printf(" [%04X] <- %04X", r.write_addr, r.write_value);
+      else if (r.flags & TRACE_WRITE8)
+        printf(" [%04X] <- %02X", r.write_addr, r.write_value);
+      if (r.flags & TRACE_MORE_WRITES)
+        printf(" ...");
+    }
+    printf("\n");
+  }
+  fclose(fp);
+  return 0;
+}
@@ -14,6 +14,10 @@
 #include <stdlib.h>
 #include "os.h"
 #include "hints.h"
+#include "buslog.h"
+#include "latency.h"
+#include "fuzz.h"
+#include "metrics.h"
 
 Serial::Serial(Cpu *cpu, Interface *iface, UI *ui, Hints *hints)
 {
@@ -51,6 +55,12 @@ Serial::Serial(Cpu *cpu, Interface *iface, UI *ui, Hints *hints)
   comm_line = 7;
   
   this->hints = hints;
+  bus_log = NULL;
+  latency = NULL;
+  latency_echo = false;
+#ifdef FUZZ
+  fuzz = NULL;
+#endif
 }
 
 void Serial::reset()
@@ -207,8 +217,15 @@ uint8_t Serial::readData()
   if (cpu->isReplaying())
     ret = cpu->retrieveEventValue(EVENT_SERIALRX);
   else {
-    ret = retrieveRxData();
+    int byte = retrieveRxData();
+    ret = byte;
     cpu->recordEvent(EVENT_SERIALRX, ret);
+    if (latency && byte != -1) {
+      if (latency_echo)
+        latency_echo = false;
+      else
+        latency->delivered(cpu->getCycles());
+    }
   }
   hints->byteReceived(ret);
   read_after_write = true;
@@ -259,8 +276,16 @@ void Serial::writeData(uint8_t data)
   cpu->sync(true);
   DEBUG(SERIAL, "writeData() time after sync %d\n", os_mtime());
   
-  if (!cpu->isReplaying())
+  if (!cpu->isReplaying()) {
+    /* log before sending, the reply may be logged by another thread */
+    if (bus_log)
+      bus_log->tx(cpu->getCycles(), data);
+    if (latency)
+      latency->sent(iface->name(), comm_line, cpu->getCycles());
+    FUZZ_HOOK(sent());
     iface->sendByte(data);
+    metrics->tx_bytes++;
+  }
 
   /* Add the echo to the input buffer. It's safe to do this here because
      ri_set_time makes sure it won't be dispensed until its time has come.
@@ -270,6 +295,8 @@ void Serial::writeData(uint8_t data)
      with VAG ECUs, where every single byte is acknowledged. */
   if (enable_echo)
     prependRxData(ti_set_byte);
+  /* the buffer has been flushed above, so this is the only echo in it */
+  latency_echo = enable_echo;
 
   ui->setLED(LED_SERIAL_TX, true);
 }
@@ -313,6 +340,9 @@ void Serial::slowInit(uint8_t bit)
   
   cpu->sync(true);
   DEBUG(SERIAL, "slowInit() time after sync %d\n", os_mtime());
+
+  if (bus_log && !cpu->isReplaying())
+    bus_log->slowInitBit(cpu->getCycles(), bit);
     
   if (iface->sendSlowInitBitwise(bit))
     return;
@@ -347,18 +377,44 @@ void Serial::slowInit(uint8_t bit)
   }
 }
 
+/* updates the metrics for a byte about to be added to the RX ring */
+void Serial::countRxByte()
+{
+  metrics_add(&metrics->rx_bytes, 1);
+  uint64_t depth;
+  if (rx_buf->full()) {
+    /* the ring will appear empty after the addition */
+    metrics_add(&metrics->rx_overflows, 1);
+    depth = 0;
+  }
+  else
+    depth = rx_buf->count() + 1;
+  metrics->rx_depth = depth;
+  metrics_max(&metrics->rx_depth_max, depth);
+}
+
 void Serial::addRxData(const int *data)
 {
   int i;
   for (i = 0; data[i] != -1; i++) {
+    countRxByte();
     rx_buf->add(data[i]);
+    if (bus_log)
+      bus_log->rx(cpu->getCycles(), data[i]);
+    if (latency)
+      latency->arrived(cpu->getCycles());
     DEBUG(SERIAL, "SERIAL RX %02X at %lld\n", data[i], (unsigned long long)cpu->getCycles());
   }
 }
 
 void Serial::addRxData(uint8_t byte)
 {
+  countRxByte();
   rx_buf->add(byte);
+  if (bus_log)
+    bus_log->rx(cpu->getCycles(), byte);
+  if (latency)
+    latency->arrived(cpu->getCycles());
   DEBUG(SERIAL, "SERIAL RX %02X at %lld\n", byte, (unsigned long long)cpu->getCycles());
 }
 
@@ -386,6 +442,7 @@ void Serial::flushRxBuf()
 {
   DEBUG(SERIAL, "flushing serial RX buffer\n");
   rx_buf->flush();
+  latency_echo = false;
 }
 
 int Serial::snoopByte(void)
@@ -505,9 +562,26 @@ void Serial::setCommLine(int line)
   hints->commLine(line);
 }
 
+void Serial::setBusLog(BusLog *log)
+{
+  bus_log = log;
+}
+
+void Serial::setLatency(SerialLatency *latency)
+{
+  this->latency = latency;
+}
+
+#ifdef FUZZ
+void Serial::setFuzz(Fuzz *fuzz)
+{
+  this->fuzz = fuzz;
+}
+#endif
+
 #include "state.h"
 
-void Serial::loadSaveState(statefile_t fp, bool write)
+void Serial::loadSaveState(statefile_t fp, bool write, int version)
 {
   STATE_RW(baudrate);
   STATE_RW(specified_baudrate);
@@ -537,6 +611,11 @@ void Serial::loadSaveState(statefile_t fp, bool write)
   STATE_RW(serial_bitbang_last_bit_sent);
   
   rx_buf->loadSaveState(fp, write);
+
+  /* older states leave it as it is; the received data may then be held
+     back until the cycle count has caught up with it */
+  if (version >= 2)
+    STATE_RW(ri_set_time);
 }
 
 void Serial::setL(uint8_t bit)
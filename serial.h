@@ -55,6 +55,9 @@ class Cpu;
 class Interface;
 class UI;
 class Hints;
+class BusLog;
+class SerialLatency;
+class Fuzz;
 
 class Serial {
 public:
@@ -94,7 +97,17 @@ public:
   
   void setCommLine(int line);
 
-  void loadSaveState(statefile_t fp, bool write);
+  /* records the bus traffic from now on; NULL to stop */
+  void setBusLog(BusLog *log);
+  /* measures request/reply latencies from now on; NULL to stop */
+  void setLatency(SerialLatency *latency);
+#ifdef FUZZ
+  /* tells the fuzzer when the firmware sends something */
+  void setFuzz(Fuzz *fuzz);
+#endif
+
+  /* "version" is that of the section the state is in */
+  void loadSaveState(statefile_t fp, bool write, int version);
   
   void reset();
   
@@ -103,6 +116,7 @@ protected:
   
 private:
   void checkInput();
+  void countRxByte();
   
   uint16_t baudrate;			/* actual baudrate used */
   uint16_t specified_baudrate;		/* baudrate requested */
@@ -132,6 +146,12 @@ private:
   
   Cpu *cpu;
   UI *ui;
+  BusLog *bus_log;
+  SerialLatency *latency;
+  bool latency_echo;	/* our echo of the last byte sent is still unread */
+#ifdef FUZZ
+  Fuzz *fuzz;
+#endif
 
   // serial input via bitbanging (used to detect baudrate, we have to fake it)
   bool serial_bitbang_enabled;          // bitbanging serial input enabled
@@ -0,0 +1,82 @@
+/*
+ * snapshot.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "snapshot.h"
+#include "dirty.h"
+#include <stdlib.h>
+#include <string.h>
+
+Snapshot::Snapshot(Snapshot *base, int total_pages)
+{
+  this->base = base;
+  this->total_pages = total_pages;
+  cycles = 0;
+  id = 0;
+  state = NULL;
+  state_len = 0;
+  num_pages = 0;
+  page_numbers = NULL;
+  if (base) {
+    pages_size = 0;
+    pages = NULL;
+  }
+  else {
+    num_pages = pages_size = total_pages;
+    pages = (uint8_t *)calloc(total_pages, DIRTY_PAGE_SIZE);
+  }
+}
+
+Snapshot::~Snapshot()
+{
+  free(state);
+  free(pages);
+  free(page_numbers);
+}
+
+size_t Snapshot::getSize()
+{
+  return sizeof(*this) + state_len +
+         ((size_t)pages_size << DIRTY_PAGE_SHIFT) +
+         (page_numbers ? pages_size * sizeof(int) : 0);
+}
+
+/* pages have to be added in ascending order */
+void Snapshot::addPage(int page, const uint8_t *data)
+{
+  if (!base) {
+    memcpy(pages + (page << DIRTY_PAGE_SHIFT), data, DIRTY_PAGE_SIZE);
+    return;
+  }
+  if (num_pages == pages_size) {
+    pages_size = pages_size ? pages_size * 2 : 32;
+    pages = (uint8_t *)realloc(pages, pages_size << DIRTY_PAGE_SHIFT);
+    page_numbers = (int *)realloc(page_numbers, pages_size * sizeof(int));
+  }
+  memcpy(pages + (num_pages << DIRTY_PAGE_SHIFT), data, DIRTY_PAGE_SIZE);
+  page_numbers[num_pages++] = page;
+}
+
+const uint8_t *Snapshot::findPage(int page)
+{
+  if (!base)
+    return pages + (page << DIRTY_PAGE_SHIFT);
+
+  int lo = 0, hi = num_pages - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (page_numbers[mid] == page)
+      return pages + (mid << DIRTY_PAGE_SHIFT);
+    else if (page_numbers[mid] < page)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return NULL;
+}
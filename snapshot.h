@@ -0,0 +1,59 @@
+/*
+ * snapshot.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* In-memory machine state, taken with Cpu::takeSnapshot().
+   A full snapshot contains every page of the tracked memories (see
+   DirtyPages), an incremental one only the pages that differ from its
+   base snapshot.  Everything else (CPU registers, peripherals) is stored
+   in full as a state blob without the bulk memories. */
+class Snapshot {
+friend class Cpu;
+public:
+  ~Snapshot();
+
+  inline uint64_t getCycles() {
+    return cycles;
+  }
+  inline Snapshot *getBase() {
+    return base;
+  }
+  /* memory used by this snapshot, not counting its base */
+  size_t getSize();
+
+private:
+  Snapshot(Snapshot *base, int total_pages);
+  void addPage(int page, const uint8_t *data);
+  /* returns this snapshot's copy of a page, NULL if it is not stored */
+  const uint8_t *findPage(int page);
+
+  uint64_t cycles;
+  Snapshot *base;
+  /* identifies full snapshots for dirty page tracking */
+  uint32_t id;
+
+  uint8_t *state;
+  size_t state_len;
+
+  /* full snapshots store all pages in order; incremental ones have a
+     sorted list of page numbers */
+  uint8_t *pages;
+  int *page_numbers;
+  int num_pages;
+  int pages_size;
+  int total_pages;
+};
+
+#endif
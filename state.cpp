@@ -0,0 +1,452 @@
+/*
+ * state.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "state.h"
+#include "codec.h"
+#include "os.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef EVENT_COMPRESSED
+#include <zlib.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define STATE_SECTION_DEPTH 4
+
+struct statefile {
+#ifdef EVENT_COMPRESSED
+  gzFile file;
+#else
+  FILE *file;
+#endif
+  /* memory buffer, used if file is NULL */
+  uint8_t *mem;
+  size_t mem_len;
+  size_t mem_size;
+  size_t mem_pos;
+  bool mem_owned;
+
+  /* when writing a file, sections are staged in the memory buffer until
+     the outermost one is complete, so that their lengths can be filled
+     in */
+  bool sections;
+  bool staging;
+  bool error;
+  int depth;
+  /* writing: position of the length field; reading: end of the section,
+     -1 if it was missing */
+  long section[STATE_SECTION_DEPTH];
+};
+
+static statefile_t state_alloc()
+{
+  statefile_t fp = (statefile_t)calloc(1, sizeof(struct statefile));
+  return fp;
+}
+
+statefile_t state_open(const char *name, const char *mode)
+{
+  statefile_t fp = state_alloc();
+#ifdef EVENT_COMPRESSED
+  fp->file = gzopen(name, mode);
+#else
+  fp->file = fopen(name, mode);
+#endif
+  if (!fp->file) {
+    free(fp);
+    return NULL;
+  }
+  return fp;
+}
+
+statefile_t state_open_at(const char *name, long offset)
+{
+#ifdef EVENT_COMPRESSED
+  int fd = open(name, O_RDONLY | O_BINARY);
+  if (fd < 0)
+    return NULL;
+  if (lseek(fd, offset, SEEK_SET) != offset) {
+    close(fd);
+    return NULL;
+  }
+  statefile_t fp = state_alloc();
+  fp->file = gzdopen(fd, "rb");
+  if (!fp->file) {
+    close(fd);
+    free(fp);
+    return NULL;
+  }
+  return fp;
+#else
+  statefile_t fp = state_open(name, "rb");
+  if (fp && fseek(fp->file, offset, SEEK_SET)) {
+    state_close(fp);
+    return NULL;
+  }
+  return fp;
+#endif
+}
+
+statefile_t state_open_mem(const uint8_t *data, size_t len)
+{
+  statefile_t fp = state_alloc();
+  if (data) {
+    fp->mem = (uint8_t *)data;
+    fp->mem_len = fp->mem_size = len;
+  }
+  else {
+    fp->mem_size = len ? len : 65536;
+    fp->mem = (uint8_t *)malloc(fp->mem_size);
+    fp->mem_owned = true;
+  }
+  return fp;
+}
+
+const uint8_t *state_mem_data(statefile_t fp, size_t *len)
+{
+  *len = fp->mem_len;
+  return fp->mem;
+}
+
+int state_close(statefile_t fp)
+{
+  int ret = 0;
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    ret = gzclose(fp->file);
+#else
+    ret = fclose(fp->file);
+#endif
+  }
+  if (fp->mem_owned)
+    free(fp->mem);
+  free(fp);
+  return ret;
+}
+
+int state_read(statefile_t fp, void *buf, unsigned int n)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gzread(fp->file, buf, n);
+#else
+    return fread(buf, 1, n, fp->file);
+#endif
+  }
+  if (n > fp->mem_len - fp->mem_pos)
+    n = fp->mem_len - fp->mem_pos;
+  memcpy(buf, fp->mem + fp->mem_pos, n);
+  fp->mem_pos += n;
+  return n;
+}
+
+int state_write(statefile_t fp, const void *buf, unsigned int n)
+{
+  if (fp->file && !fp->staging) {
+#ifdef EVENT_COMPRESSED
+    return gzwrite(fp->file, buf, n);
+#else
+    return fwrite(buf, 1, n, fp->file);
+#endif
+  }
+  if (fp->mem_pos + n > fp->mem_size) {
+    while (fp->mem_pos + n > fp->mem_size)
+      fp->mem_size *= 2;
+    fp->mem = (uint8_t *)realloc(fp->mem, fp->mem_size);
+  }
+  memcpy(fp->mem + fp->mem_pos, buf, n);
+  fp->mem_pos += n;
+  if (fp->mem_pos > fp->mem_len)
+    fp->mem_len = fp->mem_pos;
+  return n;
+}
+
+int state_puts(statefile_t fp, const char *s)
+{
+  return state_write(fp, s, strlen(s));
+}
+
+char *state_gets(statefile_t fp, char *buf, int n)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gzgets(fp->file, buf, n);
+#else
+    return fgets(buf, n, fp->file);
+#endif
+  }
+  int i;
+  for (i = 0; i < n - 1 && fp->mem_pos < fp->mem_len; ) {
+    buf[i++] = fp->mem[fp->mem_pos++];
+    if (buf[i - 1] == '\n')
+      break;
+  }
+  buf[i] = 0;
+  return i ? buf : NULL;
+}
+
+long state_tell(statefile_t fp)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gztell(fp->file);
+#else
+    return ftell(fp->file);
+#endif
+  }
+  return fp->mem_pos;
+}
+
+long state_seek(statefile_t fp, long offset, int whence)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gzseek(fp->file, offset, whence);
+#else
+    return fseek(fp->file, offset, whence) ? -1 : ftell(fp->file);
+#endif
+  }
+  long pos;
+  switch (whence) {
+    case SEEK_CUR: pos = fp->mem_pos + offset; break;
+    case SEEK_END: pos = fp->mem_len + offset; break;
+    default: pos = offset; break;
+  }
+  if (pos < 0 || (size_t)pos > fp->mem_len)
+    return -1;
+  fp->mem_pos = pos;
+  return pos;
+}
+
+int state_eof(statefile_t fp)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gzeof(fp->file);
+#else
+    return feof(fp->file);
+#endif
+  }
+  return fp->mem_pos >= fp->mem_len;
+}
+
+void state_finish(statefile_t fp)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    /* the next write starts a new gzip member */
+    gzflush(fp->file, Z_FINISH);
+#else
+    fflush(fp->file);
+#endif
+  }
+}
+
+long state_offset(statefile_t fp)
+{
+  if (fp->file) {
+#ifdef EVENT_COMPRESSED
+    return gzoffset(fp->file);
+#else
+    return ftell(fp->file);
+#endif
+  }
+  return fp->mem_pos;
+}
+
+void state_set_sections(statefile_t fp, bool on)
+{
+  fp->sections = on;
+}
+
+bool state_error(statefile_t fp)
+{
+  return fp->error;
+}
+
+int state_begin_section(statefile_t fp, bool write, const char *tag, int version)
+{
+  if (!fp->sections)
+    return 0;
+  if (fp->depth == STATE_SECTION_DEPTH) {
+    ERROR("state sections nested too deeply\n");
+    fp->error = true;
+    return -1;
+  }
+
+  uint32_t v = version;
+  uint32_t len = 0;
+  if (write) {
+    if (fp->file && !fp->depth) {
+      if (!fp->mem) {
+        fp->mem_size = 65536;
+        fp->mem = (uint8_t *)malloc(fp->mem_size);
+        fp->mem_owned = true;
+      }
+      fp->mem_pos = fp->mem_len = 0;
+      fp->staging = true;
+    }
+    state_write(fp, tag, 4);
+    state_write(fp, &v, sizeof(v));
+    fp->section[fp->depth++] = fp->mem_pos;
+    state_write(fp, &len, sizeof(len));
+    return version;
+  }
+
+  char t[4];
+  if (state_read(fp, t, 4) != 4 || memcmp(t, tag, 4) ||
+      state_read(fp, &v, sizeof(v)) != sizeof(v) ||
+      state_read(fp, &len, sizeof(len)) != sizeof(len)) {
+    ERROR("state section %.4s missing\n", tag);
+    fp->error = true;
+    fp->section[fp->depth++] = -1;
+    return -1;
+  }
+  fp->section[fp->depth++] = state_tell(fp) + len;
+  return v;
+}
+
+void state_end_section(statefile_t fp, bool write)
+{
+  if (!fp->sections || !fp->depth)
+    return;
+  long pos = fp->section[--fp->depth];
+
+  if (write) {
+    uint32_t len = fp->mem_pos - pos - sizeof(len);
+    memcpy(fp->mem + pos, &len, sizeof(len));
+    if (fp->staging && !fp->depth) {
+      fp->staging = false;
+      state_write(fp, fp->mem, fp->mem_len);
+    }
+    return;
+  }
+
+  if (pos < 0)
+    return;
+  long now = state_tell(fp);
+  if (now > pos) {
+    ERROR("state section overrun by %ld bytes\n", now - pos);
+    fp->error = true;
+  }
+  else if (now < pos) {
+    /* written by a later version */
+    state_seek(fp, pos, SEEK_SET);
+  }
+}
+
+struct save_job {
+  statefile_t fp;
+  char *name;
+  int codec;
+};
+
+static void *save_thread = NULL;
+
+static int state_save_worker(void *data)
+{
+  struct save_job *job = (struct save_job *)data;
+  size_t len;
+  const uint8_t *raw = state_mem_data(job->fp, &len);
+  size_t packed_len;
+  uint8_t *packed = codec_compress(job->codec, raw, len, &packed_len);
+  if (!packed) {
+    ERROR("codec %s not available, saving uncompressed\n", codec_name(job->codec));
+    job->codec = CODEC_RAW;
+    packed = codec_compress(job->codec, raw, len, &packed_len);
+  }
+
+  int ret = 0;
+  FILE *fp = fopen(job->name, "wb");
+  if (fp) {
+    uint32_t codec = job->codec;
+    uint32_t raw_len = len;
+    if (fwrite(STATE_FILE_MAGIC, STATE_FILE_MAGIC_LEN, 1, fp) != 1 ||
+        fwrite(&codec, sizeof(codec), 1, fp) != 1 ||
+        fwrite(&raw_len, sizeof(raw_len), 1, fp) != 1 ||
+        fwrite(packed, 1, packed_len, fp) != packed_len)
+      ret = -1;
+    if (fclose(fp))
+      ret = -1;
+  }
+  else
+    ret = -1;
+  if (ret)
+    ERROR("failed to write state file %s\n", job->name);
+  else
+    DEBUG(WARN, "saved state to %s, %d bytes (%s)\n", job->name, (int)packed_len, codec_name(job->codec));
+
+  free(packed);
+  state_close(job->fp);
+  free(job->name);
+  free(job);
+  return ret;
+}
+
+void state_save_wait()
+{
+  if (save_thread) {
+    os_wait_thread(save_thread, NULL);
+    save_thread = NULL;
+  }
+}
+
+void state_save_file(statefile_t fp, const char *name, int codec)
+{
+  state_save_wait();
+  struct save_job *job = (struct save_job *)malloc(sizeof(struct save_job));
+  job->fp = fp;
+  job->name = strdup(name);
+  job->codec = codec;
+  save_thread = os_create_thread(state_save_worker, job);
+}
+
+statefile_t state_load_file(const char *name)
+{
+  /* we may be about to load what is still being saved */
+  state_save_wait();
+
+  FILE *f = fopen(name, "rb");
+  if (!f)
+    return NULL;
+  char magic[STATE_FILE_MAGIC_LEN];
+  uint32_t codec, len;
+  if (fread(magic, STATE_FILE_MAGIC_LEN, 1, f) != 1 ||
+      memcmp(magic, STATE_FILE_MAGIC, STATE_FILE_MAGIC_LEN) ||
+      fread(&codec, sizeof(codec), 1, f) != 1 ||
+      fread(&len, sizeof(len), 1, f) != 1) {
+    fclose(f);
+    return state_open(name, "rb");
+  }
+
+  long start = ftell(f);
+  fseek(f, 0, SEEK_END);
+  size_t packed_len = ftell(f) - start;
+  fseek(f, start, SEEK_SET);
+  uint8_t *packed = (uint8_t *)malloc(packed_len);
+  uint8_t *data = (uint8_t *)malloc(len);
+  bool ok = fread(packed, 1, packed_len, f) == packed_len &&
+            codec_decompress(codec, packed, packed_len, data, len);
+  fclose(f);
+  free(packed);
+  if (!ok) {
+    ERROR("corrupt state file %s (%s)\n", name, codec_name(codec));
+    free(data);
+    return NULL;
+  }
+
+  statefile_t fp = state_open_mem(data, len);
+  fp->mem_owned = true;
+  return fp;
+}
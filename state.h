@@ -12,63 +12,89 @@
 #define _STATE_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "debug.h"
 
-#ifdef EVENT_COMPRESSED
-#include <zlib.h>
-#endif
+/* States start with STATE_MAGIC and a version number; states without
+   them are version 0. Since version 4, the rest is divided into sections,
+   each starting with a four-character tag, a version and its length. */
+#define STATE_MAGIC "CASCSAV"
+#define STATE_MAGIC_LEN 8
+#define STATE_VERSION 4
+
+/* Saved state files start with STATE_FILE_MAGIC, the codec (see codec.h)
+   and the uncompressed length, followed by the compressed state. Files
+   without it are written by older versions and contain the state as it
+   is (gzip-compressed if built with EVENT_COMPRESSED). */
+#define STATE_FILE_MAGIC "CASCSTF"
+#define STATE_FILE_MAGIC_LEN 8
+
+/* A state file is either a file on disk (gzip-compressed if built with
+   EVENT_COMPRESSED) or a buffer in memory. */
+typedef struct statefile *statefile_t;
+
+statefile_t state_open(const char *name, const char *mode);
+/* opens a file for reading, starting at raw file offset "offset"; with
+   compression, there has to be a gzip member starting there */
+statefile_t state_open_at(const char *name, long offset);
+/* opens a memory buffer for reading, or a new growing buffer for writing
+   if data is NULL */
+statefile_t state_open_mem(const uint8_t *data, size_t len);
+/* returns the contents of a memory buffer */
+const uint8_t *state_mem_data(statefile_t fp, size_t *len);
+int state_close(statefile_t fp);
+
+int state_read(statefile_t fp, void *buf, unsigned int n);
+int state_write(statefile_t fp, const void *buf, unsigned int n);
+int state_puts(statefile_t fp, const char *s);
+char *state_gets(statefile_t fp, char *buf, int n);
+/* tell/seek work on uncompressed positions */
+long state_tell(statefile_t fp);
+long state_seek(statefile_t fp, long offset, int whence);
+int state_eof(statefile_t fp);
+
+/* completes the current gzip member so that a reader can start at
+   state_offset() */
+void state_finish(statefile_t fp);
+/* raw (compressed) position in the file */
+long state_offset(statefile_t fp);
+
+/* Sections are only written and expected once enabled. When reading,
+   state_begin_section() returns the version of the section, or -1 if it
+   is not there; data at the end of a section that has not been read (i.e.
+   fields added by later versions) is skipped by state_end_section(). */
+void state_set_sections(statefile_t fp, bool on);
+int state_begin_section(statefile_t fp, bool write, const char *tag, int version);
+void state_end_section(statefile_t fp, bool write);
+/* true if a section was missing or has been read beyond its end */
+bool state_error(statefile_t fp);
+
+/* Compresses a memory state file and writes it to disk in the background;
+   fp is closed when done. */
+void state_save_file(statefile_t fp, const char *name, int codec);
+/* waits for a background save to complete */
+void state_save_wait();
+/* opens a state file for reading, decompressing it to memory if necessary */
+statefile_t state_load_file(const char *name);
 
 /* any attempt to make this more ceeplusplussy bloated it with needless complexity,
    so we let the preprocessor do the job instead */
-#ifdef EVENT_COMPRESSED
-typedef gzFile statefile_t;
-#define state_open gzopen
-#define state_tell gztell
-#define state_seek gzseek
-#define state_eof gzeof
-#define state_close gzclose
-#define STATE_RW(x) write ? gzwrite(fp, &x, sizeof(x)) : gzread(fp, &x, sizeof(x))
-#define STATE_RWBUF(x, n) write ? gzwrite(fp, x, n) : gzread(fp, x, n)
-#else
-typedef FILE* statefile_t;
-#define state_open fopen
-#define state_tell ftell
-#define state_seek fseek
-#define state_eof feof
-#define state_close gzclose
-#define STATE_RW(x) write ? fwrite(&x, sizeof(x), 1, fp) : fread(&x, sizeof(x), 1, fp)
-#define STATE_RWBUF(x, n) write ? fwrite(x, n, 1, fp) : fread(x, n, 1, fp)
-#endif
+#define STATE_RW(x) write ? state_write(fp, &x, sizeof(x)) : state_read(fp, &x, sizeof(x))
+#define STATE_RWBUF(x, n) write ? state_write(fp, x, n) : state_read(fp, x, n)
 
-#ifdef EVENT_COMPRESSED
 #define STATE_RWSTRING(s) { \
    if (write) { \
-      if (s) gzputs(fp, s); \
-      gzputc(fp, '\n'); \
+      if (s) state_puts(fp, s); \
+      state_puts(fp, "\n"); \
    } \
    else { \
       char n[256]; \
-      gzgets(fp, n, 256); \
-      n[strlen(n)-1] = 0; /* strip LF */ \
-      if (s) \
-        free(s); \
+      n[0] = 0; \
+      state_gets(fp, n, 256); \
       if (strlen(n)) \
-        s = strdup(n); \
-      else \
-        s = NULL; \
-      DEBUG(WARN, "rwstring read %s\n", s); \
-   } \
-}
-#else
-#define STATE_RWSTRING(s) { \
-   if (write) { \
-      if (s) fputs(s, fp); \
-      putc('\n', fp); \
-   } \
-   else { \
-      char n[256]; \
-      fgets(n, 256, fp); \
-      n[strlen(n)-1] = 0; /* strip LF */ \
+        n[strlen(n)-1] = 0; /* strip LF */ \
       if (s) \
         free(s); \
       if (strlen(n)) \
@@ -78,6 +104,5 @@ typedef FILE* statefile_t;
       DEBUG(WARN, "rwstring read %s\n", s); \
    } \
 }
-#endif
 
 #endif
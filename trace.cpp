@@ -0,0 +1,53 @@
+/*
+ * trace.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "trace.h"
+#include "debug.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+Trace::Trace(const char *name, uint64_t records)
+{
+  this->name = strdup(name);
+  if (!records)
+    records = TRACE_DEFAULT_RECORDS;
+  size = sizeof(struct TraceHeader) + records * sizeof(struct TraceRecord);
+  pos = 0;
+  header = (struct TraceHeader *)os_map_file(name, size);
+  if (!header) {
+    ERROR("could not create trace file %s\n", name);
+    ring = NULL;
+    return;
+  }
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->version = TRACE_VERSION;
+  header->record_size = sizeof(struct TraceRecord);
+  header->capacity = records;
+  header->count = 0;
+  ring = (struct TraceRecord *)(header + 1);
+}
+
+Trace::~Trace()
+{
+  if (header) {
+    flush();
+    os_unmap_file(header, size);
+  }
+  free(name);
+}
+
+uint64_t Trace::flush()
+{
+  if (!header)
+    return 0;
+  os_sync_file(header, size);
+  return header->count < header->capacity ? header->count : header->capacity;
+}
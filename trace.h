@@ -0,0 +1,104 @@
+/*
+ * trace.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "disasm.h"
+
+#define TRACE_MAGIC "CASCTRC"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RECORDS (1024 * 1024)
+
+/* memory effects of an instruction */
+#define TRACE_WRITE8 1		/* wrote the low byte of write_value */
+#define TRACE_WRITE16 2		/* wrote all of write_value */
+#define TRACE_MORE_WRITES 4	/* wrote more than that */
+
+/* one executed instruction; the layout is that of the trace file, in host
+   byte order */
+struct TraceRecord {
+  uint64_t cycles;
+  uint32_t phys_pc;
+  uint16_t pc;
+  uint16_t sp;
+  uint8_t code[DISASM_MAX_LEN];
+  uint8_t psw;
+  uint8_t flags;
+  uint16_t write_addr;
+  uint16_t write_value;
+  uint16_t reserved;
+};
+
+/* The trace file is this header followed by a ring of "capacity" records.
+   If more than that have been written, the oldest one is at index
+   count % capacity. */
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint64_t count;
+};
+
+/* Ring of instruction records in a memory-mapped file, so that the last
+   instructions before a crash are on disk without having to write them
+   out. See scripts/tracedump.cpp for reading it. */
+class Trace {
+public:
+  Trace(const char *name, uint64_t records);
+  ~Trace();
+
+  inline bool isOpen() {
+    return header != NULL;
+  }
+
+  /* returns the record for the next instruction */
+  inline struct TraceRecord *next() {
+    struct TraceRecord *r = &ring[pos];
+    if (++pos == header->capacity)
+      pos = 0;
+    header->count++;
+    return r;
+  }
+
+  static inline void addWrite(struct TraceRecord *r, uint16_t addr, uint8_t value) {
+    if (!(r->flags & (TRACE_WRITE8 | TRACE_WRITE16))) {
+      r->flags |= TRACE_WRITE8;
+      r->write_addr = addr;
+      r->write_value = value;
+    }
+    else if ((r->flags & TRACE_WRITE8) && addr == (uint16_t)(r->write_addr + 1)) {
+      r->flags = (r->flags & ~TRACE_WRITE8) | TRACE_WRITE16;
+      r->write_value |= value << 8;
+    }
+    else
+      r->flags |= TRACE_MORE_WRITES;
+  }
+
+  /* makes sure everything is on disk; returns the number of records
+     available */
+  uint64_t flush();
+
+  inline const char *getName() {
+    return name;
+  }
+
+private:
+  char *name;
+  struct TraceHeader *header;
+  struct TraceRecord *ring;
+  uint64_t pos;
+  unsigned long size;
+};
+
+#endif
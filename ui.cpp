@@ -151,6 +151,20 @@ UI::UI(QWidget *parent) : QWidget(parent)
   /* Factory Reset */
   QAction *factory_reset_action = machine_menu->addAction("Factory Reset");
   connect(factory_reset_action, SIGNAL(triggered(bool)), this, SLOT(factoryResetSlot()));
+  machine_menu->addSeparator();
+  /* Rewind */
+  QAction *rewind_action = machine_menu->addAction("Rewind");
+  connect(rewind_action, SIGNAL(triggered(bool)), this, SLOT(rewindSlot()));
+  machine_menu->addSeparator();
+  /* Watchpoints */
+  QAction *watch_action = machine_menu->addAction("Watchpoints...");
+  connect(watch_action, SIGNAL(triggered(bool)), this, SLOT(watchSlot()));
+  /* Memory search */
+  QAction *search_action = machine_menu->addAction("Memory Search...");
+  connect(search_action, SIGNAL(triggered(bool)), this, SLOT(searchSlot()));
+  /* Continue after a breakpoint */
+  QAction *continue_action = machine_menu->addAction("Continue");
+  connect(continue_action, SIGNAL(triggered(bool)), this, SLOT(continueSlot()));
   menu->addMenu(machine_menu);
 
   /* Help Menu */
@@ -461,6 +475,11 @@ int UI::run()
   return qApp->exec();
 }
 
+void UI::processEvents()
+{
+  qApp->processEvents();
+}
+
 bool UI::pollEvent(struct Event &ev)
 {
   for (int i = 0; i < UIKEY_MAX; i++) {
@@ -756,10 +775,14 @@ void UI::keyEvent(QKeyEvent *event, bool *key_event)
       key_event[event->key() - Qt::Key_0 + UIKEY_0] = true; break;
     case Qt::Key_F1 ... Qt::Key_F9:
       key_event[event->key() - Qt::Key_F1 + UIKEY_F1] = true; break;
+    case Qt::Key_F11:
+      key_event[UIKEY_F11] = true; break;
     case Qt::Key_F12:
       key_event[UIKEY_F12] = true; break;
     case Qt::Key_B:
       key_event[UIKEY_b] = true; break;
+    case Qt::Key_W:
+      key_event[UIKEY_w] = true; break;
     case Qt::Key_Escape:
       key_event[UIKEY_ESCAPE] = true; break;
     default:
@@ -850,6 +873,45 @@ void UI::factoryResetSlot()
   key_down[UIKEY_f] = true;
 }
 
+void UI::rewindSlot()
+{
+  key_down[UIKEY_w] = true;
+}
+
+void UI::watchSlot()
+{
+  disablePaintingSlot();
+  bool ok;
+  QString cmd = QInputDialog::getText(this, "Watchpoints",
+    "<flags> <lo>[-<hi>] adds a watchpoint on physical addresses;\n"
+    "flags: r (read), w (write), x (execute), b (stop when hit).\n"
+    "Also: delete <id>, clear, list, continue.",
+    QLineEdit::Normal, QString(), &ok);
+  enablePaintingSlot();
+  if (ok && !cmd.isEmpty())
+    cpu->requestWatchCommand(cmd.trimmed().toLocal8Bit().data());
+}
+
+void UI::searchSlot()
+{
+  disablePaintingSlot();
+  bool ok;
+  QString cmd = QInputDialog::getText(this, "Memory Search",
+    "new [8|16|32] starts a search of RAM, mapped RAM and LCD memory;\n"
+    "eq <value>, range <lo>-<hi>, changed, unchanged, increased and\n"
+    "decreased (since the last search) narrow it down.\n"
+    "Also: list, watch <flags> (see Watchpoints).",
+    QLineEdit::Normal, QString(), &ok);
+  enablePaintingSlot();
+  if (ok && !cmd.isEmpty())
+    cpu->requestWatchCommand(("search " + cmd.trimmed()).toLocal8Bit().data());
+}
+
+void UI::continueSlot()
+{
+  cpu->requestWatchCommand("continue");
+}
+
 void UI::recordSlot()
 {
   key_down[UIKEY_F7] = true;
@@ -133,6 +133,8 @@ enum UIKey {
   UIKEY_F10,
   UIKEY_F11,
   UIKEY_F12,
+  /* key values end up in recordings, add new ones at the end */
+  UIKEY_w,
   UIKEY_MAX
 };
 
@@ -201,6 +203,9 @@ public:
   void setSerial(Serial *s);
   
   int run();
+  /* handles the events that have piled up, for programs that do not
+     call run() */
+  void processEvents();
   
   bool pollEvent(struct Event &e);
   
@@ -355,6 +360,10 @@ private slots:
   void playSlot();
   void stopSlot();
   void factoryResetSlot();
+  void rewindSlot();
+  void watchSlot();
+  void searchSlot();
+  void continueSlot();
   void askUserSlot(const char *caption, const char *question, const char *button1, const char *button2);
   void fatalErrorSlot(const char *error, const char *detail, const char *arg0, const char *arg1, const char *arg2);
   void loadRomSlot();
@@ -0,0 +1,134 @@
+/*
+ * watch.cpp
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#include "watch.h"
+#include <stdlib.h>
+#include <string.h>
+
+Watchpoints::Watchpoints()
+{
+  watches = NULL;
+  num = size = 0;
+  next_id = 1;
+}
+
+Watchpoints::~Watchpoints()
+{
+  free(watches);
+}
+
+int Watchpoints::add(uint32_t lo, uint32_t hi, int flags)
+{
+  if (num == size) {
+    size = size ? size * 2 : 16;
+    watches = (struct Watch *)realloc(watches, size * sizeof(struct Watch));
+  }
+  struct Watch *w = &watches[num++];
+  w->id = next_id++;
+  w->lo = lo;
+  w->hi = hi < lo ? lo : hi;
+  w->flags = flags;
+  return w->id;
+}
+
+bool Watchpoints::remove(int id)
+{
+  for (int i = 0; i < num; i++) {
+    if (watches[i].id == id) {
+      memmove(&watches[i], &watches[i + 1], (num - i - 1) * sizeof(struct Watch));
+      num--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Watchpoints::removeMatch(uint32_t lo, uint32_t hi, int flags)
+{
+  for (int i = num - 1; i >= 0; i--) {
+    if (watches[i].lo == lo && watches[i].hi == hi && watches[i].flags == flags)
+      return remove(watches[i].id);
+  }
+  return false;
+}
+
+void Watchpoints::clear()
+{
+  num = 0;
+}
+
+int Watchpoints::rangeFlags(uint32_t lo, uint32_t hi)
+{
+  int flags = 0;
+  for (int i = 0; i < num; i++) {
+    if (watches[i].lo <= hi && watches[i].hi >= lo)
+      flags |= watches[i].flags;
+  }
+  return flags;
+}
+
+const struct Watch *Watchpoints::find(uint32_t addr, int flags)
+{
+  for (int i = 0; i < num; i++) {
+    if ((watches[i].flags & flags) && watches[i].lo <= addr && watches[i].hi >= addr)
+      return &watches[i];
+  }
+  return NULL;
+}
+
+bool Watchpoints::parseFlags(const char **spec, int *flags)
+{
+  const char *s = *spec;
+  *flags = 0;
+  for (; *s && *s != ' '; s++) {
+    switch (*s) {
+      case 'r': *flags |= WATCH_READ; break;
+      case 'w': *flags |= WATCH_WRITE; break;
+      case 'x': *flags |= WATCH_EXEC; break;
+      case 'b': *flags |= WATCH_BREAK; break;
+      default: return false;
+    }
+  }
+  *spec = s;
+  return (*flags & (WATCH_READ | WATCH_WRITE | WATCH_EXEC)) != 0;
+}
+
+bool Watchpoints::parse(const char *spec, uint32_t *lo, uint32_t *hi, int *flags)
+{
+  if (!parseFlags(&spec, flags))
+    return false;
+
+  char *end;
+  *lo = strtoul(spec, &end, 0);
+  if (end == spec)
+    return false;
+  if (*end == '-') {
+    spec = end + 1;
+    *hi = strtoul(spec, &end, 0);
+    if (end == spec || *hi < *lo)
+      return false;
+  }
+  else
+    *hi = *lo;
+  /* no trailing garbage, such as a second address */
+  return *end == 0;
+}
+
+const char *Watchpoints::flagString(int flags)
+{
+  static char buf[5];
+  char *p = buf;
+  if (flags & WATCH_READ) *p++ = 'r';
+  if (flags & WATCH_WRITE) *p++ = 'w';
+  if (flags & WATCH_EXEC) *p++ = 'x';
+  if (flags & WATCH_BREAK) *p++ = 'b';
+  *p = 0;
+  return buf;
+}
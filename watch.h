@@ -0,0 +1,76 @@
+/*
+ * watch.h
+ *
+ * (C) Copyright 2014 Ulrich Hecht
+ *
+ * This file is part of CASCADE.  CASCADE is almost free software; you can
+ * redistribute it and/or modify it under the terms of the Cascade Public
+ * License 1.0.  Read the file "LICENSE" for details.
+ */
+
+#ifndef _WATCH_H
+#define _WATCH_H
+
+#include <stdint.h>
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define WATCH_EXEC 4
+#define WATCH_BREAK 8	/* stop the emulation instead of just reporting */
+
+/* the emulator checks watchpoints per virtual page of this size first */
+#define WATCH_PAGE_SHIFT 8
+#define WATCH_PAGES (0x10000 >> WATCH_PAGE_SHIFT)
+
+struct Watch {
+  int id;
+  uint32_t lo, hi;	/* physical addresses, inclusive */
+  int flags;
+};
+
+/* A list of watchpoints (read, write) and breakpoints (execute) on ranges
+   of physical addresses, as returned by Cpu::virtToPhys(). */
+class Watchpoints {
+public:
+  Watchpoints();
+  ~Watchpoints();
+
+  /* returns the ID of the new watchpoint */
+  int add(uint32_t lo, uint32_t hi, int flags);
+  bool remove(int id);
+  /* removes the newest watchpoint with exactly these flags and range */
+  bool removeMatch(uint32_t lo, uint32_t hi, int flags);
+  void clear();
+
+  inline int count() {
+    return num;
+  }
+  inline const struct Watch *get(int i) {
+    return &watches[i];
+  }
+
+  /* returns the union of the flags of the watchpoints overlapping the
+     given range */
+  int rangeFlags(uint32_t lo, uint32_t hi);
+  /* returns the first watchpoint on addr with one of the given flags,
+     NULL if there is none */
+  const struct Watch *find(uint32_t addr, int flags);
+
+  /* Parses a watchpoint specification "<flags> <lo>[-<hi>]", where flags
+     is any combination of r, w, x and b (break). Returns false if it is
+     malformed. */
+  static bool parse(const char *spec, uint32_t *lo, uint32_t *hi, int *flags);
+  /* parses just the flags, advancing spec past them; returns false if
+     they are malformed */
+  static bool parseFlags(const char **spec, int *flags);
+  /* formats the flags as they are parsed */
+  static const char *flagString(int flags);
+
+private:
+  struct Watch *watches;
+  int num;
+  int size;
+  int next_id;
+};
+
+#endif